@@ -9,6 +9,8 @@
  */
 
 #include "CANModule.h"
+#include "FloorTable.h"                     /* Default floor codes */
+#include <EEPROM.h>                         /* Node identity record */
 
 CANModule::CANModule() : mcp2515(SPI_CS_PIN)                // Constructor  IMPORTANT: The 'new' keyword does not exist in Arduino so to instantiate an object within an class you must use an 'initializer list' (see: http://arduinoetcetera.blogspot.com/2011/01/classes-within-classes-initialiser.html)
 {}
@@ -18,83 +20,77 @@ CANModule::~CANModule() 									                 // Destructor
 
 void CANModule::setup()                                    // Set up CAN communications
 {
+    loadNode();
     initializeCAN();                                       
 }
 
-void CANModule::loop() {}                                 // Not used but kept for future
-
-
-uint16_t CANModule::getSetpoint()                         // Return setpoint private variable
-{
-    return setpoint;
+void CANModule::loop() {
+    if (m_queryDue && (long)(millis() - m_queryTime) >= 0) {   // Answer a NODE_QUERY once this node's slot has come
+        m_queryDue = false;
+        transmitNode(NODE_QUERY, NODE_QUERY_DLC);
+    }
 }
 
-void CANModule::setSetpoint(uint16_t sp) {
-  setpoint = sp;
-}
 
-byte CANModule::getTxdata()                               // Get the first byte of data from txdata array (per our protocol) - modify if you want to use more than first byte
-{
-  return txdata[0];
-}  
-                       
-void CANModule::setTxdata(byte data)                                      // Set the first byte of data from txdata array (per our protocol) - modify if you want to use more than first byte  
-{
-  txdata[0] = data;
-}                     
+void CANModule::setVerbose(boolean verbose) {
+  m_verbose = verbose;
+}
 
 // Transmit CAN message
-void CANModule::transmitCAN() {
-    byte sndStat = mcp2515.sendMsgBuf(TxID, 0, DLC, txdata);
+void CANModule::transmitCAN(const CanFrame &frame) {
+    byte sndStat = mcp2515.sendMsgBuf(frame.id, frame.dlc, (byte *)frame.data);   // The driver takes the ID flags from frame.id (it does not write the data)
     if (sndStat == CAN_OK) {
-        sprintf(msgString, "[CAN] TX: ID: 0x%X Data: 0x%X", TxID, txdata[0]);
-    }
-    else {
-        sprintf(msgString, "[CAN] TX: Error Sending Message...");
+        if (!m_verbose) {
+            return;                                             // Nothing to report
+        }
+        sprintf(msgString, "[CAN] %lu TX: ID: 0x%lX Data:", syncMillis(), frame.canId());
+        Serial.print(msgString);
+        for (byte i = 0; i < frame.dlc; i++) {
+            sprintf(msgString, " 0x%X", frame.data[i]);
+            Serial.print(msgString);
+        }
+        Serial.println();
+        return;
     }
-    Serial.println(msgString);
+    Serial.println("[CAN] TX: Error Sending Message...");
 }
 
-// Receive CAN message (based on sample code in library)
-void CANModule::receiveCAN(LCD lcd) {
-    mcp2515.readMsgBuf(&RxID, &len, rxdata);                    // Read data: len = data length, rxdata = data byte(s)
-
-    if ((RxID & 0x80000000) == 0x80000000)                      // Determine if ID is standard (11 bits) or extended (29 bits)    - Note: This library has the IDE bit in the first nibble, this is different than the order in an extended CAN frame
-        sprintf(msgString, "[CAN] RX: Extended ID: 0x%.8lX DLC: %1d Data:", (RxID & 0x1FFFFFFF), len);   // If extended ID is used then all bits are ID (uses last 29 of the 32 possible bits in the 4 byte ID) 
-    else
-        sprintf(msgString, "[CAN] RX: Standard ID: 0x%.3lX DLC: %1d Data:", RxID, len);
+// Receive CAN message (based on sample code in library) - floor calls are queued by the ElevatorController's CallScheduler
+boolean CANModule::receiveCAN(CanFrame &frame, unsigned long rxMicros) {
+    mcp2515.readMsgBuf(&frame.id, &frame.dlc, frame.data);      // Read data straight into the frame: dlc = data length, data = data byte(s)
+    if (!frame.isRemote()) {                                    // A remote request's data bytes are whatever the frame held before - no code to act on
+        handleTimeSync(frame, rxMicros);
+        countProbe(frame);
+        handleNodeConfig(frame);
+    }
+    m_backlog = digitalRead(INT_PIN) == LOW;                    // Both receive buffers were full
+    m_stats.frames++;
+    if (m_backlog) {
+        m_stats.backlog++;
+    }
+    m_stats.errorFlags |= mcp2515.getError();                   // EFLG - the overflow bits stay set until the MCU clears them
 
-    Serial.print(msgString);
+    if (m_verbose) {                                            // Frame logging (skipped under load shedding)
+        if (frame.isExtended())                                     // Determine if ID is standard (11 bits) or extended (29 bits)    - Note: This library has the IDE bit in the first nibble, this is different than the order in an extended CAN frame
+            sprintf(msgString, "[CAN] %lu RX: Extended ID: 0x%.8lX DLC: %1d Data:", syncMillis(), frame.canId(), frame.dlc);   // If extended ID is used then all bits are ID (uses last 29 of the 32 possible bits in the 4 byte ID) 
+        else
+            sprintf(msgString, "[CAN] %lu RX: Standard ID: 0x%.3lX DLC: %1d Data:", syncMillis(), frame.canId(), frame.dlc);
 
-    if ((RxID & 0x40000000) == 0x40000000) {                    // Determine if message is a remote request frame.
-        sprintf(msgString, " REMOTE REQUEST FRAME");
         Serial.print(msgString);
-    }
-    else {
-        for (byte i = 0; i < len; i++) {
-            sprintf(msgString, " 0x%.2X", rxdata[i]);
+
+        if (frame.isRemote()) {                                     // Determine if message is a remote request frame.
+            sprintf(msgString, " REMOTE REQUEST FRAME");
             Serial.print(msgString);
         }
+        else {
+            for (byte i = 0; i < frame.dlc; i++) {
+                sprintf(msgString, " 0x%.2X", frame.data[i]);
+                Serial.print(msgString);
+            }
+        }
+        Serial.println();                  
     }
-    Serial.println();                  
-
-    // Change setpoint and output new destination floor
-    lcd.lcdObj.setCursor(0, 0);                                   // Set cursor to column 0, line 0  (line 1 is second row since counting starts at 0)
-    if (rxdata[0] == FLOOR1) {
-        setpoint = FLOOR1_SP;
-        lcd.lcdObj.print("Floor 1");
-    }
-    else if (rxdata[0] == FLOOR2) {
-        setpoint = FLOOR2_SP;
-        lcd.lcdObj.print("Floor 2");
-    }
-    else if (rxdata[0] == FLOOR3) {
-        setpoint = FLOOR3_SP;
-        lcd.lcdObj.print("Floor 3");
-    }
-    else {
-      // Do nothing on unknown command
-    }
+    return m_backlog;
 }
 
 // Set up CAN communications
@@ -109,16 +105,222 @@ void CANModule::initializeCAN() {
     }
     Serial.println("Finished CAN init");
 
-    #ifdef MASK
-      mcp2515.init_Mask(0, 0, MASK);
-      mcp2515.init_Mask(1, 0, MASK);
-    #endif
-
-    #ifdef FILTER_SC
-      mcp2515.init_Filt(0, 0, FILTER_SC);                     // init_Filt(filter number, 0 for standard mode, filter used to accept a matching ID) - Filter 1
-    #endif
+    programFilters();
 
     mcp2515.setMode(MCP_NORMAL);                              // Change to normal mode to allow messages to be transmitted
     pinMode(INT_PIN, INPUT);                                  // Interrupt pin triggered by SLAVE (CAN Adapter) to ask MASTER to initiate SPI communication
     pinMode(SPI_CS_PIN, OUTPUT);                              // Chip select pin for CAN module
 }
+
+// Masks match the whole ID and each filter accepts one of the node's sources - an unused filter repeats the first source so it accepts nothing else
+void CANModule::programFilters() {
+    mcp2515.init_Mask(0, 0, MASK);
+    mcp2515.init_Mask(1, 0, MASK);
+    for (uint8_t i = 0; i < NODE_SOURCES; i++) {
+        uint16_t id = (m_node.sources[i] != NODE_NO_SOURCE) ? m_node.sources[i] : m_node.sources[0];
+        mcp2515.init_Filt(i, 0, (unsigned long)id << 16);    // init_Filt(filter number, 0 for standard mode, filter used to accept a matching ID)
+    }
+}
+
+int8_t CANModule::floorIndex(byte code) {
+    for (int8_t i = 0; i < FLOOR_COUNT; i++) {
+        if (m_node.floorCodes[i] == code) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Assignment frames (see NODE_QUERY) - the changes collect in m_pending and take effect together with NODE_STORE
+void CANModule::handleNodeConfig(const CanFrame &frame) {
+    NodeSelectFrame select(frame);
+    NodeSetFrame set(frame);
+
+    if (frame.code() == NODE_QUERY && frame.dlc == 1) {
+        m_queryDue = true;                                      // Spread the answers so the nodes of a bank do not all queue at once
+        m_queryTime = millis() + (m_node.uid & 0xFF);
+    }
+    else if (select.valid()) {
+        m_selected = select.uid() == m_node.uid;
+        m_pending = m_node;
+    }
+    else if (set.valid() && m_selected) {
+        if (!applyNodeSet(set.field(), set.value())) {
+            CanFrame nack = frame;                              // Echo the refused NODE_SET so the supervisory controller sees which one
+            nack.id = m_node.txId;
+            nack.data[0] = NODE_NACK;
+            transmitCAN(nack);
+        }
+    }
+    else if (frame.code() == NODE_STORE && frame.dlc == 1 && m_selected) {
+        if (m_pending.sources[0] == NODE_NO_SOURCE) {
+            Serial.println("[NODE] no source - not stored");    // The filters would accept nothing, and the node could not be reached again
+            return;
+        }
+        for (uint8_t i = 0; i < FLOOR_COUNT; i++) {
+            for (uint8_t j = i + 1; j < FLOOR_COUNT; j++) {
+                if (m_pending.floorCodes[i] == m_pending.floorCodes[j]) {
+                    Serial.println("[NODE] duplicate floor code - not stored");   // floorIndex() would find only the first of the floors
+                    return;
+                }
+            }
+        }
+        m_node = m_pending;
+        m_selected = false;
+        saveNode();
+        programFilters();
+        transmitNode(NODE_STORE, NODE_SELECT_DLC);
+    }
+}
+
+// One NODE_SET into m_pending - false if the field is unknown or the value out of range
+boolean CANModule::applyNodeSet(byte field, uint16_t value) {
+    if (field == NODE_FIELD_TXID && value <= 0x7FF) {
+        m_pending.txId = value;
+    }
+    else if (field == NODE_FIELD_FIRST_CAR && value < NODE_CARS) {
+        m_pending.firstCar = value;
+    }
+    else if (field >= NODE_FIELD_SOURCE && field < NODE_FIELD_SOURCE + NODE_SOURCES && (value <= 0x7FF || value == NODE_NO_SOURCE)) {
+        m_pending.sources[field - NODE_FIELD_SOURCE] = value;
+    }
+    else if (field >= NODE_FIELD_FLOOR && field < NODE_FIELD_FLOOR + FLOOR_COUNT && value != 0 && value <= CAR_CODE_MASK &&
+             (value < SYSID || value > HEALTH)) {           // A car command's code - the car would take the command for the floor
+        m_pending.floorCodes[field - NODE_FIELD_FLOOR] = value;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Answer with { code, uid[4], firstCar } (the first dlc bytes) from the board's ID
+void CANModule::transmitNode(byte code, byte dlc) {
+    CanFrame frame = { m_node.txId, dlc, { code } };
+    frame.put32(1, m_node.uid);
+    frame.data[5] = m_node.firstCar;
+    transmitCAN(frame);
+}
+
+// The stored identity - a blank or corrupt record gets the defaults and a new UID, written back so the UID stays
+void CANModule::loadNode() {
+    EEPROM.get(NODE_EEPROM, m_node);
+    if (m_node.magic != NODE_MAGIC || m_node.check != checksum(m_node)) {
+        unsigned long seed = micros();
+        for (uint8_t i = 0; i < 32; i++) {
+            seed = (seed << 1) ^ analogRead(NODE_SEED_PIN) ^ micros();   // The ADC's lowest bits and the time the conversions take
+        }
+        randomSeed(seed);
+        m_node.uid = ((unsigned long)random(0x10000) << 16) | random(0x10000);
+        m_node.txId = TxID;
+        m_node.firstCar = 0;
+        m_node.sources[0] = FILTER_SC >> 16;
+        for (uint8_t i = 1; i < NODE_SOURCES; i++) {
+            m_node.sources[i] = NODE_NO_SOURCE;
+        }
+        for (uint8_t i = 0; i < NODE_FLOORS; i++) {
+            m_node.floorCodes[i] = (i < FLOOR_COUNT) ? FLOOR_TABLE[i].code : 0xFF;
+        }
+        saveNode();
+    }
+    sprintf(msgString, "[NODE] uid 0x%08lX id 0x%X first car %u", (unsigned long)m_node.uid, m_node.txId, m_node.firstCar);
+    Serial.println(msgString);
+}
+
+void CANModule::saveNode() {
+    m_node.magic = NODE_MAGIC;
+    m_node.check = checksum(m_node);
+    EEPROM.put(NODE_EEPROM, m_node);                           // put() only writes the bytes that changed
+}
+
+uint8_t CANModule::checksum(const NodeRecord &record) {
+    const uint8_t *p = (const uint8_t *)&record;
+    uint8_t sum = 0;
+
+    for (uint8_t i = 0; i < sizeof(NodeRecord) - sizeof(record.check); i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+// SYNC: remember when it arrived. FOLLOW_UP for that SYNC: its master time becomes the reference and the master/local rate is updated
+// from the time between this SYNC and the previous one on both clocks.
+void CANModule::handleTimeSync(const CanFrame &frame, unsigned long rxMicros) {
+    SyncFrame sync(frame);
+    FollowUpFrame followUp(frame);
+
+    if (sync.valid()) {
+        m_syncSeq = sync.seq();
+        m_syncStamp = rxMicros;
+        m_syncPending = !m_backlog;                             // Without its own interrupt the arrival time is unknown - skip this sync
+    }
+    else if (followUp.valid() && m_syncPending && followUp.seq() == m_syncSeq) {
+        unsigned long ms = followUp.ms();
+        unsigned int us = followUp.us();
+
+        if (m_synced && !m_holdover) {                          // Not across a holdover - its reference is our own extrapolation
+            float master = (ms - m_refMs) * 1000.0 + ((long)us - (long)m_refUs);
+            float local = m_syncStamp - m_refStamp;
+            if (local > 0) {
+                float drift = (master - local) / local;
+                m_drift = m_rateKnown ? m_drift + TSYNC_RATE_FILTER * (drift - m_drift) : drift;   // The first measurement is taken whole
+                m_rateKnown = true;
+            }
+        }
+        m_refMs = ms;
+        m_refUs = us;
+        m_refStamp = m_syncStamp;
+        m_lastSync = millis();
+        m_synced = true;
+        m_holdover = false;
+        m_syncPending = false;
+    }
+}
+
+// Master time extrapolated from the last reference at the tracked rate
+// Without a FOLLOW_UP for TSYNC_TIMEOUT_MS the reference is moved up to now on the last rate (holdover), so the time since the reference never
+// nears the micros() wrap (71.6 min) and the drift term stays small
+unsigned long CANModule::syncMillis() {
+    if (!m_synced) {
+        return millis();
+    }
+    unsigned long elapsed = micros() - m_refStamp;
+    unsigned long us = m_refUs + elapsed + (long)(elapsed * m_drift);
+    if (elapsed > TSYNC_TIMEOUT_MS * 1000UL) {
+        m_refMs += us / 1000;
+        m_refUs = us % 1000;
+        m_refStamp += elapsed;
+        m_holdover = true;
+        return m_refMs;
+    }
+    return m_refMs + us / 1000;
+}
+
+boolean CANModule::isSynced() {
+    return m_synced && millis() - m_lastSync < TSYNC_TIMEOUT_MS;
+}
+
+// Probe sequence numbers are consecutive modulo 256, so the gap since the last one is the number lost
+void CANModule::countProbe(const CanFrame &frame) {
+    ProbeFrame probe(frame);
+
+    if (!probe.valid()) {
+        return;
+    }
+    if (m_probeSeen) {
+        m_stats.probeLost += (byte)(probe.seq() - m_probeSeq - 1);
+    }
+    m_probeSeq = probe.seq();
+    m_probeSeen = true;
+}
+
+void CANModule::recordLatency(unsigned long us) {
+    uint8_t bin = 0;
+    while (bin < CAN_LATENCY_BINS - 1 && us >= ((unsigned long)CAN_LATENCY_BIN0_US << bin)) {
+        bin++;
+    }
+    m_stats.latency[bin]++;
+    if (us > m_stats.latencyMaxUs) {
+        m_stats.latencyMaxUs = us > 0xFFFF ? 0xFFFF : us;
+    }
+}
@@ -21,9 +21,176 @@
 // Protocol for Elevator
 #define TxID 0x101                          // CAN ID OF THIS DEVICE (Elevator Controller) - Raspberry Pi (0x100), Elevator Controller (this device (0x101)), Car controller (0x200), Floor 1 (0x201), Floor 2 (0x202), Floor 3 (0x203) 
 #define DLC 1                               // Data length code in CAN (we only use one of the possible 8 bytes). This code can handle DLC from 1 to 8. 
-#define FLOOR1  0x05                        // Floor 1 = 0x05, Floor 2 = 0x06,  Floor 3 = 0x07 (this is entered into txdata[0] - we only use one of the eight CAN message bytes)
+#define FLOOR1  0x05                        // Floor 1 = 0x05, Floor 2 = 0x06,  Floor 3 = 0x07 (the frame's code in data[0] - a floor report uses one of the eight CAN message bytes)
 #define FLOOR2  0x06
 #define FLOOR3  0x07
+#define SYSID   0x0A                        // Command from the supervisory controller to run the system identification sequence (see ElevatorController::runSystemId())
+// Sensor calibration - CAL_OFFSET or CAL_XTALK { code, distance mm (2 bytes, little endian) } with a target held that far from the car's sensor
+// (MINHEIGHT..MAXHEIGHT - anything else fails), CAL_CLEAR { code } drops the calibration. Offset (white target close in), crosstalk (grey target
+// further out), then the offset again with the crosstalk known - see VL53L0XRangefinder.h.
+#define CAL_OFFSET 0x0B
+#define CAL_XTALK 0x0C
+#define CAL_CLEAR 0x0D
+#define CAL_DLC 3
+// Sensor health (SensorHealth.h) - car n sends HEALTH_DLC { HEALTH, warnings, signal %, ambient %, errors % } from ID TxID + n when a warning is
+// raised or cleared and every HEALTH_REPORT_MS. HEALTH { code } from the supervisory controller learns a new baseline once the sensor has been
+// cleaned or realigned.
+#define HEALTH 0x0E
+#define HEALTH_DLC 5
+// Destination dispatch - a floor node sends a DEST_DLC frame { origin floor code, destination floor code } instead of a single floor code.
+// When the car stops at an origin it announces who boards with a DEST_DLC frame { floor code, destinations (bit 0 = Floor 1) }.
+#define DEST_DLC 2
+// Several cars on one board (CAR_COUNT) - the high nibble of a floor or command code selects the car, so the codes of the first car are
+// unchanged (Floor 2 of the second car is 0x16). Car n reports its floor and boarding groups from ID TxID + n.
+#define CAR_SHIFT 4
+#define CAR_CODE_MASK 0x0F
+// Time synchronisation - the supervisory controller broadcasts SYNC { TSYNC_SYNC, seq } and then FOLLOW_UP { TSYNC_FOLLOW_UP, seq, ms[4], us[2] }
+// carrying its clock (ms and us within the ms, little endian) when the SYNC finished on the bus. The SYNC's arrival is stamped in the CAN
+// interrupt, so neither the master's transmit queue nor this node's loop latency enters the offset. The rate of the local clock against the
+// master's is tracked between syncs (the UNO's ceramic resonator is only good to about 0.5%). See tools/timesync_sim.py.
+#define TSYNC_SYNC 0xF0                     // High nibble is past any car, so the ElevatorController never routes these to a car
+#define TSYNC_FOLLOW_UP 0xF1
+#define TSYNC_SYNC_DLC 2
+#define TSYNC_FOLLOW_UP_DLC 8
+#define TSYNC_RATE_FILTER 0.2               // Weight of the newest rate measurement
+#define TSYNC_TIMEOUT_MS 5000               // isSynced() is false once no FOLLOW_UP has arrived for this long (and syncMillis() holds over on the last rate)
+// Bus statistics (tools/can_stress.py) - the stress tool numbers its probe frames { CAN_PROBE, seq } so a lost frame shows up as a gap
+#define CAN_PROBE 0xE0                      // High nibble is past any car, so the ElevatorController never routes it to a car
+#define CAN_PROBE_DLC 2
+#define CAN_LATENCY_BINS 8                  // Latency histogram: bin n counts frames handled within CAN_LATENCY_BIN0_US << n of the interrupt ...
+#define CAN_LATENCY_BIN0_US 250             // ... and the last bin the rest
+// Node identity - one firmware image serves every controller in a bank. setup() loads the board's NodeRecord from EEPROM (NODE_EEPROM) and
+// programs the MCP2515 filters from it: the ID the board's car n reports from (txId + n), the bank number of its first car (the high nibble of
+// a floor or command code is a car of the bank, so the board serves firstCar .. firstCar + CAR_COUNT - 1), the source IDs it accepts and the
+// CAN code of each floor. A blank or corrupt record is replaced with the defaults below and a random UID.
+// Assignment from the supervisory controller (tools/node.py):
+//   NODE_QUERY { code }                   every node answers NODE_QUERY { code, uid[4], firstCar } from its txId, (uid % 256) ms later
+//   NODE_SELECT { code, uid[4] }          the node with that UID is selected, every other node is deselected
+//   NODE_SET { code, field, value[2] }    the selected node changes one NODE_FIELD_xxx (value little endian) - applied by the store
+//   NODE_STORE { code }                   the selected node writes its record, reprograms its filters and answers NODE_STORE { code, uid[4] }
+//                                         from its new txId
+// A NODE_SET the selected node refuses (unknown field, value out of range, or a floor code that is 0 or one of the car commands SYSID ..
+// HEALTH) is answered with NODE_NACK { code, field, value[2] } - the refused frame with its code replaced - and leaves the record unchanged.
+#define NODE_QUERY 0xD0                     // High nibble is past any car, so the ElevatorController never routes these to a car
+#define NODE_SELECT 0xD1
+#define NODE_SET 0xD2
+#define NODE_STORE 0xD3
+#define NODE_NACK 0xD4
+static_assert(SYSID < CAL_OFFSET && CAL_OFFSET < CAL_XTALK && CAL_XTALK < CAL_CLEAR && CAL_CLEAR < HEALTH, "the car commands are SYSID .. HEALTH");
+#define NODE_QUERY_DLC 6
+#define NODE_SELECT_DLC 5
+#define NODE_SET_DLC 4
+#define NODE_FIELD_TXID 0x00
+#define NODE_FIELD_FIRST_CAR 0x01
+#define NODE_FIELD_SOURCE 0x10              // + n for source n (NODE_NO_SOURCE leaves the filter unused)
+#define NODE_FIELD_FLOOR 0x20               // + the FLOOR_TABLE index
+#define NODE_SOURCES 6                      // One per MCP2515 acceptance filter (two on receive buffer 0, four on buffer 1)
+#define NODE_NO_SOURCE 0xFFFF
+#define NODE_FLOORS 8                       // Floor codes in the record (FLOOR_COUNT at most)
+#define NODE_CARS 13                        // Bank cars - high nibbles 0xD .. 0xF are the node, probe and sync frames
+#define NODE_EEPROM 64                      // EEPROM address of the record - after the sensor health records (HEALTH_EEPROM)
+#define NODE_MAGIC 0x4E                     // First byte of a written record - a blank EEPROM reads 0xFF
+#define NODE_SEED_PIN A3                    // Unconnected analog input - its noise seeds the UID
+
+typedef struct {
+  uint8_t magic;                            // NODE_MAGIC
+  uint32_t uid;                             // Random at the first boot - tells the nodes of a bank apart while they are assigned
+  uint16_t txId;                            // CAN ID of the board's first car (default TxID)
+  uint8_t firstCar;                         // Bank number of the board's first car (default 0)
+  uint16_t sources[NODE_SOURCES];           // Accepted source IDs (default the supervisory controller, FILTER_SC)
+  byte floorCodes[NODE_FLOORS];             // CAN code of each floor, bottom up (default FLOOR_TABLE)
+  uint8_t check;                            // Sum of the bytes before it
+} NodeRecord;
+
+// Frames - the MCP2515 driver reads a frame straight into a CanFrame, which is passed on by const reference, and the decoders read its fields
+// through the typed views below. Transmitted frames are built the same way. A remote request frame carries no code and is only logged.
+#define CAN_FRAME_EXTENDED 0x80000000UL     // mcp_can keeps the frame's flags in the top bits of its ID
+#define CAN_FRAME_REMOTE 0x40000000UL
+#define CAN_FRAME_ID_MASK 0x1FFFFFFFUL
+#define CAN_FRAME_DATA 8
+
+struct CanFrame {
+  unsigned long id;                         // 11 or 29 bit ID with the CAN_FRAME_xxx flags (as readMsgBuf() and sendMsgBuf() take it)
+  byte dlc;                                 // Data bytes used
+  byte data[CAN_FRAME_DATA];                // data[0] is the frame's code per our protocol
+
+  boolean isExtended() const { return (id & CAN_FRAME_EXTENDED) != 0; }
+  boolean isRemote() const { return (id & CAN_FRAME_REMOTE) != 0; }   // No data - the data bytes are undefined
+  unsigned long canId() const { return id & CAN_FRAME_ID_MASK; }
+  byte code() const { return data[0]; }
+  uint16_t get16(uint8_t i) const { return data[i] | ((uint16_t)data[i + 1] << 8); }   // Multi-byte fields are little endian
+  uint32_t get32(uint8_t i) const { return get16(i) | ((uint32_t)get16(i + 2) << 16); }
+  void put16(uint8_t i, uint16_t value) { data[i] = value; data[i + 1] = value >> 8; }
+  void put32(uint8_t i, uint32_t value) { put16(i, value); put16(i + 2, value >> 16); }
+};
+
+// Typed views - valid() checks the code and DLC, the getters name the payload fields
+class DestinationFrame {                    // { origin floor code, destination floor code } (the car in the high nibbles)
+public:
+  explicit DestinationFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.dlc == DEST_DLC; }
+  byte destination() const { return m_frame.data[1]; }
+private:
+  const CanFrame &m_frame;
+};
+
+class CalibrationFrame {                    // { CAL_OFFSET or CAL_XTALK, distance mm[2] }
+public:
+  explicit CalibrationFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.dlc == CAL_DLC; }
+  uint16_t distance() const { return m_frame.get16(1); }
+private:
+  const CanFrame &m_frame;
+};
+
+class SyncFrame {                           // { TSYNC_SYNC, seq }
+public:
+  explicit SyncFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.code() == TSYNC_SYNC && m_frame.dlc == TSYNC_SYNC_DLC; }
+  byte seq() const { return m_frame.data[1]; }
+private:
+  const CanFrame &m_frame;
+};
+
+class FollowUpFrame {                       // { TSYNC_FOLLOW_UP, seq, ms[4], us[2] }
+public:
+  explicit FollowUpFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.code() == TSYNC_FOLLOW_UP && m_frame.dlc == TSYNC_FOLLOW_UP_DLC; }
+  byte seq() const { return m_frame.data[1]; }
+  unsigned long ms() const { return m_frame.get32(2); }
+  unsigned int us() const { return m_frame.get16(6); }
+private:
+  const CanFrame &m_frame;
+};
+
+class ProbeFrame {                          // { CAN_PROBE, seq }
+public:
+  explicit ProbeFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.code() == CAN_PROBE && m_frame.dlc == CAN_PROBE_DLC; }
+  byte seq() const { return m_frame.data[1]; }
+private:
+  const CanFrame &m_frame;
+};
+
+class NodeSelectFrame {                     // { NODE_SELECT, uid[4] }
+public:
+  explicit NodeSelectFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.code() == NODE_SELECT && m_frame.dlc == NODE_SELECT_DLC; }
+  unsigned long uid() const { return m_frame.get32(1); }
+private:
+  const CanFrame &m_frame;
+};
+
+class NodeSetFrame {                        // { NODE_SET, field, value[2] }
+public:
+  explicit NodeSetFrame(const CanFrame &frame) : m_frame(frame) {}
+  boolean valid() const { return m_frame.code() == NODE_SET && m_frame.dlc == NODE_SET_DLC; }
+  byte field() const { return m_frame.data[1]; }
+  uint16_t value() const { return m_frame.get16(2); }
+private:
+  const CanFrame &m_frame;
+};
+
 // Motion tuning
 #define diffMax 1500                        // Maximum difference between setpoint and distance measurement (Controlls the 1/e point on the dampening curve)
 #define DAMPENER 2                          // Motion dampening parameter (larger n dampens faster)
@@ -38,6 +205,15 @@
 #define MASK 0x07FF0000                    // Mask for filters
 #define FILTER_SC 0x01000000                // Acceptance filter for ID 0x100 (Supervisory Controller - Raspberry Pi)
 
+typedef struct {
+  unsigned long frames;                     // Frames read
+  unsigned int backlog;                     // Reads that left the other buffer full - one more frame arriving then is lost
+  unsigned int probeLost;                   // Gaps in the CAN_PROBE sequence
+  uint8_t errorFlags;                       // MCP2515 EFLG bits seen (RX overflow, error passive, bus off, ...)
+  unsigned int latencyMaxUs;                // Interrupt to frame handled
+  unsigned int latency[CAN_LATENCY_BINS];
+} CanStats;
+
 class CANModule {
 public:
 	CANModule();							                // Contructor
@@ -45,23 +221,61 @@ public:
 	void setup();
 	void loop();
 	void initializeCAN();                     // Set up CAN communications
-	void transmitCAN();						            // Transmit CAN message
-	void receiveCAN(LCD);					            // Receive CAN message
+	void transmitCAN(const CanFrame &frame);  // Transmit CAN message
+	boolean receiveCAN(CanFrame &frame, unsigned long rxMicros);   // Receive CAN message into frame - rxMicros is the micros() stamp taken by the CAN
+	                                          // interrupt. Returns true if another frame is already waiting (INT_PIN stays low, so there is no new interrupt for it)
+	unsigned long syncMillis();               // Master clock in ms (the local millis() until the first sync)
+	boolean isSynced();                       // A sync has arrived within TSYNC_TIMEOUT_MS
+	void recordLatency(unsigned long us);     // Time from the interrupt to the frame being handled
+	const CanStats &getStats() { return m_stats; }   // Totals since reset
+	uint16_t getNodeId() { return m_node.txId; }      // ID of the board's first car
+	uint8_t getFirstCar() { return m_node.firstCar; } // Bank number of the board's first car
+	byte floorCode(uint8_t floor) { return m_node.floorCodes[floor]; }   // CAN code of the FLOOR_TABLE floor
+	int8_t floorIndex(byte code);             // FLOOR_TABLE index of the floor with that code, -1 if it is not a floor code
 
   // Getters and setters
-  uint16_t getSetpoint();                   // Returns the value of the private variable 'setpoint'
-  void setSetpoint(uint16_t);               // Sets the value of the private variable 'setpoint'
-  byte getTxdata();                         // Get the first byte of data from txdata array (per our protocol) - modify if you want to use more than first byte
-  void setTxdata(byte);                     // Set the first byte of data from txdata array (per our protocol) - modify if you want to use more than first byte 
+  void setVerbose(boolean verbose);         // Print every sent/received frame on the Serial monitor (errors are always printed)
 	
 private:
-  uint16_t setpoint;					              // Distance in mm from the distance sensor to a given floor
   MCP_CAN mcp2515;						              // C++ Reference to an object passed to constructor via initializer list    
-	byte txdata[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };  // CAN message (8 bytes) - only use 1 data byte in our protocol 
-	long unsigned int RxID;					          // ID of received message
-	unsigned char len = 0;					          // DLC (length) of received message
-	unsigned char rxdata[8] = { 0, 0, 0, 0, 0, 0, 0, 0 }; // Received data 
 	char msgString[128];                      // Array to store and print the received string on the Serial Monitor
+  boolean m_verbose = true;                 // Frame logging on (turned off by load shedding)
+
+  // Time synchronisation
+  boolean m_synced = false;                 // A FOLLOW_UP has set the reference
+  boolean m_syncPending = false;            // A SYNC is waiting for its FOLLOW_UP
+  boolean m_backlog = false;                // The frame being read was waiting behind another one - its interrupt stamp is stale
+  byte m_syncSeq;                           // Sequence number of the pending SYNC
+  unsigned long m_syncStamp;                // micros() when the pending SYNC arrived
+  unsigned long m_refMs;                    // Reference: master time of the last SYNC (ms and us within the ms) ...
+  unsigned int m_refUs;
+  unsigned long m_refStamp;                 // ... and the local micros() it arrived at
+  unsigned long m_lastSync;                 // millis() of the last FOLLOW_UP
+  float m_drift = 0;                        // Master clock rate / local clock rate - 1
+  boolean m_rateKnown = false;              // m_drift has been measured
+  boolean m_holdover = false;               // syncMillis() has moved the reference on without a FOLLOW_UP
+
+  // Statistics
+  CanStats m_stats = {};
+  boolean m_probeSeen = false;              // m_probeSeq holds the last probe
+  byte m_probeSeq;
+
+  // Node identity
+  NodeRecord m_node;                        // As applied - NODE_SET edits m_pending until NODE_STORE
+  NodeRecord m_pending;
+  boolean m_selected = false;               // Addressed by NODE_SELECT
+  boolean m_queryDue = false;               // A NODE_QUERY answer is waiting for m_queryTime
+  unsigned long m_queryTime;
+
+  void handleTimeSync(const CanFrame &frame, unsigned long rxMicros);
+  void countProbe(const CanFrame &frame);
+  void handleNodeConfig(const CanFrame &frame);
+  void loadNode();
+  void saveNode();
+  void programFilters();
+  boolean applyNodeSet(byte field, uint16_t value);
+  void transmitNode(byte code, byte dlc);
+  static uint8_t checksum(const NodeRecord &record);
   
 };
 
@@ -0,0 +1,166 @@
+/*!
+ * @file CallScheduler.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "CallScheduler.h"
+
+CallScheduler::CallScheduler()                              // Constructor - No code
+{}
+
+CallScheduler::~CallScheduler()                             // Destructor - No code
+{}
+
+void CallScheduler::setup() {
+    m_pending = 0;
+    m_deferred = 0;
+    for (uint8_t i = 0; i < FLOOR_COUNT; i++) {
+        m_destinations[i] = 0;
+    }
+}
+
+// A repeated call keeps its original call time
+void CallScheduler::addCall(uint8_t floor, unsigned long now) {
+    if (!isPending(floor)) {
+        m_pending |= (1 << floor);
+        m_callTime[floor] = now;
+    }
+}
+
+void CallScheduler::clearCall(uint8_t floor) {
+    m_pending &= ~(1 << floor);
+}
+
+// Destination call: the origin becomes a stop, the destination is only known to the car once the passenger boards
+void CallScheduler::addDestinationCall(uint8_t origin, uint8_t destination, unsigned long now) {
+    if (origin == destination) {
+        return;
+    }
+    m_destinations[origin] |= (1 << destination);
+    addCall(origin, now);
+}
+
+// The car has stopped at 'floor': board one direction group of the destination calls waiting here and make their destinations stops
+uint8_t CallScheduler::arrived(uint8_t floor, unsigned long now) {
+    uint8_t below = (1 << floor) - 1;                       // Bits of the floors below this one
+    uint8_t above = ~below & ~(1 << floor);
+    uint8_t waitingUp = m_destinations[floor] & above;
+    uint8_t waitingDown = m_destinations[floor] & below;
+    uint8_t group;
+
+    m_deferred = 0;                                         // The car has moved on from any group left behind earlier
+    clearCall(floor);
+    if (!waitingUp && !waitingDown) {
+        return 0;
+    }
+
+    if (!waitingDown) {
+        group = waitingUp;
+    }
+    else if (!waitingUp) {
+        group = waitingDown;
+    }
+    else if ((m_pending & above) && !(m_pending & below)) {
+        group = waitingUp;                                  // Keep going the way the car already has stops
+    }
+    else if ((m_pending & below) && !(m_pending & above)) {
+        group = waitingDown;
+    }
+    else {
+        group = (countFloors(waitingUp) >= countFloors(waitingDown)) ? waitingUp : waitingDown;
+    }
+
+    group = nearestFloors(floor, group, SCHED_GROUP_STOPS);   // Similar destinations ride together, the rest take the next trip
+    m_destinations[floor] &= ~group;
+    for (uint8_t i = 0; i < FLOOR_COUNT; i++) {
+        if (group & (1 << i)) {
+            addCall(i, now);
+        }
+    }
+    if (m_destinations[floor]) {
+        addCall(floor, now);                                // The other group waits for the next trip
+        m_deferred |= (1 << floor);
+    }
+    return group;
+}
+
+boolean CallScheduler::isPending(uint8_t floor) {
+    return (m_pending & (1 << floor)) != 0;
+}
+
+int8_t CallScheduler::nextStop(uint16_t position, unsigned long now) {
+    int8_t best = -1;
+    float bestCost = 0;
+    boolean due = false;
+
+    for (uint8_t i = 0; i < FLOOR_COUNT; i++) {
+        if (!isPending(i) || ((m_deferred & (1 << i)) && (m_pending & ~m_deferred))) {
+            continue;                                       // A group left behind here waits while the car has other stops
+        }
+        float waited = now - m_callTime[i];
+        float weighted = SCHED_ENERGY_WEIGHT * energy(position, i);
+        float travel = abs((int)FLOOR_TABLE[i].setpoint - (int)position) * 1000.0 / SCHED_SPEED + SCHED_STOP_MS;
+        float cost = travel + weighted - waited;
+
+        if (waited >= weighted) {
+            due = true;                                     // This call has waited long enough to be worth its energy
+        }
+        if (best < 0 || cost < bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+    return due ? best : -1;
+}
+
+// Collective control: stop at a pending floor the car passes on its way to the target
+int8_t CallScheduler::stopOnTheWay(uint16_t position, uint8_t target) {
+    uint16_t to = FLOOR_TABLE[target].setpoint;
+    int8_t nearest = -1;
+
+    for (uint8_t i = 0; i < FLOOR_COUNT; i++) {
+        uint16_t sp = FLOOR_TABLE[i].setpoint;
+        if (i == target || !isPending(i)) {
+            continue;
+        }
+        if ((position < sp && sp < to) || (to < sp && sp < position)) {
+            if (nearest < 0 || abs((int)sp - (int)position) < abs((int)FLOOR_TABLE[nearest].setpoint - (int)position)) {
+                nearest = i;
+            }
+        }
+    }
+    return nearest;
+}
+
+// Energy of moving from position to a floor - up (away from the sensor) costs SCHED_ENERGY_UP per mm, down SCHED_ENERGY_DOWN
+float CallScheduler::energy(uint16_t position, uint8_t floor) {
+    int d = (int)FLOOR_TABLE[floor].setpoint - (int)position;
+    return (d > 0) ? (float)d * SCHED_ENERGY_UP : (float)-d * SCHED_ENERGY_DOWN;
+}
+
+uint8_t CallScheduler::countFloors(uint8_t mask) {
+    uint8_t n = 0;
+    for (; mask; mask &= mask - 1) {
+        n++;
+    }
+    return n;
+}
+
+// The 'count' floors of 'mask' nearest to 'floor' (mask is all above or all below it)
+uint8_t CallScheduler::nearestFloors(uint8_t floor, uint8_t mask, uint8_t count) {
+    uint8_t kept = 0;
+    for (uint8_t step = 1; step < FLOOR_COUNT && count; step++) {
+        for (int8_t i = (int8_t)floor - step; i <= (int8_t)floor + step; i += 2 * step) {
+            if (i >= 0 && i < FLOOR_COUNT && (mask & (1 << i)) && count) {
+                kept |= (1 << i);
+                count--;
+            }
+        }
+    }
+    return kept;
+}
@@ -0,0 +1,58 @@
+/*!
+ * @file CallScheduler.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Queue of floor calls and the choice of the next stop. Each pending call is scored
+ *   cost = travel time + SCHED_ENERGY_WEIGHT * energy of the move - time the call has waited
+ * and the cheapest is served. With SCHED_ENERGY_WEIGHT > 0 an idle car also holds until some call has waited
+ * longer than its weighted energy, so calls arriving meanwhile share the trip.
+ *
+ * Destination calls (origin + destination from a floor node) are kept per origin. When the car stops at the origin only
+ * one direction group boards - the direction the car is already heading if it has stops that way, otherwise the larger
+ * group - and the rest wait at the origin for a later trip, so up and down passengers do not share a trip. At most
+ * SCHED_GROUP_STOPS destinations (the nearest) board together, which bounds the stops per trip.
+ */
+
+#ifndef CALLSCHEDULER_H
+#define CALLSCHEDULER_H
+
+#include "Arduino.h"
+#include "FloorTable.h"
+
+// Travel and energy estimates - regenerate with tools/dispatch_sim.py --fit after retuning the control law
+#define SCHED_SPEED 49                      // in mm/s - average car speed (exponential law)
+#define SCHED_STOP_MS 2000                  // in ms - time added per stop (accelerate, level, doors)
+#define SCHED_ENERGY_UP 74                  // in mJ/mm - driving the car up
+#define SCHED_ENERGY_DOWN 20                // in mJ/mm - driving the car down
+#define SCHED_ENERGY_WEIGHT 0.0             // in ms/mJ - 0 serves calls as soon as possible, larger values trade wait time for energy
+#define SCHED_GROUP_STOPS 3                 // Destination dispatch: most destination floors boarding one trip
+
+class CallScheduler {
+public:
+  CallScheduler();                          // Constructor
+  ~CallScheduler();                         // Destructor
+  void setup();
+  void addCall(uint8_t floor, unsigned long now);
+  void clearCall(uint8_t floor);
+  void addDestinationCall(uint8_t origin, uint8_t destination, unsigned long now);
+  uint8_t arrived(uint8_t floor, unsigned long now);                      // Clear the served call, returns the destinations (bit per floor) boarding here
+  boolean isPending(uint8_t floor);
+  int8_t nextStop(uint16_t position, unsigned long now);                  // Floor to serve next, -1 to hold
+  int8_t stopOnTheWay(uint16_t position, uint8_t target);                 // Pending floor between position and target, -1 if none
+
+private:
+  uint8_t m_pending;                        // Bit per floor
+  unsigned long m_callTime[FLOOR_COUNT];    // millis() when each pending call was made
+  uint8_t m_destinations[FLOOR_COUNT];      // Destination calls waiting at each origin (bit per destination floor)
+  uint8_t m_deferred;                       // Origins whose other direction group was left behind - not served again until the car has moved on
+
+  float energy(uint16_t position, uint8_t floor);                         // in mJ
+  static uint8_t countFloors(uint8_t mask);
+  static uint8_t nearestFloors(uint8_t floor, uint8_t mask, uint8_t count);
+};
+
+#endif
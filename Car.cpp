@@ -0,0 +1,806 @@
+/*!
+ * @file Car.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "ElevatorController.h"                            /* Control law, output stage and SYSID settings */
+#include "FloorTable.h"
+#if CONTROL_LAW == CONTROL_LAW_MPC
+#include "MPCTable.h"
+#endif
+
+// System identification script - alternating steps so the car returns close to where it started, then a chirp. Start from the middle floor.
+const SysIdSegment SYSID_SCRIPT[] PROGMEM = {
+  { SYSID_STEP,     0, 1000 },
+  { SYSID_STEP,   300, 1500 },
+  { SYSID_STEP,     0, 1000 },
+  { SYSID_STEP,  -300, 1500 },
+  { SYSID_STEP,     0, 1000 },
+  { SYSID_STEP,  -500,  800 },
+  { SYSID_STEP,     0, 1000 },
+  { SYSID_STEP,   500,  800 },
+  { SYSID_STEP,     0, 1000 },
+  { SYSID_STEP,   120, 1500 },              // Near the friction band
+  { SYSID_STEP,  -120, 1500 },
+  { SYSID_STEP,     0, 1000 },
+  { SYSID_CHIRP,  300, 8000 },
+  { SYSID_STEP,     0, 1000 },
+};
+#define SYSID_SEGMENTS (sizeof(SYSID_SCRIPT) / sizeof(SYSID_SCRIPT[0]))
+
+Car::Car()                                                  // Constructor - No code
+{}
+
+Car::~Car()                                                 // Destructor - No code
+{}
+
+void Car::setup(uint8_t index, CANModule *can, LCD *lcd) {
+    m_index = index;
+    m_can = can;
+    m_lcd = lcd;
+
+    DSM.setup(CAR_TABLE[index].sensorAddress, CAR_TABLE[index].xshutPin, index);   // Setup Distance Sensor module object (and its calibration record)
+    DM.setup(CAR_TABLE[index].dacCs);                       // Setup DAC module object
+    SM.setup();                                             // Setup Call scheduler object
+    HM.setup(index);                                        // Setup Sensor health object (and its baseline record)
+
+    m_currentFloor = 0; // Unknown
+    m_prevTime = 0;     // No previous sample for the velocity estimate
+    m_dist = 0;
+    m_velocity = 0;
+    m_velocitySetpoint = 0;
+    m_velocityIntegral = 0;
+    m_outerTick = 0;
+    m_dt = 0;
+    m_command = 0;
+    m_sampling = false;
+    m_diagnostics = 0;
+    m_gainScale = 1;
+    m_oscSide = 0;
+    m_oscPeak = 0;
+    m_oscCrossings = 0;
+    m_oscChanged = millis();
+    m_modelValid = false;
+    m_modelCode = 0;
+    m_modelTime = millis();
+    m_faults = 0;
+    m_deadReckoning = false;
+    m_healthDue = false;
+    m_healthTime = millis();
+    startPeriods(millis());
+    setTarget(0);       // Go to the default floor
+}
+
+// First control period starts at 'start' plus this car's share of the period, so the cars' result reads and control laws never fall in the same loop
+void Car::startPeriods(unsigned long start) {
+    m_triggerTime = start - CONTROL_PERIOD_MS + (unsigned long)m_index * CONTROL_PERIOD_MS / CAR_COUNT;
+}
+
+boolean Car::loop() {
+    boolean ticked = Move(FLOOR_TABLE[m_floor]);
+    checkCurrentFloor();
+#ifdef SENSOR_HEALTH
+    if (m_healthDue) {
+        reportHealth();                                     // After the DAC write
+    }
+#endif
+#ifdef DEAD_RECKONING
+    if (m_deadReckoning) {
+        return ticked;                                      // Calls wait until the sensor is back
+    }
+#endif
+    dispatch();
+    return ticked;
+}
+
+// Stop the car and abandon the measurement in flight - the next period starts a fresh one
+void Car::halt() {
+    DM.transferDAC(0);
+#ifdef DEAD_RECKONING
+    setModelCode(0);
+#endif
+    PM.stop();                                              // The trip's timing is lost - the law falls back to the floor error
+    m_prevTime = 0;
+    m_sampling = false;
+}
+
+byte Car::getFloorCode() {
+    return m_currentFloor ? bankCode(m_currentFloor) : 0;
+}
+
+// Clear the call at the target once the car has stopped there and pick the next stop
+void Car::dispatch() {
+    if (m_target >= 0) {
+        if (abs((int)m_dist - (int)FLOOR_TABLE[m_target].setpoint) <= FLOOR_TABLE[m_target].tolerance && fabs(m_velocity) < MPC_STOP_VELOCITY) {
+            uint8_t boarding = SM.arrived(m_target, millis());
+            if (boarding) {
+                CanFrame frame = { getCanId(), DEST_DLC, { bankCode(m_can->floorCode(m_target)), boarding } };   // Announce the destination group boarding
+                m_can->transmitCAN(frame);
+            }
+            m_target = -1;
+        }
+        else {
+            int8_t stop = SM.stopOnTheWay(m_dist, m_target);
+            if (stop >= 0) {
+                setTarget(stop);                            // Leave the original call pending, it is picked up again after this stop
+            }
+            return;
+        }
+    }
+    int8_t next = SM.nextStop(m_dist, millis());
+    if (next >= 0) {
+        setTarget(next);
+    }
+}
+
+// Change setpoint and output new destination floor
+void Car::setTarget(int8_t floor) {
+    m_target = floor;
+    m_floor = floor;
+#if CONTROL_LAW == CONTROL_LAW_CASCADED && defined(MOTION_PROFILE)
+    startProfile(floor);
+#endif
+    if (m_lcd) {
+        m_lcd->lcdObj.setCursor(0, 0);                      // Set cursor to column 0, line 0
+        m_lcd->lcdObj.print("Floor ");
+        m_lcd->lcdObj.print(floor + 1);
+        m_lcd->lcdObj.print("     ");                      // Clear any longer message (e.g. "Sys ID done")
+    }
+}
+
+#if CONTROL_LAW == CONTROL_LAW_CASCADED && defined(MOTION_PROFILE)
+// Start the trip's profile - a table lookup from rest at a floor, planned from the car's position and speed otherwise (a stop added on the way)
+void Car::startProfile(int8_t floor) {
+#ifdef PROFILE_TIMING
+    unsigned long start = micros();
+#endif
+    int8_t from = -1;
+
+    if (m_dist <= MINHEIGHT || m_dist >= MAXHEIGHT) {
+        PM.stop();                                          // No position yet - the law runs on the floor error
+        return;
+    }
+    for (int8_t i = 0; i < FLOOR_COUNT; i++) {
+        if (abs((int)m_dist - (int)FLOOR_TABLE[i].setpoint) <= FLOOR_TABLE[i].tolerance) {
+            from = i;
+        }
+    }
+    if (from == floor) {
+        PM.stop();                                          // Already there - the law only levels
+        return;
+    }
+    if (from >= 0 && fabs(m_velocity) < MPC_STOP_VELOCITY) {
+        PM.start(from, floor, millis());
+    }
+    else {
+        uint16_t setpoint = FLOOR_TABLE[floor].setpoint;
+        PM.start(m_dist, setpoint, (setpoint > m_dist) ? m_velocity : -m_velocity, millis());
+    }
+#ifdef PROFILE_TIMING
+    unsigned long planUs = micros() - start;
+
+    Serial.print("[PLAN] ");
+    Serial.print(m_can->syncMillis());
+    Serial.print(" car ");
+    Serial.print(m_index + 1);
+    Serial.print(" to floor ");
+    Serial.print(floor + 1);
+    Serial.print(from >= 0 ? " from floor " : " on the way ");
+    Serial.print(planUs);
+    Serial.println(" us");
+#endif
+}
+#endif
+
+// Move to the floor's setpoint distance - returns true when the control law ran and wrote the DAC
+boolean Car::Move(const FloorEntry &floor) {
+  	int difference = 0; // Difference in mm from setpoint (floor). A positive value is above the setpoint distance (floor) and a negative value is below.
+    float command;      // DAC command from the control law (fractional codes are kept for DAC_DITHER)
+    RangeSample sample;
+
+    // Non-blocking ranging: trigger once per control period, run the law when the measurement arrives and return immediately otherwise
+    // Periods are counted from the previous one (not from the trigger) so the cars on the board keep the phase offsets given in setup()
+    if (!m_sampling && millis() - m_triggerTime >= CONTROL_PERIOD_MS) {
+        DSM.trigger();
+        m_triggerTime += (millis() - m_triggerTime) / CONTROL_PERIOD_MS * CONTROL_PERIOD_MS;   // Skip any periods missed (e.g. another car's SYSID run)
+        m_sampling = true;
+    }
+    if (!m_sampling) {
+        return false;
+    }
+    if (!DSM.poll()) {
+#ifdef DEAD_RECKONING
+        if (millis() - m_triggerTime > (m_deadReckoning ? CONTROL_PERIOD_MS : SENSOR_TIMEOUT_MS)) {
+            m_sampling = false;                                // Trigger again - while dead reckoning every period still ticks
+            return sensorFault(true);
+        }
+#else
+        if (millis() - m_triggerTime > SENSOR_TIMEOUT_MS) {
+            halt();                                            // Sensor stopped answering - stop the car and trigger again next period
+        }
+#endif
+        return false;
+    }
+    DSM.read(sample);
+    m_sampling = false;
+#ifdef SENSOR_HEALTH
+    if (HM.update(sample) || millis() - m_healthTime >= HEALTH_REPORT_MS) {
+        m_healthDue = true;
+    }
+#endif
+#ifdef DEAD_RECKONING
+    if (m_deadReckoning) {
+        if (!recover(sample)) {
+            deadReckon();
+            return true;
+        }
+    }
+    else if (!usableRange(sample)) {
+        return sensorFault(false);
+    }
+    m_faults = 0;
+#else
+    if (sample.status != RANGE_VALID) {
+        return false;                                          // Keep the last command for one period rather than act on a bad range
+    }
+#endif
+    m_dist = sample.distance;
+
+    if (m_dist > MINHEIGHT && m_dist < MAXHEIGHT) {
+        estimateVelocity();
+
+        //Output the difference between setpoint and distance
+        difference = m_dist - floor.setpoint;  // positive value means above setpoint (later take the negative of this value to indicate direction to move - i.e. down)
+        //Serial.print("Distance ");           // Testing
+        //Serial.println(m_dist);              // Testing
+
+#if CONTROL_LAW == CONTROL_LAW_MPC
+        command = mpcLaw(difference, floor);
+#elif CONTROL_LAW == CONTROL_LAW_CASCADED
+        command = cascadedLaw(difference, floor);
+#else
+        command = exponentialLaw(difference, floor);
+#endif
+        command = approach(command, difference, floor);
+#ifdef OSC_DETECT
+        detectOscillation(difference);
+        command *= m_gainScale;
+#endif
+#ifdef DEAD_RECKONING
+        m_modelPos = m_dist;                                   // Anchor the model to the good range
+        m_modelVel = m_velocity;
+        m_modelTime = millis();
+        m_modelValid = true;
+#endif
+        drive(command);
+        return true;
+    }
+    DM.transferDAC(0);                                         // Stop the elevator when get an out of range measurement - make sure Floor 1 is above MINHEIGHT and Floor 3 is below MAXHEIGHT
+#ifdef DEAD_RECKONING
+    setModelCode(0);
+#endif
+    m_prevTime = 0;                                            // Restart the velocity estimate from the next good sample
+    return false;
+}
+
+void Car::drive(float command) {
+#ifdef DAC_SLEW_LIMIT
+    command = DM.limit(command);                               // Saturate, slew limit and reverse through zero
+#else
+    command = constrain(command, -DAC_MAX, DAC_MAX);           // 1023 either way is the most that can be sent to the DAC
+#endif
+
+    //Serial.println(command);                                 // Testing
+#ifdef DAC_DITHER
+    DM.transferDACDithered(command);                           // Set values on DAC to control motor speed (fraction carried to the next tick)
+#else
+    DM.transferDAC(command);                                   // Set values on DAC to control motor speed
+#endif
+    m_command = command;
+#ifdef DEAD_RECKONING
+    setModelCode(command);
+#endif
+}
+
+#ifdef DEAD_RECKONING
+// The model runs on the code from now on
+void Car::setModelCode(float code) {
+    advanceModel(millis());
+    m_modelCode = code;
+}
+
+// First order response to the DAC code (tools/plant.py), integrated exactly over the time since the last advance
+void Car::advanceModel(unsigned long now) {
+    float dt = (now - m_modelTime) / 1000.0;
+    float drive = fabs(m_modelCode) - MOTOR_FRICTION;
+    float target = 0;
+    float decay = exp(-dt / MOTOR_TAU);
+
+    if (drive > 0) {
+        target = (m_modelCode > 0) ? -MOTOR_K * drive : MOTOR_K * drive;   // A positive code drives the car down
+    }
+    m_modelPos += target * dt + (m_modelVel - target) * MOTOR_TAU * (1 - decay);
+    m_modelVel = target + (m_modelVel - target) * decay;
+    m_modelTime = now;
+}
+
+// A valid range near where the model puts the car - an out of range reading that agrees with the model is the car at the end of the shaft
+boolean Car::usableRange(const RangeSample &sample) {
+    if (sample.status != RANGE_VALID) {
+        return false;
+    }
+    if (!m_modelValid) {
+        return true;
+    }
+    advanceModel(millis());
+    return fabs(sample.distance - m_modelPos) <= DEADRECK_JUMP_MM;
+}
+
+// No usable range this period - hold the last command for DEADRECK_FAULTS periods (a timeout is a fault at once), then dead reckon.
+// Returns true when the DAC was written.
+boolean Car::sensorFault(boolean timeout) {
+    if (!m_deadReckoning && !timeout && ++m_faults < DEADRECK_FAULTS) {
+        return false;
+    }
+    if (!m_deadReckoning) {
+        if (!m_modelValid) {
+            halt();                                            // Never had a good range to start from
+            return false;
+        }
+        startDeadReckoning();
+    }
+    deadReckon();
+    return true;
+}
+
+// Pick the floor: the nearest to where the car would come to rest if the drive were cut now, not behind a car moving faster than creep speed
+void Car::startDeadReckoning() {
+    float rest, d, best = 0;
+
+    advanceModel(millis());
+    rest = m_modelPos + m_modelVel * MOTOR_TAU;
+    m_drFloor = -1;
+    for (int8_t pass = 0; pass < 2 && m_drFloor < 0; pass++) {
+        for (int8_t i = 0; i < FLOOR_COUNT; i++) {
+            d = FLOOR_TABLE[i].setpoint - rest;
+            if (pass == 0 && fabs(m_modelVel) > DEADRECK_SPEED && d * m_modelVel < 0) {
+                continue;                                      // Behind a moving car - only if there is no floor ahead (second pass)
+            }
+            if (m_drFloor < 0 || fabs(d) < best) {             // Ties keep the lower floor
+                m_drFloor = i;
+                best = fabs(d);
+            }
+        }
+    }
+    m_deadReckoning = true;
+    m_drParked = false;
+    m_recoverCount = 0;
+    m_diagnostics |= DIAG_DEAD_RECKONING;
+    PM.stop();
+
+    Serial.print("[DIAG] ");
+    Serial.print(m_can->syncMillis());
+    Serial.print(" car ");
+    Serial.print(m_index + 1);
+    Serial.print(" sensor fault, dead reckoning from ");
+    Serial.print((int)m_modelPos);
+    Serial.print(" mm to floor ");
+    Serial.println(m_drFloor + 1);
+    if (m_lcd) {
+        m_lcd->lcdObj.setCursor(0, 0);
+        m_lcd->lcdObj.print("Sensor fault");
+    }
+}
+
+// Creep toward the floor at DEADRECK_SPEED on the inverse of the model and cut the drive when the car would coast onto the setpoint
+void Car::deadReckon() {
+    const FloorEntry &floor = FLOOR_TABLE[m_drFloor];
+    float command = 0;
+
+    advanceModel(millis());
+    float difference = m_modelPos - floor.setpoint;
+    float rest = difference + m_modelVel * MOTOR_TAU;          // Where the car stops relative to the floor if the drive is cut now
+    boolean outside = m_modelPos <= MINHEIGHT || m_modelPos >= MAXHEIGHT;
+
+    if (!m_drParked && (outside || fabs(rest) <= DEADRECK_SPEED * CONTROL_PERIOD_MS / 2000.0 || rest * difference < 0)) {
+        m_drParked = true;                                     // Within half a period of creep, or it would coast past
+        m_currentFloor = outside ? m_currentFloor : m_can->floorCode(m_drFloor);   // The node record's code - the table's is only the default
+        Serial.print("[DIAG] ");
+        Serial.print(m_can->syncMillis());
+        Serial.print(" car ");
+        Serial.print(m_index + 1);
+        Serial.print(" parked at ");
+        Serial.print((int)m_modelPos);
+        Serial.println(" mm (dead reckoning)");
+    }
+    if (!m_drParked) {
+        command = (difference > 0 ? 1 : -1) * (DEADRECK_SPEED / MOTOR_K + MOTOR_FRICTION);   // Positive (down) above the floor
+    }
+    drive(command);
+}
+
+// While dead reckoning: count valid ranges that agree with each other - DEADRECK_RECOVER in a row hand the car back to the law
+boolean Car::recover(const RangeSample &sample) {
+    if (sample.status != RANGE_VALID) {
+        m_recoverCount = 0;
+        return false;
+    }
+    if (m_recoverCount > 0 && abs((int)sample.distance - (int)m_recoverDist) > DEADRECK_JUMP_MM) {
+        m_recoverCount = 0;
+    }
+    m_recoverDist = sample.distance;
+    if (++m_recoverCount < DEADRECK_RECOVER) {
+        return false;
+    }
+    m_deadReckoning = false;
+    m_diagnostics &= ~DIAG_DEAD_RECKONING;
+    m_prevTime = 0;                                            // Restart the velocity estimate - the law picks up the trip from here
+    m_velocityIntegral = 0;
+    Serial.print("[DIAG] ");
+    Serial.print(m_can->syncMillis());
+    Serial.print(" car ");
+    Serial.print(m_index + 1);
+    Serial.println(" sensor recovered");
+    return true;
+}
+#endif
+
+// Update the velocity estimate (mm/s) from the latest in-range distance
+void Car::estimateVelocity() {
+    unsigned long now = millis();
+
+    if (m_prevTime != 0 && now != m_prevTime) {
+        m_dt = (now - m_prevTime) / 1000.0;
+        float raw = ((float)m_dist - (float)m_prevDist) / m_dt;
+        m_velocity += VELOCITY_FILTER * (raw - m_velocity);
+    }
+    else {
+        m_velocity = 0;
+        m_dt = 0;
+    }
+    m_prevDist = m_dist;
+    m_prevTime = now;
+}
+
+// Within FLOOR_APPROACH_MM of the floor: run the exponential law at the floor's leveling gain (the MPC table and the cascaded loop
+// keep their own tuning) and, while moving toward the floor faster than its approach speed, scale the command down in proportion
+// (the cascaded law caps its velocity setpoint instead)
+float Car::approach(float command, int difference, const FloorEntry &floor) {
+    if (abs(difference) >= FLOOR_APPROACH_MM) {
+        return command;
+    }
+#if CONTROL_LAW == CONTROL_LAW_EXPONENTIAL
+    command = command * floor.levelGain / 100;
+#endif
+#if CONTROL_LAW != CONTROL_LAW_CASCADED
+    if (floor.approachSpeed != FLOOR_NO_SPEED_CAP && difference * m_velocity < 0 && fabs(m_velocity) > floor.approachSpeed) {
+        command = command * floor.approachSpeed / fabs(m_velocity);
+    }
+#else
+    (void)floor;                                            // The cascaded law applies the floor's speed cap to its velocity setpoint
+#endif
+    return command;
+}
+
+#ifdef OSC_DETECT
+// Count swings of the error across the setpoint near the floor, back the gain off when they come too often and restore it step by step
+void Car::detectOscillation(int difference) {
+    unsigned long now = millis();
+    int8_t side = (difference > OSC_HYSTERESIS) ? 1 : (difference < -OSC_HYSTERESIS) ? -1 : 0;
+
+    if (abs(difference) > OSC_BAND) {
+        m_oscSide = 0;                                      // Travelling - an approach from either side starts clean
+        m_oscPeak = 0;
+    }
+    else {
+        if (side != 0 && side != m_oscSide) {
+            if (m_oscSide != 0 && m_oscPeak >= OSC_AMPLITUDE) {
+                if (m_oscCrossings == 0 || now - m_oscStart > OSC_WINDOW_MS) {
+                    m_oscCrossings = 0;
+                    m_oscStart = now;
+                }
+                m_oscCrossings++;
+            }
+            m_oscSide = side;
+            m_oscPeak = 0;
+        }
+        m_oscPeak = max(m_oscPeak, (uint16_t)abs(difference));
+    }
+
+    if (m_oscCrossings >= OSC_CROSSINGS) {
+        m_oscCrossings = 0;
+        m_gainScale = max(m_gainScale * OSC_BACKOFF, OSC_MIN_GAIN);
+        m_diagnostics |= DIAG_OSCILLATION;
+        m_oscChanged = now;
+        Serial.print("[DIAG] ");
+        Serial.print(m_can->syncMillis());
+        Serial.print(" car ");
+        Serial.print(m_index + 1);
+        Serial.print(" oscillation, gain ");
+        Serial.println(m_gainScale);
+    }
+    else if (m_gainScale < 1 && now - m_oscChanged >= OSC_RESTORE_MS) {
+        m_gainScale = min(m_gainScale / OSC_BACKOFF, 1.0);
+        m_oscChanged = now;
+        if (m_gainScale > 0.99) {
+            m_gainScale = 1;
+            m_diagnostics &= ~DIAG_OSCILLATION;
+        }
+        Serial.print("[DIAG] ");
+        Serial.print(m_can->syncMillis());
+        Serial.print(" car ");
+        Serial.print(m_index + 1);
+        Serial.print(" gain ");
+        Serial.println(m_gainScale);
+    }
+}
+#endif
+
+// Original law: difference = difference * A e^(-a * difference)
+float Car::exponentialLaw(int difference, const FloorEntry &floor) {
+    if (abs(difference) <= floor.tolerance) {
+        return 0;
+    }
+
+    // Set dynamic parameters to smooth out motion: difference = difference * A e^(-a * difference) - Graph this to see what the motion will look like
+    a = (float)DAMPENER / (float)diffMax;
+
+    return difference * A * exp((-1) * a * abs(difference));
+}
+
+#if CONTROL_LAW == CONTROL_LAW_CASCADED
+// Cascaded loop: the outer P loop turns position error into a speed limited velocity setpoint, the inner PI loop tracks it.
+// A positive DAC code moves the car down, so the code has the opposite sign to the velocity it produces.
+float Car::cascadedLaw(int difference, const FloorEntry &floor) {
+    float velocityError, out;
+
+    if (abs(difference) <= floor.tolerance && fabs(m_velocity) < MPC_STOP_VELOCITY) {
+        m_velocitySetpoint = 0;
+        m_velocityIntegral = 0;
+        m_outerTick = 0;
+        return 0;
+    }
+
+    if (m_outerTick == 0) {
+#ifdef MOTION_PROFILE
+        float reference, velocity;
+        if (PM.sample(millis(), &reference, &velocity)) {
+            m_velocitySetpoint = constrain(velocity - CASCADE_KP_POS * (m_dist - reference), -CASCADE_MAX_SPEED, CASCADE_MAX_SPEED);
+        }
+        else
+#endif
+        m_velocitySetpoint = constrain(-CASCADE_KP_POS * difference, -CASCADE_MAX_SPEED, CASCADE_MAX_SPEED);
+        if (floor.approachSpeed != FLOOR_NO_SPEED_CAP && abs(difference) < FLOOR_APPROACH_MM) {
+            m_velocitySetpoint = constrain(m_velocitySetpoint, -(float)floor.approachSpeed, (float)floor.approachSpeed);
+        }
+    }
+    m_outerTick = (m_outerTick + 1) % CASCADE_OUTER_DIVIDER;
+
+    velocityError = m_velocitySetpoint - m_velocity;
+    out = -(CASCADE_KFF * m_velocitySetpoint + CASCADE_KP_VEL * velocityError + CASCADE_KI_VEL * m_velocityIntegral);
+    if (fabs(out) < 1023) {
+        m_velocityIntegral += velocityError * m_dt;         // Anti-windup: only integrate while the output is not saturated
+    }
+
+    return constrain(out, -1023, 1023);
+}
+#endif
+
+#if CONTROL_LAW == CONTROL_LAW_MPC
+// Find the breakpoint segment containing x in a PROGMEM breakpoint array and the interpolation weight within it (clamped at the ends)
+static uint8_t mpcSegment(const int16_t *breakpoints, uint8_t n, float x, float *w) {
+    uint8_t i = 0;
+    int16_t lo = pgm_read_word(&breakpoints[0]);
+    int16_t hi;
+
+    if (x <= lo) {
+        *w = 0;
+        return 0;
+    }
+    while (i < n - 2) {
+        hi = pgm_read_word(&breakpoints[i + 1]);
+        if (x <= hi) {
+            break;
+        }
+        lo = hi;
+        i++;
+    }
+    hi = pgm_read_word(&breakpoints[i + 1]);
+    *w = (x >= hi) ? 1.0 : (x - lo) / (float)(hi - lo);
+    return i;
+}
+
+// Explicit MPC: bilinear interpolation of the precomputed control law u(e, v). The table only stores e >= 0 since u(-e, -v) = -u(e, v).
+float Car::mpcLaw(int difference, const FloorEntry &floor) {
+    float e = difference;
+    float v = m_velocity;
+    float we, wv;
+    int sign = 1;
+
+    if (abs(difference) <= floor.tolerance && fabs(m_velocity) < MPC_STOP_VELOCITY) {
+        return 0;
+    }
+    if (e < 0) {
+        e = -e;
+        v = -v;
+        sign = -1;
+    }
+
+    uint8_t i = mpcSegment(MPC_E_BREAKPOINTS, MPC_E_POINTS, e, &we);
+    uint8_t j = mpcSegment(MPC_V_BREAKPOINTS, MPC_V_POINTS, v, &wv);
+    float u00 = (int16_t)pgm_read_word(&MPC_TABLE[i][j]);
+    float u01 = (int16_t)pgm_read_word(&MPC_TABLE[i][j + 1]);
+    float u10 = (int16_t)pgm_read_word(&MPC_TABLE[i + 1][j]);
+    float u11 = (int16_t)pgm_read_word(&MPC_TABLE[i + 1][j + 1]);
+    float u0 = u00 + (u01 - u00) * wv;
+    float u1 = u10 + (u11 - u10) * wv;
+
+    return sign * (u0 + (u1 - u0) * we);
+}
+#endif
+
+// Apply the scripted DAC sequence while logging every sensor sample at the full continuous ranging rate.
+// Log lines are "[SYSID] t_ms,dac,dist_mm" between "[SYSID] start" and "[SYSID] done" (or "[SYSID] abort t_ms reason") - feed the log to tools/sysid_fit.py
+void Car::runSystemId() {
+    SysIdSegment seg;
+    unsigned long start, segStart, now;
+    float t;
+    int code = 0;
+    RangeSample sample;
+    const char *reason = NULL;                              // Why the run stopped early
+    uint8_t invalid = 0;                                    // Failed samples in a row
+    unsigned long lastSample;
+
+    if (m_lcd) {
+        m_lcd->lcdObj.setCursor(0, 0);
+        m_lcd->lcdObj.print("Sys ID  ");
+    }
+    Serial.print("[SYSID] start car ");
+    Serial.print(m_index + 1);
+    Serial.print(" at ");
+    Serial.println(m_can->syncMillis());                         // Sample times below are relative to this
+
+    DSM.startContinuous();                                  // Back-to-back ranging so every sample the sensor produces is logged
+
+    start = millis();
+    lastSample = start;
+    for (uint8_t i = 0; i < SYSID_SEGMENTS && !reason; i++) {
+        memcpy_P(&seg, &SYSID_SCRIPT[i], sizeof(seg));
+        segStart = millis();
+        while ((now = millis()) - segStart < seg.duration) {
+            if (seg.type == SYSID_CHIRP) {
+                t = (now - segStart) / 1000.0;
+                code = seg.amplitude * sin(2 * PI * (SYSID_CHIRP_F0 * t + (SYSID_CHIRP_F1 - SYSID_CHIRP_F0) * t * t / (2 * seg.duration / 1000.0)));
+            }
+            else {
+                code = seg.amplitude;
+            }
+            DM.transferDAC(code);
+
+            if (DSM.poll()) {
+                DSM.read(sample);
+                lastSample = now;
+                if (sample.status != RANGE_VALID) {
+                    if (++invalid >= SYSID_MAX_INVALID) {
+                        reason = "sensor failing";          // The car is driven blind
+                        break;
+                    }
+                    continue;
+                }
+                invalid = 0;
+                Serial.print("[SYSID] ");
+                Serial.print(now - start);
+                Serial.print(",");
+                Serial.print(code);
+                Serial.print(",");
+                Serial.println(sample.distance);
+
+                if (sample.distance < MINHEIGHT + SYSID_MARGIN || sample.distance > MAXHEIGHT - SYSID_MARGIN ||
+                    sample.distance < FLOOR_TABLE[0].setpoint - SYSID_FLOOR_MARGIN ||
+                    sample.distance > FLOOR_TABLE[FLOOR_COUNT - 1].setpoint + SYSID_FLOOR_MARGIN) {
+                    reason = "out of range";                // Too close to the ends of the shaft or past the floors
+                    break;
+                }
+            }
+            else if (now - lastSample > SYSID_SAMPLE_TIMEOUT_MS) {
+                reason = "no samples";                      // Sensor stopped answering
+                break;
+            }
+        }
+    }
+
+    halt();                                                 // Drive cut at once, whatever ended the run
+    DSM.stop();                                             // Back to the single measurements used by Move()
+    m_modelValid = false;                                   // The script moved the car without the model
+    if (reason) {
+        Serial.print("[SYSID] abort ");
+        Serial.print(m_can->syncMillis());
+        Serial.print(" ");
+        Serial.println(reason);
+    }
+    else {
+        Serial.println("[SYSID] done");
+    }
+    if (m_lcd) {
+        m_lcd->lcdObj.setCursor(0, 0);
+        m_lcd->lcdObj.print(reason ? "Sys ID abort" : "Sys ID done ");
+    }
+}
+
+// CAL_OFFSET / CAL_XTALK with a target held 'distance' mm from the sensor, or CAL_CLEAR. Logs "[CAL] car n offset <mm> crosstalk <MCPS>"
+// with the calibration in use afterwards, or "[CAL] car n failed" (blocks for VL53L0X_CAL_SAMPLES measurements). A target distance outside
+// MINHEIGHT..MAXHEIGHT fails before measuring and leaves the stored calibration as it was
+void Car::calibrateSensor(byte command, uint16_t distance) {
+    boolean ok = true;
+
+    if ((command == CAL_OFFSET || command == CAL_XTALK) && (distance < MINHEIGHT || distance > MAXHEIGHT)) {
+        ok = false;                                         // Zero or garbage - the offset would clamp and the crosstalk divide by zero
+    }
+    else if (command == CAL_OFFSET) {
+        ok = DSM.calibrateOffset(distance);
+    }
+    else if (command == CAL_XTALK) {
+        ok = DSM.calibrateCrosstalk(distance);
+    }
+    else {
+        DSM.clearCalibration();
+    }
+    m_prevTime = 0;                                         // The blocking run breaks the velocity estimate and the control period
+    m_sampling = false;
+    Serial.print("[CAL] car ");
+    Serial.print(m_index + 1);
+    if (!ok) {
+        Serial.println(" failed");
+        return;
+    }
+    Serial.print(" ");
+    DSM.printCalibration();
+    Serial.println();
+}
+
+void Car::relearnSensorHealth() {
+    HM.relearn();
+    m_healthDue = true;
+}
+
+#ifdef SENSOR_HEALTH
+// One "[HEALTH] t_ms,car,signal_pct,ambient_pct,errors_pct,warnings" record and HEALTH frame
+void Car::reportHealth() {
+    uint8_t warnings = HM.getWarnings();
+    char msg[48];
+
+    if (warnings & (HEALTH_WARN_SIGNAL | HEALTH_WARN_AMBIENT | HEALTH_WARN_ERRORS)) {
+        m_diagnostics |= DIAG_SENSOR_HEALTH;
+    }
+    else {
+        m_diagnostics &= ~DIAG_SENSOR_HEALTH;
+    }
+    sprintf(msg, "[HEALTH] %lu,%u,%u,%u,%u,%u", m_can->syncMillis(), m_index, HM.getSignal(), HM.getAmbient(), HM.getErrors(), warnings);
+    Serial.println(msg);
+    CanFrame frame = { getCanId(), HEALTH_DLC, { bankCode(HEALTH), warnings, HM.getSignal(), HM.getAmbient(), HM.getErrors() } };
+    m_can->transmitCAN(frame);
+    m_healthDue = false;
+    m_healthTime = millis();
+}
+#endif
+
+void Car::checkCurrentFloor() {
+#ifdef DEAD_RECKONING
+    if (m_deadReckoning) {
+        return;                                             // m_dist is the last range before the fault - deadReckon() sets the floor it parks at
+    }
+#endif
+
+    // Check current floor - within the floor's leveling band, with the node record's code
+    for (int8_t i = 0; i < FLOOR_COUNT; i++) {
+        if (abs((int)m_dist - (int)FLOOR_TABLE[i].setpoint) <= FLOOR_TABLE[i].tolerance) {
+            m_currentFloor = m_can->floorCode(i);
+        }
+    }
+    // If the car is between floors, keep repeating the last known floor
+}
\ No newline at end of file
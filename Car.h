@@ -0,0 +1,145 @@
+/*!
+ * @file Car.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * One car (shaft): its distance sensor, DAC, call scheduler and control state. The ElevatorController runs CAR_COUNT of them.
+ */
+
+#ifndef CAR_H
+#define CAR_H
+
+#include "Arduino.h"
+#include "CANModule.h"
+#include "DistanceSensor.h"
+#include "DAC.h"
+#include "LCD.h"
+#include "CallScheduler.h"
+#include "MotionProfile.h"
+#include "SensorHealth.h"
+
+#define CAR_COUNT 1                         // Cars driven by this board - each needs a CAR_TABLE entry
+
+typedef struct {
+  uint8_t sensorAddress;                    // I2C address given to the car's distance sensor
+  uint8_t xshutPin;                         // Sensor XSHUT pin - the first car may use SENSOR_NO_XSHUT since it is set up while the others are held in reset
+  uint8_t dacCs;                            // DAC SPI chip select pin
+} CarConfig;
+
+// Pins left free on the UNO by the CAN module, DAC, LCD and I2C are A0 - A3
+const CarConfig CAR_TABLE[] = {
+  { SENSOR_ADDRESS, SENSOR_NO_XSHUT, CS },
+  { 0x51,           A0,              A1 },
+};
+static_assert(CAR_COUNT <= sizeof(CAR_TABLE) / sizeof(CAR_TABLE[0]), "CAR_TABLE needs an entry for every car");
+static_assert(CAR_COUNT <= NODE_CARS, "a bank has NODE_CARS car numbers");
+// EEPROM: a calibration record per car from SENSOR_CAL_EEPROM, a sensor health baseline per car from HEALTH_EEPROM, then the node record
+#if RANGEFINDER == RANGEFINDER_VL53L0X
+static_assert(SENSOR_CAL_EEPROM + CAR_COUNT * sizeof(CalibrationRecord) <= HEALTH_EEPROM, "the calibration records run into the health records");
+#endif
+static_assert(HEALTH_EEPROM + CAR_COUNT * sizeof(HealthRecord) <= NODE_EEPROM, "the health records run into the node record");
+static_assert(NODE_EEPROM + sizeof(NodeRecord) <= E2END + 1, "the node record runs past the end of the EEPROM");
+
+class Car {
+public:
+	Car();                                  // Constructor
+	~Car();                                 // Destructor
+	void setup(uint8_t index, CANModule *can, LCD *lcd);   // lcd is NULL for a car without the display
+	boolean loop();                         // One non-blocking step - returns true when the control law ran and wrote the DAC
+	void startPeriods(unsigned long start); // Phase the control periods against the other cars on the board
+	void halt();                            // Stop the car (DAC 0) and drop the measurement in flight
+	void runSystemId();                     // Apply the scripted DAC sequence and log every sensor sample (blocks until finished or aborted)
+	void calibrateSensor(byte command, uint16_t distance);   // CAL_OFFSET, CAL_XTALK or CAL_CLEAR (blocks for the measurements)
+	void relearnSensorHealth();             // HEALTH command - the sensor has been serviced
+
+	CallScheduler &scheduler() { return SM; }
+	byte getFloorCode();                    // CAN code of the current floor (with the car number), 0 if not known yet
+	unsigned long getCanId() { return m_can->getNodeId() + m_index; }
+	uint8_t getIndex() { return m_index; }
+	uint16_t getDistance() { return m_dist; }
+	uint16_t getSetpoint() { return FLOOR_TABLE[m_floor].setpoint; }
+	int getCommand() { return m_command; }
+	float getVelocity() { return m_velocity; }
+	uint8_t getDiagnostics() { return m_diagnostics; }   // DIAG_xxx bits
+
+private:
+  uint8_t m_index;                        // Position in CAR_TABLE
+  CANModule *m_can;
+  LCD *m_lcd;
+  uint8_t m_currentFloor;
+  int8_t m_target;                        // FLOOR_TABLE index the car is travelling to, -1 when idle
+  uint8_t m_floor;                        // FLOOR_TABLE index of the floor Move() levels on - the last target, kept while idle
+
+  // Motion variables                     // Set dynamic parameters to smooth out motion: difference = difference * A e^(-a * difference)
+	float a;                                // Exponential dampening on the difference measurement - via exponential (see Move() function)
+  uint16_t m_dist;                        // Distance in mm from the distance sensor
+  uint16_t m_prevDist;                    // Previous in-range distance (for the velocity estimate)
+  unsigned long m_prevTime;               // millis() of m_prevDist, 0 if there is no valid previous sample
+  float m_velocity;                       // Estimated car velocity in mm/s (positive is moving up, away from the sensor)
+  float m_velocitySetpoint;               // Cascaded loop: velocity commanded by the outer loop in mm/s
+  float m_velocityIntegral;               // Cascaded loop: integrated velocity error in mm
+  uint8_t m_outerTick;                    // Cascaded loop: counts Move() calls between outer loop updates
+  float m_dt;                             // Time in s between the last two distance samples
+  int m_command;                          // Last DAC code from the control law
+  boolean m_sampling;                     // A measurement has been triggered and not read yet
+  uint8_t m_diagnostics;                  // DIAG_xxx bits
+
+  // Oscillation detector
+  float m_gainScale;                      // Multiplies the law output (1 = as tuned)
+  int8_t m_oscSide;                       // Side of the setpoint the error was last seen on beyond OSC_HYSTERESIS (-1, 1, 0 = none yet)
+  uint16_t m_oscPeak;                     // Largest |error| since the last crossing in mm
+  uint8_t m_oscCrossings;                 // Crossings counted in the current window
+  unsigned long m_oscStart;               // millis() of the first crossing in the window
+  unsigned long m_oscChanged;             // millis() of the last gain change
+  unsigned long m_triggerTime;            // millis() the current control period started
+
+  // Degraded mode (DEAD_RECKONING)
+  boolean m_modelValid;                   // The motor model has been anchored to a good range
+  float m_modelPos;                       // Model position in mm ...
+  float m_modelVel;                       // ... and velocity in mm/s (positive up)
+  float m_modelCode;                      // DAC code the model is driven with
+  unsigned long m_modelTime;              // millis() the model was last advanced to
+  uint8_t m_faults;                       // Control periods in a row without a usable range
+  boolean m_deadReckoning;                // Creeping to (or parked at) m_drFloor on the model
+  boolean m_drParked;
+  int8_t m_drFloor;                       // FLOOR_TABLE index the car creeps to
+  uint8_t m_recoverCount;                 // Consistent ranges in a row while dead reckoning
+  uint16_t m_recoverDist;                 // The last of them in mm
+
+  // Sensor health (SENSOR_HEALTH)
+  boolean m_healthDue;                    // A report is waiting for the end of the loop
+  unsigned long m_healthTime;             // millis() of the last report
+
+	DistanceSensor DSM;                     // Distance Sensor module object
+	DAC DM;                                 // DAC module object
+	CallScheduler SM;                       // Call scheduler object
+	MotionProfile PM;                       // Motion profile of the current trip (cascaded law)
+	SensorHealth HM;                        // Sensor health trend
+
+  boolean Move(const FloorEntry &floor);  // Move to the floor's setpoint distance
+  void drive(float command);              // Output stage - saturate (and slew limit), write the DAC
+  void setModelCode(float code);
+  void advanceModel(unsigned long now);
+  boolean usableRange(const RangeSample &sample);
+  boolean sensorFault(boolean timeout);
+  void startDeadReckoning();
+  void deadReckon();
+  boolean recover(const RangeSample &sample);
+  void reportHealth();
+  byte bankCode(byte code) { return code | ((m_can->getFirstCar() + m_index) << CAR_SHIFT); }   // Floor or command code with the car's bank number
+  void checkCurrentFloor();
+  void dispatch();
+  void setTarget(int8_t floor);
+  void startProfile(int8_t floor);
+  void estimateVelocity();
+  float approach(float command, int difference, const FloorEntry &floor);
+  void detectOscillation(int difference);
+  float exponentialLaw(int difference, const FloorEntry &floor);
+  float mpcLaw(int difference, const FloorEntry &floor);
+  float cascadedLaw(int difference, const FloorEntry &floor);
+};
+
+#endif
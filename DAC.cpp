@@ -16,8 +16,9 @@ DAC::DAC()                                                  // Constructor - No
 DAC::~DAC()                                                 // Destructor - No code
 {}
 
-void DAC::setup()                                           // Set up the DAC
+void DAC::setup(uint8_t csPin)                              // Set up the DAC
 {
+    m_cs = csPin;
     initializeDAC();                                        
 }
 
@@ -26,13 +27,22 @@ void DAC::loop()                                            // loop function for
 
 // Set up the DAC
 void DAC::initializeDAC() {
-    pinMode(CS, OUTPUT);                                    // Set the CS pin for DAC to output (DAC uses SPI so it needs a chip select pin)
-    digitalWrite(CS, HIGH);                                 // Set CS pin high 
+    pinMode(m_cs, OUTPUT);                                  // Set the CS pin for DAC to output (DAC uses SPI so it needs a chip select pin)
+    digitalWrite(m_cs, HIGH);                               // Set CS pin high 
+    residual = 0;                                           // Nothing carried over for the dither stage yet
+    dat = 0;
+    hold = 0;
+    lastSign = 0;
     //SPI.setBitOrder(MSBFIRST);                            // Alternative LSBFIRST  - Data sheet indicates to clock in the Four config bit first followed by data bits - meaning MSBFIRST is the operation 
 }
 
 // Transfer output voltage to DAC A and DAC B for Motor Control
 void DAC::transferDAC(int data) {
+    data = constrain(data, -DAC_MAX, DAC_MAX);                  // Never let the data bits spill into the control bits
+    dat = data;
+    if (data != 0) {
+        lastSign = (data > 0) ? 1 : -1;
+    }
     buffA = ctrA << 12;                                         // Reset buffer values to clear data bits - Reminder: buff = 1011 0000 0000 0000 (upper 4 bits are control bits - shift to the left)
     buffB = ctrB << 12;                                         // Reset buffer values to clear data bits
 
@@ -57,14 +67,64 @@ void DAC::transferDAC(int data) {
 
     // Note: LDAC (latch DAC input) - the LDAC pin is connected to LOW (ground) so that Vout A and Vout B are updated at the same time (This PIN is not connected on the current board so we actually do this one at a time)
     // Set registers for DAC A
-    digitalWrite(CS, LOW);                                      // Transfer new values to register (by setting the CS pin LOW)
+    digitalWrite(m_cs, LOW);                                    // Transfer new values to register (by setting the CS pin LOW)
     SPI.transfer(highByte(buffA));                              // Set the first byte (high bits)
     SPI.transfer(lowByte(buffA));                               // Set the last byte (low bits)
-    digitalWrite(CS, HIGH);                                     // Stop data transfer and output voltage value set in register
+    digitalWrite(m_cs, HIGH);                                   // Stop data transfer and output voltage value set in register
 
     // Set registers for DAC B
-    digitalWrite(CS, LOW);                                      // Transfer new values to register (by setting the CS pin LOW)
+    digitalWrite(m_cs, LOW);                                    // Transfer new values to register (by setting the CS pin LOW)
     SPI.transfer(highByte(buffB));                              // Set the first byte (high bits)
     SPI.transfer(lowByte(buffB));                               // Set the last byte (low bits)
-    digitalWrite(CS, HIGH);                                     // Stop data transfer and output voltage value set in register
+    digitalWrite(m_cs, HIGH);                                   // Stop data transfer and output voltage value set in register
+}
+
+// First order sigma-delta: send the nearest code to (command + carried error) and carry the rounding error to the next call.
+// Called once per control tick, the codes sent average out to the fractional command.
+void DAC::transferDACDithered(float data) {
+    float target;
+    int code;
+
+    if (data == 0 || (data > 0 && dat < 0) || (data < 0 && dat > 0)) {
+        residual = 0;                                           // Stop exactly on a zero command and don't carry error through a reversal
+    }
+    target = data + residual;
+    code = (target >= 0) ? (int)(target + 0.5) : -(int)(-target + 0.5);
+    code = constrain(code, -DAC_MAX, DAC_MAX);
+    residual = target - code;
+
+    transferDAC(code);
+}
+
+// Called once per control tick before the transfer. A command that grows is limited to DAC_SLEW_UP/DAC_SLEW_DOWN codes per tick,
+// one that shrinks to DAC_SLEW_RELEASE. A command of the other sign first brings the output to zero and holds it there for
+// DAC_REVERSAL_TICKS so the drive never steps straight from one direction to the other. A start in the direction of the last
+// non-zero code (the next trip after a stop at a floor) is not held.
+float DAC::limit(float command) {
+    float step;
+
+    command = constrain(command, -DAC_MAX, DAC_MAX);
+    if ((command > 0 && dat < 0) || (command < 0 && dat > 0)) {
+        command = 0;                                            // Reversal: brake to zero first
+    }
+    if (dat == 0 && hold > 0) {
+        if (command * lastSign > 0) {
+            hold = 0;                                           // Same direction as before the stop - not a reversal
+        }
+        else {
+            hold--;
+            return 0;
+        }
+    }
+    if (fabs(command) > abs(dat)) {
+        step = (command > 0) ? DAC_SLEW_DOWN : DAC_SLEW_UP;
+    }
+    else {
+        step = DAC_SLEW_RELEASE;
+    }
+    command = constrain(command, dat - step, dat + step);
+    if (command == 0 && dat != 0) {
+        hold = DAC_REVERSAL_TICKS;
+    }
+    return command;
 }
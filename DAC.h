@@ -14,24 +14,37 @@
 #include <SPI.h>                            /* SPI protocol functions */
 
 // DAC
-#define CS 10                               // pin 10 is used as SPI CS pin for DAC 
+#define CS 10                               // pin 10 is used as SPI CS pin for DAC (default - each car on the board has its own DAC chip select, see CAR_TABLE)
 #define ctrA 0x0003                         // Control bits are '0011'  - Control bits for selecting DAC A (see spec sheet for MCP4912-E/P-ND) 
 #define ctrB 0x000B                         // Control bits are '1011'  - Control bits for selecting DAC B (see spec sheet for MCP4912-E/P-ND)
+#define DAC_MAX 1023                        // 10-bit data field - largest code either way (anything larger spills into the control bits)
+
+// Output stage (DAC::limit(), enabled with DAC_SLEW_LIMIT) - rates are in codes per control tick (CONTROL_PERIOD_MS)
+#define DAC_SLEW_UP 150                     // Growth of a negative (car up) command - the motor lifts the load
+#define DAC_SLEW_DOWN 100                   // Growth of a positive (car down) command - gravity helps, so gentler
+#define DAC_SLEW_RELEASE 300                // Shrinking towards zero (braking), either direction
+#define DAC_REVERSAL_TICKS 1                // Ticks held at zero before the command may change sign
 
 class DAC {
 public:
 	DAC();									// Contructor
 	~DAC();									// Destructor
-	void setup();
+	void setup(uint8_t csPin = CS);
 	void loop();
 	void initializeDAC();					 // Set up DAC
 	void transferDAC(int data);				 // Transfer output voltage to DAC A and DAC B for Motor Control
+	void transferDACDithered(float data);	 // Transfer a fractional command - alternates adjacent codes so the average output has sub-LSB resolution
+	float limit(float command);              // Output stage: saturate to +-DAC_MAX, slew limit from the last code and reverse only through zero
 
 private:
 	// DAC variables
+	uint8_t m_cs;                            // SPI chip select pin of this DAC
 	int buffA;                               // Transmit buffer for DAC A
 	int buffB;                               // Transmit buffer for DAC B
 	int dat;                                 // Data - value of output voltage 
+	float residual;                          // Dither: part of the command not yet sent to the DAC (always within +-0.5 code)
+	uint8_t hold;                            // Output stage: ticks left at zero before a reversal
+	int8_t lastSign;                         // Sign of the last non-zero code sent (0 before the first)
 
 };
 
@@ -13,7 +13,96 @@
  */
 
 #include "DFRobot_VL53L0X.h"
-VL53L0X_DetailedData_t DetailedData;
+
+// Register scripts (see runScript())
+static const uint8_t DATAINIT_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(0x88, 0x00),
+	VL53L0X_WR(0x80, 0x01),
+	VL53L0X_WR(0xFF, 0x01),
+	VL53L0X_WR(0x00, 0x00),
+	VL53L0X_RD_STOP(0x91),
+	VL53L0X_WR(0x00, 0x01),
+	VL53L0X_WR(0xFF, 0x00),
+	VL53L0X_WR(0x80, 0x00),
+	VL53L0X_SCRIPT_END
+};
+
+/* DefaultTuningSettings from ST's vl53l0x_tuning.h */
+static const uint8_t TUNING_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x00, 0x00),
+	VL53L0X_WR(0xFF, 0x00), VL53L0X_WR(0x09, 0x00), VL53L0X_WR(0x10, 0x00), VL53L0X_WR(0x11, 0x00),
+	VL53L0X_WR(0x24, 0x01), VL53L0X_WR(0x25, 0xFF), VL53L0X_WR(0x75, 0x00),
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x4E, 0x2C), VL53L0X_WR(0x48, 0x00), VL53L0X_WR(0x30, 0x20),
+	VL53L0X_WR(0xFF, 0x00), VL53L0X_WR(0x30, 0x09), VL53L0X_WR(0x54, 0x00), VL53L0X_WR(0x31, 0x04),
+	VL53L0X_WR(0x32, 0x03), VL53L0X_WR(0x40, 0x83), VL53L0X_WR(0x46, 0x25), VL53L0X_WR(0x60, 0x00),
+	VL53L0X_WR(0x27, 0x00), VL53L0X_WR(0x50, 0x06), VL53L0X_WR(0x51, 0x00), VL53L0X_WR(0x52, 0x96),
+	VL53L0X_WR(0x56, 0x08), VL53L0X_WR(0x57, 0x30), VL53L0X_WR(0x61, 0x00), VL53L0X_WR(0x62, 0x00),
+	VL53L0X_WR(0x64, 0x00), VL53L0X_WR(0x65, 0x00), VL53L0X_WR(0x66, 0xA0),
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x22, 0x32), VL53L0X_WR(0x47, 0x14), VL53L0X_WR(0x49, 0xFF),
+	VL53L0X_WR(0x4A, 0x00),
+	VL53L0X_WR(0xFF, 0x00), VL53L0X_WR(0x7A, 0x0A), VL53L0X_WR(0x7B, 0x00), VL53L0X_WR(0x78, 0x21),
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x23, 0x34), VL53L0X_WR(0x42, 0x00), VL53L0X_WR(0x44, 0xFF),
+	VL53L0X_WR(0x45, 0x26), VL53L0X_WR(0x46, 0x05), VL53L0X_WR(0x40, 0x40), VL53L0X_WR(0x0E, 0x06),
+	VL53L0X_WR(0x20, 0x1A), VL53L0X_WR(0x43, 0x40),
+	VL53L0X_WR(0xFF, 0x00), VL53L0X_WR(0x34, 0x03), VL53L0X_WR(0x35, 0x44),
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x31, 0x04), VL53L0X_WR(0x4B, 0x09), VL53L0X_WR(0x4C, 0x05),
+	VL53L0X_WR(0x4D, 0x04),
+	VL53L0X_WR(0xFF, 0x00), VL53L0X_WR(0x44, 0x00), VL53L0X_WR(0x45, 0x20), VL53L0X_WR(0x47, 0x08),
+	VL53L0X_WR(0x48, 0x28), VL53L0X_WR(0x67, 0x00), VL53L0X_WR(0x70, 0x04), VL53L0X_WR(0x71, 0x01),
+	VL53L0X_WR(0x72, 0xFE), VL53L0X_WR(0x76, 0x00), VL53L0X_WR(0x77, 0x00),
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x0D, 0x01),
+	VL53L0X_WR(0xFF, 0x00), VL53L0X_WR(0x80, 0x01), VL53L0X_WR(0x01, 0xF8),
+	VL53L0X_WR(0xFF, 0x01), VL53L0X_WR(0x8E, 0x01), VL53L0X_WR(0x00, 0x01), VL53L0X_WR(0xFF, 0x00),
+	VL53L0X_WR(0x80, 0x00),
+	VL53L0X_SCRIPT_END
+};
+
+/* Enter/leave the page used to read the SPAD info from NVM (see getSpadInfo()) */
+static const uint8_t SPADINFO_ENTER_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(0x80, 0x01),
+	VL53L0X_WR(0xFF, 0x01),
+	VL53L0X_WR(0x00, 0x00),
+	VL53L0X_WR(0xFF, 0x06),
+	VL53L0X_SCRIPT_END
+};
+
+static const uint8_t SPADINFO_STROBE_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(0xFF, 0x07),
+	VL53L0X_WR(0x81, 0x01),
+	VL53L0X_WR(0x80, 0x01),
+	VL53L0X_WR(0x94, 0x6b),
+	VL53L0X_WR(0x83, 0x00),
+	VL53L0X_SCRIPT_END
+};
+
+static const uint8_t SPADINFO_LEAVE_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(0xFF, 0x01),
+	VL53L0X_WR(0x00, 0x01),
+	VL53L0X_WR(0xFF, 0x00),
+	VL53L0X_WR(0x80, 0x00),
+	VL53L0X_SCRIPT_END
+};
+
+static const uint8_t START_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(0x80, 0x01),
+	VL53L0X_WR(0xFF, 0x01),
+	VL53L0X_WR(0x00, 0x00),
+	VL53L0X_WR_STOP(0x91),
+	VL53L0X_WR(0x00, 0x01),
+	VL53L0X_WR(0xFF, 0x00),
+	VL53L0X_WR(0x80, 0x00),
+	VL53L0X_SCRIPT_END
+};
+
+static const uint8_t STOP_SCRIPT[] PROGMEM = {
+	VL53L0X_WR(VL53L0X_REG_SYSRANGE_START, VL53L0X_REG_SYSRANGE_MODE_SINGLESHOT),
+	VL53L0X_WR(0xFF, 0x01),
+	VL53L0X_WR(0x00, 0x00),
+	VL53L0X_WR(0x91, 0x00),
+	VL53L0X_WR(0x00, 0x01),
+	VL53L0X_WR(0xFF, 0x00),
+	VL53L0X_SCRIPT_END
+};
 
 
 DFRobotVL53L0X::DFRobotVL53L0X()
@@ -23,12 +112,22 @@ DFRobotVL53L0X::~DFRobotVL53L0X()
 {}
 
 
-void DFRobotVL53L0X::begin(uint8_t i2c_addr=0x29){
+/* false if no VL53L0X answers on the power up address or its SPAD info or reference calibration does not complete */
+bool DFRobotVL53L0X::begin(uint8_t i2c_addr=0x29){
   uint8_t val1;
+  bool ok;
   delay(1500);
   DetailedData.I2cDevAddr = I2C_DevAddr; 
+  _stopVariable = 0x3c;
+  if (readByteData(VL53L0X_REG_IDENTIFICATION_MODEL_ID) != VL53L0X_MODEL_ID) {
+    return false;                          // Nothing (or something else) there - a missing device reads 0xFF
+  }
   DataInit(); 
   setDeviceAddress(i2c_addr);
+  ok = StaticInit() && PerformRefCalibration();
+  if (!ok) {
+    Serial.println("VL53L0X reference init failed");
+  }
   val1 = readByteData(VL53L0X_REG_IDENTIFICATION_REVISION_ID);
   Serial.println("");
   Serial.print("Revision ID: "); Serial.println(val1,HEX);
@@ -36,7 +135,7 @@ void DFRobotVL53L0X::begin(uint8_t i2c_addr=0x29){
   val1 = readByteData(VL53L0X_REG_IDENTIFICATION_MODEL_ID);
   Serial.print("Device ID: "); Serial.println(val1,HEX);	
   Serial.println("");
-	
+  return ok;
 }
 
 void DFRobotVL53L0X::DataInit(){
@@ -46,24 +145,161 @@ void DFRobotVL53L0X::DataInit(){
 	data = (data & 0xFE) | 0x01;
 	writeByteData(VL53L0X_REG_VHV_CONFIG_PAD_SCL_SDA__EXTSUP_HV, data);
 #endif
-	writeByteData(0x88, 0x00);
-	writeByteData(0x80, 0x01);
+	runScript(DATAINIT_SCRIPT);
+
+	/* disable SIGNAL_RATE_MSRC (bit 1) and SIGNAL_RATE_PRE_RANGE (bit 4) limit checks */
+	writeByteData(VL53L0X_REG_MSRC_CONFIG_CONTROL, readByteData(VL53L0X_REG_MSRC_CONFIG_CONTROL) | 0x12);
+	setSignalRateLimit(0.25);
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, 0xFF);
+}
+
+/* Reference SPADs, tuning settings, interrupt config and timing budget - VL53L0X_StaticInit() in ST's API */
+bool DFRobotVL53L0X::StaticInit(){
+	uint8_t spadCount;
+	bool spadTypeIsAperture;
+	uint8_t refSpadMap[6];
+	uint8_t firstSpadToEnable, spadsEnabled = 0;
+
+	if(!getSpadInfo(&spadCount, &spadTypeIsAperture)){
+		return false;
+	}
+
+	/* set_reference_spads: enable spadCount good SPADs of the right type, starting at the first aperture SPAD (12) if needed */
+	readData(VL53L0X_REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0, 6);
+	memcpy(refSpadMap, DetailedData.originalData, 6);
 	writeByteData(0xFF, 0x01);
-	writeByteData(0x00, 0x00);
-	readByteData(0x91);
-	writeByteData(0x91, 0x3c);
-	writeByteData(0x00, 0x01);
+	writeByteData(VL53L0X_REG_DYNAMIC_SPAD_REF_EN_START_OFFSET, 0x00);
+	writeByteData(VL53L0X_REG_DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD, 0x2C);
 	writeByteData(0xFF, 0x00);
-	writeByteData(0x80, 0x00);
+	writeByteData(VL53L0X_REG_GLOBAL_CONFIG_REF_EN_START_SELECT, 0xB4);
+	firstSpadToEnable = spadTypeIsAperture ? 12 : 0;
+	for(uint8_t i=0;i<48;i++){
+		if(i < firstSpadToEnable || spadsEnabled == spadCount){
+			refSpadMap[i / 8] &= ~(1 << (i % 8));
+		}
+		else if((refSpadMap[i / 8] >> (i % 8)) & 0x1){
+			spadsEnabled++;
+		}
+	}
+	writeData(VL53L0X_REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0, refSpadMap, 6);
+
+	runScript(TUNING_SCRIPT);
+
+	/* interrupt on new sample ready, active low */
+	writeByteData(VL53L0X_REG_SYSTEM_INTERRUPT_CONFIG_GPIO, 0x04);
+	writeByteData(VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH, readByteData(VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH) & ~0x10);
+	writeByteData(VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x01);
+
+	_timingBudgetUs = getMeasurementTimingBudget();
+	/* disable MSRC and TCC by default, then recalculate the timing budget for the remaining steps */
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, 0xE8);
+	return setMeasurementTimingBudget(_timingBudgetUs);
+}
+
+/* VHV then phase calibration - VL53L0X_PerformRefCalibration() in ST's API */
+bool DFRobotVL53L0X::PerformRefCalibration(){
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, 0x01);
+	if(!performSingleRefCalibration(0x40)){
+		return false;
+	}
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, 0x02);
+	if(!performSingleRefCalibration(0x00)){
+		return false;
+	}
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, 0xE8);
+	return true;
+}
+
+bool DFRobotVL53L0X::getSpadInfo(uint8_t *count, bool *typeIsAperture){
+	uint8_t tmp;
+	unsigned long start;
+
+	runScript(SPADINFO_ENTER_SCRIPT);
+	writeByteData(0x83, readByteData(0x83) | 0x04);
+	runScript(SPADINFO_STROBE_SCRIPT);
+
+	start = millis();
+	while(readByteData(0x83) == 0x00){
+		if(millis() - start > VL53L0X_IO_TIMEOUT){
+			return false;
+		}
+	}
+	writeByteData(0x83, 0x01);
+	tmp = readByteData(0x92);
+	*count = tmp & 0x7f;
+	*typeIsAperture = (tmp >> 7) & 0x01;
+
+	writeByteData(0x81, 0x00);
+	writeByteData(0xFF, 0x06);
+	writeByteData(0x83, readByteData(0x83) & ~0x04);
+	runScript(SPADINFO_LEAVE_SCRIPT);
+	return true;
+}
+
+bool DFRobotVL53L0X::performSingleRefCalibration(uint8_t vhvInitByte){
+	unsigned long start;
+
+	writeByteData(VL53L0X_REG_SYSRANGE_START, VL53L0X_REG_SYSRANGE_MODE_START_STOP | vhvInitByte);
+	start = millis();
+	while((readByteData(VL53L0X_REG_RESULT_INTERRUPT_STATUS) & 0x07) == 0){
+		if(millis() - start > VL53L0X_IO_TIMEOUT){
+			return false;
+		}
+	}
+	writeByteData(VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x01);
+	writeByteData(VL53L0X_REG_SYSRANGE_START, 0x00);
+	return true;
+}
+
+/* Execute a PROGMEM register script. Writes to consecutive registers are merged into one auto-increment
+   transaction; a run never crosses the 0xFF page select register since it changes what the following indexes mean. */
+void DFRobotVL53L0X::runScript(const uint8_t *script){
+	uint8_t buf[VL53L0X_SCRIPT_MAX_RUN];
+	uint8_t start = 0;
+	uint8_t len = 0;
+	uint8_t count, reg;
+
+	while(1){
+		count = pgm_read_byte(script++);
+		if(count == VL53L0X_SCRIPT_END){
+			break;
+		}
+		reg = pgm_read_byte(script++);
+		if(count == VL53L0X_SCRIPT_READ_STOP || count == VL53L0X_SCRIPT_WRITE_STOP){
+			if(len) writeData(start, buf, len);
+			len = 0;
+			if(count == VL53L0X_SCRIPT_READ_STOP){
+				_stopVariable = readByteData(reg);
+			}
+			else{
+				writeByteData(reg, _stopVariable);
+			}
+			continue;
+		}
+		if(len && (reg != (uint8_t)(start + len) || reg == 0xFF || start == 0xFF || len + count > VL53L0X_SCRIPT_MAX_RUN)){
+			writeData(start, buf, len);
+			len = 0;
+		}
+		if(len == 0){
+			start = reg;
+		}
+		while(count--){
+			buf[len++] = pgm_read_byte(script++);
+		}
+	}
+	if(len) writeData(start, buf, len);
 }
 
 
 void DFRobotVL53L0X::writeData(unsigned char Reg ,unsigned char *buf, 
 	unsigned char Num){
-   for(unsigned char i=0;i<Num;i++)
-   {
-	   writeByteData(Reg++, buf[i]);
-   }
+	Wire.beginTransmission(DetailedData.I2cDevAddr);
+	Wire.write(Reg);              // index auto-increments after each data byte
+	for(unsigned char i=0;i<Num;i++)
+	{
+		Wire.write((uint8_t)buf[i]);
+	}
+	Wire.endTransmission();
 }
 
 void DFRobotVL53L0X::writeByteData(unsigned char Reg, unsigned char byte){
@@ -82,12 +318,27 @@ void DFRobotVL53L0X::readData(unsigned char Reg, unsigned char Num){
 
 	for(int i=0;i<Num;i++)
 	{
-		DetailedData.originalData[i] = Wire.read();
-		delay(1);
+		DetailedData.originalData[i] = Wire.read();   // requestFrom() has already buffered all Num bytes
 	}
 }
 
 
+void DFRobotVL53L0X::writeWordData(unsigned char Reg, uint16_t word){
+	uint8_t buf[2] = { (uint8_t)(word >> 8), (uint8_t)(word & 0xFF) };
+	writeData(Reg, buf, 2);
+}
+
+uint16_t DFRobotVL53L0X::readWordData(unsigned char Reg){
+	uint16_t data;
+	Wire.beginTransmission(DetailedData.I2cDevAddr);
+	Wire.write((uint8_t)Reg);
+	Wire.endTransmission();
+	Wire.requestFrom((uint8_t)DetailedData.I2cDevAddr, (uint8_t)2);
+	data = (uint16_t)Wire.read() << 8;
+	data |= Wire.read();
+	return data;
+}
+
 uint8_t DFRobotVL53L0X::readByteData(unsigned char Reg){
 	uint8_t data;
 	Wire.beginTransmission(DetailedData.I2cDevAddr); // transmit to device #8
@@ -106,13 +357,7 @@ void DFRobotVL53L0X::start(){
 	
 	DeviceMode = DetailedData.mode;
 	
-	writeByteData(0x80, 0x01);
-	writeByteData(0xFF, 0x01);
-	writeByteData(0x00, 0x00);
-	writeByteData(0x91, 0x3c);
-	writeByteData(0x00, 0x01);
-	writeByteData(0xFF, 0x00);
-	writeByteData(0x80, 0x00);
+	runScript(START_SCRIPT);
 	
 	switch(DeviceMode){
 		case VL53L0X_DEVICEMODE_SINGLE_RANGING:
@@ -140,6 +385,8 @@ void DFRobotVL53L0X::start(){
 
 void DFRobotVL53L0X::readVL53L0X(){
 	readData(VL53L0X_REG_RESULT_RANGE_STATUS, 12);
+	DetailedData.spadCount = ((DetailedData.originalData[2] & 0xFF) << 8) | 
+									(DetailedData.originalData[3] & 0xFF);
 	DetailedData.ambientCount = ((DetailedData.originalData[6] & 0xFF) << 8) | 
 									(DetailedData.originalData[7] & 0xFF);
 	DetailedData.signalCount = ((DetailedData.originalData[8] & 0xFF) << 8) | 
@@ -176,13 +423,7 @@ void DFRobotVL53L0X::setMode(ModeState mode, PrecisionState precision){
 
 
 void DFRobotVL53L0X::stop(){
-	writeByteData(VL53L0X_REG_SYSRANGE_START, VL53L0X_REG_SYSRANGE_MODE_SINGLESHOT);
-	
-	writeByteData(0xFF, 0x01);
-	writeByteData(0x00, 0x00);
-	writeByteData(0x91, 0x00);
-	writeByteData(0x00, 0x01);
-	writeByteData(0xFF, 0x00);
+	runScript(STOP_SCRIPT);
 }
 
 float DFRobotVL53L0X::getDistance(){
@@ -212,3 +453,226 @@ uint8_t DFRobotVL53L0X::getStatus(){
 	return DetailedData.status;
 }
 
+const VL53L0X_DetailedData_t &DFRobotVL53L0X::readResult(){
+	readVL53L0X();
+	return DetailedData;
+}
+
+bool DFRobotVL53L0X::isDataReady(){
+	return (readByteData(VL53L0X_REG_RESULT_INTERRUPT_STATUS) & 0x07) != 0;
+}
+
+void DFRobotVL53L0X::clearInterrupt(){
+	writeByteData(VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x01);
+	writeByteData(VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x00);
+}
+
+/* Timing helpers (from ST's API). Timeouts are in macro periods (MCLKs), whose length depends on the VCSEL period. */
+static uint32_t calcMacroPeriod(uint8_t vcselPeriodPclks){
+	return (((uint32_t)2304 * vcselPeriodPclks * 1655) + 500) / 1000;                    // in ns
+}
+
+static uint16_t decodeTimeout(uint16_t regVal){
+	return (uint16_t)((regVal & 0x00FF) << (uint16_t)((regVal & 0xFF00) >> 8)) + 1;   // LSByte * 2^MSByte + 1
+}
+
+static uint16_t encodeTimeout(uint32_t timeoutMclks){
+	uint32_t lsByte;
+	uint16_t msByte = 0;
+
+	if(timeoutMclks == 0){
+		return 0;
+	}
+	lsByte = timeoutMclks - 1;
+	while((lsByte & 0xFFFFFF00) > 0){
+		lsByte >>= 1;
+		msByte++;
+	}
+	return (msByte << 8) | (lsByte & 0xFF);
+}
+
+static uint32_t timeoutMclksToMicroseconds(uint16_t timeoutMclks, uint8_t vcselPeriodPclks){
+	uint32_t macroPeriodNs = calcMacroPeriod(vcselPeriodPclks);
+	return ((timeoutMclks * macroPeriodNs) + 500) / 1000;
+}
+
+static uint32_t timeoutMicrosecondsToMclks(uint32_t timeoutUs, uint8_t vcselPeriodPclks){
+	uint32_t macroPeriodNs = calcMacroPeriod(vcselPeriodPclks);
+	return ((timeoutUs * 1000) + (macroPeriodNs / 2)) / macroPeriodNs;
+}
+
+/* Return limit for the final range signal rate in MCPS - lower values range further but accept noisier returns */
+bool DFRobotVL53L0X::setSignalRateLimit(float limitMcps){
+	if(limitMcps < 0 || limitMcps > 511.99){
+		return false;
+	}
+	writeWordData(VL53L0X_REG_FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT, limitMcps * (1 << 7));    // Q9.7 fixed point
+	return true;
+}
+
+void DFRobotVL53L0X::getSequenceStepEnables(SequenceStepEnables *enables){
+	uint8_t sequenceConfig = readByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG);
+
+	enables->tcc = (sequenceConfig >> 4) & 0x1;
+	enables->dss = (sequenceConfig >> 3) & 0x1;
+	enables->msrc = (sequenceConfig >> 2) & 0x1;
+	enables->preRange = (sequenceConfig >> 6) & 0x1;
+	enables->finalRange = (sequenceConfig >> 7) & 0x1;
+}
+
+void DFRobotVL53L0X::getSequenceStepTimeouts(const SequenceStepEnables *enables, SequenceStepTimeouts *timeouts){
+	timeouts->preRangeVcselPclks = getVcselPulsePeriod(VcselPeriodPreRange);
+	timeouts->msrcDssTccMclks = readByteData(VL53L0X_REG_MSRC_CONFIG_TIMEOUT_MACROP) + 1;
+	timeouts->msrcDssTccUs = timeoutMclksToMicroseconds(timeouts->msrcDssTccMclks, timeouts->preRangeVcselPclks);
+	timeouts->preRangeMclks = decodeTimeout(readWordData(VL53L0X_REG_PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI));
+	timeouts->preRangeUs = timeoutMclksToMicroseconds(timeouts->preRangeMclks, timeouts->preRangeVcselPclks);
+
+	timeouts->finalRangeVcselPclks = getVcselPulsePeriod(VcselPeriodFinalRange);
+	timeouts->finalRangeMclks = decodeTimeout(readWordData(VL53L0X_REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI));
+	if(enables->preRange){
+		timeouts->finalRangeMclks -= timeouts->preRangeMclks;                    // final range timeout includes the pre-range
+	}
+	timeouts->finalRangeUs = timeoutMclksToMicroseconds(timeouts->finalRangeMclks, timeouts->finalRangeVcselPclks);
+}
+
+/* Time allowed for one measurement. Only the final range step is resized; the fixed overheads of the other enabled steps are subtracted first */
+bool DFRobotVL53L0X::setMeasurementTimingBudget(uint32_t budgetUs){
+	SequenceStepEnables enables;
+	SequenceStepTimeouts timeouts;
+	uint32_t usedBudgetUs = 1320 + 960;                        // start + end overhead
+	uint32_t finalRangeTimeoutMclks;
+
+	if(budgetUs < VL53L0X_MIN_TIMING_BUDGET){
+		return false;
+	}
+	getSequenceStepEnables(&enables);
+	getSequenceStepTimeouts(&enables, &timeouts);
+
+	if(enables.tcc) usedBudgetUs += timeouts.msrcDssTccUs + 590;
+	if(enables.dss) usedBudgetUs += 2 * (timeouts.msrcDssTccUs + 690);
+	else if(enables.msrc) usedBudgetUs += timeouts.msrcDssTccUs + 660;
+	if(enables.preRange) usedBudgetUs += timeouts.preRangeUs + 660;
+
+	if(enables.finalRange){
+		usedBudgetUs += 550;
+		if(usedBudgetUs > budgetUs){
+			return false;                                      // requested budget is too short for the enabled steps
+		}
+		finalRangeTimeoutMclks = timeoutMicrosecondsToMclks(budgetUs - usedBudgetUs, timeouts.finalRangeVcselPclks);
+		if(enables.preRange){
+			finalRangeTimeoutMclks += timeouts.preRangeMclks;
+		}
+		writeWordData(VL53L0X_REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI, encodeTimeout(finalRangeTimeoutMclks));
+		_timingBudgetUs = budgetUs;
+	}
+	return true;
+}
+
+uint32_t DFRobotVL53L0X::getMeasurementTimingBudget(){
+	SequenceStepEnables enables;
+	SequenceStepTimeouts timeouts;
+	uint32_t budgetUs = 1910 + 960;                            // start + end overhead
+
+	getSequenceStepEnables(&enables);
+	getSequenceStepTimeouts(&enables, &timeouts);
+
+	if(enables.tcc) budgetUs += timeouts.msrcDssTccUs + 590;
+	if(enables.dss) budgetUs += 2 * (timeouts.msrcDssTccUs + 690);
+	else if(enables.msrc) budgetUs += timeouts.msrcDssTccUs + 660;
+	if(enables.preRange) budgetUs += timeouts.preRangeUs + 660;
+	if(enables.finalRange) budgetUs += timeouts.finalRangeUs + 550;
+
+	_timingBudgetUs = budgetUs;
+	return budgetUs;
+}
+
+uint8_t DFRobotVL53L0X::getVcselPulsePeriod(VcselPeriodType type){
+	uint8_t reg = (type == VcselPeriodPreRange) ? VL53L0X_REG_PRE_RANGE_CONFIG_VCSEL_PERIOD : VL53L0X_REG_FINAL_RANGE_CONFIG_VCSEL_PERIOD;
+	return (readByteData(reg) + 1) << 1;
+}
+
+/* VCSEL (laser) pulse period in PCLKs. Pre-range accepts 12-18, final range 8-14 (even values only). Longer periods range further.
+   Rescales the step timeouts to keep the timing budget and redoes the phase calibration. */
+bool DFRobotVL53L0X::setVcselPulsePeriod(VcselPeriodType type, uint8_t periodPclks){
+	SequenceStepEnables enables;
+	SequenceStepTimeouts timeouts;
+	uint8_t vcselPeriodReg = (periodPclks >> 1) - 1;
+	uint8_t sequenceConfig;
+	uint32_t newTimeoutMclks;
+
+	getSequenceStepEnables(&enables);
+	getSequenceStepTimeouts(&enables, &timeouts);
+
+	if(type == VcselPeriodPreRange){
+		switch(periodPclks){
+			case 12: writeByteData(VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x18); break;
+			case 14: writeByteData(VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x30); break;
+			case 16: writeByteData(VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x40); break;
+			case 18: writeByteData(VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x50); break;
+			default: return false;
+		}
+		writeByteData(VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_LOW, 0x08);
+		writeByteData(VL53L0X_REG_PRE_RANGE_CONFIG_VCSEL_PERIOD, vcselPeriodReg);
+
+		newTimeoutMclks = timeoutMicrosecondsToMclks(timeouts.preRangeUs, periodPclks);
+		writeWordData(VL53L0X_REG_PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI, encodeTimeout(newTimeoutMclks));
+		newTimeoutMclks = timeoutMicrosecondsToMclks(timeouts.msrcDssTccUs, periodPclks);
+		writeByteData(VL53L0X_REG_MSRC_CONFIG_TIMEOUT_MACROP, (newTimeoutMclks > 256) ? 255 : (newTimeoutMclks - 1));
+	}
+	else{
+		uint8_t phaseHigh, vcselWidth, phasecalTimeout, phasecalLim;
+		switch(periodPclks){
+			case 8:  phaseHigh = 0x10; vcselWidth = 0x02; phasecalTimeout = 0x0C; phasecalLim = 0x30; break;
+			case 10: phaseHigh = 0x28; vcselWidth = 0x03; phasecalTimeout = 0x09; phasecalLim = 0x20; break;
+			case 12: phaseHigh = 0x38; vcselWidth = 0x03; phasecalTimeout = 0x08; phasecalLim = 0x20; break;
+			case 14: phaseHigh = 0x48; vcselWidth = 0x03; phasecalTimeout = 0x07; phasecalLim = 0x20; break;
+			default: return false;
+		}
+		writeByteData(VL53L0X_REG_FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, phaseHigh);
+		writeByteData(VL53L0X_REG_FINAL_RANGE_CONFIG_VALID_PHASE_LOW, 0x08);
+		writeByteData(VL53L0X_REG_GLOBAL_CONFIG_VCSEL_WIDTH, vcselWidth);
+		writeByteData(VL53L0X_REG_ALGO_PHASECAL_CONFIG_TIMEOUT, phasecalTimeout);
+		writeByteData(0xFF, 0x01);
+		writeByteData(VL53L0X_REG_ALGO_PHASECAL_LIM, phasecalLim);
+		writeByteData(0xFF, 0x00);
+		writeByteData(VL53L0X_REG_FINAL_RANGE_CONFIG_VCSEL_PERIOD, vcselPeriodReg);
+
+		newTimeoutMclks = timeoutMicrosecondsToMclks(timeouts.finalRangeUs, periodPclks);
+		if(enables.preRange){
+			newTimeoutMclks += timeouts.preRangeMclks;
+		}
+		writeWordData(VL53L0X_REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI, encodeTimeout(newTimeoutMclks));
+	}
+
+	setMeasurementTimingBudget(_timingBudgetUs);
+
+	sequenceConfig = readByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG);
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, 0x02);
+	performSingleRefCalibration(0x00);                        // phase calibration depends on the VCSEL period
+	writeByteData(VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG, sequenceConfig);
+	return true;
+}
+
+/* Ranging profiles from ST's application notes. Each one sets every parameter so profiles can be switched at any time.
+   ProfileHighSpeed: 20 ms per measurement. ProfileLongRange: lower signal limit and longer VCSEL pulses (~2 m, 33 ms).
+   ProfileHighAccuracy: 200 ms per measurement. ProfileDefault: ST defaults (33 ms). */
+bool DFRobotVL53L0X::setProfile(RangingProfile profile){
+	bool ok = true;
+
+	switch(profile){
+		case ProfileLongRange:
+			ok &= setSignalRateLimit(0.1);
+			ok &= setVcselPulsePeriod(VcselPeriodPreRange, 18);
+			ok &= setVcselPulsePeriod(VcselPeriodFinalRange, 14);
+			ok &= setMeasurementTimingBudget(VL53L0X_DEFAULT_BUDGET);
+			break;
+		default:
+			ok &= setSignalRateLimit(0.25);
+			ok &= setVcselPulsePeriod(VcselPeriodPreRange, 14);
+			ok &= setVcselPulsePeriod(VcselPeriodFinalRange, 10);
+			ok &= setMeasurementTimingBudget(profile == ProfileHighSpeed ? VL53L0X_HIGH_SPEED_BUDGET :
+			                                 profile == ProfileHighAccuracy ? VL53L0X_HIGH_ACCURACY_BUDGET : VL53L0X_DEFAULT_BUDGET);
+			break;
+	}
+	return ok;
+}
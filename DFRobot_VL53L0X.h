@@ -25,6 +25,7 @@
 #define VL53L0X_REG_SYSRANGE_START                 		    0x0000
 #define VL53L0X_REG_RESULT_INTERRUPT_STATUS        		    0x0013
 #define VL53L0X_REG_RESULT_RANGE_STATUS            		    0x0014
+#define VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR          		0x000b
 #define VL53L0X_REG_I2C_SLAVE_DEVICE_ADDRESS        		0x008a
 #define VL53L0X_I2C_ADDR									0x0029
 #define VL53L0X_REG_SYSTEM_RANGE_CONFIG			            0x0009
@@ -33,11 +34,49 @@
 #define VL53L0X_REG_SYSRANGE_MODE_START_STOP                0x0001
 #define VL53L0X_REG_SYSRANGE_MODE_BACKTOBACK                0x0002
 #define VL53L0X_REG_SYSRANGE_MODE_TIMED                     0x0004
+#define VL53L0X_REG_SYSTEM_SEQUENCE_CONFIG                  0x0001
+#define VL53L0X_REG_SYSTEM_INTERRUPT_CONFIG_GPIO            0x000a
+#define VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH                 0x0084
+#define VL53L0X_REG_MSRC_CONFIG_CONTROL                     0x0060
+#define VL53L0X_REG_MSRC_CONFIG_TIMEOUT_MACROP              0x0046
+#define VL53L0X_REG_FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT 0x0044
+#define VL53L0X_REG_PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI      0x0051
+#define VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_LOW        0x0056
+#define VL53L0X_REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH       0x0057
+#define VL53L0X_REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI    0x0071
+#define VL53L0X_REG_FINAL_RANGE_CONFIG_VALID_PHASE_LOW      0x0047
+#define VL53L0X_REG_FINAL_RANGE_CONFIG_VALID_PHASE_HIGH     0x0048
+#define VL53L0X_REG_GLOBAL_CONFIG_VCSEL_WIDTH               0x0032
+#define VL53L0X_REG_ALGO_PHASECAL_CONFIG_TIMEOUT            0x0030
+#define VL53L0X_REG_ALGO_PHASECAL_LIM                       0x0030      // on register page 1
+#define VL53L0X_REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0        0x00b0
+#define VL53L0X_REG_GLOBAL_CONFIG_REF_EN_START_SELECT       0x00b6
+#define VL53L0X_REG_DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD     0x004e
+#define VL53L0X_REG_DYNAMIC_SPAD_REF_EN_START_OFFSET        0x004f
 
 #define VL53L0X_DEVICEMODE_SINGLE_RANGING	               ((uint8_t)  0)
 #define VL53L0X_DEVICEMODE_CONTINUOUS_RANGING	           ((uint8_t)  1)
 #define VL53L0X_DEVICEMODE_CONTINUOUS_TIMED_RANGING        ((uint8_t)  3)
 #define VL53L0X_DEFAULT_MAX_LOOP  200
+#define VL53L0X_IO_TIMEOUT        500        // ms to wait for SPAD info / reference calibration before giving up
+#define VL53L0X_MODEL_ID          0xEE       // IDENTIFICATION_MODEL_ID - checked by begin()
+#define VL53L0X_MIN_TIMING_BUDGET 20000      // us
+
+// Ranging profiles (see setProfile())
+#define VL53L0X_HIGH_SPEED_BUDGET     20000  // us
+#define VL53L0X_DEFAULT_BUDGET        33000  // us
+#define VL53L0X_HIGH_ACCURACY_BUDGET  200000 // us
+
+// Register scripts (kept in PROGMEM, executed by runScript()). Records are [count, reg, data...] writing count bytes from reg upwards,
+// [VL53L0X_SCRIPT_READ_STOP, reg] reading the stop variable, [VL53L0X_SCRIPT_WRITE_STOP, reg] writing it back, and VL53L0X_SCRIPT_END.
+// Consecutive-register writes are sent as one auto-increment transaction.
+#define VL53L0X_SCRIPT_END                  0x00
+#define VL53L0X_SCRIPT_READ_STOP            0x80
+#define VL53L0X_SCRIPT_WRITE_STOP           0x81
+#define VL53L0X_SCRIPT_MAX_RUN              16      // Longest coalesced write (Wire buffer is 32 bytes)
+#define VL53L0X_WR(reg, val)                1, (reg), (val)
+#define VL53L0X_RD_STOP(reg)                VL53L0X_SCRIPT_READ_STOP, (reg)
+#define VL53L0X_WR_STOP(reg)                VL53L0X_SCRIPT_WRITE_STOP, (reg)
 
 #define ESD_2V8
 #define I2C_DevAddr 0x29
@@ -45,6 +84,8 @@
 typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
 typedef enum {High = 0, Low = !High} PrecisionState;
 typedef enum {Single = 0, Continuous = !Single} ModeState;
+typedef enum {VcselPeriodPreRange = 0, VcselPeriodFinalRange} VcselPeriodType;
+typedef enum {ProfileDefault = 0, ProfileHighSpeed, ProfileLongRange, ProfileHighAccuracy} RangingProfile;
 typedef struct {
 	unsigned char I2cDevAddr;
 	uint8_t mode;
@@ -52,10 +93,10 @@ typedef struct {
 	unsigned char originalData[16];
 	uint16_t ambientCount;//Environment quantity
 	uint16_t signalCount;//A semaphore
+	uint16_t spadCount;                    // Effective SPAD return count (8.8 fixed point) - scales the crosstalk correction
 	uint16_t distance; 
 	uint8_t status;
 }VL53L0X_DetailedData_t;
-extern VL53L0X_DetailedData_t DetailedData;
 
 
 class DFRobotVL53L0X
@@ -63,23 +104,54 @@ class DFRobotVL53L0X
 	public:
 		DFRobotVL53L0X();
 		~DFRobotVL53L0X();
-		void begin(uint8_t i2c_addr);	
+		bool begin(uint8_t i2c_addr);	
 		void setMode(ModeState mode, PrecisionState precision);
+		bool setProfile(RangingProfile profile);
+		bool setSignalRateLimit(float limitMcps);
+		bool setMeasurementTimingBudget(uint32_t budgetUs);
+		uint32_t getMeasurementTimingBudget();
+		uint32_t timingBudget() { return _timingBudgetUs; }   // As last set or read, without the register reads
+		bool setVcselPulsePeriod(VcselPeriodType type, uint8_t periodPclks);
+		uint8_t getVcselPulsePeriod(VcselPeriodType type);
 		void start();
 		void stop();
 		float getDistance();
 		uint16_t getAmbientCount();
 		uint16_t getSignalCount();
 		uint8_t getStatus();	
+		const VL53L0X_DetailedData_t &readResult();   // One result read (status, rates and distance together)
+		bool isDataReady();
+		void clearInterrupt();
 	private:
+		typedef struct {
+			bool tcc, msrc, dss, preRange, finalRange;
+		} SequenceStepEnables;
+		typedef struct {
+			uint8_t preRangeVcselPclks, finalRangeVcselPclks;
+			uint16_t msrcDssTccMclks, preRangeMclks, finalRangeMclks;
+			uint32_t msrcDssTccUs, preRangeUs, finalRangeUs;
+		} SequenceStepTimeouts;
+
+		VL53L0X_DetailedData_t DetailedData;   // Per device (address and last result) so several sensors can share the bus
 		uint16_t _distance;
+		uint8_t _stopVariable;                 // read from 0x91 in DataInit(), written back before every measurement
+		uint32_t _timingBudgetUs;
 		void writeByteData(unsigned char Reg, unsigned char byte);	
 		uint8_t readByteData(unsigned char Reg);
 		void writeData(unsigned char Reg ,unsigned char *buf, unsigned char Num);
+		void runScript(const uint8_t *script);
 		void readData(unsigned char Reg, unsigned char Num);
 		void setDeviceAddress(uint8_t newAddr);
 		void highPrecisionEnable(FunctionalState NewState);
 		void DataInit();
+		bool StaticInit();
+		bool PerformRefCalibration();
+		bool getSpadInfo(uint8_t *count, bool *typeIsAperture);
+		bool performSingleRefCalibration(uint8_t vhvInitByte);
+		void getSequenceStepEnables(SequenceStepEnables *enables);
+		void getSequenceStepTimeouts(const SequenceStepEnables *enables, SequenceStepTimeouts *timeouts);
+		void writeWordData(unsigned char Reg, uint16_t word);
+		uint16_t readWordData(unsigned char Reg);
 		void readVL53L0X();
 };
 
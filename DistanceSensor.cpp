@@ -9,6 +9,7 @@
  */
 
 #include "DistanceSensor.h"
+#include <EEPROM.h>                         /* Sensor calibration records */
 
 DistanceSensor::DistanceSensor() {									// Constructor
 
@@ -18,7 +19,10 @@ DistanceSensor::~DistanceSensor() {									// Destructor
 
 }
 
-void DistanceSensor::setup() {
+void DistanceSensor::setup(uint8_t address, uint8_t xshutPin, uint8_t calSlot) {
+    m_address = address;
+    m_xshutPin = xshutPin;
+    m_calSlot = calSlot;
     initializeDistanceSensor();                             // Set up the Distance sensor
 }
 
@@ -26,10 +30,113 @@ void DistanceSensor::loop() {
 
 }
 
+// Drive XSHUT low - the sensor is held in reset (and off the I2C bus) until it is released by setup()
+void DistanceSensor::holdInReset(uint8_t xshutPin) {
+    if (xshutPin != SENSOR_NO_XSHUT) {
+        pinMode(xshutPin, OUTPUT);
+        digitalWrite(xshutPin, LOW);
+    }
+}
+
 // Set up the Distance sensor
 void DistanceSensor::initializeDistanceSensor() {
     Serial.println("Init sensor");
-    sensor.begin(0x50);                                     // Set I2C sub-device address for the distance sensor - sensor has hex address 0x50
-    sensor.setMode(Single, Low);                            // Single measurements in Low (+- 1 mm) precision mode  (High precision mode is too noisy)
+    if (m_xshutPin != SENSOR_NO_XSHUT) {
+        pinMode(m_xshutPin, INPUT);                         // Release XSHUT (the breakout pulls it up to the sensor supply) - the sensor boots on the power up address
+        delay(2);
+    }
+    if (!m_sensor.begin(m_address)) {                       // Move the sensor from the power up address to its own I2C sub-device address
+        Serial.println("Sensor not found");                 // No profile or calibration for it - its readings fail the range checks
+        return;
+    }
+#if RANGEFINDER == RANGEFINDER_VL53L1X
+    if (!m_sensor.setDistanceMode(VL53L1X_DISTANCE_MODE) || !m_sensor.setTimingBudget(VL53L1X_TIMING_BUDGET)) {
+        Serial.println("Sensor profile not applied");
+    }
+#else
+    if (!m_sensor.sensor.setProfile(SENSOR_PROFILE)) {     // Timing budget and VCSEL periods
+        Serial.println("Sensor profile not applied");
+    }
+    loadCalibration();
+#endif
     Serial.println("Completed Sensor init");
-}
\ No newline at end of file
+}
+
+#if RANGEFINDER == RANGEFINDER_VL53L1X
+// The VL53L1X keeps its own offset and crosstalk calibration - not supported here
+boolean DistanceSensor::calibrateOffset(uint16_t distance) {
+    return false;
+}
+
+boolean DistanceSensor::calibrateCrosstalk(uint16_t distance) {
+    return false;
+}
+
+void DistanceSensor::clearCalibration() {
+}
+
+void DistanceSensor::printCalibration() {
+    Serial.print("not supported");
+}
+#else
+boolean DistanceSensor::calibrateOffset(uint16_t distance) {
+    if (!m_sensor.calibrateOffset(distance)) {
+        return false;
+    }
+    saveCalibration();
+    return true;
+}
+
+boolean DistanceSensor::calibrateCrosstalk(uint16_t distance) {
+    if (!m_sensor.calibrateCrosstalk(distance)) {
+        return false;
+    }
+    saveCalibration();
+    return true;
+}
+
+void DistanceSensor::clearCalibration() {
+    VL53L0XCalibration cal = { 0, 0 };
+    m_sensor.setCalibration(cal);
+    saveCalibration();
+}
+
+void DistanceSensor::printCalibration() {
+    const VL53L0XCalibration &cal = m_sensor.getCalibration();
+    Serial.print("offset ");
+    Serial.print(cal.offset / 4.0);
+    Serial.print(" crosstalk ");
+    Serial.print(cal.crosstalk / 65536.0, 5);
+}
+
+// Apply the stored record - a blank or corrupt one leaves the sensor uncalibrated
+void DistanceSensor::loadCalibration() {
+    CalibrationRecord record;
+
+    EEPROM.get(SENSOR_CAL_EEPROM + m_calSlot * sizeof(CalibrationRecord), record);
+    if (record.magic != SENSOR_CAL_MAGIC || record.check != checksum(record)) {
+        Serial.println("Sensor not calibrated");
+        return;
+    }
+    m_sensor.setCalibration(record.cal);
+}
+
+void DistanceSensor::saveCalibration() {
+    CalibrationRecord record;
+
+    record.magic = SENSOR_CAL_MAGIC;
+    record.cal = m_sensor.getCalibration();
+    record.check = checksum(record);
+    EEPROM.put(SENSOR_CAL_EEPROM + m_calSlot * sizeof(CalibrationRecord), record);   // put() only writes the bytes that changed
+}
+
+uint8_t DistanceSensor::checksum(const CalibrationRecord &record) {
+    const uint8_t *p = (const uint8_t *)&record;
+    uint8_t sum = 0;
+
+    for (uint8_t i = 0; i < sizeof(record.magic) + sizeof(record.cal); i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+#endif
\ No newline at end of file
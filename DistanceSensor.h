@@ -12,20 +12,67 @@
 #define DISTANCE_H
 
 #include "Wire.h"                           /* I2C protocol functions */
-#include "DFRobot_VL53L0X.h"                /* Laser rangefinder functions */
+#include "Rangefinder.h"                    /* Sensor independent trigger/poll/read interface */
+
+// Rangefinder fitted to the shaft (selected at build time)
+#define RANGEFINDER_VL53L0X 0
+#define RANGEFINDER_VL53L1X 1
+#define RANGEFINDER RANGEFINDER_VL53L0X
+
+#define SENSOR_ADDRESS 0x50                 // I2C sub-device address given to the sensor at start up (default - each car on the board has its own, see CAR_TABLE)
+#define SENSOR_NO_XSHUT 0xFF                // No XSHUT line: the sensor is out of reset at power up
+#define SENSOR_CAL_EEPROM 0                 // EEPROM address of the first car's sensor calibration record (one record per car, see CalibrationRecord)
+#define SENSOR_CAL_MAGIC 0xC5               // First byte of a written record - a blank EEPROM reads 0xFF
+
+#if RANGEFINDER == RANGEFINDER_VL53L1X
+#include "VL53L1X.h"
+#define VL53L1X_DISTANCE_MODE DistanceShort // DistanceShort (up to 1.3 m) or DistanceLong (up to 4 m)
+#define VL53L1X_TIMING_BUDGET 20            // ms: 15 (Short only), 20, 33, 50, 100, 200, 500
+#else
+#include "VL53L0XRangefinder.h"
+#define SENSOR_PROFILE ProfileDefault       // ProfileDefault (33 ms), ProfileHighSpeed (20 ms), ProfileLongRange or ProfileHighAccuracy (200 ms) - see DFRobotVL53L0X::setProfile()
+
+typedef struct {
+  uint8_t magic;                            // SENSOR_CAL_MAGIC
+  VL53L0XCalibration cal;
+  uint8_t check;                            // Sum of the bytes before it
+} CalibrationRecord;
+#endif
 
 class DistanceSensor {
 public:
 	DistanceSensor();						              // Contructor
 	~DistanceSensor();						            // Destructor
-	void setup();
+	void setup(uint8_t address = SENSOR_ADDRESS, uint8_t xshutPin = SENSOR_NO_XSHUT, uint8_t calSlot = 0);   // calSlot - EEPROM calibration record (the car's index)
 	void loop();
 	void initializeDistanceSensor();		      // Set up the Distance sensor
+	static void holdInReset(uint8_t xshutPin);  // Keep a sensor off the bus until its setup() - every sensor answers on the same address at power up
 
-	DFRobotVL53L0X sensor;                    // Distance sensor object
+	void trigger() { m_sensor.trigger(); }                        // Start one measurement
+	boolean poll() { return m_sensor.poll(); }                    // Measurement ready?
+	void read(RangeSample &sample) { m_sensor.read(sample); }     // Fetch the ready measurement
+	void startContinuous() { m_sensor.startContinuous(); }        // Back-to-back measurements
+	void stop() { m_sensor.stop(); }
+	Rangefinder &rangefinder() { return m_sensor; }
+	boolean calibrateOffset(uint16_t distance);       // Target at 'distance' mm - blocks for the measurements, stores the result in EEPROM
+	boolean calibrateCrosstalk(uint16_t distance);
+	void clearCalibration();
+	void printCalibration();                  // "offset <mm> crosstalk <MCPS per SPAD>" (no line end)
 
 private:
+	uint8_t m_address;                        // I2C address given to the sensor
+	uint8_t m_xshutPin;                       // XSHUT (active low shutdown) pin or SENSOR_NO_XSHUT
+	uint8_t m_calSlot;                        // Index of the sensor's calibration record in EEPROM
+#if RANGEFINDER == RANGEFINDER_VL53L1X
+	VL53L1X m_sensor;                         // Distance sensor object
+#else
+	VL53L0XRangefinder m_sensor;              // Distance sensor object
+
+	void loadCalibration();
+	void saveCalibration();
+	static uint8_t checksum(const CalibrationRecord &record);
+#endif
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -9,6 +9,7 @@
  */
 
 #include "ElevatorController.h"
+#include "FloorTable.h"
 
 ElevatorController::ElevatorController()                    // Constructor - No code
 {}	
@@ -23,118 +24,212 @@ void ElevatorController::setup() {
     SPI.begin();                                            // initialize the SPI library and set the MOSI, and CS pin modes to output mode. Also sets MOSI and SCLK to LOW and CS to HIGH.
     
     // Setup of sub-modules of the ElevatorController
-    initializeTimer();                                      // Set up interrupt timing for transmit interval (EC sends current floor every 2 seconds) 
+#ifdef TIMER_BENCHMARK
+    TW.benchmark();                                         // Before the tick interrupt runs the wheel
+#endif
+    initializeTimer();                                      // Set up the tick interrupt of the software timers
+    TW.start(TIMER_FLOOR_REPORT, TIMER_TICKS(FLOOR_REPORT_MS), TIMER_TICKS(FLOOR_REPORT_MS));
+#ifdef CAN_STATS
+    TW.start(TIMER_CAN_STATS, TIMER_TICKS(CAN_STATS_MS), TIMER_TICKS(CAN_STATS_MS));
+#endif
     CM.setup();                                             // Setup CAN module object
-    DSM.setup();                                            // Setup Distance Sensor module object
-    DM.setup();                                             // Setup DAC module object
     LCDM.setup();                                           // Setup CAN module object
+#if CONTROL_LAW == CONTROL_LAW_CASCADED && defined(MOTION_PROFILE) && defined(PROFILE_CACHE)
+    MotionProfile::planTable();                             // Shared by the cars - they serve the same floors
+#endif
+    for (uint8_t i = 0; i < CAR_COUNT; i++) {
+        DistanceSensor::holdInReset(CAR_TABLE[i].xshutPin); // Every sensor powers up on the same I2C address - bring them up one at a time
+    }
+    for (uint8_t i = 0; i < CAR_COUNT; i++) {
+        m_cars[i].setup(i, &CM, i == 0 ? &LCDM : NULL);     // Each car starts for its default floor, the LCD follows the first car
+    }
+    unsigned long start = millis();
+    for (uint8_t i = 0; i < CAR_COUNT; i++) {
+        m_cars[i].startPeriods(start);                      // Sensor set up takes seconds, so phase the cars once they are all ready
+    }
 
-    // Initial settings (default floor)
-    CM.setTxdata(FLOOR1);                                  // FLOOR1, FLOOR2, FLOOR3    
-    LCDM.lcdObj.setCursor(0, 0);
-    LCDM.lcdObj.print("Floor 1");
-    CM.setSetpoint(FLOOR1_SP);                             // Initialize default setpoint to that of FLOOR1
-
-    m_currentFloor = 0; // Unknown
+    m_nextCar = 0;
+    m_txPending = 0;
+    m_shedLevel = SHED_NONE;
+    m_loopMaxUs = 0;
+    m_slackSince = millis();
+    m_statsLoopMaxUs = 0;
+    m_loopStart = micros();
 
     // Initialize flags
     flagRecv = false;
-    flagTx = false;
 }
 
 void ElevatorController::loop() {
+    unsigned long now = micros();
+
+    updateLoadShedding(now - m_loopStart);                 // Length of the previous loop
+    m_loopStart = now;
+
     // Receive CAN message for which floor to go to
     if (flagRecv) {                                         // Receive message (INT_PIN triggers interrupt that sets flagRecv true to indicate that a new message has been received)
         flagRecv = false;                                   // Reset the flag as we will use it again if another request is received
-        CM.receiveCAN(LCDM);                                // Receive the message 
+        noInterrupts();                                     // rxMicros is 4 bytes - copy it without the ISR writing halfway
+        unsigned long stamp = rxMicros;
+        interrupts();
+        CanFrame frame;                                     // Read straight from the driver and decoded in place
+        if (CM.receiveCAN(frame, stamp)) {                  // Receive the message
+            flagRecv = true;                                // Another frame is waiting in the other buffer - read it next loop
+        }
+        handleFrame(frame);
+        CM.recordLatency(micros() - stamp);                 // For a frame read from the other buffer this includes its wait behind the first
+    }
+    CM.loop();                                              // Pending NODE_QUERY answer
+
+    // Transmit CAN message to tell everyone the current elevator floor every FLOOR_REPORT_MS
+    if (TW.expired(TIMER_FLOOR_REPORT)) {                   // Flagged by the timer tick interrupt
+        m_txPending = CAR_COUNT;
+    }
+    if (m_txPending) {                                      // One car per loop so the reports don't add up to an overrun
+        m_txPending--;
+        CanFrame report = { m_cars[m_txPending].getCanId(), DLC, { m_cars[m_txPending].getFloorCode() } };
+        CM.transmitCAN(report);                             // Send the current floor via CAN 
     }
 
-    // Transmit CAN message to tell everyone the current elevator floor every few seconds
-    if (flagTx) {                                           // Use a timer interrupt (that sets flagTx true) to transmit the current floor every few seconds
-        flagTx = false;
-        CM.setTxdata(m_currentFloor);
-        CM.transmitCAN();                                   // Send the current floor via CAN 
+    // Round robin: one car per loop, so the loop stays within LOOP_BUDGET_US however many cars the board drives
+    Car &car = m_cars[m_nextCar];
+    m_nextCar = (m_nextCar + 1) % CAR_COUNT;
+    if (car.loop()) {
+        // Non-critical outputs after the DAC write so they never delay it
+        if (m_shedLevel < SHED_LCD && car.getIndex() == 0) {
+            LCDM.loop(car.getDistance());                   // Output the distance to the LCD
+        }
+#ifdef TELEMETRY
+        if (m_shedLevel < SHED_TELEMETRY) {
+            sendTelemetry(car);
+        }
+#endif
     }
+#ifdef CAN_STATS
+    else if (m_shedLevel < SHED_TELEMETRY && TW.expired(TIMER_CAN_STATS)) {
+        sendCanStats();                                     // In a loop without a control tick
+    }
+#endif
+}
 
-    Move(CM.getSetpoint());
-    checkCurrentFloor();
+// Queue the floor call or run the command in the received frame - the high nibble of the code selects the car of the bank
+void ElevatorController::handleFrame(const CanFrame &frame) {
+    byte code = frame.code();
+    uint8_t index = (code >> CAR_SHIFT) - CM.getFirstCar();   // Bank car number to the board's car (cars below the first wrap past CAR_COUNT)
+
+    if ((code >> CAR_SHIFT) >= NODE_CARS || index >= CAR_COUNT || frame.isRemote() || frame.dlc == 0) {
+        return;                                             // Not a car on this board (or no code - the data bytes are the previous frame's)
+    }
+    Car &car = m_cars[index];
+    DestinationFrame destinationCall(frame);
+    CalibrationFrame calibration(frame);
+    int8_t floor = CM.floorIndex(code & CAR_CODE_MASK);
+    if (floor >= 0 && destinationCall.valid()) {
+        int8_t destination = CM.floorIndex(destinationCall.destination() & CAR_CODE_MASK);
+        if (destination >= 0) {
+            car.scheduler().addDestinationCall(floor, destination, millis());   // Destination dispatch call from a floor node
+        }
+    }
+    else if (floor >= 0) {
+        car.scheduler().addCall(floor, millis());           // Queue the call - the car's dispatch() decides when it is served
+    }
+    else if ((code & CAR_CODE_MASK) == SYSID) {
+        for (uint8_t i = 0; i < CAR_COUNT; i++) {
+            m_cars[i].halt();                               // The run blocks the loop - park every car first
+        }
+        car.runSystemId();
+        m_loopStart = micros();                             // The blocking run is not a loop overrun
+    }
+    else if ((code & CAR_CODE_MASK) == CAL_CLEAR || (((code & CAR_CODE_MASK) == CAL_OFFSET || (code & CAR_CODE_MASK) == CAL_XTALK) && calibration.valid())) {
+        for (uint8_t i = 0; i < CAR_COUNT; i++) {
+            m_cars[i].halt();                               // Blocks the loop like SYSID
+        }
+        car.calibrateSensor(code & CAR_CODE_MASK, calibration.distance());
+        m_loopStart = micros();
+    }
+    else if ((code & CAR_CODE_MASK) == HEALTH) {
+        car.relearnSensorHealth();
+    }
 }
- 
-	
-// Set up interrupt timing for transmit interval (EC sends current floor every 2 seconds) 
+
+// Set up the timer tick interrupt - Timer1 calls ElevatorController::tick() every TIMER_TICK_MS, which runs the software timers (TimerWheel)
 void ElevatorController::initializeTimer() {                     
+    TW.setup();                                                         // Stop every timer before the first tick
     cli();                                                              // stop interrupts
     // Set timer1 interrupt by setting the registers --> See register map and tutorial at:  https://www.instructables.com/Arduino-Timer-Interrupts/
     TCCR1A = 0;                                                         // Set TCCR1A register to 0 (clear existing control values so we can set functionality below)
     TCCR1B = 0;                                                         // Set TCCR1B register to 0 (clear existing control valuesso we can set functionality below)
     TCNT1 = 0;                                                          // Initialize the counter value for timer1 to 0
 
-    // Set the compare match register (binary value) so we get our desired Hz increments (as described above with prescaler of 1024)
-    // [(16*10^6) / (1/T *1024)] - 1     --> Control Register for timer1 must be below 65536 since it is a 16-bit register (you can modify the prescaler value if too large)
-    // 15624 -> T=1 second
-    // 32767 -> T=2 seconds
-    OCR1A = 15624;
+    // Set the compare match register (binary value) so we get our desired Hz increments (as described above with prescaler of 64)
+    // [(16*10^6) / (1/T *64)] - 1     --> Control Register for timer1 must be below 65536 since it is a 16-bit register (you can modify the prescaler value if too large)
+    // 2499 -> T=10 ms (TIMER_TICK_MS)
+    OCR1A = TIMER_OCR;
 
     // Turn on CTC Mode for timer1
     TCCR1B |= (1 << WGM12);                                             // WGM12 == 3 (turn on CTC Mode for timer1)
-    // Set the CS10 and CS12 bits in TCCR1B to give a prescaler = 1024
-    TCCR1B |= (1 << CS12) | (1 << CS10);                                // CS12 == 2, (to get value of 1024), CS10 == 0  (Use external 16MHz clock (external to microprocessor but onboard the UNO) source on T1 pin of arduino) - See register map at:  https://www.instructables.com/Arduino-Timer-Interrupts/
+    // Set the CS11 and CS10 bits in TCCR1B to give a prescaler = 64
+    TCCR1B |= (1 << CS11) | (1 << CS10);                                // CS11 == 1, CS10 == 0 (to get value of 64) - See register map at:  https://www.instructables.com/Arduino-Timer-Interrupts/
     // Enable the timer compare interrupt for timer1
     TIMSK1 |= (1 << OCIE1A);                                            // TIMSK1 is a register, OCIE1A = 1  (set this bit to 1) - this enables the interrupt vector (TIMER1_COMPA_vect)
     sei();                                                              // enable/allow interrupts
-    // Set timer-based interrupt flag
-    flagTx = false;
 }
 
-// Move to setpoint distance (floor)
-void ElevatorController::Move(uint16_t setpoint) {
-  	int difference = 0; // Difference in mm from setpoint (floor). A positive value is above the setpoint distance (floor) and a negative value is below.
-    
-    DSM.sensor.start();
-    m_dist = DSM.sensor.getDistance();
-    delay(100);
-    DSM.sensor.stop();
-
-    if (m_dist > MINHEIGHT && m_dist < MAXHEIGHT) {
-        // Output the distance to the LCD
-        LCDM.loop(m_dist);
-
-        //Output the difference between setpoint and distance
-        difference = m_dist - setpoint;        // positive value means above setpoint (later take the negative of this value to indicate direction to move - i.e. down)
-        //Serial.print("Distance ");           // Testing
-        //Serial.println(m_dist);              // Testing
-        if (abs(difference) <= SETPOINT_TOLERANCE) {
-            difference = 0;
-        }
-
-        // Set dynamic parameters to smooth out motion: difference = difference * A e^(-a * difference) - Graph this to see what the motion will look like
-        a = (float)DAMPENER / (float)diffMax;
-
-        difference = difference * A * exp((-1) * a * abs(difference));   
-        
-        // Need to make sure this is below 1023 since this is the max value that can be sent to the DAC
-        if(difference > 1023) {
-          difference = 1023; 
-        } 
+// Step the load shedding level from the measured loop time: one level up per overrun, one level down after SHED_RESTORE_MS without one
+void ElevatorController::updateLoadShedding(unsigned long loopUs) {
+    unsigned long now = millis();
+    uint8_t level = m_shedLevel;
 
-        //Serial.println(difference);                          // Testing
-        DM.transferDAC(difference);                            // Set values on DAC to control motor speed
+    if (loopUs > m_loopMaxUs) {
+        m_loopMaxUs = loopUs;
+    }
+    if (loopUs > m_statsLoopMaxUs) {
+        m_statsLoopMaxUs = loopUs;
+    }
+    if (loopUs > LOOP_BUDGET_US) {
+        if (level < SHED_TELEMETRY) {
+            level++;
+        }
+        m_slackSince = now;
     }
-    else {
-        DM.transferDAC(0);                                     // Stop the elevator when get an out of range measurement - make sure Floor 1 is above MINHEIGHT and Floor 3 is below MAXHEIGHT
+    else if (level > SHED_NONE && now - m_slackSince >= SHED_RESTORE_MS) {
+        level--;
+        m_slackSince = now;
+    }
+
+    if (level != m_shedLevel) {
+        m_shedLevel = level;
+        CM.setVerbose(level < SHED_LOGGING);
+        Serial.print("[SHED] ");
+        Serial.print(CM.syncMillis());
+        Serial.print(" level ");
+        Serial.println(level);
     }
 }
 
-void ElevatorController::checkCurrentFloor() {
+#ifdef TELEMETRY
+// One "[TLM] t_ms,dist,setpoint,dac,velocity,loop_us,shed,car,diag" record - loop_us is the longest loop since the previous record
+void ElevatorController::sendTelemetry(Car &car) {
+    char msg[64];
 
-    // Check current floor
-    if ((m_dist >= FLOOR1_SP - (SETPOINT_TOLERANCE + 10)) && (m_dist <= FLOOR1_SP + (SETPOINT_TOLERANCE + 10))) {
-        m_currentFloor = FLOOR1;
-    } else if ((m_dist >= FLOOR2_SP - (SETPOINT_TOLERANCE + 10)) && (m_dist <= FLOOR2_SP + (SETPOINT_TOLERANCE + 10))) {
-        m_currentFloor = FLOOR2;
-    } else if ((m_dist >= FLOOR3_SP - (SETPOINT_TOLERANCE + 10)) && (m_dist <= FLOOR3_SP + (SETPOINT_TOLERANCE + 10))) {
-        m_currentFloor = FLOOR3;
-    } else {
-      // If the car is between floors, keep repeating the last known floor
+    sprintf(msg, "[TLM] %lu,%u,%u,%d,%d,%lu,%u,%u,%u", CM.syncMillis(), car.getDistance(), car.getSetpoint(), car.getCommand(), (int)car.getVelocity(), m_loopMaxUs, m_shedLevel, car.getIndex(), car.getDiagnostics());
+    Serial.println(msg);
+    m_loopMaxUs = 0;
+}
+#endif
+
+#ifdef CAN_STATS
+void ElevatorController::sendCanStats() {
+    const CanStats &stats = CM.getStats();
+    char msg[80];
+
+    sprintf(msg, "[CANSTAT] %lu,%lu,%u,%u,%u,%u,%lu", CM.syncMillis(), stats.frames, stats.backlog, stats.probeLost, stats.errorFlags, stats.latencyMaxUs, m_statsLoopMaxUs);
+    Serial.print(msg);
+    for (uint8_t i = 0; i < CAN_LATENCY_BINS; i++) {
+        Serial.print(',');
+        Serial.print(stats.latency[i]);
     }
-}
\ No newline at end of file
+    Serial.println();
+    m_statsLoopMaxUs = 0;
+}
+#endif
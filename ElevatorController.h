@@ -13,9 +13,104 @@
 
 #include "Arduino.h"
 #include "CANModule.h"
-#include "DistanceSensor.h"
-#include "DAC.h"
+#include "TimerWheel.h"
 #include "LCD.h"
+#include "Car.h"
+
+// Controller selection - CONTROL_LAW picks the law compiled into Move()
+#define CONTROL_LAW_EXPONENTIAL 0           // difference * A e^(-a * difference) damping curve (original law)
+#define CONTROL_LAW_MPC 1                   // Explicit MPC - interpolated lookup of the offline solution in MPCTable.h (tools/mpc_table.py)
+#define CONTROL_LAW_CASCADED 2              // Outer position loop (speed limited) commanding an inner PI velocity loop
+#define CONTROL_LAW CONTROL_LAW_EXPONENTIAL
+#define CONTROL_PERIOD_MS 100               // in ms - a measurement is triggered every period and the law runs when it arrives (tools/laws.py CONTROL_PERIOD)
+                                            // With several cars each loop serves the next car in turn, so a car's result waits at most CAR_COUNT loops
+#define SENSOR_TIMEOUT_MS 300               // in ms - a triggered measurement that has not arrived by now stops the car (or starts DEAD_RECKONING)
+#define VELOCITY_FILTER 0.5                 // Weight of the newest sample in the velocity estimate (1 = no filtering)
+#define MPC_STOP_VELOCITY 20                // in mm/s - MPC output is forced to 0 inside SETPOINT_TOLERANCE once the car is slower than this
+
+// Cascaded position/velocity loop tuning (CONTROL_LAW_CASCADED) - the inner loop runs every Move(), the outer loop every CASCADE_OUTER_DIVIDER calls
+#define CASCADE_OUTER_DIVIDER 2             // Outer (position) loop rate = control rate / CASCADE_OUTER_DIVIDER
+#define CASCADE_KP_POS 2.0                  // in 1/s - velocity setpoint per mm of position error
+#define CASCADE_MAX_SPEED 200               // in mm/s - speed limit on the velocity setpoint
+#define CASCADE_KFF 2.5                     // DAC code per mm/s of velocity setpoint (feedforward)
+#define CASCADE_KP_VEL 2.0                  // DAC code per mm/s of velocity error
+#define CASCADE_KI_VEL 2.0                  // DAC code per mm of integrated velocity error
+#define MOTION_PROFILE                      // The outer loop tracks a trapezoidal profile of the trip (MotionProfile.h) instead of the floor error alone
+#define PROFILE_CACHE                       // Plan the profiles of every floor pair in setup() (comment out to plan each trip as it starts)
+//#define PROFILE_TIMING                    // Print "[PLAN] t_ms car n to floor f from floor|on the way us" - the time taken to start each profile - on the
+                                            // Serial monitor (uncomment to measure a cached start against a planned one on the board)
+
+// Oscillation detector - while the position error is within OSC_BAND of the setpoint, count the times it swings from one side to the other
+// (beyond OSC_HYSTERESIS, with a half swing of at least OSC_AMPLITUDE). OSC_CROSSINGS such crossings inside OSC_WINDOW_MS scale the law
+// output down by OSC_BACKOFF (not below OSC_MIN_GAIN) and set DIAG_OSCILLATION; each OSC_RESTORE_MS without a backoff restores one step.
+#define OSC_DETECT                          // Comment out to run the law at full gain always
+#define OSC_BAND 150                        // in mm
+#define OSC_HYSTERESIS 5                    // in mm - sensor noise around the setpoint is not a crossing
+#define OSC_AMPLITUDE 10                    // in mm
+#define OSC_CROSSINGS 4
+#define OSC_WINDOW_MS 6000                  // in ms
+#define OSC_BACKOFF 0.7
+#define OSC_MIN_GAIN 0.2
+#define OSC_RESTORE_MS 30000                // in ms
+
+// Degraded mode - DEADRECK_FAULTS control periods in a row without a usable range (an invalid status, or a reading more than DEADRECK_JUMP_MM
+// from where the motor model puts the car - a VL53L0X with no return reads 8190) or one sensor timeout switch the car to dead reckoning: the
+// model below is integrated from the car's own DAC commands, starting at the last good range, and the car creeps at DEADRECK_SPEED to the
+// nearest floor (never reversing while faster than that) and parks there. DEADRECK_RECOVER consistent ranges in a row hand control back to the
+// law. See tools/fault_sim.py.
+#define DEAD_RECKONING                      // Comment out to hold the last command on an invalid range and stop on a timeout or out of range reading
+#define DEADRECK_FAULTS 3
+#define DEADRECK_JUMP_MM 100                // in mm
+#define DEADRECK_SPEED 40                   // in mm/s
+#define DEADRECK_RECOVER 10
+#define MOTOR_K 0.30                        // in mm/s per DAC code above the friction band - motor model (tools/sysid_fit.py fits these)
+#define MOTOR_TAU 0.15                      // in s
+#define MOTOR_FRICTION 60                   // in DAC codes
+
+// Diagnostics bits (Car::getDiagnostics(), last field of the [TLM] record)
+#define DIAG_OSCILLATION 0x01               // The law is running at reduced gain after hunting around the setpoint
+#define DIAG_DEAD_RECKONING 0x02            // Sensor fault - the car is creeping to (or parked at) a floor on the motor model
+#define DIAG_SENSOR_HEALTH 0x04             // A sensor health warning is raised - maintenance due (see [HEALTH])
+#define SENSOR_HEALTH                       // Trend the sensor's return, ambient light and failed statuses (SensorHealth.h, comment out to disable) and print
+                                            // "[HEALTH] t_ms,car,signal_pct,ambient_pct,errors_pct,warnings" with each HEALTH frame
+
+// Output stage
+//#define DAC_DITHER                        // Sigma-delta dither the fractional DAC command between adjacent codes (uncomment - truncates by default)
+#define DAC_SLEW_LIMIT                      // Slew limit the command per direction and reverse only through zero (DAC_SLEW_xxx in DAC.h, comment out to only saturate)
+
+// Load shedding - when a loop overruns LOOP_BUDGET_US the next level of non-critical work is skipped, one level is restored once no loop has
+// overrun for SHED_RESTORE_MS. Sensing, control and the MINHEIGHT/MAXHEIGHT kill switch always run.
+#define TELEMETRY                           // Print a "[TLM] t_ms,dist,setpoint,dac,velocity,loop_us,shed,car,diag" record every control tick (comment out to disable) - t_ms is CANModule::syncMillis()
+#define LOOP_BUDGET_US 5000                 // in us - longest acceptable loop (the delay between a sample arriving and the law running)
+#define SHED_RESTORE_MS 2000                // in ms
+#define SHED_NONE 0                         // Everything runs
+#define SHED_LCD 1                          // Skip the LCD distance refresh (the display follows the first car)
+#define SHED_LOGGING 2                      // ... and the verbose CAN logging
+#define SHED_TELEMETRY 3                    // ... and the telemetry records (and the CAN statistics)
+#define CAN_STATS                           // Print "[CANSTAT] t_ms,frames,backlog,lost,eflg,lat_max_us,loop_max_us,lat_bin0..lat_bin7" every CAN_STATS_MS
+                                            // (totals since reset except loop_max_us, the longest loop since the last record) - see tools/can_stress.py
+#define CAN_STATS_MS 5000                   // in ms
+
+// Software timers (TimerWheel ids) - every periodic job takes a timer here rather than a hardware timer or a millis() check of its own
+#define TIMER_FLOOR_REPORT 0                // Every car reports its floor on the bus, one per loop
+#define TIMER_CAN_STATS 1                   // [CANSTAT] record (in the next loop without a control tick)
+#define FLOOR_REPORT_MS 1000                // in ms
+
+// System identification (SYSID command) - scripted DAC sequence logged over Serial for tools/sysid_fit.py
+#define SYSID_STEP 0                        // Hold the amplitude for the duration of the segment
+#define SYSID_CHIRP 1                       // Sine sweep from SYSID_CHIRP_F0 to SYSID_CHIRP_F1 over the duration of the segment
+#define SYSID_CHIRP_F0 0.2                  // in Hz
+#define SYSID_CHIRP_F1 2.0                  // in Hz
+#define SYSID_MARGIN 150                    // in mm - the run aborts if the car comes this close to MINHEIGHT or MAXHEIGHT ...
+#define SYSID_FLOOR_MARGIN 100              // in mm - ... or goes this far past the bottom or top floor of FLOOR_TABLE ...
+#define SYSID_MAX_INVALID 5                 // ... or the sensor fails this many samples in a row ...
+#define SYSID_SAMPLE_TIMEOUT_MS 250         // in ms - ... or sends none for this long (continuous ranging takes one timing budget a sample)
+
+typedef struct {
+  uint8_t type;                             // SYSID_STEP or SYSID_CHIRP
+  int16_t amplitude;                        // DAC code
+  uint16_t duration;                        // in ms
+} SysIdSegment;
 
 class ElevatorController {
 public:
@@ -25,26 +120,33 @@ public:
 	ElevatorController();					          // Contructor
 	~ElevatorController();					        // Destructor
 
-	void initializeTimer();					        // Set up timer-based interrupt on the ElevatorController (Arduino UNO) for transmission of current floor every 2 seconds
-	void Move(uint16_t setpoint);					  // Move to setpoint distance (floor)
+	void initializeTimer();					        // Set up the Timer1 tick interrupt that drives the software timers (TimerWheel)
+	void tick() { TW.tick(); }              // From the Timer1 interrupt - sets the expired flags of the timers due
 
 	volatile boolean flagRecv;              // Flag used to indicate message received in the loop via interrupt --> Interrupt flag for receive (CAN module, a SPI SLAVE, uses an interrupt on INT_PIN to ask the Arduino (SPI MASTER) to initiate communication)
-	volatile boolean flagTx;                // flag for timer-based transmit interrupt --> Interrupt flag for timer-based interrupt for transmit process (UNO should broadcast the current floor on the bus every few seconds)
+	volatile unsigned long rxMicros;        // micros() when the CAN interrupt fired - arrival time for time sync frames
 
 private:
-  uint8_t m_currentFloor;
+  uint8_t m_nextCar;                      // Car served by the next loop (round robin)
+  uint8_t m_txPending;                    // Cars whose floor report is still to be sent this period
 
-  // Motion variables                     // Set dynamic parameters to smooth out motion: difference = difference * A e^(-a * difference)
-	float a;                                // Exponential dampening on the difference measurement - via exponential (see Move() function)
-  uint16_t m_dist;                        // Distance in mm from the distance sensor
+  // Load shedding
+  uint8_t m_shedLevel;                    // SHED_xxx
+  unsigned long m_loopStart;              // micros() at the start of the current loop
+  unsigned long m_loopMaxUs;              // Longest loop since the last telemetry record
+  unsigned long m_slackSince;             // millis() of the last overrun (or level restore)
+  unsigned long m_statsLoopMaxUs;         // Longest loop since the last [CANSTAT] record
 
   // Instantiate sub-objects of the ElevatorController
   CANModule CM;                           // CAN module object                      
-	DistanceSensor DSM;                     // Distance Sensor module object
-	DAC DM;                                 // DAC module object
 	LCD LCDM;                               // LCD module object
+  TimerWheel TW;                          // Software timers (TIMER_xxx ids)
+	Car m_cars[CAR_COUNT];                  // One per shaft (CAR_TABLE)
 
-  void checkCurrentFloor();
+  void handleFrame(const CanFrame &frame);   // Route the received frame to its car
+  void updateLoadShedding(unsigned long loopUs);
+  void sendTelemetry(Car &car);
+  void sendCanStats();
 };
 
 #endif
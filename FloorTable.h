@@ -0,0 +1,42 @@
+/*!
+ * @file FloorTable.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Floors served by the car - CAN floor code and setpoint, indexed from the bottom floor - and how the car approaches each one.
+ * Within FLOOR_APPROACH_MM of its target the car runs the law at the floor's leveling gain and no faster than its approach speed,
+ * and it counts as level within the floor's tolerance. Floors near MINHEIGHT/MAXHEIGHT want a gentle approach; open floors can take
+ * a faster one (tools/sim.py --uniform-floors compares against SETPOINT_TOLERANCE everywhere).
+ *
+ * The leveling gain only applies to the exponential law - the MPC table and the cascaded loop keep their own tuning and lose damping
+ * when scaled up. Rerun tools/sim.py --floors after changing the law's constants or the floors.
+ */
+
+#ifndef FLOORTABLE_H
+#define FLOORTABLE_H
+
+#include "CANModule.h"                      /* Floor codes and setpoints */
+
+#define FLOOR_COUNT 3
+#define FLOOR_APPROACH_MM 200               // in mm - approach zone around the target floor
+#define FLOOR_NO_SPEED_CAP 0
+static_assert(FLOOR_COUNT <= NODE_FLOORS, "the node record holds NODE_FLOORS floor codes");
+
+typedef struct {
+  byte code;                                // Default CAN floor code (FLOOR1, FLOOR2, FLOOR3) - the node record's floor codes apply (CANModule::floorCode())
+  uint16_t setpoint;                        // Distance in mm from the sensor
+  uint8_t tolerance;                        // in mm - leveling band
+  uint16_t approachSpeed;                   // in mm/s - speed cap in the approach zone (FLOOR_NO_SPEED_CAP for none)
+  uint16_t levelGain;                       // in % - exponential law output in the approach zone (100 = as tuned)
+} FloorEntry;
+
+const FloorEntry FLOOR_TABLE[FLOOR_COUNT] = {
+  { FLOOR1, FLOOR1_SP, 30, FLOOR_NO_SPEED_CAP, 200 },     // 200 mm above MINHEIGHT - gentler approach, wider band
+  { FLOOR2, FLOOR2_SP, 20, FLOOR_NO_SPEED_CAP, 400 },
+  { FLOOR3, FLOOR3_SP, 20, FLOOR_NO_SPEED_CAP, 300 },     // 280 mm below MAXHEIGHT
+};
+
+#endif
@@ -0,0 +1,36 @@
+/*!
+ * @file MPCTable.h
+ * @brief Explicit MPC lookup table for ElevatorController (CONTROL_LAW_MPC)
+ *
+ * GENERATED by tools/mpc_table.py - do not edit by hand.
+ * Plant: K=0.300 mm/s/code, tau=0.150 s, friction=60 codes; period 100 ms, speed limit 250 mm/s
+ * Rows are position error (mm, e >= 0 only - the law is odd), columns are velocity (mm/s).
+ */
+
+#ifndef MPCTABLE_H
+#define MPCTABLE_H
+
+#include <avr/pgmspace.h>
+
+#define MPC_E_POINTS 12
+#define MPC_V_POINTS 15
+
+const int16_t MPC_E_BREAKPOINTS[MPC_E_POINTS] PROGMEM = { 0, 25, 50, 75, 100, 150, 200, 300, 400, 600, 800, 1200 };
+const int16_t MPC_V_BREAKPOINTS[MPC_V_POINTS] PROGMEM = { -300, -250, -200, -150, -100, -50, -25, 0, 25, 50, 100, 150, 200, 250, 300 };
+
+const int16_t MPC_TABLE[MPC_E_POINTS][MPC_V_POINTS] PROGMEM = {
+  {  -624,  -560,  -488,  -424,  -408,  -232,  -152,     0,   152,   232,   408,   424,   488,   560,   624 },  // e = 0
+  {  -224,  -144,     0,     0,   184,   280,   408,   440,   472,   504,   560,   624,   688,   736,   888 },  // e = 25
+  {   232,   312,   384,   472,   528,   688,   720,   744,   768,   800,   864,   920,   976,  1023,  1023 },  // e = 50
+  {   576,   648,   720,   776,   928,   984,  1016,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 75
+  {   712,   864,   928,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 100
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 150
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 200
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 300
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 400
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 600
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 800
+  {   712,   888,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023,  1023 },  // e = 1200
+};
+
+#endif
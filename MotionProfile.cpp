@@ -0,0 +1,135 @@
+/*!
+ * @file MotionProfile.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "ElevatorController.h"                            /* PROFILE_CACHE */
+#include "MotionProfile.h"
+
+ProfileEntry MotionProfile::s_table[PROFILE_PAIRS];
+
+MotionProfile::MotionProfile()                              // Constructor - No code
+{}
+
+MotionProfile::~MotionProfile()                             // Destructor - No code
+{}
+
+void MotionProfile::planTable() {
+    float vPeak, tAccel, tCruise, tDecel;
+
+    for (uint8_t a = 0; a < FLOOR_COUNT; a++) {
+        for (uint8_t b = a + 1; b < FLOOR_COUNT; b++) {
+            ProfileEntry &entry = s_table[pairIndex(a, b)];
+            plan(FLOOR_TABLE[b].setpoint - FLOOR_TABLE[a].setpoint, 0, &vPeak, &tAccel, &tCruise, &tDecel);
+            entry.vPeak = vPeak;
+            entry.tAccel = tAccel * 1000;
+            entry.tCruise = tCruise * 1000;
+        }
+    }
+}
+
+uint8_t MotionProfile::pairIndex(uint8_t a, uint8_t b) {
+    if (a > b) {
+        uint8_t t = a;
+        a = b;
+        b = t;
+    }
+    return a * (2 * FLOOR_COUNT - a - 1) / 2 + (b - a - 1);
+}
+
+// Trapezoid over 'distance' starting at v0 and ending at rest. From (vPeak^2 - v0^2) / 2a + vPeak^2 / 2a = distance the peak speed
+// is sqrt(a * distance + v0^2 / 2), capped at PROFILE_SPEED. Too close to stop at PROFILE_ACCEL, it decelerates harder from v0.
+void MotionProfile::plan(float distance, float v0, float *vPeak, float *tAccel, float *tCruise, float *tDecel) {
+    v0 = constrain(v0, 0, PROFILE_SPEED);
+    if (v0 > 0 && distance < v0 * v0 / (2.0 * PROFILE_ACCEL)) {
+        *vPeak = v0;
+        *tAccel = 0;
+        *tCruise = 0;
+        *tDecel = 2 * distance / v0;
+        return;
+    }
+    *vPeak = min(sqrt(PROFILE_ACCEL * distance + v0 * v0 / 2), (float)PROFILE_SPEED);
+    *tAccel = (*vPeak - v0) / PROFILE_ACCEL;
+    *tDecel = *vPeak / PROFILE_ACCEL;
+    *tCruise = (distance - (*vPeak * *vPeak - v0 * v0 / 2) / PROFILE_ACCEL) / *vPeak;
+}
+
+void MotionProfile::begin(uint16_t origin, uint16_t target, unsigned long now) {
+    m_origin = origin;
+    m_direction = (target > origin) ? 1 : -1;
+    m_distance = abs((int)target - (int)origin);
+    m_start = now;
+    m_running = true;
+}
+
+void MotionProfile::start(uint8_t from, uint8_t to, unsigned long now) {
+    begin(FLOOR_TABLE[from].setpoint, FLOOR_TABLE[to].setpoint, now);
+#ifdef PROFILE_CACHE
+    const ProfileEntry &entry = s_table[pairIndex(from, to)];
+    m_v0 = 0;
+    m_vPeak = entry.vPeak;
+    m_accel = PROFILE_ACCEL;
+    m_decel = PROFILE_ACCEL;
+    m_tAccel = entry.tAccel;
+    m_tCruise = entry.tCruise;
+    m_tDecel = entry.tAccel;
+#else
+    start(FLOOR_TABLE[from].setpoint, FLOOR_TABLE[to].setpoint, 0, now);
+#endif
+}
+
+void MotionProfile::start(uint16_t position, uint16_t target, float speed, unsigned long now) {
+    float vPeak, tAccel, tCruise, tDecel;
+
+    begin(position, target, now);
+    m_v0 = constrain(speed, 0, PROFILE_SPEED);
+    plan(m_distance, m_v0, &vPeak, &tAccel, &tCruise, &tDecel);
+    m_vPeak = vPeak;
+    m_accel = (tAccel > 0) ? (vPeak - m_v0) / tAccel : 0;
+    m_decel = (tDecel > 0) ? vPeak / tDecel : 0;
+    m_tAccel = tAccel * 1000;
+    m_tCruise = tCruise * 1000;
+    m_tDecel = tDecel * 1000;
+}
+
+void MotionProfile::stop() {
+    m_running = false;
+}
+
+boolean MotionProfile::sample(unsigned long now, float *position, float *velocity) {
+    float t, s, v;
+    float tCruiseEnd, tEnd;
+
+    if (!m_running) {
+        return false;
+    }
+    t = (now - m_start) / 1000.0;
+    tCruiseEnd = (m_tAccel + m_tCruise) / 1000.0;
+    tEnd = tCruiseEnd + m_tDecel / 1000.0;
+    if (t < m_tAccel / 1000.0) {
+        s = (m_v0 + 0.5 * m_accel * t) * t;
+        v = m_v0 + m_accel * t;
+    }
+    else if (t < tCruiseEnd) {
+        s = (m_v0 + m_vPeak) / 2 * (m_tAccel / 1000.0) + m_vPeak * (t - m_tAccel / 1000.0);
+        v = m_vPeak;
+    }
+    else if (t < tEnd) {
+        t = tEnd - t;                                          // Time to go - the deceleration mirrors onto the end point
+        s = m_distance - 0.5 * m_decel * t * t;
+        v = m_decel * t;
+    }
+    else {
+        s = m_distance;
+        v = 0;
+    }
+    s = min(s, m_distance);
+    *position = m_origin + m_direction * s;
+    *velocity = m_direction * v;
+    return true;
+}
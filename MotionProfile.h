@@ -0,0 +1,66 @@
+/*!
+ * @file MotionProfile.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Trapezoidal motion profile for a trip: accelerate at PROFILE_ACCEL to PROFILE_SPEED (or less on a short trip), cruise, and
+ * decelerate at PROFILE_ACCEL onto the target. The cascaded law's outer loop tracks the profile position with the profile velocity
+ * fed forward (MOTION_PROFILE in ElevatorController.h).
+ *
+ * Planning takes a square root and float divisions, so the profiles of every floor pair are planned once by planTable() and a
+ * trip from rest at a floor starts with a lookup (6 bytes per floor pair - the reverse trip uses the same entry). A trip from
+ * anywhere else - a stop added on the way while the car is moving - is planned when it starts.
+ */
+
+#ifndef MOTIONPROFILE_H
+#define MOTIONPROFILE_H
+
+#include "Arduino.h"
+#include "FloorTable.h"
+
+#define PROFILE_ACCEL 150                   // in mm/s^2
+#define PROFILE_SPEED 180                   // in mm/s - below CASCADE_MAX_SPEED so the outer loop keeps room to correct
+#define PROFILE_PAIRS (FLOOR_COUNT * (FLOOR_COUNT - 1) / 2)
+
+typedef struct {
+  int16_t vPeak;                            // in mm/s
+  uint16_t tAccel;                          // in ms - also the deceleration time, the trip starts and ends at rest
+  uint16_t tCruise;                         // in ms
+} ProfileEntry;
+
+class MotionProfile {
+public:
+  MotionProfile();                          // Constructor
+  ~MotionProfile();                         // Destructor
+  static void planTable();                  // Plan every floor pair (call once from setup())
+  void start(uint8_t from, uint8_t to, unsigned long now);                // From rest at floor 'from' - a lookup with PROFILE_CACHE
+  void start(uint16_t position, uint16_t target, float speed, unsigned long now);   // From anywhere, moving toward the target at speed (mm/s)
+  void stop();
+  boolean sample(unsigned long now, float *position, float *velocity);    // Reference at 'now' (mm, mm/s with positive up) - false if none is running
+  boolean isRunning() { return m_running; }
+
+private:
+  static ProfileEntry s_table[PROFILE_PAIRS];   // Upper triangle of the floor pair matrix, row by row
+
+  boolean m_running;
+  uint16_t m_origin;                        // in mm
+  int8_t m_direction;                       // 1 up, -1 down
+  float m_distance;                         // in mm
+  float m_v0;                               // in mm/s along the direction of travel
+  float m_vPeak;
+  float m_accel;                            // in mm/s^2
+  float m_decel;
+  uint16_t m_tAccel;                        // in ms
+  uint16_t m_tCruise;
+  uint16_t m_tDecel;
+  unsigned long m_start;                    // millis() the trip started
+
+  static uint8_t pairIndex(uint8_t a, uint8_t b);
+  static void plan(float distance, float v0, float *vPeak, float *tAccel, float *tCruise, float *tDecel);
+  void begin(uint16_t origin, uint16_t target, unsigned long now);
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*!
+ * @file Rangefinder.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Sensor independent interface for the car position sensor. Measurements are non-blocking:
+ * trigger() starts one, poll() reports when it is finished and read() fetches it.
+ */
+
+#ifndef RANGEFINDER_H
+#define RANGEFINDER_H
+
+#include "Arduino.h"
+
+// Range status (normalized across sensors)
+#define RANGE_VALID 0                       // Good measurement
+#define RANGE_SIGMA_FAIL 1                  // Measurement too noisy (estimated standard deviation above limit)
+#define RANGE_SIGNAL_FAIL 2                 // Return signal too weak
+#define RANGE_OUT_OF_BOUNDS 3               // Target outside the measurable range (phase/min range check)
+#define RANGE_HARDWARE_FAIL 4               // Laser or reference failure inside the sensor
+#define RANGE_WRAP_AROUND 5                 // Ambiguous reading from a target beyond the maximum range
+#define RANGE_NO_DATA 6                     // Nothing decoded (unknown status)
+
+typedef struct {
+  uint16_t distance;                        // in mm
+  uint8_t status;                           // RANGE_xxx
+  uint16_t signalRate;                      // Return signal rate (MCPS, 9.7 fixed point) - higher is a better return
+  uint16_t ambientRate;                     // Ambient light rate (MCPS, 9.7 fixed point)
+} RangeSample;
+
+class Rangefinder {
+public:
+  virtual ~Rangefinder() {}
+  virtual boolean begin(uint8_t i2cAddr) = 0;     // Initialize the sensor and move it to i2cAddr
+  virtual void trigger() = 0;                     // Start a single measurement
+  virtual boolean poll() = 0;                     // True once a measurement is ready to read
+  virtual void read(RangeSample &sample) = 0;     // Read the ready measurement and re-arm the sensor
+  virtual void startContinuous() = 0;             // Back-to-back measurements (poll()/read() each one)
+  virtual void stop() = 0;                        // Stop continuous measurements
+};
+
+#endif
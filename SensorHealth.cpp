@@ -0,0 +1,118 @@
+/*!
+ * @file SensorHealth.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "SensorHealth.h"
+#include <EEPROM.h>                         /* Baseline records */
+
+SensorHealth::SensorHealth()                                // Constructor - No code
+{}
+
+SensorHealth::~SensorHealth()                               // Destructor - No code
+{}
+
+void SensorHealth::setup(uint8_t slot) {
+    m_slot = slot;
+    m_errors = 0;
+    m_started = false;
+    m_warnings = 0;
+    m_learnCount = 0;
+    loadBaseline();
+}
+
+// Averages are kept scaled by 2^HEALTH_SHIFT, so avg += (x - avg) / 2^HEALTH_SHIFT becomes sum += x - sum >> HEALTH_SHIFT
+boolean SensorHealth::update(const RangeSample &sample) {
+    uint8_t before = getWarnings();
+    uint32_t signal;
+
+    m_errors += (sample.status != RANGE_VALID ? 100 : 0) - (m_errors >> HEALTH_SHIFT);
+    if (sample.status == RANGE_VALID) {
+        signal = min(sample.signalRate * sq(sample.distance / 100.0), 65535.0);   // Return of the target moved to 100 mm
+        if (!m_started) {
+            m_signal = signal << HEALTH_SHIFT;
+            m_ambient = (uint32_t)sample.ambientRate << HEALTH_SHIFT;
+            m_started = true;
+        }
+        m_signal += signal - (m_signal >> HEALTH_SHIFT);
+        m_ambient += sample.ambientRate - (m_ambient >> HEALTH_SHIFT);
+        if (!m_learned && ++m_learnCount >= HEALTH_LEARN) {
+            m_baseline.signal = m_signal >> HEALTH_SHIFT;
+            m_baseline.ambient = m_ambient >> HEALTH_SHIFT;
+            m_learned = true;
+            saveBaseline();
+        }
+    }
+
+    if (m_learned) {
+        m_warnings = threshold(m_warnings & HEALTH_WARN_SIGNAL, m_signal, (uint32_t)m_baseline.signal * HEALTH_SIGNAL_WARN / 100, false)
+                   ? (m_warnings | HEALTH_WARN_SIGNAL) : (m_warnings & ~HEALTH_WARN_SIGNAL);
+        m_warnings = threshold(m_warnings & HEALTH_WARN_AMBIENT, m_ambient, (uint32_t)m_baseline.ambient * HEALTH_AMBIENT_WARN / 100 + HEALTH_AMBIENT_FLOOR, true)
+                   ? (m_warnings | HEALTH_WARN_AMBIENT) : (m_warnings & ~HEALTH_WARN_AMBIENT);
+    }
+    m_warnings = threshold(m_warnings & HEALTH_WARN_ERRORS, m_errors, HEALTH_ERROR_WARN, true)
+               ? (m_warnings | HEALTH_WARN_ERRORS) : (m_warnings & ~HEALTH_WARN_ERRORS);
+    return getWarnings() != before;
+}
+
+// Compare a scaled average against an unscaled limit - a raised warning holds until the value is HEALTH_HYSTERESIS back inside
+boolean SensorHealth::threshold(boolean warning, uint32_t value, uint32_t limit, boolean above) {
+    limit <<= HEALTH_SHIFT;
+    if (warning) {
+        limit = above ? limit - limit / 100 * HEALTH_HYSTERESIS : limit + limit / 100 * HEALTH_HYSTERESIS;
+    }
+    return above ? value > limit : value < limit;
+}
+
+void SensorHealth::relearn() {
+    m_learned = false;
+    m_learnCount = 0;
+    m_warnings &= ~(HEALTH_WARN_SIGNAL | HEALTH_WARN_AMBIENT);
+    EEPROM.update(HEALTH_EEPROM + m_slot * sizeof(HealthRecord), 0);   // A reset before the new baseline is learned must not bring the old one back
+}
+
+uint8_t SensorHealth::getSignal() {
+    return m_learned ? percent(m_signal, m_baseline.signal) : 0;
+}
+
+uint8_t SensorHealth::getAmbient() {
+    return m_learned ? percent(m_ambient, m_baseline.ambient) : 0;
+}
+
+uint8_t SensorHealth::getErrors() {
+    return m_errors >> HEALTH_SHIFT;
+}
+
+uint8_t SensorHealth::percent(uint32_t value, uint16_t baseline) {
+    if (baseline == 0) {
+        return value ? 255 : 100;
+    }
+    return min((value >> HEALTH_SHIFT) * 100 / baseline, 255UL);
+}
+
+// The stored baseline - a blank or corrupt record starts learning
+void SensorHealth::loadBaseline() {
+    EEPROM.get(HEALTH_EEPROM + m_slot * sizeof(HealthRecord), m_baseline);
+    m_learned = m_baseline.magic == HEALTH_MAGIC && m_baseline.check == checksum(m_baseline);
+}
+
+void SensorHealth::saveBaseline() {
+    m_baseline.magic = HEALTH_MAGIC;
+    m_baseline.check = checksum(m_baseline);
+    EEPROM.put(HEALTH_EEPROM + m_slot * sizeof(HealthRecord), m_baseline);
+}
+
+uint8_t SensorHealth::checksum(const HealthRecord &record) {
+    const uint8_t *p = (const uint8_t *)&record;
+    uint8_t sum = 0;
+
+    for (uint8_t i = 0; i < sizeof(record.magic) + sizeof(record.signal) + sizeof(record.ambient); i++) {
+        sum += p[i];
+    }
+    return sum;
+}
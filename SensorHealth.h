@@ -0,0 +1,77 @@
+/*!
+ * @file SensorHealth.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Slow trend of the rangefinder's health for predictive maintenance. Every sample updates three exponentially weighted averages (one
+ * shift and add each): the return signal rate scaled by the square of the range (a target's return falls off with distance, so the car's
+ * position mostly drops out), the ambient rate, and the share of samples with a failed status. A dirty or misaligned lens shows up as the
+ * return sinking below the baseline learned when the sensor was last serviced long before the ranges start to fail; a light leak into the
+ * shaft as the ambient rate climbing. A crossed threshold raises a warning (HEALTH_WARN_xxx), which clears HEALTH_HYSTERESIS back inside.
+ * See tools/health_sim.py for the detection lead time on simulated degradation.
+ */
+
+#ifndef SENSORHEALTH_H
+#define SENSORHEALTH_H
+
+#include "Arduino.h"
+#include "Rangefinder.h"
+
+#define HEALTH_SHIFT 8                      // Weight of the newest sample is 1 / 2^HEALTH_SHIFT (256 samples - about 26 s at CONTROL_PERIOD_MS)
+#define HEALTH_LEARN 1024                   // Valid samples before the averages are taken as the baseline (4 time constants)
+#define HEALTH_SIGNAL_WARN 75               // in % of the baseline return
+#define HEALTH_AMBIENT_WARN 300             // in % of the baseline ambient rate ...
+#define HEALTH_AMBIENT_FLOOR 64             // ... plus this much (MCPS, 9.7 fixed point - 0.5 MCPS), so a dark shaft does not warn on any light
+#define HEALTH_ERROR_WARN 5                 // in % of samples with a failed status
+#define HEALTH_HYSTERESIS 10                // in % of the threshold - a warning clears this far back inside it
+#define HEALTH_REPORT_MS 60000              // in ms - [HEALTH] record and HEALTH frame interval (and at once when a warning is raised or cleared)
+#define HEALTH_EEPROM 32                    // EEPROM address of the first car's baseline record - after the sensor calibration records (SENSOR_CAL_EEPROM)
+#define HEALTH_MAGIC 0xA7                   // First byte of a written record - a blank EEPROM reads 0xFF
+
+// Warning bits
+#define HEALTH_WARN_SIGNAL 0x01             // Return below HEALTH_SIGNAL_WARN - clean or realign the sensor
+#define HEALTH_WARN_AMBIENT 0x02            // Ambient light above HEALTH_AMBIENT_WARN
+#define HEALTH_WARN_ERRORS 0x04             // Failed statuses above HEALTH_ERROR_WARN
+#define HEALTH_LEARNING 0x80                // No baseline yet - the signal and ambient warnings are off
+
+typedef struct {
+  uint8_t magic;                            // HEALTH_MAGIC
+  uint16_t signal;                          // Baseline return (MCPS at 100 mm, 9.7 fixed point)
+  uint16_t ambient;                         // Baseline ambient rate (MCPS, 9.7 fixed point)
+  uint8_t check;                            // Sum of the bytes before it
+} HealthRecord;
+
+class SensorHealth {
+public:
+  SensorHealth();                           // Constructor
+  ~SensorHealth();                          // Destructor
+  void setup(uint8_t slot);                 // slot - EEPROM baseline record (the car's index)
+  boolean update(const RangeSample &sample);    // Add a sample - returns true when the warnings changed
+  void relearn();                           // Drop the baseline and learn a new one (after the sensor has been serviced)
+  uint8_t getWarnings() { return m_warnings | (m_learned ? 0 : HEALTH_LEARNING); }   // HEALTH_xxx bits
+  uint8_t getSignal();                      // Return in % of the baseline (255 at most, 0 while learning)
+  uint8_t getAmbient();                     // Ambient rate in % of the baseline (255 at most, 0 while learning)
+  uint8_t getErrors();                      // Failed statuses in %
+
+private:
+  uint8_t m_slot;
+  uint32_t m_signal;                        // Averages scaled by 2^HEALTH_SHIFT
+  uint32_t m_ambient;
+  uint32_t m_errors;                        // Of 100 per failed sample
+  boolean m_started;                        // The signal and ambient averages hold a sample
+  boolean m_learned;                        // m_baseline is set
+  uint16_t m_learnCount;                    // Valid samples toward the baseline
+  HealthRecord m_baseline;
+  uint8_t m_warnings;
+
+  static uint8_t percent(uint32_t value, uint16_t baseline);
+  static boolean threshold(boolean warning, uint32_t value, uint32_t limit, boolean above);
+  void loadBaseline();
+  void saveBaseline();
+  static uint8_t checksum(const HealthRecord &record);
+};
+
+#endif
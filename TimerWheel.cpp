@@ -0,0 +1,216 @@
+/*!
+ * @file TimerWheel.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "TimerWheel.h"
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_SPAN ((uint32_t)1 << (TIMER_SLOT_BITS * TIMER_LEVELS))   // Ticks the wheel holds
+
+TimerWheel::TimerWheel()                                    // Constructor - No code
+{}
+
+TimerWheel::~TimerWheel()                                   // Destructor - No code
+{}
+
+void TimerWheel::setup() {
+    uint8_t sreg = SREG;                                    // Save and restore the interrupt state rather than enable interrupts blindly
+    cli();
+    clear();
+    SREG = sreg;
+}
+
+void TimerWheel::clear() {
+    m_now = 0;
+    for (uint8_t i = 0; i < TIMER_LEVELS * TIMER_SLOTS; i++) {
+        m_slots[i] = TIMER_NONE;
+    }
+    for (uint8_t i = 0; i < TIMER_COUNT; i++) {
+        m_timers[i].slot = TIMER_NONE;
+    }
+    for (uint8_t i = 0; i < sizeof(m_expired); i++) {
+        m_expired[i] = 0;
+    }
+}
+
+// Run the slot of this tick - after cascading the next slot of level 1 when level 0 wraps (and of level 2 when level 1 wraps, ...)
+void TimerWheel::tick() {
+    uint8_t index = m_now & TIMER_MASK;
+
+    if (index == 0) {
+        for (uint8_t level = 1; level < TIMER_LEVELS; level++) {
+            uint8_t slot = (m_now >> (TIMER_SLOT_BITS * level)) & TIMER_MASK;
+            cascade(level * TIMER_SLOTS + slot);
+            if (slot != 0) {
+                break;
+            }
+        }
+    }
+
+    uint8_t id = m_slots[index];
+    m_slots[index] = TIMER_NONE;                            // The whole list is due - detach it and walk it
+    while (id != TIMER_NONE) {
+        WheelTimer &timer = m_timers[id];
+        uint8_t next = timer.next;
+        m_expired[id >> 3] |= 1 << (id & 7);
+        if (timer.period) {
+            timer.expires += timer.period;                  // From when it was due, so a periodic timer does not drift
+            insert(id);
+        }
+        else {
+            timer.slot = TIMER_NONE;
+        }
+        id = next;
+    }
+    m_now++;
+}
+
+// Re-insert every timer of a higher level slot by the ticks it has left
+void TimerWheel::cascade(uint8_t slot) {
+    uint8_t id = m_slots[slot];
+
+    m_slots[slot] = TIMER_NONE;
+    while (id != TIMER_NONE) {
+        uint8_t next = m_timers[id].next;
+        insert(id);
+        id = next;
+    }
+}
+
+// Link the timer into the slot its expiry falls in - the lowest level whose span covers the ticks it has left
+void TimerWheel::insert(uint8_t id) {
+    WheelTimer &timer = m_timers[id];
+    uint32_t expires = timer.expires;
+    uint32_t delta = expires - m_now;
+    uint8_t slot;
+
+    if (delta >= TIMER_SPAN) {
+        expires = m_now + TIMER_SPAN - 1;                   // Beyond the wheel - wait in the last slot and come back down from there
+        delta = TIMER_SPAN - 1;
+    }
+    uint8_t level = 0;
+    while (delta >= ((uint32_t)1 << (TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    slot = level * TIMER_SLOTS + ((expires >> (TIMER_SLOT_BITS * level)) & TIMER_MASK);
+
+    timer.slot = slot;
+    timer.prev = TIMER_NONE;
+    timer.next = m_slots[slot];
+    if (timer.next != TIMER_NONE) {
+        m_timers[timer.next].prev = id;
+    }
+    m_slots[slot] = id;
+}
+
+void TimerWheel::unlink(uint8_t id) {
+    WheelTimer &timer = m_timers[id];
+
+    if (timer.prev != TIMER_NONE) {
+        m_timers[timer.prev].next = timer.next;
+    }
+    else {
+        m_slots[timer.slot] = timer.next;
+    }
+    if (timer.next != TIMER_NONE) {
+        m_timers[timer.next].prev = timer.prev;
+    }
+    timer.slot = TIMER_NONE;
+}
+
+// Due on the ticks-th tick from now - the current tick period is partly gone, so the wait is ticks - 1 to ticks periods
+void TimerWheel::start(uint8_t id, uint16_t ticks, uint16_t period) {
+    if (id >= TIMER_COUNT) {
+        return;
+    }
+    uint8_t sreg = SREG;
+    cli();
+    if (m_timers[id].slot != TIMER_NONE) {
+        unlink(id);
+    }
+    m_timers[id].expires = m_now + (ticks ? ticks : 1) - 1; // m_now is the next tick to run
+    m_timers[id].period = period;
+    m_expired[id >> 3] &= ~(1 << (id & 7));
+    insert(id);
+    SREG = sreg;
+}
+
+void TimerWheel::cancel(uint8_t id) {
+    if (id >= TIMER_COUNT) {
+        return;
+    }
+    uint8_t sreg = SREG;
+    cli();
+    if (m_timers[id].slot != TIMER_NONE) {
+        unlink(id);
+    }
+    m_expired[id >> 3] &= ~(1 << (id & 7));
+    SREG = sreg;
+}
+
+boolean TimerWheel::expired(uint8_t id) {
+    uint8_t mask = 1 << (id & 7);
+    uint8_t sreg = SREG;
+    cli();                                                  // Test and clear in one go - the tick may set the flag in between otherwise
+    boolean set = (m_expired[id >> 3] & mask) != 0;
+    m_expired[id >> 3] &= ~mask;
+    SREG = sreg;
+    return set;
+}
+
+boolean TimerWheel::pending(uint8_t id) {
+    return (m_expired[id >> 3] & (1 << (id & 7))) != 0;     // One byte - no need to hold off the tick
+}
+
+boolean TimerWheel::isRunning(uint8_t id) {
+    uint8_t sreg = SREG;
+    cli();
+    boolean running = m_timers[id].slot != TIMER_NONE;
+    SREG = sreg;
+    return running;
+}
+
+uint32_t TimerWheel::now() {
+    uint8_t sreg = SREG;
+    cli();                                                  // 4 bytes - copy it without the tick writing halfway
+    uint32_t ticks = m_now;
+    SREG = sreg;
+    return ticks;
+}
+
+#ifdef TIMER_BENCHMARK
+// For 16, 32 .. TIMER_COUNT timers: every timer periodic with a different period, so slots hold several timers and the cascades carry
+// some - ticks run back to back
+void TimerWheel::benchmark() {
+    char msg[64];
+    uint16_t ticks = 4 * TIMER_SLOTS * TIMER_SLOTS;         // Four turns of level 1
+
+    for (uint8_t count = 16; count <= TIMER_COUNT; count += 16) {
+        unsigned long total = 0;
+        unsigned long worst = 0;
+
+        clear();
+        for (uint8_t i = 0; i < count; i++) {
+            start(i, 1 + i, 7 + 13 * i);
+        }
+        for (uint16_t i = 0; i < ticks; i++) {
+            unsigned long began = micros();
+            tick();
+            unsigned long us = micros() - began;            // micros() counts in 4 us steps on a 16 MHz UNO
+            total += us;
+            if (us > worst) {
+                worst = us;
+            }
+        }
+        sprintf(msg, "[TIMER] %u,%u,%lu,%lu", count, ticks, total / ticks, worst);   // timers,ticks,avg_us,max_us
+        Serial.println(msg);
+    }
+    clear();
+}
+#endif
@@ -0,0 +1,81 @@
+/*!
+ * @file TimerWheel.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Software timers on the one Timer1 interrupt. The interrupt calls tick() every TIMER_TICK_MS; a timer started for n ticks has its
+ * expired flag set by the tick n ticks later (and again every period for a periodic one), and the loop takes the flag with expired().
+ * Nothing runs in the interrupt but the wheel itself.
+ *
+ * Hierarchical wheel (as the classic Linux timer wheel): TIMER_LEVELS levels of TIMER_SLOTS slots, each slot a doubly linked list of
+ * timers. Level 0 holds the timers due within TIMER_SLOTS ticks, one slot per tick; level n the timers due within TIMER_SLOTS^(n+1)
+ * ticks, one slot per TIMER_SLOTS^n ticks. Every tick runs one level 0 slot; when level 0 wraps, the next level 1 slot is cascaded down
+ * (its timers re-inserted by the ticks they have left), and so on up. Start and cancel are O(1); a tick is O(timers in the slot), plus
+ * the timers cascaded every TIMER_SLOTS ticks. Delays beyond the wheel wait in the top level and are re-inserted until they fit.
+ * See tools/timer_wheel.py for the tick cost against a scan of every timer.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "Arduino.h"
+
+#define TIMER_TICK_MS 10                    // in ms - Timer1 compare match period
+#define TIMER_OCR (F_CPU / 64 / 1000 * TIMER_TICK_MS - 1)   // Compare value with the prescaler at 64 (2499 at 16 MHz)
+//#define TIMER_BENCHMARK                   // Print "[TIMER] timers,ticks,avg_us,max_us" - the tick cost with 16, 32 .. TIMER_BENCHMARK_COUNT timers
+                                            // running - at start-up (uncomment)
+#define TIMER_BENCHMARK_COUNT 48            // Largest pool the benchmark runs
+#ifdef TIMER_BENCHMARK
+#define TIMER_COUNT TIMER_BENCHMARK_COUNT   // The benchmark build takes the RAM for its pool
+#else
+#define TIMER_COUNT 16                      // Timers (ids 0 .. TIMER_COUNT - 1) - 10 bytes each
+#endif
+#define TIMER_SLOT_BITS 5
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)  // Slots per level
+#define TIMER_LEVELS 3                      // Delays up to TIMER_SLOTS^3 ticks (327 s at TIMER_TICK_MS) go straight into the wheel
+#define TIMER_NONE 0xFF                     // End of a slot's list
+#define TIMER_TICKS(ms) (((ms) + TIMER_TICK_MS - 1) / TIMER_TICK_MS)   // Ticks in ms (rounded up)
+static_assert(TIMER_COUNT < TIMER_NONE, "timer ids are bytes");
+
+typedef struct {
+  uint32_t expires;                         // Tick the timer is due at
+  uint16_t period;                          // in ticks - 0 for a one-shot timer
+  uint8_t next;                             // Slot list links (TIMER_NONE at the ends)
+  uint8_t prev;
+  uint8_t slot;                             // level * TIMER_SLOTS + slot holding the timer, TIMER_NONE while stopped
+} WheelTimer;
+
+class TimerWheel {
+public:
+  TimerWheel();                             // Constructor
+  ~TimerWheel();                            // Destructor
+  void setup();                             // Stop every timer - ElevatorController::initializeTimer() then starts the tick: Timer1 in CTC mode,
+                                            // prescaler 64, OCR1A = TIMER_OCR (2499 for 10 ms at 16 MHz)
+  void tick();                              // From the Timer1 interrupt only
+  void start(uint8_t id, uint16_t ticks, uint16_t period = 0);   // Due in ticks (at least 1), then every period ticks if period is not 0 -
+                                                                 // restarts a running timer and clears its expired flag
+  void cancel(uint8_t id);                  // Stop the timer and clear its expired flag
+  boolean expired(uint8_t id);              // True once per expiry (a periodic timer that expired twice in between reports it once)
+  boolean pending(uint8_t id);              // The expired flag without taking it
+  boolean isRunning(uint8_t id);
+  uint32_t now();                           // Ticks since setup()
+#ifdef TIMER_BENCHMARK
+  void benchmark();                         // Print the tick cost for each pool size - before the Timer1 tick is started
+#endif
+
+private:
+  WheelTimer m_timers[TIMER_COUNT];
+  uint8_t m_slots[TIMER_LEVELS * TIMER_SLOTS];   // First timer of each slot's list
+  volatile uint8_t m_expired[(TIMER_COUNT + 7) / 8];   // Expired flags - set by tick(), taken by expired()
+  uint32_t m_now;                           // Next tick to run
+
+  void insert(uint8_t id);
+  void unlink(uint8_t id);
+  void cascade(uint8_t level);
+  void clear();
+};
+
+#endif
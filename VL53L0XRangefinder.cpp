@@ -0,0 +1,153 @@
+/*!
+ * @file VL53L0XRangefinder.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "VL53L0XRangefinder.h"
+
+VL53L0XRangefinder::VL53L0XRangefinder()                    // Constructor - uncalibrated until setCalibration()
+{
+    m_cal.offset = 0;
+    m_cal.crosstalk = 0;
+}
+
+VL53L0XRangefinder::~VL53L0XRangefinder()                   // Destructor - No code
+{}
+
+boolean VL53L0XRangefinder::begin(uint8_t i2cAddr) {
+    if (!sensor.begin(i2cAddr)) {
+        return false;                                       // Not found, or its reference initialization failed
+    }
+    sensor.setMode(Single, Low);                            // Single measurements in Low (+- 1 mm) precision mode
+    return true;
+}
+
+// Single shot: start() returns once the device has accepted the start command, the result arrives one timing budget later
+void VL53L0XRangefinder::trigger() {
+    sensor.start();
+}
+
+boolean VL53L0XRangefinder::poll() {
+    return sensor.isDataReady();
+}
+
+void VL53L0XRangefinder::read(RangeSample &sample) {
+    const VL53L0X_DetailedData_t &data = sensor.readResult();
+
+    sample.status = mapStatus(data.status);
+    sample.distance = correct(rawRange(data), data.signalCount, data.spadCount, m_cal, &sample.status);
+    sample.signalRate = data.signalCount;
+    sample.ambientRate = data.ambientCount;
+    sensor.clearInterrupt();
+}
+
+void VL53L0XRangefinder::startContinuous() {
+    sensor.setMode(Continuous, Low);                        // Back-to-back ranging
+    sensor.start();
+}
+
+void VL53L0XRangefinder::stop() {
+    sensor.stop();
+    sensor.setMode(Single, Low);
+}
+
+// Range in 1/4 mm whatever the precision mode
+uint16_t VL53L0XRangefinder::rawRange(const VL53L0X_DetailedData_t &data) {
+    return (data.precision == High) ? data.distance : data.distance * 4;
+}
+
+// Offset, then crosstalk as in ST's VL53L0X_GetRangingMeasurementData(): the signal rate (9.7) includes the crosstalk, whose total is the
+// per SPAD rate (0.16) times the effective SPAD count (8.8). In float - a weak return far down the shaft is a few dozen 9.7 steps, so a
+// crosstalk total truncated to 9.7 as in ST's code would be off by several percent. A return that is all crosstalk is a signal fail.
+uint16_t VL53L0XRangefinder::correct(uint16_t range4, uint16_t signalRate, uint16_t spadCount, const VL53L0XCalibration &cal, uint8_t *status) {
+    float r = max((int32_t)range4 + cal.offset, (int32_t)0);
+
+    if (cal.crosstalk != 0) {
+        float crosstalk = (float)cal.crosstalk * spadCount / 131072.0;    // 16 + 8 - 7 fractional bits to 9.7
+        if (crosstalk >= signalRate) {
+            if (*status == RANGE_VALID) {
+                *status = RANGE_SIGNAL_FAIL;
+            }
+            return range4 / 4;
+        }
+        r = r * signalRate / (signalRate - crosstalk);
+    }
+    return min(r / 4 + 0.5, 65535.0);
+}
+
+// One blocking measurement for a calibration: raw range (mm), signal rate (MCPS) and effective SPADs - returns its RANGE_xxx status
+uint8_t VL53L0XRangefinder::measure(float *range, float *signal, float *spads) {
+    unsigned long start = millis();
+    unsigned long timeout = sensor.timingBudget() / 1000 + VL53L0X_CAL_MARGIN_MS;   // ProfileHighAccuracy takes 200 ms a measurement
+
+    trigger();
+    while (!poll()) {
+        if (millis() - start > timeout) {
+            return RANGE_NO_DATA;
+        }
+    }
+    const VL53L0X_DetailedData_t &data = sensor.readResult();
+    *range = rawRange(data) / 4.0;
+    *signal = data.signalCount / 128.0;
+    *spads = data.spadCount / 256.0;
+    sensor.clearInterrupt();
+    return mapStatus(data.status);
+}
+
+// Offset that brings the crosstalk corrected range onto 'distance': distance * (S - X) / S - raw, averaged
+boolean VL53L0XRangefinder::calibrateOffset(uint16_t distance) {
+    float range, signal, spads, crosstalk;
+    float sum = 0;
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < VL53L0X_CAL_SAMPLES; i++) {
+        if (measure(&range, &signal, &spads) != RANGE_VALID || signal <= 0) {
+            continue;
+        }
+        crosstalk = m_cal.crosstalk / 65536.0 * spads;
+        sum += distance * (signal - crosstalk) / signal - range;
+        n++;
+    }
+    if (n < VL53L0X_CAL_SAMPLES / 2) {
+        return false;
+    }
+    m_cal.offset = constrain(sum / n * 4, -2048, 2047);          // ST's part-to-part range offset is 12 bits signed
+    return true;
+}
+
+// Crosstalk per SPAD that brings the offset corrected range onto 'distance': S * (1 - (raw + offset) / distance) / SPADs, averaged
+boolean VL53L0XRangefinder::calibrateCrosstalk(uint16_t distance) {
+    float range, signal, spads;
+    float sum = 0;
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < VL53L0X_CAL_SAMPLES; i++) {
+        if (measure(&range, &signal, &spads) != RANGE_VALID || spads <= 0) {
+            continue;
+        }
+        sum += signal * (1 - (range + m_cal.offset / 4.0) / distance) / spads;
+        n++;
+    }
+    if (n < VL53L0X_CAL_SAMPLES / 2) {
+        return false;
+    }
+    m_cal.crosstalk = constrain(sum / n * 65536, 0, 65535);      // A target reading long means no crosstalk to remove
+    return true;
+}
+
+// Device range status (RESULT_RANGE_STATUS bits 6:3) to RANGE_xxx, following ST's VL53L0X_get_pal_range_status()
+uint8_t VL53L0XRangefinder::mapStatus(uint8_t deviceStatus) {
+    switch (deviceStatus) {
+        case 11: return RANGE_VALID;
+        case 1: case 2: case 3: return RANGE_HARDWARE_FAIL;    // VCSEL continuity/watchdog, no VHV value
+        case 4: case 5: return RANGE_SIGNAL_FAIL;              // MSRC no target, SNR check
+        case 7: return RANGE_SIGMA_FAIL;
+        case 6: case 8: case 9: case 10: case 12: case 13: return RANGE_OUT_OF_BOUNDS;   // phase, TCC, min clip, algo under/overflow
+        default: return RANGE_NO_DATA;
+    }
+}
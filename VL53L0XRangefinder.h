@@ -0,0 +1,58 @@
+/*!
+ * @file VL53L0XRangefinder.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * Rangefinder interface on top of DFRobot's VL53L0X driver
+ *
+ * Calibration (ST's offset and crosstalk calibrations, applied on the host side): the crosstalk return off the cover glass sits at zero
+ * range and pulls the measured range toward it in proportion to its share of the signal, and the part-to-part offset shifts every range.
+ * read() reports (range + offset) * signal / (signal - crosstalk per SPAD * effective SPADs). calibrateOffset() and calibrateCrosstalk()
+ * average VL53L0X_CAL_SAMPLES ranges of a target held at a known distance - offset on a white target close in where crosstalk is a small
+ * share of the return, crosstalk on a grey target further out, then the offset again. tools/calibration.py checks the correction math.
+ */
+
+#ifndef VL53L0XRANGEFINDER_H
+#define VL53L0XRANGEFINDER_H
+
+#include "Rangefinder.h"
+#include "DFRobot_VL53L0X.h"                /* Laser rangefinder functions */
+
+#define VL53L0X_CAL_SAMPLES 32              // Measurements averaged by a calibration
+#define VL53L0X_CAL_MARGIN_MS 50            // Longest wait for one of them is the active timing budget plus this
+
+typedef struct {
+  int16_t offset;                           // in 1/4 mm - added to the range
+  uint16_t crosstalk;                       // Crosstalk rate per SPAD (MCPS, 16 fractional bits - the fraction of ST's FixPoint1616)
+} VL53L0XCalibration;
+
+class VL53L0XRangefinder : public Rangefinder {
+public:
+  VL53L0XRangefinder();                     // Constructor
+  ~VL53L0XRangefinder();                    // Destructor
+  boolean begin(uint8_t i2cAddr);
+  void trigger();
+  boolean poll();
+  void read(RangeSample &sample);
+  void startContinuous();
+  void stop();
+  boolean calibrateOffset(uint16_t distance);     // Target at 'distance' mm - false if too few valid measurements
+  boolean calibrateCrosstalk(uint16_t distance);
+  void setCalibration(const VL53L0XCalibration &cal) { m_cal = cal; }
+  const VL53L0XCalibration &getCalibration() { return m_cal; }
+  static uint16_t correct(uint16_t range4, uint16_t signalRate, uint16_t spadCount, const VL53L0XCalibration &cal, uint8_t *status);   // range4 in 1/4 mm, result in mm
+
+  DFRobotVL53L0X sensor;                    // VL53L0X driver (for the sensor specific settings - profiles, precision)
+
+private:
+  VL53L0XCalibration m_cal;
+
+  static uint8_t mapStatus(uint8_t deviceStatus);
+  static uint16_t rawRange(const VL53L0X_DetailedData_t &data);
+  uint8_t measure(float *range, float *signal, float *spads);
+};
+
+#endif
@@ -0,0 +1,257 @@
+/*!
+ * @file VL53L1X.cpp
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ */
+
+#include "VL53L1X.h"
+
+#define VL53L1X_IO_2V8                      // Module is supplied at 2V8 (I2C pads pulled up to AVDD)
+
+// ULD default configuration for registers 0x2D..0x87. Ranging is left stopped, interrupt is "new sample ready".
+static const uint8_t DEFAULT_CONFIG[] PROGMEM = {
+  0x00, 0x00, 0x00, 0x01, 0x02, 0x00, 0x02, 0x08,     // 0x2D: I2C/GPIO pad config, 0x30: GPIO active high, 0x31: data ready flag
+  0x00, 0x08, 0x10, 0x01, 0x01, 0x00, 0x00, 0x00,     // 0x35
+  0x00, 0xFF, 0x00, 0x0F, 0x00, 0x00, 0x00, 0x00,     // 0x3D
+  0x00, 0x20, 0x0B, 0x00, 0x00, 0x02, 0x0A, 0x21,     // 0x45: 0x46 interrupt on new sample
+  0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0xC8,     // 0x4D
+  0x00, 0x00, 0x38, 0xFF, 0x01, 0x00, 0x08, 0x00,     // 0x55
+  0x00, 0x01, 0xCC, 0x0F, 0x01, 0xF1, 0x0D, 0x01,     // 0x5D: 0x5E..0x63 long mode 100 ms timeouts/VCSEL periods, 0x64 sigma threshold
+  0x68, 0x00, 0x80, 0x08, 0xB8, 0x00, 0x00, 0x00,     // 0x65: 0x66 min count rate
+  0x00, 0x0F, 0x89, 0x00, 0x00, 0x00, 0x00, 0x00,     // 0x6D: 0x6D..0x6F intermeasurement period (LSBs)
+  0x00, 0x00, 0x01, 0x0F, 0x0D, 0x0E, 0x0E, 0x00,     // 0x75
+  0x00, 0x02, 0xC7, 0xFF, 0x9B, 0x00, 0x00, 0x00,     // 0x7D: 0x7F ROI centre, 0x80 ROI size (16x16)
+  0x01, 0x00, 0x00                                    // 0x85: 0x86 interrupt clear, 0x87 mode start (stopped)
+};
+static_assert(sizeof(DEFAULT_CONFIG) == VL53L1X_SYSTEM_MODE_START - VL53L1X_DEFAULT_CONFIG_START + 1, "VL53L1X default configuration must cover 0x2D..0x87");
+
+// Timing budget -> RANGE_CONFIG_TIMEOUT_MACROP_A/B (ULD VL53L1X_SetTimingBudgetInMs()), 0 where the mode does not support the budget
+typedef struct {
+  uint16_t budgetMs;
+  uint16_t shortA, shortB;
+  uint16_t longA, longB;
+} VL53L1XTiming;
+
+static const VL53L1XTiming TIMING_TABLE[] PROGMEM = {
+  {  15, 0x001D, 0x0027, 0x0000, 0x0000 },
+  {  20, 0x0051, 0x006E, 0x001E, 0x0022 },
+  {  33, 0x00D6, 0x006E, 0x0060, 0x006E },
+  {  50, 0x01AE, 0x01E8, 0x00AD, 0x00C6 },
+  { 100, 0x02E1, 0x0388, 0x01CC, 0x01EA },
+  { 200, 0x03E1, 0x0496, 0x02D9, 0x02F8 },
+  { 500, 0x0591, 0x05C1, 0x048F, 0x04A4 },
+};
+#define TIMING_ENTRIES (sizeof(TIMING_TABLE) / sizeof(TIMING_TABLE[0]))
+
+VL53L1X::VL53L1X()                                          // Constructor
+: m_addr(VL53L1X_I2C_ADDR), m_intPolarity(1), m_mode(DistanceLong), m_budgetMs(100)
+{}
+
+VL53L1X::~VL53L1X()                                         // Destructor - No code
+{}
+
+boolean VL53L1X::begin(uint8_t i2cAddr) {
+    unsigned long start = millis();
+
+    m_addr = VL53L1X_I2C_ADDR;
+    while (readReg(VL53L1X_FIRMWARE_SYSTEM_STATUS) != 0x01) {             // Wait for the device firmware to boot
+        if (millis() - start > VL53L1X_IO_TIMEOUT) {
+            return false;
+        }
+    }
+    if (readReg16(VL53L1X_IDENTIFICATION_MODEL_ID) != VL53L1X_MODEL_ID) {
+        return false;
+    }
+    writeReg(VL53L1X_I2C_SLAVE_DEVICE_ADDRESS, i2cAddr & 0x7F);
+    m_addr = i2cAddr & 0x7F;
+
+    writeBlock_P(VL53L1X_DEFAULT_CONFIG_START, DEFAULT_CONFIG, sizeof(DEFAULT_CONFIG));
+#ifdef VL53L1X_IO_2V8
+    writeReg(VL53L1X_PAD_I2C_HV_EXTSUP_CONFIG, readReg(VL53L1X_PAD_I2C_HV_EXTSUP_CONFIG) | 0x01);
+#endif
+    m_intPolarity = !((readReg(VL53L1X_GPIO_HV_MUX_CTRL) & 0x10) >> 4);
+
+    // One measurement to run the VHV calibration, then skip it on every later measurement (ULD VL53L1X_SensorInit())
+    writeReg(VL53L1X_SYSTEM_MODE_START, VL53L1X_MODE_TIMED);
+    start = millis();
+    while (!poll()) {
+        if (millis() - start > VL53L1X_IO_TIMEOUT) {
+            return false;
+        }
+    }
+    clearInterrupt();
+    stop();
+    writeReg(VL53L1X_VHV_CONFIG_TIMEOUT_MACROP_LOOP_BOUND, 0x09);
+    writeReg(VL53L1X_VHV_CONFIG_INIT, 0x00);
+
+    m_mode = DistanceLong;                                  // What the default configuration programs
+    m_budgetMs = 100;
+    return true;
+}
+
+void VL53L1X::trigger() {
+    writeReg(VL53L1X_SYSTEM_MODE_START, VL53L1X_MODE_SINGLESHOT);
+}
+
+boolean VL53L1X::poll() {
+    return (readReg(VL53L1X_GPIO_TIO_HV_STATUS) & 0x01) == m_intPolarity;
+}
+
+// Status, ambient, signal and distance come from one 17 byte read (ULD VL53L1X_GetResult())
+void VL53L1X::read(RangeSample &sample) {
+    uint8_t buf[VL53L1X_RESULT_LEN];
+
+    readBlock(VL53L1X_RESULT_RANGE_STATUS, buf, VL53L1X_RESULT_LEN);
+    sample.status = mapStatus(buf[0] & 0x1F);
+    sample.ambientRate = ((uint16_t)buf[7] << 8) | buf[8];
+    sample.distance = ((uint16_t)buf[13] << 8) | buf[14];
+    sample.signalRate = ((uint16_t)buf[15] << 8) | buf[16];
+    clearInterrupt();
+}
+
+// Timed ranging with the inter-measurement period equal to the timing budget (back-to-back)
+void VL53L1X::startContinuous() {
+    uint16_t clockPll = readReg16(VL53L1X_RESULT_OSC_CALIBRATE_VAL) & 0x3FF;
+
+    writeReg32(VL53L1X_SYSTEM_INTERMEASUREMENT_PERIOD, (uint32_t)(clockPll * m_budgetMs * 1.075));
+    writeReg(VL53L1X_SYSTEM_MODE_START, VL53L1X_MODE_TIMED);
+}
+
+void VL53L1X::stop() {
+    writeReg(VL53L1X_SYSTEM_MODE_START, VL53L1X_MODE_STOP);
+}
+
+// The macro period depends on the VCSEL periods, so the timing budget is re-applied for the new mode
+boolean VL53L1X::setDistanceMode(VL53L1XDistanceMode mode) {
+    uint16_t budgetMs = m_budgetMs;
+
+    if (mode == DistanceShort) {
+        writeReg(VL53L1X_PHASECAL_CONFIG_TIMEOUT_MACROP, 0x14);
+        writeReg(VL53L1X_RANGE_CONFIG_VCSEL_PERIOD_A, 0x07);
+        writeReg(VL53L1X_RANGE_CONFIG_VCSEL_PERIOD_B, 0x05);
+        writeReg(VL53L1X_RANGE_CONFIG_VALID_PHASE_HIGH, 0x38);
+        writeReg16(VL53L1X_SD_CONFIG_WOI_SD0, 0x0705);
+        writeReg16(VL53L1X_SD_CONFIG_INITIAL_PHASE_SD0, 0x0606);
+    }
+    else {
+        writeReg(VL53L1X_PHASECAL_CONFIG_TIMEOUT_MACROP, 0x0A);
+        writeReg(VL53L1X_RANGE_CONFIG_VCSEL_PERIOD_A, 0x0F);
+        writeReg(VL53L1X_RANGE_CONFIG_VCSEL_PERIOD_B, 0x0D);
+        writeReg(VL53L1X_RANGE_CONFIG_VALID_PHASE_HIGH, 0xB8);
+        writeReg16(VL53L1X_SD_CONFIG_WOI_SD0, 0x0F0D);
+        writeReg16(VL53L1X_SD_CONFIG_INITIAL_PHASE_SD0, 0x0E0E);
+        if (budgetMs < 20) {
+            budgetMs = 20;                                  // 15 ms is Short mode only
+        }
+    }
+    m_mode = mode;
+    return setTimingBudget(budgetMs);
+}
+
+boolean VL53L1X::setTimingBudget(uint16_t budgetMs) {
+    VL53L1XTiming timing;
+
+    for (uint8_t i = 0; i < TIMING_ENTRIES; i++) {
+        memcpy_P(&timing, &TIMING_TABLE[i], sizeof(timing));
+        if (timing.budgetMs != budgetMs) {
+            continue;
+        }
+        uint16_t a = (m_mode == DistanceShort) ? timing.shortA : timing.longA;
+        uint16_t b = (m_mode == DistanceShort) ? timing.shortB : timing.longB;
+        if (a == 0) {
+            return false;
+        }
+        writeReg16(VL53L1X_RANGE_CONFIG_TIMEOUT_MACROP_A_HI, a);
+        writeReg16(VL53L1X_RANGE_CONFIG_TIMEOUT_MACROP_B_HI, b);
+        m_budgetMs = budgetMs;
+        return true;
+    }
+    return false;
+}
+
+void VL53L1X::clearInterrupt() {
+    writeReg(VL53L1X_SYSTEM_INTERRUPT_CLEAR, 0x01);
+}
+
+// Device range status (RESULT_RANGE_STATUS bits 4:0) to RANGE_xxx
+uint8_t VL53L1X::mapStatus(uint8_t deviceStatus) {
+    switch (deviceStatus) {
+        case 9: return RANGE_VALID;                                 // Range complete
+        case 1: case 2: case 3: case 17: return RANGE_HARDWARE_FAIL; // VCSEL continuity/watchdog, no VHV value, multiple clip
+        case 4: case 12: return RANGE_SIGNAL_FAIL;                   // MSRC no target, range ignore threshold (crosstalk)
+        case 6: return RANGE_SIGMA_FAIL;
+        case 5: case 8: case 13: return RANGE_OUT_OF_BOUNDS;         // Phase check, min clip, ROI clip
+        case 7: return RANGE_WRAP_AROUND;                            // Phase consistency
+        default: return RANGE_NO_DATA;
+    }
+}
+
+void VL53L1X::writeReg(uint16_t reg, uint8_t value) {
+    Wire.beginTransmission(m_addr);
+    Wire.write((uint8_t)(reg >> 8));
+    Wire.write((uint8_t)(reg & 0xFF));
+    Wire.write(value);
+    Wire.endTransmission();
+}
+
+void VL53L1X::writeReg16(uint16_t reg, uint16_t value) {
+    Wire.beginTransmission(m_addr);
+    Wire.write((uint8_t)(reg >> 8));
+    Wire.write((uint8_t)(reg & 0xFF));
+    Wire.write((uint8_t)(value >> 8));
+    Wire.write((uint8_t)(value & 0xFF));
+    Wire.endTransmission();
+}
+
+void VL53L1X::writeReg32(uint16_t reg, uint32_t value) {
+    Wire.beginTransmission(m_addr);
+    Wire.write((uint8_t)(reg >> 8));
+    Wire.write((uint8_t)(reg & 0xFF));
+    for (int8_t shift = 24; shift >= 0; shift -= 8) {
+        Wire.write((uint8_t)(value >> shift));
+    }
+    Wire.endTransmission();
+}
+
+// Write a PROGMEM block to consecutive registers, VL53L1X_MAX_WRITE bytes per transaction
+void VL53L1X::writeBlock_P(uint16_t reg, const uint8_t *data, uint8_t len) {
+    while (len) {
+        uint8_t n = (len > VL53L1X_MAX_WRITE) ? VL53L1X_MAX_WRITE : len;
+        Wire.beginTransmission(m_addr);
+        Wire.write((uint8_t)(reg >> 8));
+        Wire.write((uint8_t)(reg & 0xFF));
+        for (uint8_t i = 0; i < n; i++) {
+            Wire.write(pgm_read_byte(data++));
+        }
+        Wire.endTransmission();
+        reg += n;
+        len -= n;
+    }
+}
+
+uint8_t VL53L1X::readReg(uint16_t reg) {
+    uint8_t value;
+    readBlock(reg, &value, 1);
+    return value;
+}
+
+uint16_t VL53L1X::readReg16(uint16_t reg) {
+    uint8_t buf[2];
+    readBlock(reg, buf, 2);
+    return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+void VL53L1X::readBlock(uint16_t reg, uint8_t *buf, uint8_t len) {
+    Wire.beginTransmission(m_addr);
+    Wire.write((uint8_t)(reg >> 8));
+    Wire.write((uint8_t)(reg & 0xFF));
+    Wire.endTransmission();
+    Wire.requestFrom(m_addr, len);
+    for (uint8_t i = 0; i < len; i++) {
+        buf[i] = Wire.read();
+    }
+}
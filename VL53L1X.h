@@ -0,0 +1,92 @@
+/*!
+ * @file VL53L1X.h
+ * @brief Michael Galle's Elevator Controller API
+ * @copyright Michael Galle
+ *
+ * @author [Michael Galle]
+ * @version V1.0
+ *
+ * VL53L1X time-of-flight rangefinder (up to 4 m, 50 Hz). Follows ST's VL53L1X ultra lite driver (ULD):
+ * the device is configured by writing the ULD default configuration block, so no ST API is needed.
+ */
+
+#ifndef VL53L1X_H
+#define VL53L1X_H
+
+#include "Arduino.h"
+#include "Wire.h"                           /* I2C protocol functions */
+#include "Rangefinder.h"
+
+#define VL53L1X_I2C_ADDR 0x29               // Address at power up
+#define VL53L1X_MODEL_ID 0xEACC
+#define VL53L1X_IO_TIMEOUT 500              // ms to wait for boot / the first measurement
+
+// Registers (16-bit index)
+#define VL53L1X_SOFT_RESET                                  0x0000
+#define VL53L1X_I2C_SLAVE_DEVICE_ADDRESS                    0x0001
+#define VL53L1X_VHV_CONFIG_TIMEOUT_MACROP_LOOP_BOUND        0x0008
+#define VL53L1X_VHV_CONFIG_INIT                             0x000B
+#define VL53L1X_DEFAULT_CONFIG_START                        0x002D
+#define VL53L1X_PAD_I2C_HV_EXTSUP_CONFIG                    0x002E
+#define VL53L1X_GPIO_HV_MUX_CTRL                            0x0030
+#define VL53L1X_GPIO_TIO_HV_STATUS                          0x0031
+#define VL53L1X_PHASECAL_CONFIG_TIMEOUT_MACROP              0x004B
+#define VL53L1X_RANGE_CONFIG_TIMEOUT_MACROP_A_HI            0x005E
+#define VL53L1X_RANGE_CONFIG_VCSEL_PERIOD_A                 0x0060
+#define VL53L1X_RANGE_CONFIG_TIMEOUT_MACROP_B_HI            0x0061
+#define VL53L1X_RANGE_CONFIG_VCSEL_PERIOD_B                 0x0063
+#define VL53L1X_RANGE_CONFIG_VALID_PHASE_HIGH               0x0069
+#define VL53L1X_SYSTEM_INTERMEASUREMENT_PERIOD              0x006C
+#define VL53L1X_SD_CONFIG_WOI_SD0                           0x0078
+#define VL53L1X_SD_CONFIG_INITIAL_PHASE_SD0                 0x007A
+#define VL53L1X_SYSTEM_INTERRUPT_CLEAR                      0x0086
+#define VL53L1X_SYSTEM_MODE_START                           0x0087
+#define VL53L1X_RESULT_RANGE_STATUS                         0x0089
+#define VL53L1X_RESULT_OSC_CALIBRATE_VAL                    0x00DE
+#define VL53L1X_FIRMWARE_SYSTEM_STATUS                      0x00E5
+#define VL53L1X_IDENTIFICATION_MODEL_ID                     0x010F
+
+// SYSTEM_MODE_START values
+#define VL53L1X_MODE_STOP         0x00
+#define VL53L1X_MODE_SINGLESHOT   0x10
+#define VL53L1X_MODE_TIMED        0x40
+
+#define VL53L1X_RESULT_LEN        17        // RESULT_RANGE_STATUS .. peak signal rate (one read per sample)
+#define VL53L1X_MAX_WRITE         16        // Largest block write (Wire buffer is 32 bytes incl. the 2 index bytes)
+
+typedef enum {DistanceShort = 1, DistanceLong = 2} VL53L1XDistanceMode;   // Short: up to 1.3 m, better ambient immunity. Long: up to 4 m.
+
+class VL53L1X : public Rangefinder {
+public:
+  VL53L1X();                                // Constructor
+  ~VL53L1X();                               // Destructor
+  boolean begin(uint8_t i2cAddr);
+  void trigger();
+  boolean poll();
+  void read(RangeSample &sample);
+  void startContinuous();
+  void stop();
+
+  boolean setDistanceMode(VL53L1XDistanceMode mode);
+  boolean setTimingBudget(uint16_t budgetMs);       // 15 (Short only), 20, 33, 50, 100, 200 or 500 ms
+  uint16_t getTimingBudget() { return m_budgetMs; }
+  VL53L1XDistanceMode getDistanceMode() { return m_mode; }
+
+private:
+  uint8_t m_addr;
+  uint8_t m_intPolarity;                    // GPIO level that signals data ready
+  VL53L1XDistanceMode m_mode;
+  uint16_t m_budgetMs;
+
+  void clearInterrupt();
+  static uint8_t mapStatus(uint8_t deviceStatus);
+  void writeReg(uint16_t reg, uint8_t value);
+  void writeReg16(uint16_t reg, uint16_t value);
+  void writeReg32(uint16_t reg, uint32_t value);
+  void writeBlock_P(uint16_t reg, const uint8_t *data, uint8_t len);
+  uint8_t readReg(uint16_t reg);
+  uint16_t readReg16(uint16_t reg);
+  void readBlock(uint16_t reg, uint8_t *buf, uint8_t len);
+};
+
+#endif
@@ -19,13 +19,14 @@ void setup() {
   // Do not need to attach anything to the timer-based interrupt. It will automatically call ISR(TIMER1_COMPA_vect) when triggered. It is on a register external to the microcontroller.
 }
 
-// Timer-based Interrupt routine for timer1 -- This ISR is called when the timer-based interrupt is triggered and is exteral to the ElevatorController Object
+// Timer-based Interrupt routine for timer1 -- This ISR is called every TIMER_TICK_MS and is exteral to the ElevatorController Object
 ISR(TIMER1_COMPA_vect) {
-    EC.flagTx = true;
+    EC.tick();                                                                    // Software timers - only flags are set here, the loop acts on them
 }
 
 // When message is received and the INT_PIN is triggered LOW, the interrupt calls this function
 void CAN_MSGRCVD_ISR() {
+    EC.rxMicros = micros();                                                       // Stamp the arrival here - the loop may be several ms away
     EC.flagRecv = true;                                                           // Set received flag to true - dealt with inside the loop
 }
 
@@ -0,0 +1,230 @@
+"""
+@file calibration.py
+@brief Checks of the VL53L0X offset and crosstalk correction in VL53L0XRangefinder
+
+Ports VL53L0XRangefinder::correct() and the two
+calibrations, calibrateOffset() and calibrateCrosstalk() (float averages of
+VL53L0X_CAL_SAMPLES measurements, read from VL53L0XRangefinder.h), and runs
+them against a sensor model:
+
+  target   signal rate falling with the square of the distance, scaled by
+           the target's reflectance; the sensor's SPAD selection (DSS) enables
+           more SPADs the weaker the return
+  crosstalk  a return off the cover glass at zero range, a fixed rate per
+           SPAD - it pulls the measured range toward zero by its share of the
+           signal, so the error grows with distance
+  offset   part-to-part range offset, range noise growing with distance,
+           1 mm steps (Low precision) and 9.7 / 8.8 fixed point rates
+
+Prints the range error over the shaft before and after calibration (offset on
+a white target at --offset-at mm, then crosstalk on a grey target at
+--xtalk-at mm). With --check it instead verifies the correction math and exits
+1 on a failure:
+  - an uncalibrated sensor reads its raw range
+  - the correction of the fixed point readings agrees with the exact formula
+  - calibrating a noise free sensor finds its offset and crosstalk, and the
+    corrected range is good to the range and signal rate steps everywhere in
+    the shaft, for random offsets and crosstalk rates
+  - a return that is all crosstalk is a signal fail
+
+    python3 tools/calibration.py
+    python3 tools/calibration.py --offset 25 --xtalk 0.002
+    python3 tools/calibration.py --check
+"""
+
+import argparse
+import os
+import random
+import re
+import sys
+
+from plant import MINHEIGHT, MAXHEIGHT
+
+RANGE_VALID = 0
+RANGE_SIGNAL_FAIL = 2
+WHITE = 0.88                # Reflectance of the white calibration target ...
+GREY = 0.17                 # ... and of the grey one (ST's recommended targets)
+WHITE_RATE_100 = 60.0       # MCPS returned by a white target at 100 mm
+MIN_SIGNAL = 0.25           # MCPS - below the driver's signal rate limit the range is invalid
+
+
+def read_samples(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "VL53L0XRangefinder.h")
+    with open(path) as f:
+        return int(re.search(r"#define VL53L0X_CAL_SAMPLES\s+(\d+)", f.read()).group(1))
+
+
+def correct(range4, signal, spads, offset, crosstalk, status=RANGE_VALID):
+    """VL53L0XRangefinder::correct(): range4 in 1/4 mm, signal 9.7, spads 8.8, offset 1/4 mm, crosstalk 0.16 -> (mm, status)."""
+    r = float(max(0, range4 + offset))
+    if crosstalk:
+        x = crosstalk * spads / 131072.0
+        if x >= signal:
+            return range4 // 4, RANGE_SIGNAL_FAIL if status == RANGE_VALID else status
+        r = r * signal / (signal - x)
+    return int(min(r / 4 + 0.5, 65535.0)), status
+
+
+class Sensor:
+    """VL53L0X with a part-to-part offset (mm) and cover glass crosstalk (MCPS per SPAD) ranging a target of some reflectance."""
+
+    def __init__(self, offset=0.0, xtalk=0.0, noise=True, seed=1):
+        self.offset = offset
+        self.xtalk = xtalk
+        self.noise = noise
+        self.rng = random.Random(seed)
+
+    def measure(self, distance, reflectance):
+        """(raw range 1/4 mm, signal 9.7, spads 8.8, status) as VL53L0XRangefinder reads them in Low precision."""
+        target = WHITE_RATE_100 * reflectance / WHITE * (100.0 / distance) ** 2
+        spads = max(3.0, min(44.0, 20.0 / target ** 0.5))
+        x = self.xtalk * spads
+        signal = target + x
+        phase = distance * target / signal - self.offset
+        if self.noise:
+            phase += self.rng.gauss(0.0, 1.0 + distance / 400.0)
+        status = RANGE_VALID if target >= MIN_SIGNAL else RANGE_SIGNAL_FAIL
+        return int(round(max(0.0, phase))) * 4, min(0xFFFF, int(signal * 128)), int(spads * 256), status
+
+
+def calibrate_offset(sensor, distance, crosstalk, samples):
+    """calibrateOffset(): mean of distance * (S - X) / S - raw over the valid samples, 1/4 mm, None if too few."""
+    total, n = 0.0, 0
+    for _ in range(samples):
+        range4, signal, spads, status = sensor.measure(distance, WHITE)
+        if status != RANGE_VALID or signal <= 0:
+            continue
+        s = signal / 128.0
+        x = crosstalk / 65536.0 * spads / 256.0
+        total += distance * (s - x) / s - range4 / 4.0
+        n += 1
+    if n < samples // 2:
+        return None
+    return int(max(-2048, min(2047, total / n * 4)))
+
+
+def calibrate_crosstalk(sensor, distance, offset, samples):
+    """calibrateCrosstalk(): mean of S * (1 - (raw + offset) / distance) / SPADs, 0.16, None if too few."""
+    total, n = 0.0, 0
+    for _ in range(samples):
+        range4, signal, spads, status = sensor.measure(distance, GREY)
+        if status != RANGE_VALID or spads <= 0:
+            continue
+        total += signal / 128.0 * (1 - (range4 / 4.0 + offset / 4.0) / distance) / (spads / 256.0)
+        n += 1
+    if n < samples // 2:
+        return None
+    return int(max(0, min(65535, total / n * 65536)))
+
+
+def calibrate(sensor, offset_at, xtalk_at, samples):
+    """Offset, then crosstalk, then the offset again with the crosstalk known (the second CAL_OFFSET the procedure asks for)."""
+    offset = calibrate_offset(sensor, offset_at, 0, samples)
+    crosstalk = calibrate_crosstalk(sensor, xtalk_at, offset, samples)
+    offset = calibrate_offset(sensor, offset_at, crosstalk, samples)
+    return offset, crosstalk
+
+
+def shaft():
+    return range(MINHEIGHT + 50, MAXHEIGHT, 50)
+
+
+def errors(sensor, offset, crosstalk, reflectance, repeats):
+    """{distance: mean error in mm} over the shaft (valid readings only)."""
+    out = {}
+    for d in shaft():
+        e = []
+        for _ in range(repeats):
+            range4, signal, spads, status = sensor.measure(d, reflectance)
+            mm, status = correct(range4, signal, spads, offset, crosstalk, status)
+            if status == RANGE_VALID:
+                e.append(mm - d)
+        if e:
+            out[d] = sum(e) / len(e)
+    return out
+
+
+def check(samples):
+    failures = []
+    rng = random.Random(7)
+
+    sensor = Sensor(offset=12.0, xtalk=0.001, noise=False)
+    for d in shaft():
+        range4, signal, spads, _ = sensor.measure(d, 0.5)
+        if correct(range4, signal, spads, 0, 0)[0] != range4 // 4:
+            failures.append("uncalibrated reading changed at %d mm" % d)
+
+    for _ in range(1000):
+        range4 = rng.randint(100, 8000)
+        signal = rng.randint(32, 0xFFFF)
+        spads = rng.randint(3 * 256, 44 * 256)
+        offset = rng.randint(-2048, 2047)
+        crosstalk = rng.randint(1, 0xFFFF)
+        x = crosstalk * spads / 131072.0
+        if x >= signal * 0.9:
+            continue
+        exact = max(0, range4 + offset) / 4.0 * signal / (signal - x)
+        mm, status = correct(range4, signal, spads, offset, crosstalk)
+        if abs(mm - exact) > 0.5 + 1e-6 * exact or status != RANGE_VALID:
+            failures.append("corrected %d mm against %.2f mm (range4 %d signal %d spads %d offset %d crosstalk %d)" % (
+                mm, exact, range4, signal, spads, offset, crosstalk))
+
+    # Noise free sensors: the calibration finds the offset and crosstalk, and the corrected range is only off by the 1 mm range step
+    # and the 9.7 signal step, both scaled up by S / (S - X)
+    for i in range(50):
+        sensor = Sensor(offset=rng.uniform(-30, 30), xtalk=rng.uniform(0, 0.002), noise=False, seed=i)
+        offset, crosstalk = calibrate(sensor, 100, 400, samples)
+        _, signal, spads, _ = sensor.measure(400, GREY)
+        xtalk_step = signal / 128.0 * 1.25 / 400 / (spads / 256.0)     # Crosstalk worth the range step plus the offset's error at 400 mm
+        if abs(offset / 4.0 - sensor.offset) > 0.75 or abs(crosstalk / 65536.0 - sensor.xtalk) > xtalk_step:
+            failures.append("sensor offset %.2f mm crosstalk %.5f: calibrated to %.2f mm, %.5f" % (
+                sensor.offset, sensor.xtalk, offset / 4.0, crosstalk / 65536.0))
+        for d in shaft():
+            range4, signal, spads, status = sensor.measure(d, 0.5)
+            if status != RANGE_VALID:
+                continue
+            gain = signal / (signal - crosstalk * spads / 131072.0)
+            bound = gain * (1.0 + d / signal) + 0.5
+            mm, _ = correct(range4, signal, spads, offset, crosstalk, status)
+            if abs(mm - d) > bound:
+                failures.append("sensor offset %.2f mm crosstalk %.5f: %+d mm at %d mm (bound %.1f mm)" % (
+                    sensor.offset, sensor.xtalk, mm - d, d, bound))
+
+    if correct(1000 * 4, 100, 10 * 256, 0, 40000)[1] != RANGE_SIGNAL_FAIL:
+        failures.append("all crosstalk return not a signal fail")
+
+    for f in failures:
+        print("FAIL " + f)
+    print("%s" % ("ok" if not failures else "%d failures" % len(failures)))
+    return not failures
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--offset", type=float, default=15.0, help="sensor's part-to-part offset in mm (reads short by this much)")
+    ap.add_argument("--xtalk", type=float, default=0.001, help="cover glass crosstalk in MCPS per SPAD")
+    ap.add_argument("--offset-at", type=int, default=100, help="white target distance for CAL_OFFSET in mm")
+    ap.add_argument("--xtalk-at", type=int, default=400, help="grey target distance for CAL_XTALK in mm")
+    ap.add_argument("--reflectance", type=float, default=0.5, help="reflectance of the car's target")
+    ap.add_argument("--repeats", type=int, default=50, help="readings averaged per distance")
+    ap.add_argument("--check", action="store_true", help="verify the correction math, exit 1 on a failure")
+    args = ap.parse_args()
+    samples = read_samples()
+
+    if args.check:
+        sys.exit(0 if check(samples) else 1)
+
+    sensor = Sensor(args.offset, args.xtalk)
+    offset, crosstalk = calibrate(sensor, args.offset_at, args.xtalk_at, samples)
+    print("VL53L0X_CAL_SAMPLES %d: offset %.2f mm, crosstalk %.4f MCPS per SPAD (sensor %.1f mm, %.4f)" % (
+        samples, offset / 4.0, crosstalk / 65536.0, args.offset, args.xtalk))
+    raw = errors(sensor, 0, 0, args.reflectance, args.repeats)
+    cal = errors(sensor, offset, crosstalk, args.reflectance, args.repeats)
+    print("  distance  raw error  calibrated")
+    for d in sorted(raw):
+        print("  %5d mm  %+7.1f mm  %+7.1f mm" % (d, raw[d], cal.get(d, float("nan"))))
+    print("  worst     %7.1f mm  %7.1f mm" % (max(abs(e) for e in raw.values()), max(abs(e) for e in cal.values())))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,448 @@
+"""
+@file can_stress.py
+@brief CAN load and stress generator for sizing the bus bitrate and the controller's receive path
+
+Builds a frame mix at fixed rates:
+  probe        numbered { CAN_PROBE, seq } frames from 0x100 - gaps are lost frames
+  commands     bursts of floor codes from 0x100, queued back to back
+  background   traffic from --ids floor node IDs (0x200 up), dropped by the MCP2515 filter
+  reports      the floor reports of the other --boards of the bank, each car from its own ID once a second
+  rtr          remote request polls from 0x100 (read by the controller, no data)
+  errors       bus errors destroying the frame on the wire (it is retransmitted)
+
+and either plays it through a model of the bus and controller (default),
+through the host build of the firmware itself (--firmware, tools/firmware.py)
+or sends it on a SocketCAN interface (--iface) to a controller on the bench.
+
+The model arbitrates the mix on the bus at --bitrate, delivers 0x100 frames
+to the MCP2515's two receive buffers (a frame arriving with both full is
+lost) and runs ElevatorController::loop() with the task costs, load shedding
+and car model of loadshed_sim.py: one frame read per loop, a frame left in the
+other buffer is read on the next. It reports what the controller's [CANSTAT]
+record would show (drops, backlog, interrupt-to-handled latency) alongside
+the true latency from the end of the frame, and the loop time and control
+jitter under the load.
+
+With --boards the controller is one board of a bank sharing the bus: the boards
+are brought up blank and given their IDs and car numbers by node.py's
+assignment procedure, the commands address any car of the bank (every board's
+filter passes them, only the addressed board queues the call) and the other
+boards' reports load the bus.
+
+With --firmware the mix goes on the host build's bus (125 kbps, as
+CANModule::initializeCAN() sets it) and the real receive path, loop and load
+shedding handle it - the report is the firmware's own [CANSTAT] records read
+back as with --log, with the frames the MCP2515 model lost alongside. Its loop
+timing is the host shims' cost estimates, not cycle counts, so it checks the
+model's logic (one read per loop, backlog, shedding) rather than its figures.
+
+On the bench, capture the Serial monitor while the mix runs and read the
+[CANSTAT] records back with --log (the firmware counts only what it receives;
+bus errors and background frames never reach it).
+
+    python3 tools/can_stress.py                              # default mix at 125, 250 and 500 kbps
+    python3 tools/can_stress.py --probe 800 --bitrate 125000 # push the probe rate
+    python3 tools/can_stress.py --limit                      # highest probe rate without loss per bitrate
+    python3 tools/can_stress.py --buffers 4 --limit          # ... with a deeper receive queue
+    python3 tools/can_stress.py --boards 6 --cars 2          # one board of a six board bank
+    python3 tools/can_stress.py --firmware                   # the same mix through the host-built controller
+    python3 tools/can_stress.py --iface can0 --duration 60   # send the mix on a real bus
+    python3 tools/can_stress.py --log capture.txt            # controller-side report from [CANSTAT] records
+"""
+
+import argparse
+import heapq
+import os
+import random
+import re
+import struct
+import sys
+import time
+
+from node import bank
+from loadshed_sim import (Serial, Shedder, Car, read_config, pct, SHED_LCD, SHED_LOGGING, SHED_TELEMETRY,
+                          CAN_READ_US, CAN_SEND_US, POLL_US, TRIGGER_US, READ_US, LAW_US, DAC_US, LCD_CHAR_US,
+                          SENSOR_BUDGET_MS, RX_LOG, TX_LOG, TLM_LOG, LOOP_US)
+
+MASTER_ID = 0x100
+FLOOR_NODE_ID = 0x200
+FLOOR_CODES = (0x05, 0x06, 0x07)
+EFLG_US = 30                # getError(): one register read over SPI
+ISR_US = 5                  # CAN interrupt entry and micros()
+CALL_US = 40                # handleFrame() queueing a call (the LCD "Floor n" is written once per trip, by Car::setTarget())
+STATS_LOG = 70              # "[CANSTAT] ..." record
+ERROR_BITS = 23             # error flag, echo, delimiter and intermission
+
+
+def read_can_config(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "CANModule.h")
+    with open(path) as f:
+        text = f.read()
+    get = lambda name: int(re.search(r"#define %s\s+(0x[0-9A-Fa-f]+|\d+)" % name, text).group(1), 0)
+    return {k: get(k) for k in ("CAN_PROBE", "CAN_PROBE_DLC", "CAN_LATENCY_BINS", "CAN_LATENCY_BIN0_US")}
+
+
+class Frame:
+    def __init__(self, ready, can_id, data, kind, rtr=False):
+        self.ready = ready          # us the host queues it
+        self.id = can_id
+        self.data = data
+        self.kind = kind
+        self.rtr = rtr
+        self.done = None            # us the last bit left the bus
+
+    def bits(self, rng):
+        """Standard frame with intermission, plus stuff bits (one per 5 equal bits at worst)."""
+        dlc = 0 if self.rtr else len(self.data)
+        return 47 + 8 * dlc + rng.randint(0, (34 + 8 * dlc - 1) // 4)
+
+
+def periodic(rate, duration, phase=0.0):
+    if rate <= 0:
+        return []
+    step = 1e6 / rate
+    return [phase + i * step for i in range(int((duration * 1e6 - phase) / step) + 1) if phase + i * step < duration * 1e6]
+
+
+def build_mix(args, can, rng, boards=None):
+    """The frame mix - boards is the bank (node.bank()) with the simulated controller first, None for a lone board."""
+    frames = []
+    cars = sum(n.cars for n in boards) if boards else 1
+    for i, t in enumerate(periodic(args.probe, args.duration, 1000.0)):
+        frames.append(Frame(t, MASTER_ID, bytes([can["CAN_PROBE"], i & 0xFF]), "probe"))
+    for t in periodic(1.0 / args.burst_period if args.burst else 0, args.duration, 500e3):
+        for k in range(args.burst):
+            frames.append(Frame(t, MASTER_ID, bytes([FLOOR_CODES[k % len(FLOOR_CODES)] | ((rng.randrange(cars) << 4) if boards else 0)]), "command"))
+    for node in (boards or [])[1:]:
+        for i in range(node.cars):
+            for t in periodic(1.0, args.duration, rng.uniform(0, 1e6)):
+                frames.append(Frame(t, node.car_id(i), bytes([FLOOR_CODES[0] | ((node.record.first_car + i) << 4)]), "report"))
+    for n in range(args.ids):
+        for t in periodic(args.background / args.ids, args.duration, rng.uniform(0, 1e6 * args.ids / max(args.background, 1))):
+            frames.append(Frame(t, FLOOR_NODE_ID + n, bytes([FLOOR_CODES[n % len(FLOOR_CODES)], n & 0xFF]), "background"))
+    for t in periodic(args.rtr, args.duration, 250.0):
+        frames.append(Frame(t, MASTER_ID, b"", "rtr", rtr=True))
+    frames.sort(key=lambda f: f.ready)
+    return frames
+
+
+def arbitrate(frames, bitrate, error_rate, duration, rng):
+    """Play the queued frames on the bus: lowest ID wins when the bus goes idle. Returns the delivered frames and the bus load."""
+    bit_us = 1e6 / bitrate
+    errors = []
+    t = 0.0
+    while error_rate > 0:
+        t += rng.expovariate(error_rate) * 1e6
+        if t >= duration * 1e6:
+            break
+        errors.append(t)
+    errors.reverse()
+
+    queue = []
+    out = []
+    busy = 0.0
+    t = 0.0
+    i = 0
+    while i < len(frames) or queue:
+        if not queue:
+            t = max(t, frames[i].ready)
+        while i < len(frames) and frames[i].ready <= t:
+            heapq.heappush(queue, (frames[i].id, frames[i].ready, i, frames[i]))
+            i += 1
+        _, _, _, f = heapq.heappop(queue)
+        end = t + f.bits(rng) * bit_us
+        while errors and errors[-1] < t:
+            errors.pop()
+        if errors and errors[-1] < end:                             # destroyed on the wire - error frame, then it tries again
+            end = errors.pop() + ERROR_BITS * bit_us
+            heapq.heappush(queue, (f.id, f.ready, -1, f))
+        else:
+            f.done = end
+            out.append(f)
+        busy += end - t
+        t = end
+    return out, busy / max(t, 1.0)
+
+
+class Mcp2515:
+    """Receive side: the node's acceptance filters (0x100 by default), two buffers, INT low while either holds a frame."""
+
+    def __init__(self, buffers, node=None):
+        self.buffers = buffers
+        self.accepts = node.accepts if node else (lambda can_id: can_id == MASTER_ID)
+        self.rx = []
+        self.lost = []
+        self.stamp = 0.0
+
+    def deliver(self, f):
+        if not self.accepts(f.id):
+            return False
+        if len(self.rx) >= self.buffers:
+            self.lost.append(f)                                     # RXnOVR
+            return False
+        if not self.rx:
+            self.stamp = f.done + ISR_US                            # falling edge: the ISR stamps rxMicros
+        self.rx.append(f)
+        return True
+
+
+def run(args, bitrate, cfg, can, seed=1):
+    rng = random.Random(seed)
+    boards = bank(args.boards, args.cars)[0] if args.boards > 1 else None
+    node = boards[0] if boards else None
+    delivered, load = arbitrate(build_mix(args, can, rng, boards), bitrate, args.errors, args.duration, rng)
+    mcp = Mcp2515(args.buffers, node)
+    serial = Serial()
+    shed = Shedder(cfg, True)
+    period_us = cfg["period_ms"] * 1000.0
+    fleet = [Car(i, args.cars, period_us, node) for i in range(args.cars)]
+    numbers = set(c.number for c in fleet)
+    bins = [0] * can["CAN_LATENCY_BINS"]
+
+    lat_fw, lat_true, loops = [], [], []
+    read = backlog = probe_lost = 0
+    probe_seq = None
+    flag_recv = False
+    k = 0
+    now = loop_start = 0.0
+    next_tx = 1e6
+    next_stats = args.stats_ms * 1000.0
+    next_car = tx_pending = 0
+    while now < args.duration * 1e6:
+        loops.append(now - loop_start)
+        shed.update(now, now - loop_start)
+        loop_start = now
+        verbose = shed.level < SHED_LOGGING
+
+        while k < len(delivered) and delivered[k].done <= now:      # frames that ended while the loop was busy
+            if mcp.deliver(delivered[k]) and len(mcp.rx) == 1:
+                flag_recv = True
+            k += 1
+        drain = args.drain
+        while flag_recv and drain:
+            drain -= 1
+            flag_recv = False
+            stamp = mcp.stamp
+            f = mcp.rx.pop(0)
+            now += CAN_READ_US + EFLG_US
+            read += 1
+            while k < len(delivered) and delivered[k].done <= now:
+                if mcp.deliver(delivered[k]) and len(mcp.rx) == 1:
+                    flag_recv = True
+                k += 1
+            if mcp.rx:
+                backlog += 1
+                flag_recv = True
+            if f.kind == "probe":
+                if probe_seq is not None:
+                    probe_lost += (f.data[1] - probe_seq - 1) & 0xFF
+                probe_seq = f.data[1]
+            if verbose:
+                now += serial.print(now, RX_LOG + (3 * len(f.data) if len(f.data) > 1 else 0))
+            if f.kind == "command" and (f.data[0] >> 4) in numbers:
+                now += CALL_US                                      # One of this board's cars - another board's call is dropped at once
+            lat_fw.append(now - stamp)
+            lat_true.append(now - f.done)
+            b = 0
+            while b < len(bins) - 1 and now - stamp >= can["CAN_LATENCY_BIN0_US"] << b:
+                b += 1
+            bins[b] += 1
+        if now >= next_tx:
+            next_tx += 1e6
+            tx_pending = args.cars
+        if tx_pending:
+            tx_pending -= 1
+            now += CAN_SEND_US
+            if verbose:
+                now += serial.print(now, TX_LOG)
+
+        car = fleet[next_car]
+        next_car = (next_car + 1) % args.cars
+        ticked = False
+        if not car.sampling and now - car.trigger_time >= period_us:
+            now += TRIGGER_US
+            car.trigger_time += (now - car.trigger_time) // period_us * period_us
+            car.ready_at = now + SENSOR_BUDGET_MS * 1000.0
+            car.sampling = True
+        elif car.sampling:
+            now += POLL_US
+            if now >= car.ready_at:
+                car.sampling = False
+                ticked = True
+                now += READ_US + LAW_US + DAC_US
+                car.writes.append(now)
+                car.latency.append(now - car.ready_at)
+                if shed.level < SHED_LCD and car.index == 0:
+                    now += 7 * LCD_CHAR_US
+                if shed.level < SHED_TELEMETRY:
+                    now += serial.print(now, TLM_LOG)
+        if not ticked and shed.level < SHED_TELEMETRY and now >= next_stats:
+            next_stats = now + args.stats_ms * 1000.0
+            now += serial.print(now, STATS_LOG)
+        now += LOOP_US
+
+    offered = sum(1 for f in delivered if mcp.accepts(f.id))
+    jitter = [abs((b - a) - period_us) for c in fleet for a, b in zip(c.writes, c.writes[1:])]
+    return {"load": load, "offered": offered, "read": read, "dropped": len(mcp.lost), "probe_lost": probe_lost, "backlog": backlog,
+            "lat_fw": lat_fw, "lat_true": lat_true, "bins": bins, "loops": loops, "jitter": jitter,
+            "shed": max(l for _, l in shed.levels) if shed.levels else 0,
+            "ticks": sum(len(c.writes) for c in fleet) / float(args.cars) / args.duration}
+
+
+def report(bitrate, r):
+    print("%4d kbps  bus %3.0f%%  to controller %5d  read %5d  dropped %4d (probe gaps %d)  backlog %4d" % (
+        bitrate // 1000, 100 * r["load"], r["offered"], r["read"], r["dropped"], r["probe_lost"], r["backlog"]))
+    print("           latency [CANSTAT] p50 %.2f p99 %.2f max %.2f ms   true p50 %.2f p99 %.2f max %.2f ms" % tuple(
+        v / 1000 for v in (pct(r["lat_fw"], 0.5), pct(r["lat_fw"], 0.99), max(r["lat_fw"] or [0]),
+                           pct(r["lat_true"], 0.5), pct(r["lat_true"], 0.99), max(r["lat_true"] or [0]))))
+    print("           loop p99 %.2f max %.2f ms  shed level %d  control %.1f Hz jitter p99 %.1f ms max %.1f ms" % (
+        pct(r["loops"], 0.99) / 1000, max(r["loops"]) / 1000, r["shed"], r["ticks"],
+        pct(r["jitter"], 0.99) / 1000, max(r["jitter"] or [0]) / 1000))
+
+
+def find_limit(args, bitrate, cfg, can):
+    """Highest probe rate (on top of the rest of the mix) with no frame lost, by bisection."""
+    lo, hi = 0.0, bitrate / 50.0                                    # a short frame is about 50 bits
+    while hi - lo > 5:
+        args.probe = (lo + hi) / 2
+        r = run(args, bitrate, cfg, can)
+        if r["dropped"] or r["probe_lost"]:
+            hi = args.probe
+        else:
+            lo = args.probe
+    return lo
+
+
+def send(args, can):
+    """Play the mix on a SocketCAN interface in real time (bus errors cannot be generated from here)."""
+    import socket
+    frames = build_mix(args, can, random.Random(1))
+    sock = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+    sock.bind((args.iface,))
+    start = time.perf_counter()
+    late = 0.0
+    for f in frames:
+        while (time.perf_counter() - start) * 1e6 < f.ready:
+            pass                                                    # spin - sleep() granularity is too coarse for the rates
+        late = max(late, (time.perf_counter() - start) * 1e6 - f.ready)
+        can_id = f.id | (socket.CAN_RTR_FLAG if f.rtr else 0)
+        try:
+            sock.send(struct.pack("=IB3x8s", can_id, len(f.data), f.data.ljust(8, b"\0")))
+        except OSError:                                             # TX queue full (ENOBUFS) - the bus is saturated
+            time.sleep(0.001)
+    counts = {}
+    for f in frames:
+        counts[f.kind] = counts.get(f.kind, 0) + 1
+    print("sent %s in %.1f s, worst send lateness %.2f ms" % (", ".join("%d %s" % (n, k) for k, n in sorted(counts.items())),
+                                                            time.perf_counter() - start, late / 1000))
+    if args.errors:
+        print("bus errors need a fault injector on the bus - not sent")
+
+
+def read_log(path, can):
+    with open(path) as f:
+        report_log(f, can)
+
+
+def report_log(lines, can):
+    """Controller-side report from the first and last [CANSTAT] records of a capture."""
+    records = []
+    for line in lines:
+        m = re.search(r"\[CANSTAT\]\s+([\d,]+)", line)
+        if m:
+            records.append([int(v) for v in m.group(1).split(",")])
+    if len(records) < 2:
+        sys.exit("need two [CANSTAT] records")
+    a, b = records[0], records[-1]
+    secs = (b[0] - a[0]) / 1000.0
+    bins = [y - x for x, y in zip(a[7:], b[7:])]
+    total = sum(bins)
+    edges = ["<%.2f" % ((can["CAN_LATENCY_BIN0_US"] << i) / 1000.0) for i in range(len(bins) - 1)] + [">=%.2f" % ((can["CAN_LATENCY_BIN0_US"] << (len(bins) - 2)) / 1000.0)]
+
+    def upper(p):
+        n = 0
+        for i, c in enumerate(bins):
+            n += c
+            if total and n >= p * total:
+                return edges[i]
+        return "-"
+    print("%.1f s: %d frames (%.0f/s)  backlog %d  probe gaps %d  EFLG 0x%02X" % (
+        secs, b[1] - a[1], (b[1] - a[1]) / secs, b[2] - a[2], b[3] - a[3], b[4]))
+    print("latency p50 %s ms  p99 %s ms  max %.2f ms  (histogram %s)" % (upper(0.5), upper(0.99), b[5] / 1000.0,
+                                                                        " ".join("%s:%d" % (e, c) for e, c in zip(edges, bins))))
+    print("longest loop %.2f ms" % (max(r[6] for r in records[1:]) / 1000.0))
+
+
+def run_firmware(args, can):
+    """Play the mix on the host build's bus against the real controller and report from its [CANSTAT] records."""
+    from firmware import Board
+    rng = random.Random(1)
+    board = Board()
+    fw = board.fw
+    fw.setup()
+    start = fw.now
+    frames = build_mix(args, can, rng)
+    for f in frames:
+        fw.inject(start + f.ready * 1e-6, f.id, f.data, remote=f.rtr)
+    t = 0.0
+    while args.errors > 0:
+        t += rng.expovariate(args.errors)
+        if t >= args.duration:
+            break
+        fw.can_error(start + t)
+    board.run_until(start + args.duration)
+    stats = fw.stats()
+    print("host build  125 kbps  frames %d  to controller %d  lost in the MCP2515 %d (EFLG 0x%02X)" % (
+        len(frames), stats["can_rx"] + stats["can_lost"], stats["can_lost"], fw.can_eflg()))
+    report_log(fw.serial().splitlines(), can)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--bitrate", type=int, action="append", help="bus bitrate(s) in bit/s (default 125000, 250000, 500000)")
+    ap.add_argument("--probe", type=float, default=100.0, help="probe frames per second")
+    ap.add_argument("--burst", type=int, default=8, help="floor codes per command burst")
+    ap.add_argument("--burst-period", type=float, default=2.0, help="s between command bursts")
+    ap.add_argument("--background", type=float, default=300.0, help="background frames per second (all floor node IDs)")
+    ap.add_argument("--ids", type=int, default=32, help="floor node IDs sending background traffic")
+    ap.add_argument("--rtr", type=float, default=20.0, help="remote request polls per second")
+    ap.add_argument("--errors", type=float, default=5.0, help="bus errors per second")
+    ap.add_argument("--duration", type=float, default=20.0, help="s of traffic")
+    ap.add_argument("--buffers", type=int, default=2, help="receive buffers (the MCP2515 has 2)")
+    ap.add_argument("--drain", type=int, default=1, help="frames read per loop pass (the firmware reads 1)")
+    ap.add_argument("--cars", type=int, default=1, help="cars served by the loop (CAR_COUNT)")
+    ap.add_argument("--boards", type=int, default=1, help="boards of the bank on the bus, each with --cars cars (node.py assigns them)")
+    ap.add_argument("--stats-ms", type=int, help="[CANSTAT] period (default CAN_STATS_MS)")
+    ap.add_argument("--limit", action="store_true", help="find the highest loss-free probe rate per bitrate")
+    ap.add_argument("--firmware", action="store_true", help="play the mix through the host build of the firmware (tools/firmware.py)")
+    ap.add_argument("--iface", help="send the mix on this SocketCAN interface instead of simulating")
+    ap.add_argument("--log", help="report from the [CANSTAT] records in a Serial capture")
+    args = ap.parse_args()
+
+    can = read_can_config()
+    if args.log:
+        read_log(args.log, can)
+        return
+    if args.iface:
+        send(args, can)
+        return
+    if args.firmware:
+        if args.boards > 1 or args.cars > 1 or args.bitrate or args.buffers != 2 or args.drain != 1:
+            sys.exit("--firmware runs one board as built: CAR_COUNT 1, 125 kbps, the MCP2515's buffers and one read per loop")
+        run_firmware(args, can)
+        return
+    cfg = read_config()
+    if args.stats_ms is None:
+        with open(os.path.join(os.path.dirname(__file__), "..", "ElevatorController.h")) as f:
+            args.stats_ms = int(re.search(r"#define CAN_STATS_MS\s+(\d+)", f.read()).group(1))
+    print("mix: probe %.0f/s, %d commands every %.1f s, background %.0f/s from %d IDs, rtr %.0f/s, errors %.0f/s, %d receive buffers" % (
+        args.probe, args.burst, args.burst_period, args.background, args.ids, args.rtr, args.errors, args.buffers))
+    for bitrate in args.bitrate or [125000, 250000, 500000]:
+        if args.limit:
+            print("%4d kbps  loss-free probe rate %.0f frames/s" % (bitrate // 1000, find_limit(args, bitrate, cfg, can)))
+        else:
+            report(bitrate, run(args, bitrate, cfg, can))
+
+
+if __name__ == "__main__":
+    main()
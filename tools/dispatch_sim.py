@@ -0,0 +1,271 @@
+"""
+@file dispatch_sim.py
+@brief Simulated day of passenger traffic for comparing call scheduler settings
+
+Trip times and energies for every floor pair come from closed-loop runs of the
+selected control law on plant.py (the energy model there integrates motor
+power from the DAC commands and direction). Passengers arrive by a daily
+profile, press a hall call at their origin and a car call for their
+destination on boarding (conventional), or send origin and destination
+together from the floor node (destination dispatch, CAN DEST_DLC frames). The
+scheduler is a port of CallScheduler and reads its constants from
+CallScheduler.h; --weight overrides SCHED_ENERGY_WEIGHT. A trip is a run of
+moves in one direction.
+
+    python3 tools/dispatch_sim.py                          # weights 0, 0.1, 0.25, 0.5, 1, both call modes
+    python3 tools/dispatch_sim.py --weight 0 --weight 2 --law mpc
+    python3 tools/dispatch_sim.py --weight 0 --traffic 5 --floors 6     # busier, taller building
+    python3 tools/dispatch_sim.py --fit                    # SCHED_xxx estimates for CallScheduler.h
+"""
+
+import argparse
+import os
+import random
+import re
+
+from plant import load_params, FLOOR_SP, ENERGY_SCALE, MAXHEIGHT
+from laws import LAWS
+from sim import run_trip
+
+DWELL = 5.0         # s, doors open at a stop
+TICK = 0.5          # s, simulation step
+# Passengers per hour over the day: morning up peak from the lobby, lunch, evening down peak
+PROFILE = [2, 1, 1, 1, 1, 2, 6, 20, 40, 25, 15, 15, 30, 25, 15, 15, 20, 40, 20, 10, 8, 6, 4, 3]
+
+
+def read_constants(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "CallScheduler.h")
+    with open(path) as f:
+        text = f.read()
+    get = lambda name: float(re.search(r"#define %s\s+([\d.]+)" % name, text).group(1))
+    return {k: get(k) for k in ("SCHED_SPEED", "SCHED_STOP_MS", "SCHED_ENERGY_UP", "SCHED_ENERGY_DOWN", "SCHED_ENERGY_WEIGHT", "SCHED_GROUP_STOPS")}
+
+
+def firmware_law():
+    with open(os.path.join(os.path.dirname(__file__), "..", "ElevatorController.h")) as f:
+        name = re.search(r"#define CONTROL_LAW CONTROL_LAW_(\w+)", f.read()).group(1)
+    return name.lower()
+
+
+def floor_setpoints(n=None):
+    """The firmware floors, or n floors spread evenly over the shaft (a taller building for the benchmark)."""
+    if not n:
+        return list(FLOOR_SP)
+    top = MAXHEIGHT - 100
+    return [int(FLOOR_SP[0] + (top - FLOOR_SP[0]) * i / (n - 1)) for i in range(n)]
+
+
+def trip_table(law, params, floors):
+    """{(a, b): (seconds, joules)} for every floor index pair."""
+    table = {}
+    for a, pa in enumerate(floors):
+        for b, pb in enumerate(floors):
+            if a != b:
+                r = run_trip(LAWS[law](), params, pa, pb)
+                table[(a, b)] = (r["trip_time"], r["energy"])
+    return table
+
+
+class Scheduler:
+    """Port of CallScheduler (the car is always at a floor when it decides)."""
+
+    def __init__(self, const, weight, floors):
+        self.floors = floors
+        self.c = const
+        self.weight = weight
+        self.calls = {}                 # floor -> call time (s)
+        self.destinations = {}          # origin -> set of destination floors
+        self.deferred = set()
+
+    def add(self, floor, now):
+        self.calls.setdefault(floor, now)
+
+    def add_destination(self, origin, dest, now):
+        self.destinations.setdefault(origin, set()).add(dest)
+        self.add(origin, now)
+
+    def arrived(self, floor, now):
+        """CallScheduler::arrived(): returns the destination group boarding, None for conventional calls."""
+        self.deferred = set()
+        self.calls.pop(floor, None)
+        waiting = self.destinations.get(floor, set())
+        if not waiting:
+            return None
+        up = {d for d in waiting if d > floor}
+        down = waiting - up
+        pending_up = any(f > floor for f in self.calls)
+        pending_down = any(f < floor for f in self.calls)
+        if not down:
+            group = up
+        elif not up:
+            group = down
+        elif pending_up and not pending_down:
+            group = up
+        elif pending_down and not pending_up:
+            group = down
+        else:
+            group = up if len(up) >= len(down) else down
+        nearest = sorted(group, key=lambda d: abs(d - floor))
+        group = set(nearest[:int(self.c["SCHED_GROUP_STOPS"])])
+        self.destinations[floor] = waiting - group
+        for d in group:
+            self.add(d, now)
+        if self.destinations[floor]:
+            self.add(floor, now)
+            self.deferred.add(floor)
+        return group
+
+    def energy(self, position, floor):
+        d = self.floors[floor] - position
+        return d * self.c["SCHED_ENERGY_UP"] if d > 0 else -d * self.c["SCHED_ENERGY_DOWN"]
+
+    def next_stop(self, position, now):
+        best, best_cost, due = None, 0.0, False
+        others = set(self.calls) - self.deferred
+        for floor, t in sorted(self.calls.items()):
+            if floor in self.deferred and others:
+                continue
+            waited = (now - t) * 1000.0
+            weighted = self.weight * self.energy(position, floor)
+            travel = abs(self.floors[floor] - position) * 1000.0 / self.c["SCHED_SPEED"] + self.c["SCHED_STOP_MS"]
+            cost = travel + weighted - waited
+            due = due or waited >= weighted
+            if best is None or cost < best_cost:
+                best, best_cost = floor, cost
+        return best if due else None
+
+
+def passengers(seed, traffic, n):
+    rng = random.Random(seed)
+    out = []
+    for hour, rate in enumerate(PROFILE):
+        rate *= traffic
+        t = hour * 3600.0
+        while True:
+            t += rng.expovariate(rate / 3600.0)
+            if t >= (hour + 1) * 3600.0:
+                break
+            if 7 <= hour < 10:
+                origin = 0                                          # up peak from the lobby
+            elif 16 <= hour < 19:
+                origin = rng.randrange(1, n)                        # down peak to the lobby
+            else:
+                origin = rng.randrange(n)
+            if origin == 0 or 16 <= hour < 19 or rng.random() < 0.5:
+                dest = 0 if origin else rng.randrange(1, n)
+            else:
+                dest = rng.choice([f for f in range(n) if f != origin])
+            out.append((t, origin, dest))
+    return out
+
+
+def simulate_day(table, const, weight, floors, seed=1, destination=False, traffic=1.0):
+    sched = Scheduler(const, weight, floors)
+    arrivals = passengers(seed, traffic, len(floors))
+    waiting = []                        # (arrival time, origin, dest)
+    riding = []                         # (arrival time, dest, boarding time)
+    floor = 0
+    busy_until = 0.0
+    energy = 0.0
+    moves = 0
+    trips = 0
+    direction = 0
+    waits, journeys, rides = [], [], []
+    t = 0.0
+    k = 0
+    while t < 24 * 3600.0 or waiting or riding:
+        while k < len(arrivals) and arrivals[k][0] <= t:
+            t_arr, origin, dest = arrivals[k]
+            waiting.append(arrivals[k])
+            if destination:
+                sched.add_destination(origin, dest, t_arr)
+            else:
+                sched.add(origin, t_arr)
+            k += 1
+        if t >= busy_until:
+            target = sched.next_stop(floors[floor], t)
+            if target is not None:
+                if target != floor:
+                    secs, joules = table[(floor, target)]
+                    energy += joules
+                    moves += 1
+                    if (1 if target > floor else -1) != direction:
+                        trips += 1
+                        direction = 1 if target > floor else -1
+                    t_stop = t + secs
+                    floor = target
+                else:
+                    t_stop = t
+                # Serve the stop: riders for this floor leave, waiting passengers board (conventional: and press their destination)
+                group = sched.arrived(floor, t_stop)
+                for p in [p for p in riding if p[1] == floor]:
+                    journeys.append(t_stop - p[0])
+                    rides.append(t_stop - p[2])
+                    riding.remove(p)
+                for p in [p for p in waiting if p[1] == floor and p[0] <= t_stop]:
+                    if destination and p[2] not in group:
+                        continue
+                    waits.append(t_stop - p[0])
+                    waiting.remove(p)
+                    riding.append((p[0], p[2], t_stop))
+                    if not destination:
+                        sched.add(p[2], t_stop)
+                busy_until = t_stop + DWELL
+        t += TICK
+    waits.sort()
+    return {
+        "kwh": energy * ENERGY_SCALE,
+        "joules": energy,
+        "trips": trips,
+        "moves": moves,
+        "passengers": len(arrivals),
+        "wait": sum(waits) / len(waits),
+        "wait95": waits[int(0.95 * len(waits))],
+        "journey": sum(journeys) / len(journeys),
+        "ride": sum(rides) / len(rides),
+    }
+
+
+def fit(table, law, floors):
+    """Least squares energy per mm up/down and mean speed from the trip table."""
+    up = [(floors[b] - floors[a], e) for (a, b), (_, e) in table.items() if b > a]
+    down = [(floors[a] - floors[b], e) for (a, b), (_, e) in table.items() if b < a]
+    per_mm = lambda pairs: sum(d * e for d, e in pairs) / sum(d * d for d, _ in pairs) * 1000.0
+    dist = sum(abs(floors[b] - floors[a]) for (a, b) in table)
+    secs = sum(s for s, _ in table.values())
+    print("// %s law on the plant model" % law)
+    print("#define SCHED_SPEED %d" % round(dist / secs))
+    print("#define SCHED_ENERGY_UP %d" % round(per_mm(up)))
+    print("#define SCHED_ENERGY_DOWN %d" % round(per_mm(down)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--law", choices=sorted(LAWS), help="control law for the trip table (default: CONTROL_LAW in ElevatorController.h)")
+    ap.add_argument("--model", help="fitted plant model JSON from sysid_fit.py")
+    ap.add_argument("--weight", type=float, action="append", help="SCHED_ENERGY_WEIGHT value(s) in ms/mJ")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--traffic", type=float, default=1.0, help="scale the passenger profile")
+    ap.add_argument("--floors", type=int, help="benchmark a building with this many evenly spaced floors instead of FLOOR_SP")
+    ap.add_argument("--mode", choices=["conventional", "destination"], action="append", help="call mode(s) (default: both)")
+    ap.add_argument("--fit", action="store_true", help="print SCHED_xxx estimates from the trip table")
+    args = ap.parse_args()
+
+    law = args.law or firmware_law()
+    floors = floor_setpoints(args.floors)
+    table = trip_table(law, load_params(args.model), floors)
+    if args.fit:
+        fit(table, law, floors)
+        return
+    const = read_constants()
+    print("%s law, %d floors" % (law, len(floors)))
+    for mode in args.mode or ["conventional", "destination"]:
+        print(mode)
+        for weight in args.weight or [0.0, 0.1, 0.25, 0.5, 1.0]:
+            r = simulate_day(table, const, weight, floors, args.seed, mode == "destination", args.traffic)
+            print("  weight %5.2f ms/mJ  %.3f kWh-eq/day (%.0f J)  %3d trips  %.2f stops/trip  wait %.1f s (p95 %.1f)  ride %.1f s  journey %.1f s  (%d passengers)" % (
+                weight, r["kwh"], r["joules"], r["trips"], r["moves"] / float(r["trips"]), r["wait"], r["wait95"], r["ride"], r["journey"], r["passengers"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,123 @@
+"""
+@file fault_sim.py
+@brief Sensor failure injection on the plant model for checking the DEAD_RECKONING degraded mode
+
+Runs every floor-to-floor trip and breaks the sensor once the car has covered
+--at of the way (each fraction given), then compares the firmware without
+DEAD_RECKONING (stop) against the degraded mode (dead reckoning) - both are
+DeadReckoning in laws.py, a port of the fault handling in Car::Move() that
+reads DEADRECK_*, MOTOR_* and SENSOR_TIMEOUT_MS from ElevatorController.h.
+
+Failure modes:
+  timeout   the sensor stops answering (stuck I2C bus, dead sensor)
+  invalid   every range comes back with a failed status
+  jump      valid status but 8190 mm - a VL53L0X that lost its target
+  blip      a timeout for --blip s, after which the sensor recovers
+
+Reported per mode and method, over the trips and fault points:
+  parked    runs that end at rest within the tolerance of a floor
+  stranded  worst distance from the nearest floor at the end
+  runaway   worst travel past MINHEIGHT / MAXHEIGHT
+  stop      longest time from the fault until the car is at rest
+
+The firmware's motor model (MOTOR_*) is the default plant; --load and --model
+give the real car a different response than the one it dead reckons with.
+
+    python3 tools/fault_sim.py
+    python3 tools/fault_sim.py --load 1.3 --sensor vl53l0x
+    python3 tools/fault_sim.py --mode blip --blip 2 --trace
+"""
+
+import argparse
+
+from plant import Plant, Sensor, SENSORS, load_params, FLOOR_SP, MINHEIGHT, MAXHEIGHT
+from laws import LAWS, CONTROL_PERIOD, DeadReckoning, Truncate, Dither, Slew
+
+NO_TARGET = 8190        # VL53L0X range with no return
+REST = 1.0              # mm/s - the car counts as at rest below this
+
+
+def reading(mode, plant, sensor, t_fault, blip):
+    """The period's reading: (distance, valid) or None - also advances the plant by the sensor's timing budget."""
+    dist = sensor.sample(plant) if sensor else plant.measure()
+    if t_fault is None or (mode == "blip" and plant.t - t_fault > blip):
+        return dist, True
+    if mode in ("timeout", "blip"):
+        return None
+    if mode == "invalid":
+        return dist, False
+    return NO_TARGET, True
+
+
+def run(law, params, origin, dest, at, mode, enabled, load=1.0, sensor=None, output=None, duration=25.0, blip=2.0):
+    plant = Plant(params, position=origin, load=load)
+    output = output or Truncate()
+    dr = DeadReckoning(law, enabled)
+    t_fault = None
+    t_rest = None
+    runaway = 0.0
+    while plant.t < duration:
+        start = plant.t
+        if t_fault is None and abs(plant.x - origin) >= at * abs(dest - origin):
+            t_fault = plant.t
+        command = dr.step(reading(mode, plant, sensor, t_fault, blip), dest, plant.t)
+        if command is not None:
+            plant.apply(output(command))
+            dr.applied(plant.u, plant.t)
+        plant.advance(CONTROL_PERIOD - (plant.t - start))
+        runaway = max(runaway, MINHEIGHT - plant.x, plant.x - MAXHEIGHT)
+        if t_fault is not None:
+            if abs(plant.v) >= REST:
+                t_rest = None
+            elif t_rest is None:
+                t_rest = plant.t
+    nearest = min(FLOOR_SP, key=lambda sp: abs(sp - plant.x))
+    stranded = abs(plant.x - nearest)
+    return {
+        "parked": abs(plant.v) < REST and stranded <= law.floor(nearest)[0],
+        "stranded": stranded,
+        "runaway": max(0.0, runaway),
+        "stop": (t_rest - t_fault) if t_rest is not None and t_fault is not None else float("inf"),
+        "events": dr.events,
+        "final": plant.x,
+    }
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--law", default="exponential", choices=sorted(LAWS))
+    ap.add_argument("--mode", action="append", choices=("timeout", "invalid", "jump", "blip"), help="failure mode(s) (default: all)")
+    ap.add_argument("--at", type=float, action="append", help="fraction of the trip covered when the sensor fails (default 0.2 0.5 0.8)")
+    ap.add_argument("--model", help="fitted plant model JSON from sysid_fit.py (the firmware keeps MOTOR_*)")
+    ap.add_argument("--load", type=float, default=1.0, help="car load factor, 1.0 is nominal")
+    ap.add_argument("--sensor", choices=sorted(SENSORS), help="rangefinder model (default: ideal reading)")
+    ap.add_argument("--dither", action="store_true", help="DAC_DITHER output stage")
+    ap.add_argument("--slew", action="store_true", help="DAC_SLEW_LIMIT output stage")
+    ap.add_argument("--blip", type=float, default=2.0, help="s the sensor is out in the blip mode")
+    ap.add_argument("--trace", action="store_true", help="print each run's [DIAG] events")
+    args = ap.parse_args()
+    params = load_params(args.model)
+    stage = Dither if args.dither else Truncate
+
+    print("law %s  load %.2f%s" % (args.law, args.load, "  sensor " + args.sensor if args.sensor else ""))
+    for mode in args.mode or ("timeout", "invalid", "jump", "blip"):
+        for enabled in (False, True):
+            results = []
+            for a in FLOOR_SP:
+                for b in FLOOR_SP:
+                    if a == b:
+                        continue
+                    for at in args.at or (0.2, 0.5, 0.8):
+                        r = run(LAWS[args.law](), params, a, b, at, mode, enabled, args.load,
+                                Sensor(args.sensor) if args.sensor else None, Slew(stage()) if args.slew else stage(), blip=args.blip)
+                        results.append(r)
+                        if args.trace:
+                            print("    %4d -> %4d at %.1f: %s -> %.0f mm" % (a, b, at, "; ".join(
+                                "%.1f s %s" % e for e in r["events"]) or "no events", r["final"]))
+            print("  %-8s %-15s parked %2d/%d  stranded max %6.1f mm  runaway max %6.1f mm  stop max %5.1f s" % (
+                mode, "dead reckoning" if enabled else "stop", sum(r["parked"] for r in results), len(results),
+                max(r["stranded"] for r in results), max(r["runaway"] for r in results), max(r["stop"] for r in results)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,527 @@
+"""
+@file firmware.py
+@brief Host build of the firmware - the sketch and its .cpp files compiled against tools/host and driven from Python
+
+build() compiles the firmware's own sources unchanged against the shims in
+tools/host (Arduino core, SPI, Wire, EEPROM, LiquidCrystal, mcp_can) and the
+simulated UNO behind them - its clock, Timer1 and INT0 interrupts, the
+MCP2515 and the CAN bus, the cars' VL53L0X sensors and MCP4912 DACs (see
+tools/host/Arduino.h). Defines are overridden in the header that sets them
+(CAR_COUNT in Car.h, CONTROL_LAW in ElevatorController.h, ...) or added on
+the command line if no header does. Builds are cached under
+tools/host/build by the hash of the sources and the overrides.
+
+Firmware loads one build: setup() and loop() run as main() calls them, and
+the board's clock moves only with what the firmware spends (bus transfers,
+delays, the core's calls - tools/host/board.cpp). Each instance gets its own
+copy of the library, so several boards can run side by side. The sources and
+the shims build with -Wall -Wextra; the warnings are kept with the build.
+
+Board gives each car of a Firmware a plant.Plant: a sensor's measurement
+returns the plant position halfway through its timing budget, and a DAC write
+is applied to the plant at the moment its chip select latches it. The
+firmware's own computation takes no board time, so loop timing is the
+shims' (tools/host/board.cpp HOST_xxx_US) and not a cycle count.
+
+With --check the default and CAR_COUNT 2 builds must compile without a
+warning, and the host build is verified against the plant: boot (sensor on its
+address, Timer1 period, node record), a floor call over CAN moving the car
+there and the floor report, a frame from a source the node does not accept
+filtered out, a node record with one code for two floors refused, and a sensor
+lost at the start of a trip - the car dead reckons to the next floor and
+reports that floor, not the one it left. A CAR_COUNT 2 build is then run
+through what only a second car uses: the XSHUT sequencing that leaves the
+sensors on their own addresses, the second DAC chip select, the car number in
+the floor and command codes and reports, the second car's calibration and
+health records in EEPROM, and calibrations without a target distance refused
+with the record left as it was (exit 1 on a failure).
+
+    python3 tools/firmware.py --check
+    python3 tools/firmware.py --define CAR_COUNT=2 --call 0x07 --call 0x15 --duration 20
+"""
+
+import argparse
+import ctypes
+import hashlib
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+from plant import Plant, load_params, FLOOR_SP, SETPOINT_TOLERANCE
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+HOST = os.path.join(os.path.dirname(os.path.abspath(__file__)), "host")
+BUILD = os.path.join(HOST, "build")
+SKETCH = "ese-ep6-elevator-controller.ino"
+CXX = os.environ.get("CXX", "g++")
+WARNINGS = "warnings.txt"
+CXXFLAGS = ["-std=gnu++11", "-O1", "-fPIC", "-Wall", "-Wextra"]
+
+SUPERVISOR_ID = 0x100
+TX_ID = 0x101
+FRAME_EXTENDED = 0x80000000
+FRAME_REMOTE = 0x40000000
+
+# EEPROM layout (DistanceSensor.h, SensorHealth.h) - records of car n follow at n times their size (host_car_records())
+SENSOR_CAL_EEPROM = 0
+SENSOR_CAL_MAGIC = 0xC5
+HEALTH_EEPROM = 32
+HEALTH_MAGIC = 0xA7
+CAR_SHIFT = 4                           # CANModule.h - the car number in the high nibble of a code
+CAL_OFFSET = 0x0B
+CAL_XTALK = 0x0C
+NODE_EEPROM = 64                        # CANModule.h - the node record and its assignment frames
+NODE_SELECT = 0xD1
+NODE_SET = 0xD2
+NODE_STORE = 0xD3
+NODE_FIELD_FLOOR = 0x20
+POWER_UP_ADDRESS = 0x29
+I2C_SLAVE_DEVICE_ADDRESS = 0x8A
+
+# tools/host/vl53l0x.cpp FAULT_xxx
+SENSOR_FAULTS = {"none": 0, "absent": 1, "no_spad": 2, "no_refcal": 3, "stuck": 4}
+
+RANGE_CB = ctypes.CFUNCTYPE(ctypes.c_double, ctypes.c_int, ctypes.c_double)
+DAC_CB = ctypes.CFUNCTYPE(None, ctypes.c_int, ctypes.c_double, ctypes.c_int)
+
+
+def _sources():
+    names = sorted(f for f in os.listdir(ROOT) if f.endswith((".cpp", ".h")))
+    host = sorted(os.path.relpath(os.path.join(d, f), HOST) for d, _, fs in os.walk(HOST) if not d.startswith(BUILD)
+                  for f in fs if f.endswith((".cpp", ".h")))
+    return names, host
+
+
+def _override(text, name, value):
+    """text with the #define of name set to value (None removes it) - None if text does not define it."""
+    pattern = re.compile(r"^([ \t]*)#define[ \t]+%s\b([^\n]*)$" % re.escape(name), re.M)
+    match = pattern.search(text)
+    if not match:
+        return None
+    if value is None:
+        return text[:match.start()] + "// #define %s (off in the host build)" % name + text[match.end():]
+    comment = re.search(r"\s//.*$", match.group(2))
+    line = "%s#define %s %s%s" % (match.group(1), name, value, comment.group(0) if comment else "")
+    return text[:match.start()] + line + text[match.end():]
+
+
+def build(defines=None, quiet=True):
+    """Compile the firmware with the #define overrides {name: value or None} - returns the path of the shared library."""
+    defines = dict(defines or {})
+    names, host = _sources()
+    key = hashlib.sha1(repr((sorted(defines.items()), CXX, CXXFLAGS)).encode())
+    for name in names + [SKETCH]:
+        with open(os.path.join(ROOT, name), "rb") as f:
+            key.update(name.encode() + f.read())
+    for name in host:
+        with open(os.path.join(HOST, name), "rb") as f:
+            key.update(name.encode() + f.read())
+    out = os.path.join(BUILD, key.hexdigest()[:16])
+    lib = os.path.join(out, "firmware.so")
+    if os.path.exists(lib):
+        return lib
+
+    os.makedirs(BUILD, exist_ok=True)
+    work = tempfile.mkdtemp(prefix="tmp.", dir=BUILD)
+    texts = {}
+    for name in names:
+        with open(os.path.join(ROOT, name)) as f:
+            texts[name] = f.read()
+    flags = []
+    for define, value in defines.items():
+        hits = [name for name in names if name.endswith(".h") and _override(texts[name], define, value) is not None]
+        for name in hits:
+            texts[name] = _override(texts[name], define, value)
+        if not hits and value is not None:
+            flags.append("-D%s=%s" % (define, value))
+    for name, text in texts.items():
+        with open(os.path.join(work, name), "w") as f:
+            f.write(text)
+    with open(os.path.join(ROOT, SKETCH)) as f:
+        sketch = f.read()
+    prototypes = "".join("%s;\n" % m.group(1) for m in re.finditer(r"^(void\s+\w+\s*\(\s*\))\s*\{", sketch, re.M))
+    with open(os.path.join(work, "sketch.cpp"), "w") as f:
+        f.write("#include <Arduino.h>\n%s#line 1 \"%s\"\n%s" % (prototypes, SKETCH, sketch))   # What the IDE does with the .ino
+
+    units = [os.path.join(work, n) for n in names if n.endswith(".cpp")] + [os.path.join(work, "sketch.cpp")] + \
+            [os.path.join(HOST, n) for n in host if n.endswith(".cpp")]
+
+    def compile(src):
+        obj = os.path.join(work, os.path.basename(src)[:-4] + (".host.o" if src.startswith(HOST) else ".o"))
+        cmd = [CXX] + CXXFLAGS + flags + ["-I", HOST, "-I", work, "-c", src, "-o", obj]
+        run = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+        if run.returncode:
+            raise RuntimeError("%s\n%s" % (" ".join(cmd), run.stdout))
+        return obj, run.stdout.replace(work + os.sep, "")
+
+    try:
+        with ThreadPoolExecutor(os.cpu_count() or 4) as pool:
+            compiled = list(pool.map(compile, units))
+        objects = [obj for obj, _ in compiled]
+        with open(os.path.join(work, WARNINGS), "w") as f:
+            f.write("".join(text for _, text in compiled))
+        subprocess.run([CXX, "-shared", "-o", os.path.join(work, "firmware.so")] + objects, check=True)
+        os.replace(work, out)
+    except BaseException:
+        shutil.rmtree(work, ignore_errors=True)
+        raise
+    if not quiet:
+        print("built %s" % os.path.relpath(out, ROOT))
+        print(build_warnings(lib), end="")
+    return lib
+
+
+def build_warnings(lib):
+    """The compiler's warnings from the build of lib (the firmware's sources and the shims, -Wall -Wextra)."""
+    with open(os.path.join(os.path.dirname(lib), WARNINGS)) as f:
+        return f.read()
+
+
+class Firmware:
+    """One board running a build: distance(sensor, t) gives a sensor's target distance in mm (NaN - none), dac(car, t, code) takes a DAC write."""
+
+    def __init__(self, defines=None, distance=None, dac=None, seed=1, lib=None):
+        path = lib or build(defines)
+        fd, copy = tempfile.mkstemp(suffix=".so")
+        os.close(fd)
+        shutil.copyfile(path, copy)
+        try:
+            self.lib = ctypes.CDLL(copy)        # Its own statics - the board's state
+        finally:
+            os.unlink(copy)
+        self._signatures()
+        self._range = RANGE_CB(lambda i, t: distance(i, t * 1e-6) if distance else float("nan"))
+        self._dac = DAC_CB(lambda car, t, code: dac(car, t * 1e-6, code) if dac else None)
+        self.lib.host_seed(seed)
+        self.lib.host_init(self._range, self._dac)
+        xshut, cs, address = (ctypes.c_uint8 * 16)(), (ctypes.c_uint8 * 16)(), (ctypes.c_uint8 * 16)()
+        self.cars = self.lib.host_cars(xshut, cs, address)
+        self.car_table = [(address[i], xshut[i], cs[i]) for i in range(self.cars)]
+        calibration, health = ctypes.c_int(), ctypes.c_int()
+        self.lib.host_car_records(ctypes.byref(calibration), ctypes.byref(health))
+        self.records = (calibration.value, health.value)
+        self._serial = ""
+
+    def _signatures(self):
+        lib = self.lib
+        lib.host_now.restype = ctypes.c_double
+        lib.host_run_until.argtypes = [ctypes.c_double]
+        lib.host_loop.argtypes = [ctypes.c_int]
+        lib.host_seed.argtypes = [ctypes.c_uint32]
+        lib.host_eeprom.restype = ctypes.POINTER(ctypes.c_uint8)
+        lib.host_timer1_period_us.restype = ctypes.c_double
+        lib.host_stat_names.restype = ctypes.c_char_p
+        lib.host_sensor_config.argtypes = [ctypes.c_int] + [ctypes.c_double] * 4 + [ctypes.c_int]
+        lib.host_sensor_budget_us.restype = ctypes.c_double
+        lib.host_can_inject.argtypes = [ctypes.c_double, ctypes.c_uint32, ctypes.c_int, ctypes.c_char_p]
+        lib.host_can_error.argtypes = [ctypes.c_double]
+        lib.host_can_sent.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_double), ctypes.POINTER(ctypes.c_uint32), ctypes.c_char_p]
+        lib.host_i2c_record.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_double)] + [ctypes.POINTER(ctypes.c_uint8)] * 3 + [ctypes.c_char_p]
+
+    # Running
+    def setup(self):
+        self.lib.host_setup()
+
+    def loop(self, count=1):
+        self.lib.host_loop(count)
+
+    def run_until(self, t):
+        self.lib.host_run_until(t * 1e6)
+
+    @property
+    def now(self):
+        return self.lib.host_now() * 1e-6
+
+    # What the board shows
+    def serial(self):
+        """Everything printed so far."""
+        buf = ctypes.create_string_buffer(4096)
+        while True:
+            n = self.lib.host_serial_read(buf, len(buf))
+            if not n:
+                return self._serial
+            self._serial += buf.raw[:n].decode("latin-1")
+
+    def eeprom(self):
+        return bytes(self.lib.host_eeprom()[:1024])
+
+    def pin(self, pin):
+        return self.lib.host_pin(pin)
+
+    def pin_mode(self, pin):
+        return self.lib.host_pin_mode(pin)
+
+    def dac_code(self, car):
+        return self.lib.host_dac_code(car)
+
+    def timer1_period(self):
+        return self.lib.host_timer1_period_us() * 1e-6
+
+    def lcd(self):
+        buf = ctypes.create_string_buffer(32)
+        self.lib.host_lcd(buf)
+        return buf.raw[:16].decode("latin-1"), buf.raw[16:].decode("latin-1")
+
+    def stats(self):
+        names = self.lib.host_stat_names().decode().split(",")
+        values = (ctypes.c_uint64 * len(names))()
+        self.lib.host_stats(values)
+        return dict(zip(names, values))
+
+    # CAN
+    def inject(self, t, can_id, data=b"", extended=False, remote=False, dlc=None):
+        """A frame from another node, ready to go on the bus at t."""
+        flags = (FRAME_EXTENDED if extended else 0) | (FRAME_REMOTE if remote else 0)
+        data = bytes(data)
+        self.lib.host_can_inject(t * 1e6, can_id | flags, len(data) if dlc is None else dlc, data.ljust(8, b"\0"))
+
+    def sent(self):
+        """[(t at the end of the frame, ID, data)] the board put on the bus."""
+        frames = []
+        t, can_id, data = ctypes.c_double(), ctypes.c_uint32(), ctypes.create_string_buffer(8)
+        for i in range(self.lib.host_can_sent_count()):
+            dlc = self.lib.host_can_sent(i, ctypes.byref(t), ctypes.byref(can_id), data)
+            frames.append((t.value * 1e-6, can_id.value, data.raw[:dlc]))
+        return frames
+
+    def can_error(self, t):
+        """A bus error at t - the frame on the wire is destroyed and retransmitted."""
+        self.lib.host_can_error(t * 1e6)
+
+    def can_ack(self, on):
+        self.lib.host_can_ack(1 if on else 0)
+
+    def can_eflg(self):
+        return self.lib.host_can_eflg()
+
+    # Sensors and I2C
+    def sensor(self, i, signal100=100.0, ambient=0.5, crosstalk=0.0, offset=0.0, fault="none"):
+        self.lib.host_sensor_config(i, signal100, ambient, crosstalk, offset, SENSOR_FAULTS[fault])
+
+    def sensor_address(self, i):
+        return self.lib.host_sensor_address(i)
+
+    def sensor_budget(self, i):
+        return self.lib.host_sensor_budget_us(i) * 1e-6
+
+    def sensor_reg(self, i, page, reg):
+        return self.lib.host_sensor_reg(i, page, reg)
+
+    def i2c_trace(self, on=True):
+        """Start (or stop) recording the Wire transactions - restarting drops the record."""
+        self.lib.host_i2c_trace(1 if on else 0)
+
+    def i2c(self):
+        """[(t, address, read, ack, data)] recorded since i2c_trace()."""
+        records = []
+        t = ctypes.c_double()
+        address, read, ack = ctypes.c_uint8(), ctypes.c_uint8(), ctypes.c_uint8()
+        data = ctypes.create_string_buffer(32)
+        for i in range(self.lib.host_i2c_count()):
+            n = self.lib.host_i2c_record(i, ctypes.byref(t), ctypes.byref(address), ctypes.byref(read), ctypes.byref(ack), data)
+            records.append((t.value * 1e-6, address.value, bool(read.value), bool(ack.value), data.raw[:n]))
+        return records
+
+
+class Board:
+    """A Firmware whose cars each drive a plant.Plant - the sensors read the plants, the DACs drive them."""
+
+    def __init__(self, defines=None, params=None, positions=None, load=1.0, seed=1, lib=None):
+        self.params = load_params() if params is None else params
+        self.plants = []
+        self.fw = Firmware(defines, distance=self._distance, dac=self._dac, seed=seed, lib=lib)
+        positions = positions or [FLOOR_SP[0]] * self.fw.cars
+        self.plants = [Plant(self.params, position=positions[i], load=load) for i in range(self.fw.cars)]
+        self.budgets = [None] * self.fw.cars
+        self.latches = [[] for _ in range(self.fw.cars)]   # Times each car's DAC latched a code
+
+    def _advance(self, plant, t):
+        if t > plant.t:
+            plant.advance(t - plant.t)
+
+    def _distance(self, i, t):
+        if i >= len(self.plants):
+            return float("nan")
+        plant = self.plants[i]
+        self._advance(plant, t)
+        if self.budgets[i] is None:
+            self.budgets[i] = self.fw.sensor_budget(i)
+        middle = t - self.budgets[i] / 2      # The return averages the window - its middle
+        x = plant.history[0][1]
+        for ts, xs in plant.history:
+            if ts > middle:
+                break
+            x = xs
+        return x
+
+    def _dac(self, car, t, code):
+        if car < len(self.plants):
+            self.latches[car].append(t)
+            self._advance(self.plants[car], t)
+            self.plants[car].apply(code)
+
+    def run_until(self, t):
+        self.fw.run_until(t)
+        for plant in self.plants:
+            self._advance(plant, t)
+
+
+def check():
+    failures = []
+
+    for defines in ({}, {"CAR_COUNT": 2}):
+        warnings = build_warnings(build(defines))
+        if warnings:
+            failures.append("build %s: compiler warnings\n%s" % (defines or "default", warnings.rstrip()))
+
+    board = Board()
+    fw = board.fw
+    fw.setup()
+    out = fw.serial()
+    if "[NODE] uid" not in out or "MCP2515 Initialized Successfully!" not in out:
+        failures.append("boot: node record or CAN init missing from the log")
+    if fw.sensor_address(0) != fw.car_table[0][0]:
+        failures.append("boot: sensor on 0x%02X, not CAR_TABLE's 0x%02X" % (fw.sensor_address(0), fw.car_table[0][0]))
+    if abs(fw.timer1_period() - 0.010) > 1e-6:
+        failures.append("boot: Timer1 period %.6f s, not TIMER_TICK_MS" % fw.timer1_period())
+    if fw.eeprom()[NODE_EEPROM] != 0x4E:
+        failures.append("boot: blank EEPROM's node record not written (NODE_MAGIC)")
+
+    board.run_until(2.0)
+    if abs(board.plants[0].x - FLOOR_SP[0]) > SETPOINT_TOLERANCE:
+        failures.append("car left floor 1 without a call (%.0f mm)" % board.plants[0].x)
+    fw.inject(2.0, SUPERVISOR_ID, [0x07])
+    fw.inject(2.1, 0x200, [0x06])             # Not a source of the node - filtered
+    board.run_until(25.0)
+    plant = board.plants[0]
+    if abs(plant.x - FLOOR_SP[2]) > SETPOINT_TOLERANCE or abs(plant.v) > 5:
+        failures.append("floor 3 call: car at %.0f mm moving %.0f mm/s" % (plant.x, plant.v))
+    reports = [(t, data) for t, can_id, data in fw.sent() if can_id == TX_ID and data[:1] == b"\x07"]
+    if not reports:
+        failures.append("no floor 3 report from 0x%X" % TX_ID)
+    stats = fw.stats()
+    if stats["can_rx"] != 1 or stats["ranges"] < 200 or stats["dac_writes"] < 200:
+        failures.append("counters off: %s" % stats)
+
+    uid = int(re.search(r"\[NODE\] uid 0x([0-9A-F]+)", out).group(1), 16)
+    record = fw.eeprom()[NODE_EEPROM:NODE_EEPROM + 32]
+    fw.inject(25.0, SUPERVISOR_ID, [NODE_SELECT] + list(uid.to_bytes(4, "little")))
+    fw.inject(25.1, SUPERVISOR_ID, [NODE_SET, NODE_FIELD_FLOOR + 1, 0x05, 0])   # Floor 2 on floor 1's code
+    fw.inject(25.2, SUPERVISOR_ID, [NODE_STORE])
+    board.run_until(26.0)
+    if "[NODE] duplicate floor code - not stored" not in fw.serial() or fw.eeprom()[NODE_EEPROM:NODE_EEPROM + 32] != record:
+        failures.append("node: a floor code given to two floors was stored")
+
+    board = Board()                           # The sensor stops answering while the car is still in floor 1's band
+    fw = board.fw
+    fw.setup()
+    board.run_until(2.0)
+    fw.inject(2.0, SUPERVISOR_ID, [0x07])
+    board.run_until(2.2)
+    fw.sensor(0, fault="stuck")
+    board.run_until(30.0)
+    parked = [line for line in fw.serial().splitlines() if "parked at" in line]
+    reports = set(data[0] for t, can_id, data in fw.sent() if can_id == TX_ID and t > 25.0)
+    if not parked or abs(board.plants[0].x - FLOOR_SP[1]) > SETPOINT_TOLERANCE or reports != {0x06}:
+        failures.append("dead reckoning: car parked at %.0f mm reports %s, not floor 2's 0x06" % (
+            board.plants[0].x, ["0x%02X" % r for r in sorted(reports)]))
+
+    check_cars(failures)
+
+    for f in failures:
+        print("FAIL " + f)
+    print("ok" if not failures else "%d failures" % len(failures))
+    return not failures
+
+
+def check_cars(failures):
+    """CAR_COUNT 2: sensor addresses, the second car's DAC, bank codes and EEPROM records."""
+    board = Board({"CAR_COUNT": 2})
+    fw = board.fw
+    fw.sensor(1, offset=15.0)                 # Car 2's part reads 15 mm long
+    fw.i2c_trace(True)
+    fw.setup()
+    moves = [(address, data[1]) for _, address, read, ack, data in fw.i2c()
+             if not read and ack and len(data) == 2 and data[0] == I2C_SLAVE_DEVICE_ADDRESS]
+    fw.i2c_trace(False)
+    expected = [(POWER_UP_ADDRESS, address) for address, _, _ in fw.car_table]
+    if moves != expected:
+        failures.append("2 cars: address writes %s, expected %s - a sensor left out of reset too early" % (moves, expected))
+    addresses = [fw.sensor_address(i) for i in range(fw.cars)]
+    if addresses != [address for address, _, _ in fw.car_table]:
+        failures.append("2 cars: sensors on %s, not CAR_TABLE's" % ["0x%02X" % a for a in addresses])
+
+    board.run_until(2.0)
+    fw.inject(2.0, SUPERVISOR_ID, [(1 << CAR_SHIFT) | 0x07])   # Car 2, floor 3
+    board.run_until(30.0)
+    car1, car2 = board.plants
+    if abs(car2.x - FLOOR_SP[2]) > SETPOINT_TOLERANCE or abs(car2.v) > 5 or abs(car1.x - FLOOR_SP[0]) > SETPOINT_TOLERANCE:
+        failures.append("2 cars: car 2 call left car 1 at %.0f mm and car 2 at %.0f mm" % (car1.x, car2.x))
+    sent = fw.sent()
+    if not any(can_id == TX_ID + 1 and data[:1] == b"\x17" for _, can_id, data in sent):
+        failures.append("2 cars: no car 2 floor 3 report (0x17) from 0x%X" % (TX_ID + 1))
+    if any(can_id == TX_ID and data[:1] and data[0] >> CAR_SHIFT for _, can_id, data in sent):
+        failures.append("2 cars: car 1 reported a code of another car")
+
+    distance = int(round(car2.x))
+    fw.inject(30.0, SUPERVISOR_ID, [(1 << CAR_SHIFT) | CAL_OFFSET, distance & 0xFF, distance >> 8])
+    board.run_until(120.0)                    # Past HEALTH_LEARN samples of both cars
+    calibration, health = fw.records
+    eeprom = fw.eeprom()
+    if "[CAL] car 2 offset -15" not in fw.serial():
+        failures.append("2 cars: car 2 offset calibration did not log -15 mm")
+    if eeprom[SENSOR_CAL_EEPROM] != 0xFF or eeprom[SENSOR_CAL_EEPROM + calibration] != SENSOR_CAL_MAGIC:
+        failures.append("2 cars: car 2 calibration not in the second record (magics %02X %02X)" % (
+            eeprom[SENSOR_CAL_EEPROM], eeprom[SENSOR_CAL_EEPROM + calibration]))
+    if eeprom[HEALTH_EEPROM] != HEALTH_MAGIC or eeprom[HEALTH_EEPROM + health] != HEALTH_MAGIC:
+        failures.append("2 cars: health baselines not in a record per car (magics %02X %02X)" % (
+            eeprom[HEALTH_EEPROM], eeprom[HEALTH_EEPROM + health]))
+
+    record = eeprom[SENSOR_CAL_EEPROM + calibration:SENSOR_CAL_EEPROM + 2 * calibration]
+    fw.inject(121.0, SUPERVISOR_ID, [(1 << CAR_SHIFT) | CAL_OFFSET, 0, 0])   # No target distance
+    fw.inject(123.0, SUPERVISOR_ID, [(1 << CAR_SHIFT) | CAL_XTALK, 0, 0])
+    board.run_until(126.0)
+    eeprom = fw.eeprom()
+    if fw.serial().count("[CAL] car 2 failed") != 2 or eeprom[SENSOR_CAL_EEPROM + calibration:SENSOR_CAL_EEPROM + 2 * calibration] != record:
+        failures.append("2 cars: a calibration at 0 mm did not fail or changed the stored record")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--define", action="append", default=[], help="NAME=VALUE override (NAME= removes the #define)")
+    ap.add_argument("--call", type=lambda v: int(v, 0), action="append", default=[], help="floor or command code from the supervisory controller")
+    ap.add_argument("--at", type=float, default=1.0, help="s - time of the first call (the rest follow CALL_SPACING apart)")
+    ap.add_argument("--spacing", type=float, default=8.0, help="s between the calls")
+    ap.add_argument("--duration", type=float, default=15.0, help="s to run")
+    ap.add_argument("--model", help="fitted plant model JSON from sysid_fit.py")
+    ap.add_argument("--check", action="store_true", help="verify the host build, exit 1 on a failure")
+    args = ap.parse_args()
+    if args.check:
+        sys.exit(0 if check() else 1)
+
+    defines = {}
+    for d in args.define:
+        name, _, value = d.partition("=")
+        defines[name] = value or None
+    board = Board(defines, load_params(args.model))
+    board.fw.setup()
+    for i, code in enumerate(args.call):
+        board.fw.inject(args.at + i * args.spacing, SUPERVISOR_ID, [code])
+    step = 0.5
+    t = 0.0
+    while t < args.duration:
+        t = min(t + step, args.duration)
+        board.run_until(t)
+        print("%6.1f s  %s" % (t, "  ".join("car %d %6.0f mm %5d" % (i + 1, p.x, p.u) for i, p in enumerate(board.plants))))
+    sys.stdout.write(board.fw.serial())
+    for t, can_id, data in board.fw.sent():
+        print("%9.4f s  TX 0x%03X %s" % (t, can_id & 0x1FFFFFFF, data.hex()))
+    print(board.fw.stats())
+
+
+if __name__ == "__main__":
+    main()
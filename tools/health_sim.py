@@ -0,0 +1,226 @@
+"""
+@file health_sim.py
+@brief Detection lead time of the sensor health trend (SensorHealth) on simulated sensor degradation
+
+Ports SensorHealth::update() - the shift and add averages of the return scaled
+to 100 mm, the ambient rate and the failed status share, the baseline learned
+after HEALTH_LEARN valid samples and the warning thresholds with their
+hysteresis, all read from SensorHealth.h - and feeds it a VL53L0X model on a
+car that dwells at random floors and travels between them:
+
+  return   a white target, falling with the square of the range, times the
+           lens transmission; below MIN_SIGNAL the range is a signal fail
+  sigma    the range's estimated spread grows with sqrt(signal + ambient) /
+           signal; above SIGMA_LIMIT the range is a sigma fail
+  faults   a share of samples failing outright (hardware fail)
+
+After a healthy first hour one of these degrades linearly over --hours:
+
+  healthy    nothing - any warning is a false alarm
+  dirt       lens transmission 1 -> 0.3 (dust, oil film or misalignment)
+  light      ambient 0.2 -> 8 MCPS (a light leak into the shaft)
+  connector  hardware fails 0 -> 30 % of samples (loose connector, failing part)
+
+The sensor counts as failed once more than FAIL_SHARE of the ranges in the last
+FAIL_WINDOW s failed - the car is then dropping readings often enough to stop
+or dead reckon. The lead time is from the first warning to that failure. The
+averages settle in a few minutes, so the lead time scales with the
+degradation time; --hours only trades run time for resolution.
+
+    python3 tools/health_sim.py
+    python3 tools/health_sim.py --hours 24 --scenario dirt
+    python3 tools/health_sim.py --check
+"""
+
+import argparse
+import math
+import os
+import random
+import re
+import sys
+
+from plant import FLOOR_SP
+
+PERIOD = 0.1                # s - CONTROL_PERIOD_MS
+RATE_100 = 60.0             # MCPS returned by the car's white target at 100 mm
+MIN_SIGNAL = 0.25           # MCPS - the driver's signal rate limit
+SIGMA_K = 3.0               # mm * sqrt(MCPS) - estimated range sigma per sqrt(signal + ambient) / signal
+SIGMA_LIMIT = 18.0          # mm - the driver's sigma limit
+AMBIENT = 0.2               # MCPS - shaft lighting
+SPEED = 150.0               # mm/s - travel between floors
+DWELL = (20.0, 90.0)        # s - time parked at a floor
+FAIL_WINDOW = 600           # s
+FAIL_SHARE = 0.1
+WARMUP = 3600.0             # s healthy before the degradation starts
+RANGE_VALID = 0
+SCENARIOS = ("healthy", "dirt", "light", "connector")
+
+
+def read_config(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "SensorHealth.h")
+    with open(path) as f:
+        text = f.read()
+    cfg = {}
+    for name in ("SHIFT", "LEARN", "SIGNAL_WARN", "AMBIENT_WARN", "AMBIENT_FLOOR", "ERROR_WARN", "HYSTERESIS",
+                 "WARN_SIGNAL", "WARN_AMBIENT", "WARN_ERRORS"):
+        cfg[name] = int(re.search(r"#define HEALTH_%s\s+(0x[0-9A-Fa-f]+|\d+)" % name, text).group(1), 0)
+    return cfg
+
+
+class SensorHealth:
+    """SensorHealth::update() in the firmware's integer arithmetic."""
+
+    def __init__(self, cfg):
+        self.cfg = cfg
+        self.signal = self.ambient = self.errors = 0
+        self.started = False
+        self.baseline = None
+        self.count = 0
+        self.warnings = 0
+
+    def threshold(self, bit, value, limit, above):
+        limit <<= self.cfg["SHIFT"]
+        if self.warnings & bit:
+            limit = limit - limit // 100 * self.cfg["HYSTERESIS"] if above else limit + limit // 100 * self.cfg["HYSTERESIS"]
+        hit = value > limit if above else value < limit
+        self.warnings = (self.warnings | bit) if hit else (self.warnings & ~bit)
+
+    def update(self, distance, status, signal_rate, ambient_rate):
+        c = self.cfg
+        shift = c["SHIFT"]
+        self.errors += (100 if status != RANGE_VALID else 0) - (self.errors >> shift)
+        if status == RANGE_VALID:
+            signal = int(min(signal_rate * (distance / 100.0) ** 2, 65535.0))
+            if not self.started:
+                self.signal = signal << shift
+                self.ambient = ambient_rate << shift
+                self.started = True
+            self.signal += signal - (self.signal >> shift)
+            self.ambient += ambient_rate - (self.ambient >> shift)
+            if self.baseline is None:
+                self.count += 1
+                if self.count >= c["LEARN"]:
+                    self.baseline = (self.signal >> shift, self.ambient >> shift)
+        if self.baseline is not None:
+            self.threshold(c["WARN_SIGNAL"], self.signal, self.baseline[0] * c["SIGNAL_WARN"] // 100, False)
+            self.threshold(c["WARN_AMBIENT"], self.ambient, self.baseline[1] * c["AMBIENT_WARN"] // 100 + c["AMBIENT_FLOOR"], True)
+        self.threshold(c["WARN_ERRORS"], self.errors, c["ERROR_WARN"], True)
+        return self.warnings
+
+
+class Car:
+    """Dwells at a random floor, then travels to another at SPEED."""
+
+    def __init__(self, rng):
+        self.rng = rng
+        self.x = float(FLOOR_SP[0])
+        self.target = self.x
+        self.wait = rng.uniform(*DWELL)
+
+    def step(self, dt):
+        if self.x != self.target:
+            step = SPEED * dt
+            self.x = self.target if abs(self.target - self.x) <= step else self.x + math.copysign(step, self.target - self.x)
+            return
+        self.wait -= dt
+        if self.wait <= 0:
+            self.target = float(self.rng.choice([f for f in FLOOR_SP if f != self.x]))
+            self.wait = self.rng.uniform(*DWELL)
+
+
+def degradation(scenario, frac):
+    """(lens transmission, ambient MCPS, hardware fail share) at frac of the way through the degradation."""
+    frac = min(max(frac, 0.0), 1.0)
+    if scenario == "dirt":
+        return 1.0 - 0.7 * frac, AMBIENT, 0.0
+    if scenario == "light":
+        return 1.0, AMBIENT + (8.0 - AMBIENT) * frac, 0.0
+    if scenario == "connector":
+        return 1.0, AMBIENT, 0.3 * frac
+    return 1.0, AMBIENT, 0.0
+
+
+def measure(rng, d, transmission, ambient, fails):
+    """(distance, status, signal 9.7, ambient 9.7) of one VL53L0X range."""
+    signal = RATE_100 * (100.0 / d) ** 2 * transmission * rng.lognormvariate(0.0, 0.05)
+    ambient = ambient * rng.lognormvariate(0.0, 0.05)
+    sigma = SIGMA_K * math.sqrt(signal + ambient) / signal * (1 + 0.15 * rng.gauss(0.0, 1.0))
+    if rng.random() < fails:
+        status = 4                                      # RANGE_HARDWARE_FAIL
+    elif signal < MIN_SIGNAL:
+        status = 2                                      # RANGE_SIGNAL_FAIL
+    elif sigma > SIGMA_LIMIT:
+        status = 1                                      # RANGE_SIGMA_FAIL
+    else:
+        status = RANGE_VALID
+    distance = int(round(d + rng.gauss(0.0, 3.0 * (1 + d / 1000.0))))
+    return distance, status, min(0xFFFF, int(signal * 128)), min(0xFFFF, int(ambient * 128))
+
+
+def run(scenario, hours, cfg, seed=1):
+    """First warning, failure and the warning bits raised (times in s from the start of the degradation, None if never)."""
+    rng = random.Random(seed)
+    car = Car(rng)
+    health = SensorHealth(cfg)
+    span = hours * 3600.0
+    window = [False] * int(FAIL_WINDOW / PERIOD)
+    failed = 0
+    warned_at = failed_at = None
+    bits = 0
+    for i in range(int((WARMUP + span) / PERIOD)):
+        t = i * PERIOD - WARMUP
+        car.step(PERIOD)
+        distance, status, signal, ambient = measure(rng, car.x, *degradation(scenario, t / span))
+        warnings = health.update(distance, status, signal, ambient)
+        bad = status != RANGE_VALID
+        failed += bad - window[i % len(window)]
+        window[i % len(window)] = bad
+        if warnings and warned_at is None:
+            warned_at = t
+        bits |= warnings
+        if failed_at is None and i >= len(window) and failed > FAIL_SHARE * len(window):
+            failed_at = t
+    return warned_at, failed_at, bits, health
+
+
+def describe(bits, cfg):
+    names = [n for n, b in (("signal", cfg["WARN_SIGNAL"]), ("ambient", cfg["WARN_AMBIENT"]), ("errors", cfg["WARN_ERRORS"])) if bits & b]
+    return ",".join(names) or "-"
+
+
+def hours(t):
+    return "%6.2f h" % (t / 3600.0) if t is not None else "   never"
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--hours", type=float, default=8.0, help="degradation time (healthy to fully degraded)")
+    ap.add_argument("--scenario", action="append", choices=SCENARIOS, help="scenario(s) to run (default: all)")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--check", action="store_true", help="exit 1 on a false alarm or a failure that was not warned of first")
+    args = ap.parse_args()
+    cfg = read_config()
+    failures = []
+
+    print("HEALTH_SHIFT %d: signal below %d %%, ambient above %d %% + %d, errors above %d %% - degradation over %.1f h" % (
+        cfg["SHIFT"], cfg["SIGNAL_WARN"], cfg["AMBIENT_WARN"], cfg["AMBIENT_FLOOR"], cfg["ERROR_WARN"], args.hours))
+    print("  scenario    warning     failure     lead        warnings")
+    for scenario in args.scenario or SCENARIOS:
+        warned, failed, bits, _ = run(scenario, args.hours, cfg, args.seed)
+        lead = failed - warned if warned is not None and failed is not None else None
+        print("  %-10s %s  %s  %s  %s" % (scenario, hours(warned), hours(failed), hours(lead), describe(bits, cfg)))
+        if scenario == "healthy":
+            if warned is not None or failed is not None:
+                failures.append("healthy sensor: warning at %s, failure at %s" % (hours(warned), hours(failed)))
+        elif warned is None or warned < 0 or (failed is not None and warned >= failed):
+            failures.append("%s: warning at %s, failure at %s" % (scenario, hours(warned), hours(failed)))
+
+    if args.check:
+        for f in failures:
+            print("FAIL " + f)
+        print("ok" if not failures else "%d failures" % len(failures))
+        sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
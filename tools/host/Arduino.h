@@ -0,0 +1,158 @@
+/*!
+ * @file Arduino.h
+ * @brief Host build of the Elevator Controller - Arduino core shim
+ *
+ * The firmware's .cpp files and the sketch compile unchanged against the headers in this directory and link with the simulated UNO in
+ * board.cpp (tools/firmware.py builds and drives it). Time only moves when the firmware spends it: every call into the core, SPI, Wire,
+ * EEPROM, LiquidCrystal and the MCP2515 driver advances the board's clock by what the call takes on the UNO - bus transfers at their bit
+ * rate, delays as given, the rest at the estimates in board.cpp (HOST_xxx_US). The Timer1 compare interrupt, the CAN interrupt and the
+ * sensors' measurements fire as the clock passes them.
+ *
+ * Types: long is 32 bits as on the AVR (the #define at the end, after every system header), so millis()/micros() arithmetic wraps as it
+ * does on the board. int stays 32 bits and double 64 bits - the control laws' float math is not bit exact against avr-gcc.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define HOST_PINS 20
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define F_CPU 16000000UL
+#define E2END 0x3FF
+#define PI 3.1415926535897932384626433832795
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define abs(x) ((x) > 0 ? (x) : -(x))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define sq(x) ((x) * (x))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+
+// Program memory is ordinary memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_float(addr) (*(const float *)(addr))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+
+// Interrupts - the I bit of SREG gates the board's interrupts, and setting it again runs the ones that came in meanwhile
+struct HostSreg {
+  operator uint8_t() const;
+  HostSreg &operator=(uint8_t value);
+};
+extern HostSreg SREG;
+void cli();
+void sei();
+#define noInterrupts() cli()
+#define interrupts() sei()
+#define ISR(vector) extern "C" void vector(void)
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+void attachInterrupt(uint8_t interruptNum, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t interruptNum);
+
+// Timer1 registers - read by the board when interrupts are enabled again (initializeTimer() ends with sei())
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+extern volatile uint16_t OCR1A, TCNT1;
+#define WGM12 3
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE1A 1
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+void randomSeed(uint32_t seed);
+int32_t random(int32_t howbig);
+int32_t random(int32_t howsmall, int32_t howbig);
+
+int host_sprintf(char *s, const char *format, ...);
+#define sprintf host_sprintf                // avr-libc's %lu/%lX take a 32 bit long - the host version drops the l
+
+// Print as in the Arduino core: numbers in a base, floats with a number of decimals
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t write(const uint8_t *buffer, size_t size);
+
+  size_t print(const char s[]) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println() { return write("\r\n"); }
+  template <class T> size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <class T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+private:
+  size_t printNumber(unsigned long n, uint8_t base);
+};
+
+// UART at the baud rate given to begin() with the core's 64 byte transmit buffer: a write to a full buffer waits for a byte to go out
+class HardwareSerial : public Print {
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int availableForWrite();
+  void flush();
+  size_t write(uint8_t c);
+  using Print::write;
+  operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+
+#define long int                            // 32 bit long from here on (see the top of the file)
+
+#endif
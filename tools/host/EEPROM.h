@@ -0,0 +1,33 @@
+/*!
+ * @file EEPROM.h
+ * @brief Host build of the Elevator Controller - EEPROM shim (see Arduino.h)
+ *
+ * The UNO's 1 KB, blank (0xFF) at the first power up unless tools/firmware.py loads an image. A write waits for the one before it to
+ * finish (3.4 ms each, as avr-libc's eeprom_write_byte()); update() and put() only write the bytes that change.
+ */
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+  uint8_t read(int idx);
+  void write(int idx, uint8_t value);
+  void update(int idx, uint8_t value) { if (read(idx) != value) write(idx, value); }
+  uint16_t length() { return E2END + 1; }
+  template <class T> T &get(int idx, T &t) {
+    uint8_t *p = (uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) p[i] = read(idx + i);
+    return t;
+  }
+  template <class T> const T &put(int idx, const T &t) {
+    const uint8_t *p = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) update(idx + i, p[i]);
+    return t;
+  }
+};
+extern EEPROMClass EEPROM;
+
+#endif
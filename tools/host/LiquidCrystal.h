@@ -0,0 +1,29 @@
+/*!
+ * @file LiquidCrystal.h
+ * @brief Host build of the Elevator Controller - 16x2 character LCD shim (see Arduino.h)
+ *
+ * Keeps the display contents for tools/firmware.py. Each byte to the display is two 4 bit writes as in the LiquidCrystal library: 7 pin
+ * writes and the 100 us enable pulse wait for each nibble; clear() and home() wait 2 ms more, begin() the library's 50 ms power up.
+ */
+
+#ifndef HOST_LIQUIDCRYSTAL_H
+#define HOST_LIQUIDCRYSTAL_H
+
+#include "Arduino.h"
+
+class LiquidCrystal : public Print {
+public:
+  LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+  void begin(uint8_t cols, uint8_t rows);
+  void clear();
+  void home();
+  void setCursor(uint8_t col, uint8_t row);
+  size_t write(uint8_t c);
+  using Print::write;
+
+private:
+  uint8_t m_col;
+  uint8_t m_row;
+};
+
+#endif
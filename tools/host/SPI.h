@@ -0,0 +1,41 @@
+/*!
+ * @file SPI.h
+ * @brief Host build of the Elevator Controller - SPI shim (see Arduino.h)
+ *
+ * A byte goes to the device whose chip select is low: the DAC of a car (CAR_TABLE dacCs), decoded as an MCP4912 write when its chip select
+ * goes high again. Each transfer takes 8 clocks at the SPI clock (4 MHz after begin(), as the AVR core sets it) plus the loop around it.
+ * The MCP2515 driver (mcp_can.h) accounts its own transfers.
+ */
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_CLOCK_DIV4 0x00
+
+class SPISettings {
+public:
+  SPISettings() : clock(4000000) {}
+  SPISettings(uint32_t clock, uint8_t /* bitOrder */, uint8_t /* dataMode */) : clock(clock) {}
+  uint32_t clock;
+};
+
+class SPIClass {
+public:
+  void begin();
+  void end() {}
+  void beginTransaction(SPISettings settings);
+  void endTransaction();
+  uint8_t transfer(uint8_t data);
+  uint16_t transfer16(uint16_t data) { uint16_t hi = transfer(data >> 8); return (hi << 8) | transfer(data & 0xFF); }
+  void setBitOrder(uint8_t /* bitOrder */) {}
+  void setDataMode(uint8_t /* dataMode */) {}
+  void setClockDivider(uint8_t /* divider */) {}
+};
+extern SPIClass SPI;
+
+#endif
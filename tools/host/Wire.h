@@ -0,0 +1,41 @@
+/*!
+ * @file Wire.h
+ * @brief Host build of the Elevator Controller - I2C shim (see Arduino.h)
+ *
+ * The AVR Wire library's blocking transactions: endTransmission() and requestFrom() run the whole transfer (start, address, data, stop)
+ * at the bus clock (100 kHz unless setClock() says otherwise) against the simulated devices - the cars' VL53L0X sensors. A device holds
+ * the bus while it is out of reset and on the address; two on one address both answer, and their read bytes are ANDed as on the wire.
+ */
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+public:
+  void begin();
+  void setClock(uint32_t clock);
+  void beginTransmission(uint8_t address);
+  void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+  uint8_t endTransmission(uint8_t sendStop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop = true);
+  uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (uint8_t)quantity); }
+  size_t write(uint8_t data);
+  size_t write(const uint8_t *data, size_t quantity);
+  int available();
+  int read();
+
+private:
+  uint8_t m_address;
+  uint8_t m_tx[BUFFER_LENGTH];
+  uint8_t m_txLength;
+  uint8_t m_rx[BUFFER_LENGTH];
+  uint8_t m_rxLength;
+  uint8_t m_rxIndex;
+};
+extern TwoWire Wire;
+
+#endif
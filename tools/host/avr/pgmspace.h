@@ -0,0 +1,6 @@
+/*!
+ * @file pgmspace.h
+ * @brief Host build of the Elevator Controller - program memory is ordinary memory (see ../Arduino.h)
+ */
+
+#include "../Arduino.h"
@@ -0,0 +1,856 @@
+/*!
+ * @file board.cpp
+ * @brief Host build of the Elevator Controller - the simulated UNO (see Arduino.h)
+ *
+ * Clock, events and interrupts, the core's pin, time, Serial, ADC and random functions, SPI with the cars' MCP4912 DACs, Wire, EEPROM,
+ * the LCD, and the C interface tools/firmware.py loads. The costs below are the UNO's (16 MHz) for the calls the firmware makes - a bus
+ * transfer takes its bits at the bus clock, the rest are estimates of the core's code. The firmware's own computation (the control laws'
+ * float math included) takes no board time.
+ */
+
+#include "board.h"
+#include "SPI.h"
+#include "Wire.h"
+#include "EEPROM.h"
+#include "LiquidCrystal.h"
+
+#define HOST_PIN_US 3.0                     // digitalWrite(), digitalRead(), pinMode()
+#define HOST_MILLIS_US 2.0
+#define HOST_MICROS_US 3.0
+#define HOST_ANALOG_US 112.0                // One conversion at the core's ADC clock (125 kHz, 13 clocks) plus the call
+#define HOST_LOOP_US 10.0                   // main()'s loop around loop() and the firmware's work between the calls above
+#define HOST_TIMER1_ISR_US 8.0              // ISR(TIMER1_COMPA_vect) with the wheel's tick
+#define HOST_INT0_ISR_US 3.0                // The core's INT0 dispatch (the handler's micros() is counted by micros())
+#define HOST_SERIAL_BYTE_US 5.0             // HardwareSerial::write() into the buffer
+#define HOST_SERIAL_BUFFER 63               // Bytes the core's 64 byte ring buffer holds
+#define HOST_SPI_BYTE_US 0.5                // SPI.transfer() around the 8 clocks
+#define HOST_I2C_US 15.0                    // Start, stop and the twi driver per transaction
+#define HOST_EEPROM_READ_US 1.0
+#define HOST_EEPROM_WRITE_US 3400.0         // The write cycle - the next access waits for it
+#define HOST_LCD_PULSE_US 102.0             // LiquidCrystal::pulseEnable() waits per nibble
+#define HOST_LCD_CLEAR_US 2000.0
+
+namespace host {
+
+Time now;
+uint64_t stats[STAT_COUNT];
+RangeCallback rangeCallback;
+DacCallback dacCallback;
+
+static const char *STAT_NAMES = "i2c_writes,i2c_reads,i2c_bytes,i2c_nacks,i2c_ns,spi_bytes,dac_writes,can_tx,can_rx,can_lost,can_tx_ns,"
+                                "serial_bytes,serial_wait_ns,eeprom_writes,eeprom_wait_ns,lcd_bytes,timer1_irqs,int0_irqs,ranges,loops";
+
+// Events
+struct Event {
+  Time t;
+  uint64_t seq;                             // Events due at the same time run in the order they were set
+  std::function<void()> run;
+};
+struct Later {
+  bool operator()(const Event &a, const Event &b) const { return a.t > b.t || (a.t == b.t && a.seq > b.seq); }
+};
+static std::priority_queue<Event, std::vector<Event>, Later> events;
+static uint64_t eventSeq;
+
+void at(Time t, std::function<void()> event) {
+  events.push(Event { t, eventSeq++, event });
+}
+
+// Interrupts - the I bit is set at reset by the core's init(), before setup()
+static boolean iFlag = true;
+static boolean inIsr;
+static boolean int0Flag;
+static boolean timer1Flag;
+static void (*int0Handler)(void);
+static Time timer1Period;
+static uint32_t timer1Generation;           // Stops the ticks of a timer set up again
+
+}
+
+extern "C" void TIMER1_COMPA_vect(void);    // The sketch's ISR()
+
+namespace host {
+
+// Run the interrupts that are pending and enabled, INT0 first as in the AVR vector table - returns the time they took
+static Time serviceInterrupts() {
+  Time start = now;
+
+  while (iFlag && !inIsr) {
+    void (*vector)(void);
+    double cost;
+    if (int0Flag && int0Handler) {
+      int0Flag = false;
+      vector = int0Handler;
+      cost = HOST_INT0_ISR_US;
+      stats[STAT_INT0_IRQS]++;
+    }
+    else if (timer1Flag && (TIMSK1 & (1 << OCIE1A))) {
+      timer1Flag = false;
+      vector = TIMER1_COMPA_vect;
+      cost = HOST_TIMER1_ISR_US;
+      stats[STAT_TIMER1_IRQS]++;
+    }
+    else {
+      break;
+    }
+    inIsr = true;                           // The I bit is cleared while an ISR runs
+    iFlag = false;
+    spend(HOST_US(cost));
+    vector();
+    iFlag = true;
+    inIsr = false;
+  }
+  return now - start;
+}
+
+void spend(Time ns) {
+  Time end = now + ns;
+
+  for (;;) {
+    end += serviceInterrupts();             // The foreground waits while an ISR runs
+    if (events.empty() || events.top().t > end) {
+      break;
+    }
+    Event event = events.top();
+    events.pop();
+    if (event.t > now) {
+      now = event.t;
+    }
+    event.run();
+  }
+  if (now < end) {
+    now = end;
+  }
+}
+
+void int0Edge() {
+  int0Flag = true;                          // INTF0 latches whether or not the interrupt is enabled
+}
+
+// Timer1 in CTC mode from its registers - checked when interrupts are enabled again, which initializeTimer() ends with
+static void timer1Tick(uint32_t generation) {
+  if (generation != timer1Generation) {
+    return;
+  }
+  timer1Flag = true;
+  at(now + timer1Period, [generation] { timer1Tick(generation); });
+}
+
+static void checkTimer1() {
+  static const uint16_t PRESCALERS[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  uint16_t prescaler = PRESCALERS[TCCR1B & 0x07];
+  Time period = 0;
+
+  if ((TCCR1B & (1 << WGM12)) && prescaler) {
+    period = (Time)(OCR1A + 1) * prescaler * 1000000000ULL / F_CPU;
+  }
+  if (period != timer1Period) {
+    timer1Period = period;
+    uint32_t generation = ++timer1Generation;
+    if (period) {
+      at(now + period, [generation] { timer1Tick(generation); });
+    }
+  }
+}
+
+// Pins
+struct Pin {
+  uint8_t mode;
+  uint8_t out;
+};
+static Pin pins[HOST_PINS];
+
+uint8_t pinModeOf(uint8_t pin) {
+  return pin < HOST_PINS ? pins[pin].mode : INPUT;
+}
+
+uint8_t pinOutput(uint8_t pin) {
+  return pin < HOST_PINS ? pins[pin].out : LOW;
+}
+
+boolean pinHigh(uint8_t pin) {
+  if (pin == 2) {
+    return !canIntLow();                    // INT_PIN - driven by the MCP2515
+  }
+  return pinModeOf(pin) != OUTPUT || pinOutput(pin) == HIGH;
+}
+
+// The cars' MCP4912 DACs - a 16 bit write per chip select low: channel (bit 15), gain (13), active (12), 10 bit code (11 .. 2)
+struct Dac {
+  uint8_t cs;
+  uint8_t n;
+  uint8_t bytes[2];
+  int a;
+  int b;
+};
+static std::vector<Dac> dacs;
+
+void addDac(uint8_t csPin) {
+  dacs.push_back(Dac { csPin, 0, { 0, 0 }, 0, 0 });
+}
+
+static void dacSelect(uint8_t pin, boolean high) {
+  for (size_t i = 0; i < dacs.size(); i++) {
+    Dac &dac = dacs[i];
+    if (dac.cs != pin) {
+      continue;
+    }
+    if (!high) {
+      dac.n = 0;
+      continue;
+    }
+    if (dac.n == 2) {                       // Latched on the rising chip select (LDAC is tied low)
+      uint16_t word = (dac.bytes[0] << 8) | dac.bytes[1];
+      int code = (word & 0x1000) ? (word >> 2) & 0x3FF : 0;
+      ((word & 0x8000) ? dac.b : dac.a) = code;
+      stats[STAT_DAC_WRITES]++;
+      if (dacCallback) {
+        dacCallback(i, now / 1000.0, dac.a - dac.b);
+      }
+    }
+    dac.n = 0;
+  }
+}
+
+static void dacByte(uint8_t data) {
+  for (size_t i = 0; i < dacs.size(); i++) {
+    Dac &dac = dacs[i];
+    if (pinModeOf(dac.cs) == OUTPUT && pinOutput(dac.cs) == LOW && dac.n < 2) {
+      dac.bytes[dac.n++] = data;
+    }
+  }
+}
+
+// I2C
+static std::vector<I2CDevice *> i2cDevices;
+static std::vector<I2CRecord> i2cTrace;
+static boolean i2cTracing;
+
+void attachI2C(I2CDevice *device) {
+  i2cDevices.push_back(device);
+}
+
+void traceI2C(const I2CRecord &record) {
+  if (i2cTracing) {
+    i2cTrace.push_back(record);
+  }
+}
+
+// Serial - what the firmware prints, for tools/firmware.py
+static std::string serialOut;
+static uint32_t serialBaud = 115200;
+static Time serialFree;                     // When the UART has sent every byte written so far
+
+// EEPROM
+static uint8_t eeprom[E2END + 1];
+static Time eepromReady;
+
+static void eepromWait() {
+  if (eepromReady > now) {
+    stats[STAT_EEPROM_WAIT_NS] += eepromReady - now;
+    spend(eepromReady - now);
+  }
+}
+
+// LCD
+static char lcd[2][16];
+
+static void lcdByte() {
+  spend(HOST_US(HOST_PIN_US + 2 * (7 * HOST_PIN_US + HOST_LCD_PULSE_US)));   // RS, then two nibbles of 4 data pins and the enable pulse
+  stats[STAT_LCD_BYTES]++;
+}
+
+// random() as avr-libc (Park-Miller minimal standard)
+static uint32_t randomState = 1;
+static uint32_t noiseState = 0x2545F491;    // ADC noise - seeded by tools/firmware.py
+
+}
+
+using namespace host;
+
+HostSreg SREG;
+HardwareSerial Serial;
+SPIClass SPI;
+TwoWire Wire;
+EEPROMClass EEPROM;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t OCR1A, TCNT1;
+
+HostSreg::operator uint8_t() const {
+  return iFlag ? 0x80 : 0;
+}
+
+HostSreg &HostSreg::operator=(uint8_t value) {
+  if (value & 0x80) {
+    sei();
+  }
+  else {
+    cli();
+  }
+  return *this;
+}
+
+void cli() {
+  iFlag = false;
+}
+
+void sei() {
+  iFlag = true;
+  checkTimer1();
+  serviceInterrupts();                      // What came in while they were off runs at once
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*handler)(void), int /* mode */) {
+  if (interruptNum == 0) {
+    int0Handler = handler;                  // FALLING - the only edge the MCP2515's INT gives
+    serviceInterrupts();
+  }
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+  if (interruptNum == 0) {
+    int0Handler = NULL;
+  }
+}
+
+uint32_t millis() {
+  spend(HOST_US(HOST_MILLIS_US));
+  return now / 1000000;
+}
+
+uint32_t micros() {
+  spend(HOST_US(HOST_MICROS_US));
+  return (uint32_t)(now / 1000) & ~3u;      // Timer0 counts 4 us steps at 16 MHz
+}
+
+void delay(uint32_t ms) {
+  spend((Time)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  spend((Time)us * 1000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  spend(HOST_US(HOST_PIN_US));
+  if (pin >= HOST_PINS) {
+    return;
+  }
+  boolean wasHigh = pinHigh(pin);
+  pins[pin].mode = (mode == OUTPUT) ? OUTPUT : INPUT;
+  if (mode != OUTPUT) {
+    pins[pin].out = (mode == INPUT_PULLUP) ? HIGH : LOW;
+  }
+  if (pinHigh(pin) != wasHigh) {
+    dacSelect(pin, pinHigh(pin));
+  }
+  sensorsPower();
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  spend(HOST_US(HOST_PIN_US));
+  if (pin >= HOST_PINS) {
+    return;
+  }
+  boolean wasHigh = pinHigh(pin);
+  pins[pin].out = value ? HIGH : LOW;
+  if (pinHigh(pin) != wasHigh) {
+    dacSelect(pin, pinHigh(pin));
+  }
+  sensorsPower();
+}
+
+int digitalRead(uint8_t pin) {
+  spend(HOST_US(HOST_PIN_US));
+  return pinHigh(pin) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t /* pin */) {
+  spend(HOST_US(HOST_ANALOG_US));
+  noiseState ^= noiseState << 13;           // An unconnected input - a few counts of noise around mid scale
+  noiseState ^= noiseState >> 17;
+  noiseState ^= noiseState << 5;
+  return 500 + (noiseState & 0x0F);
+}
+
+void randomSeed(uint32_t seed) {
+  if (seed != 0) {
+    randomState = seed;
+  }
+}
+
+static int32_t avrRandom() {
+  int32_t x = randomState;
+  if (x == 0) {
+    x = 123459876;
+  }
+  int32_t hi = x / 127773;
+  int32_t lo = x % 127773;
+  x = 16807 * lo - 2836 * hi;
+  if (x < 0) {
+    x += 0x7FFFFFFF;
+  }
+  randomState = x;
+  return x;
+}
+
+int32_t random(int32_t howbig) {
+  if (howbig == 0) {
+    return 0;
+  }
+  return avrRandom() % howbig;
+}
+
+int32_t random(int32_t howsmall, int32_t howbig) {
+  if (howsmall >= howbig) {
+    return howsmall;
+  }
+  return random(howbig - howsmall) + howsmall;
+}
+
+// The format with the l length modifiers dropped - the arguments are the firmware's 32 bit longs
+int host_sprintf(char *s, const char *format, ...) {
+  char fmt[256];
+  size_t n = 0;
+  boolean spec = false;
+
+  for (const char *p = format; *p && n < sizeof(fmt) - 1; p++) {
+    if (spec && *p == 'l') {
+      continue;
+    }
+    if (*p == '%') {
+      spec = !spec;
+    }
+    else if (spec && strchr("diouxXcsfeEgGp", *p)) {
+      spec = false;
+    }
+    fmt[n++] = *p;
+  }
+  fmt[n] = 0;
+
+  va_list args;
+  va_start(args, format);
+  int length = vsprintf(s, fmt, args);
+  va_end(args);
+  return length;
+}
+
+// Print as the Arduino core's
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if (base == 0) {
+    return write((uint8_t)n);
+  }
+  if (base == 10 && n < 0) {
+    return print('-') + printNumber(-n, 10);
+  }
+  return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  if (base == 0) {
+    return write((uint8_t)n);
+  }
+  return printNumber(n, base);
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  *str = 0;
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+// printFloat() of the core in the AVR's 32 bit double
+size_t Print::print(double value, int digits) {
+  float number = value;
+  size_t n = 0;
+
+  if (isnan(number)) return print("nan");
+  if (isinf(number)) return print("inf");
+  if (number > 4294967040.0) return print("ovf");
+  if (number < -4294967040.0) return print("ovf");
+  if (number < 0.0) {
+    n += print('-');
+    number = -number;
+  }
+  float rounding = 0.5;
+  for (uint8_t i = 0; i < digits; ++i) {
+    rounding /= 10.0;
+  }
+  number += rounding;
+  uint32_t whole = (uint32_t)number;
+  float remainder = number - (float)whole;
+  n += print((unsigned long)whole);
+  if (digits > 0) {
+    n += print('.');
+  }
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    unsigned int toPrint = (unsigned int)remainder;
+    n += print(toPrint);
+    remainder -= toPrint;
+  }
+  return n;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  serialBaud = baud;
+}
+
+static Time serialByteTime() {
+  return 10 * 1000000000ULL / serialBaud;   // Start, 8 data and stop bits
+}
+
+int HardwareSerial::availableForWrite() {
+  Time queued = serialFree > now ? (serialFree - now + serialByteTime() - 1) / serialByteTime() : 0;
+  return queued < HOST_SERIAL_BUFFER ? HOST_SERIAL_BUFFER - queued : 0;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  Time full = (Time)HOST_SERIAL_BUFFER * serialByteTime();
+  if (serialFree > now + full) {            // Buffer full - wait for the UART to take a byte
+    Time wait = serialFree - now - full;
+    stats[STAT_SERIAL_WAIT_NS] += wait;
+    spend(wait);
+  }
+  serialFree = (serialFree > now ? serialFree : now) + serialByteTime();
+  serialOut += (char)c;
+  stats[STAT_SERIAL_BYTES]++;
+  spend(HOST_US(HOST_SERIAL_BYTE_US));
+  return 1;
+}
+
+void HardwareSerial::flush() {
+  if (serialFree > now) {
+    spend(serialFree - now);
+  }
+}
+
+// SPI - the AVR's clock divider gives F_CPU / 2 at most, and endTransaction() leaves the last transaction's clock set
+static uint32_t spiClock = F_CPU / 4;
+
+void SPIClass::begin() {
+  pins[10].mode = OUTPUT;                   // SS must be an output for master mode - the core drives it high
+  pins[10].out = HIGH;
+  pins[11].mode = OUTPUT;
+  pins[13].mode = OUTPUT;
+}
+
+void SPIClass::beginTransaction(SPISettings settings) {
+  uint32_t clock = F_CPU / 2;
+  while (clock > settings.clock && clock > F_CPU / 128) {
+    clock /= 2;
+  }
+  spiClock = clock;
+}
+
+void SPIClass::endTransaction() {
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  spend(8 * 1000000000ULL / spiClock + HOST_US(HOST_SPI_BYTE_US));
+  stats[STAT_SPI_BYTES]++;
+  dacByte(data);
+  return 0;                                 // The DACs have no output - the MCP2515's replies are in mcp2515.cpp
+}
+
+// Wire - the bytes take 9 clocks each (8 data bits and the acknowledge)
+static uint32_t i2cClock = 100000;
+
+static Time i2cTime(uint8_t bytes) {
+  return (Time)bytes * 9 * 1000000000ULL / i2cClock + HOST_US(HOST_I2C_US);
+}
+
+void TwoWire::begin() {
+  m_txLength = 0;
+  m_rxLength = 0;
+  m_rxIndex = 0;
+}
+
+void TwoWire::setClock(uint32_t clock) {
+  i2cClock = clock;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  m_address = address;
+  m_txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (m_txLength >= BUFFER_LENGTH) {
+    return 0;
+  }
+  m_tx[m_txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity) {
+  size_t n = 0;
+  while (quantity-- && write(*data++)) {
+    n++;
+  }
+  return n;
+}
+
+static std::vector<I2CDevice *> answering(uint8_t address) {
+  std::vector<I2CDevice *> devices;
+  for (size_t i = 0; i < i2cDevices.size(); i++) {
+    if (i2cDevices[i]->answers(address)) {
+      devices.push_back(i2cDevices[i]);
+    }
+  }
+  return devices;
+}
+
+// 0 - sent, 2 - no device answered the address (the transfer stops after it)
+uint8_t TwoWire::endTransmission(uint8_t /* sendStop */) {
+  I2CRecord record = { now, m_address, 0, 0, m_txLength, { 0 } };
+  std::vector<I2CDevice *> devices = answering(m_address);
+  Time start = now;
+
+  memcpy(record.data, m_tx, m_txLength);
+  record.ack = !devices.empty();
+  spend(i2cTime(devices.empty() ? 1 : 1 + m_txLength));
+  stats[STAT_I2C_NS] += now - start;
+  stats[STAT_I2C_WRITES]++;
+  traceI2C(record);
+  if (devices.empty()) {
+    stats[STAT_I2C_NACKS]++;
+    return 2;
+  }
+  stats[STAT_I2C_BYTES] += 1 + m_txLength;
+  for (size_t i = 0; i < devices.size(); i++) {
+    devices[i]->write(m_tx, m_txLength);
+  }
+  m_txLength = 0;
+  return 0;
+}
+
+// Two devices on the address drive the same open drain line - a 0 from either wins
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t /* sendStop */) {
+  std::vector<I2CDevice *> devices = answering(address);
+  Time start = now;
+
+  if (quantity > BUFFER_LENGTH) {
+    quantity = BUFFER_LENGTH;
+  }
+  I2CRecord record = { now, address, 1, !devices.empty(), 0, { 0 } };
+  m_rxIndex = 0;
+  m_rxLength = devices.empty() ? 0 : quantity;
+  for (uint8_t i = 0; i < m_rxLength; i++) {
+    uint8_t data = 0xFF;
+    for (size_t d = 0; d < devices.size(); d++) {
+      data &= devices[d]->read();
+    }
+    m_rx[i] = data;
+  }
+  record.n = m_rxLength;
+  memcpy(record.data, m_rx, m_rxLength);
+  spend(i2cTime(1 + m_rxLength));
+  stats[STAT_I2C_NS] += now - start;
+  stats[STAT_I2C_READS]++;
+  traceI2C(record);
+  if (devices.empty()) {
+    stats[STAT_I2C_NACKS]++;
+  }
+  else {
+    stats[STAT_I2C_BYTES] += 1 + m_rxLength;
+  }
+  return m_rxLength;
+}
+
+int TwoWire::available() {
+  return m_rxLength - m_rxIndex;
+}
+
+int TwoWire::read() {
+  return m_rxIndex < m_rxLength ? m_rx[m_rxIndex++] : -1;
+}
+
+uint8_t EEPROMClass::read(int idx) {
+  eepromWait();
+  spend(HOST_US(HOST_EEPROM_READ_US));
+  return eeprom[idx & E2END];
+}
+
+void EEPROMClass::write(int idx, uint8_t value) {
+  eepromWait();
+  eeprom[idx & E2END] = value;
+  eepromReady = now + HOST_US(HOST_EEPROM_WRITE_US);
+  stats[STAT_EEPROM_WRITES]++;
+  spend(HOST_US(HOST_EEPROM_READ_US));
+}
+
+LiquidCrystal::LiquidCrystal(uint8_t /* rs */, uint8_t /* enable */, uint8_t /* d0 */, uint8_t /* d1 */, uint8_t /* d2 */, uint8_t /* d3 */) : m_col(0), m_row(0) {
+}
+
+void LiquidCrystal::begin(uint8_t /* cols */, uint8_t /* rows */) {
+  spend(HOST_US(50000 + 4500 + 4500 + 150));   // Power up wait and the three function sets of the 4 bit handshake
+  for (uint8_t i = 0; i < 4; i++) {
+    lcdByte();
+  }
+  lcdByte();                                // Function set, display on, entry mode
+  lcdByte();
+  lcdByte();
+  clear();
+}
+
+void LiquidCrystal::clear() {
+  lcdByte();
+  spend(HOST_US(HOST_LCD_CLEAR_US));
+  memset(lcd, ' ', sizeof(lcd));
+  m_col = 0;
+  m_row = 0;
+}
+
+void LiquidCrystal::home() {
+  lcdByte();
+  spend(HOST_US(HOST_LCD_CLEAR_US));
+  m_col = 0;
+  m_row = 0;
+}
+
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row) {
+  lcdByte();
+  m_col = col;
+  m_row = row;
+}
+
+size_t LiquidCrystal::write(uint8_t c) {
+  lcdByte();
+  if (m_row < 2 && m_col < 16) {
+    lcd[m_row][m_col] = c;
+  }
+  m_col++;
+  return 1;
+}
+
+// The sketch
+void setup();
+void loop();
+extern "C" int host_cars(uint8_t *xshut, uint8_t *dacCs, uint8_t *address);
+
+extern "C" {
+
+// The cars of CAR_TABLE: a sensor on its XSHUT pin and a DAC on its chip select each
+void host_init(RangeCallback range, DacCallback dac) {
+  uint8_t xshut[16], cs[16], address[16];
+  int cars = host_cars(xshut, cs, address);
+
+  rangeCallback = range;
+  dacCallback = dac;
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  memset(lcd, ' ', sizeof(lcd));
+  for (int i = 0; i < cars; i++) {
+    addSensor(xshut[i]);
+    addDac(cs[i]);
+  }
+  sensorsPower();
+}
+
+void host_setup() {
+  setup();
+}
+
+// loop() as main() calls it
+void host_loop(int count) {
+  while (count-- > 0) {
+    spend(HOST_US(HOST_LOOP_US));
+    loop();
+    stats[STAT_LOOPS]++;
+  }
+}
+
+double host_now() {
+  return now / 1000.0;
+}
+
+void host_run_until(double tUs) {
+  while (now < HOST_US(tUs)) {
+    host_loop(1);
+  }
+}
+
+// Everything printed since the last call (up to size bytes)
+int host_serial_read(char *buf, int size) {
+  int n = serialOut.size() < (size_t)size ? serialOut.size() : size;
+  memcpy(buf, serialOut.data(), n);
+  serialOut.erase(0, n);
+  return n;
+}
+
+uint8_t *host_eeprom() {
+  return eeprom;
+}
+
+void host_seed(uint32_t seed) {
+  noiseState = seed ? seed : 1;
+}
+
+int host_pin(int pin) {
+  return pinHigh(pin);
+}
+
+int host_pin_mode(int pin) {
+  return pinModeOf(pin);
+}
+
+int host_dac_code(int car) {
+  return car < (int)dacs.size() ? dacs[car].a - dacs[car].b : 0;
+}
+
+double host_timer1_period_us() {
+  return timer1Period / 1000.0;
+}
+
+void host_lcd(char *out) {
+  memcpy(out, lcd, sizeof(lcd));
+}
+
+void host_i2c_trace(int on) {
+  i2cTracing = on;
+  i2cTrace.clear();
+}
+
+int host_i2c_count() {
+  return i2cTrace.size();
+}
+
+// Transaction i of the trace: time, address, read (1) or write, acknowledged - returns the byte count
+int host_i2c_record(int i, double *tUs, uint8_t *address, uint8_t *read, uint8_t *ack, uint8_t *data) {
+  const I2CRecord &record = i2cTrace[i];
+  *tUs = record.t / 1000.0;
+  *address = record.address;
+  *read = record.read;
+  *ack = record.ack;
+  memcpy(data, record.data, record.n);
+  return record.n;
+}
+
+int host_stats(uint64_t *out) {
+  memcpy(out, stats, sizeof(stats));
+  return STAT_COUNT;
+}
+
+const char *host_stat_names() {
+  return STAT_NAMES;
+}
+
+}
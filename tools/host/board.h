@@ -0,0 +1,85 @@
+/*!
+ * @file board.h
+ * @brief Host build of the Elevator Controller - the simulated UNO behind the shims (see Arduino.h)
+ *
+ * The board's clock and event queue, its pins and interrupts, the devices on its buses and what tools/firmware.py reads back. Only the
+ * host's own files include it (before anything else - it brings in the system headers ahead of Arduino.h and takes back its long).
+ */
+
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <stdint.h>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <string>
+
+#include "Arduino.h"
+#undef long                                 // The host's own code keeps the host's long
+
+#define HOST_US(us) ((host::Time)((us) * 1000.0))   // Board time of a count of microseconds
+
+namespace host {
+
+typedef uint64_t Time;                      // in ns since power up
+
+extern Time now;
+
+// Time - the foreground spends it, events and interrupts come due in it
+void spend(Time ns);                        // Foreground work of ns (interrupts that come in stretch it)
+void at(Time t, std::function<void()> event);   // Run event when the clock reaches t
+void int0Edge();                            // Falling edge on INT0 (pin 2) - latches the flag, the handler runs when interrupts allow it
+
+// Pins
+uint8_t pinModeOf(uint8_t pin);
+uint8_t pinOutput(uint8_t pin);             // Level written to the pin
+boolean pinHigh(uint8_t pin);               // Level on the pin: an input floats high (the sensor breakouts pull XSHUT up)
+
+// I2C devices on Wire
+class I2CDevice {
+public:
+  virtual ~I2CDevice() {}
+  virtual boolean answers(uint8_t address) = 0;    // ACKs the address (powered, out of reset and on that address)
+  virtual void write(const uint8_t *data, uint8_t n) = 0;   // The bytes after the address of a write
+  virtual uint8_t read() = 0;               // Next byte of a read (from the index set by the write before it)
+};
+void attachI2C(I2CDevice *device);
+
+struct I2CRecord {                          // One Wire transaction
+  Time t;                                   // Start
+  uint8_t address;
+  uint8_t read;                             // requestFrom() rather than endTransmission()
+  uint8_t ack;                              // A device answered
+  uint8_t n;
+  uint8_t data[32];
+};
+void traceI2C(const I2CRecord &record);
+
+// MCP2515 (mcp2515.cpp)
+boolean canIntLow();                        // INT is low while a received frame waits
+
+// The cars' devices (vl53l0x.cpp, the DACs in board.cpp)
+void addSensor(uint8_t xshutPin);
+void sensorsPower();                        // XSHUT changed - power sensors up or down
+void addDac(uint8_t csPin);
+
+// Counters for tools/firmware.py - host_stat_names() lists them in this order
+enum Stat {
+  STAT_I2C_WRITES, STAT_I2C_READS, STAT_I2C_BYTES, STAT_I2C_NACKS, STAT_I2C_NS,
+  STAT_SPI_BYTES, STAT_DAC_WRITES, STAT_CAN_TX, STAT_CAN_RX, STAT_CAN_LOST, STAT_CAN_TX_NS,
+  STAT_SERIAL_BYTES, STAT_SERIAL_WAIT_NS, STAT_EEPROM_WRITES, STAT_EEPROM_WAIT_NS, STAT_LCD_BYTES,
+  STAT_TIMER1_IRQS, STAT_INT0_IRQS, STAT_RANGES, STAT_LOOPS,
+  STAT_COUNT
+};
+extern uint64_t stats[STAT_COUNT];
+
+// Into tools/firmware.py
+typedef double (*RangeCallback)(int sensor, double tUs);    // Target distance in mm when a measurement ends (NaN - no target)
+typedef void (*DacCallback)(int car, double tUs, int code); // Net code (A - B) latched by a car's DAC
+extern RangeCallback rangeCallback;
+extern DacCallback dacCallback;
+
+}
+
+#endif
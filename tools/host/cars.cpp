@@ -0,0 +1,25 @@
+/*!
+ * @file cars.cpp
+ * @brief Host build of the Elevator Controller - the board's cars from the firmware's CAR_TABLE (see Arduino.h)
+ */
+
+#include "Car.h"
+
+extern "C" int host_cars(uint8_t *xshut, uint8_t *dacCs, uint8_t *address) {
+  for (uint8_t i = 0; i < CAR_COUNT; i++) {
+    xshut[i] = CAR_TABLE[i].xshutPin;
+    dacCs[i] = CAR_TABLE[i].dacCs;
+    address[i] = CAR_TABLE[i].sensorAddress;
+  }
+  return CAR_COUNT;
+}
+
+// Size of a car's calibration and health records in the host's layout (padded - the AVR build packs them), 0 for no calibration records
+extern "C" void host_car_records(int *calibration, int *health) {
+#if RANGEFINDER == RANGEFINDER_VL53L0X
+  *calibration = sizeof(CalibrationRecord);
+#else
+  *calibration = 0;
+#endif
+  *health = sizeof(HealthRecord);
+}
@@ -0,0 +1,475 @@
+/*!
+ * @file mcp2515.cpp
+ * @brief Host build of the Elevator Controller - the MCP2515 and the CAN bus behind mcp_can.h (see Arduino.h)
+ *
+ * The controller takes frames off the bus in normal mode only (begin() leaves it in loopback, as the library's does). A standard frame
+ * is matched on its 11 bit ID and its first two data bytes against the mask and the filters of a buffer (mask 0 with filters 0 and 1
+ * for buffer 0, mask 1 with filters 2 to 5 for buffer 1); a standard filter never takes an extended frame. Buffer 0 rolls over into
+ * buffer 1, and a frame that finds its buffer full is lost and sets the EFLG overflow bit. A remote frame leaves the buffer's data
+ * bytes as the frame before wrote them.
+ *
+ * The bus: frames that tools/firmware.py injects and the node's own wait for it to be free and then go lowest ID first. A frame takes
+ * its bits at 125 kbps - stuff bits from its CRC-15 included, then the delimiters, EOF and interframe space. Without another node to
+ * acknowledge it (host_can_ack(0)) the node's frame fails and goes again after an error frame until one does, and its transmit buffer
+ * stays busy meanwhile - sendMsgBuf() gives up after the library's 2500 polls. A bus error (host_can_error()) destroys the frame on the
+ * wire the same way.
+ */
+
+#include "board.h"
+#include "SPI.h"
+#include "mcp_can.h"
+
+#define MCP_TIMEOUT 2500                    // The library's TIMEOUTVALUE - polls of the transmit buffer
+#define MCP_TX_BUFFERS 3
+#define MCP_RX1OVR 0x80
+#define MCP_EFLG_ERRORMASK 0xF8
+#define CAN_ERROR_FRAME_BITS 17             // Error flag, its delimiter and the interframe space
+
+namespace host {
+
+struct Frame {
+  uint32_t id;                              // With the CAN_FRAME_xxx flags, as readMsgBuf() gives it
+  uint8_t dlc;
+  uint8_t data[8];
+};
+
+struct Queued {
+  Frame frame;
+  int buffer;                               // The node's transmit buffer - -1 for an injected frame
+};
+
+struct Sent {
+  Time t;                                   // End of the frame
+  Frame frame;
+};
+
+struct Filter {
+  uint8_t ext;
+  uint32_t data;                            // As init_Mask()/init_Filt() take it: standard ID << 16 | first two data bytes
+};
+
+static uint8_t idMode;
+static uint8_t opMode = MCP_LOOPBACK;
+static Time bitTime = 8000;                 // 125 kbps
+static Filter masks[2];
+static Filter filters[6];
+static Frame rx[2];
+static boolean rxFull[2];
+static uint8_t eflg;
+static Frame last;                          // The library's copy of the last frame read
+static boolean txBusy[MCP_TX_BUFFERS];
+static boolean ack = true;
+
+static std::vector<Queued> waiting;
+static boolean busBusy;
+static Queued onWire;
+static uint32_t wireGeneration;             // An error frame ends the frame on the wire early - its scheduled end is dropped
+static std::vector<Sent> sent;
+
+boolean canIntLow() {
+  return rxFull[0] || rxFull[1];
+}
+
+// One SPI command of bytes bytes with the chip select around it - the MCP2515's replies come from the model, not the transfer
+static void command(uint8_t cs, uint8_t bytes) {
+  SPI.beginTransaction(SPISettings(10000000, MSBFIRST, SPI_MODE0));
+  digitalWrite(cs, LOW);
+  while (bytes--) {
+    SPI.transfer(0);
+  }
+  digitalWrite(cs, HIGH);
+  SPI.endTransaction();
+}
+
+// Bits of the frame on the wire
+static void pushBits(std::vector<uint8_t> &bits, uint32_t value, uint8_t n) {
+  while (n--) {
+    bits.push_back((value >> n) & 1);
+  }
+}
+
+static uint32_t frameBits(const Frame &frame) {
+  std::vector<uint8_t> bits;
+  uint32_t id = frame.id & 0x1FFFFFFF;
+  boolean remote = (frame.id & 0x40000000) != 0;
+  uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+
+  bits.push_back(0);                        // SOF
+  if (frame.id & 0x80000000) {
+    pushBits(bits, id >> 18, 11);
+    pushBits(bits, 3, 2);                   // SRR, IDE
+    pushBits(bits, id, 18);
+    pushBits(bits, remote, 1);
+    pushBits(bits, 0, 2);                   // r1, r0
+  }
+  else {
+    pushBits(bits, id, 11);
+    pushBits(bits, remote, 1);
+    pushBits(bits, 0, 2);                   // IDE, r0
+  }
+  pushBits(bits, frame.dlc, 4);
+  for (uint8_t i = 0; !remote && i < dlc; i++) {
+    pushBits(bits, frame.data[i], 8);
+  }
+  uint16_t crc = 0;
+  for (size_t i = 0; i < bits.size(); i++) {
+    uint8_t next = bits[i] ^ ((crc >> 14) & 1);
+    crc = (crc << 1) & 0x7FFF;
+    if (next) {
+      crc ^= 0x4599;
+    }
+  }
+  pushBits(bits, crc, 15);
+
+  uint32_t stuffed = bits.size();
+  uint8_t run = 0;
+  uint8_t level = 2;
+  for (size_t i = 0; i < bits.size(); i++) {
+    run = (bits[i] == level) ? run + 1 : 1;
+    level = bits[i];
+    if (run == 5) {                         // The stuff bit is the opposite level and starts the next run
+      stuffed++;
+      level = !level;
+      run = 1;
+    }
+  }
+  return stuffed + 1 + 2 + 7 + 3;           // CRC delimiter, ACK slot and delimiter, EOF, interframe space
+}
+
+// Acceptance
+static boolean matches(const Frame &frame, const Filter &mask, const Filter &filter) {
+  if (frame.id & 0x80000000) {
+    if (!filter.ext) {
+      return false;
+    }
+    uint32_t id = frame.id & 0x1FFFFFFF;
+    return ((id ^ filter.data) & mask.data & 0x1FFFFFFF) == 0;
+  }
+  if (filter.ext) {
+    return false;
+  }
+  uint32_t value = ((frame.id & 0x7FF) << 16) | (frame.dlc > 0 ? frame.data[0] << 8 : 0) | (frame.dlc > 1 ? frame.data[1] : 0);
+  return ((value ^ filter.data) & mask.data & 0x07FFFFFF) == 0;
+}
+
+static void store(uint8_t buffer, const Frame &frame) {
+  boolean wasLow = canIntLow();
+  uint8_t data[8];
+
+  memcpy(data, rx[buffer].data, sizeof(data));
+  rx[buffer] = frame;
+  if (frame.id & 0x40000000) {
+    memcpy(rx[buffer].data, data, sizeof(data));   // A remote frame has no data bytes
+  }
+  rxFull[buffer] = true;
+  stats[STAT_CAN_RX]++;
+  if (!wasLow) {
+    int0Edge();
+  }
+}
+
+static void receive(const Frame &frame) {
+  if (opMode != MCP_NORMAL) {
+    return;
+  }
+  boolean any = idMode == MCP_ANY;
+  if (any || matches(frame, masks[0], filters[0]) || matches(frame, masks[0], filters[1])) {
+    if (!rxFull[0]) {
+      store(0, frame);
+    }
+    else if (!rxFull[1]) {
+      store(1, frame);                      // BUKT rollover
+    }
+    else {
+      eflg |= MCP_RX1OVR;
+      stats[STAT_CAN_LOST]++;
+    }
+    return;
+  }
+  for (uint8_t i = 2; i < 6; i++) {
+    if (matches(frame, masks[1], filters[i])) {
+      if (!rxFull[1]) {
+        store(1, frame);
+      }
+      else {
+        eflg |= MCP_RX1OVR;
+        stats[STAT_CAN_LOST]++;
+      }
+      return;
+    }
+  }
+}
+
+// Bus - the next frame starts when the bus is free, lowest ID first (an extended frame's base ID, then the standard frame first)
+static uint32_t priority(const Frame &frame) {
+  uint32_t id = frame.id & 0x1FFFFFFF;
+  return (frame.id & 0x80000000) ? ((id >> 18) << 19) | (1 << 18) | (id & 0x3FFFF) : id << 19;
+}
+
+static void busNext();
+
+static void busEnd(Queued queued, Time start, uint32_t generation) {
+  if (generation != wireGeneration) {
+    return;
+  }
+  busBusy = false;
+  if (queued.buffer >= 0) {
+    if (ack) {
+      txBusy[queued.buffer] = false;
+      sent.push_back(Sent { now, queued.frame });
+      stats[STAT_CAN_TX]++;
+      stats[STAT_CAN_TX_NS] += now - start;
+    }
+    else {
+      waiting.push_back(queued);            // Acknowledge error - again after the error frame
+    }
+  }
+  else {
+    receive(queued.frame);
+  }
+  busNext();
+}
+
+static void busNext() {
+  if (busBusy || waiting.empty()) {
+    return;
+  }
+  size_t first = 0;
+  for (size_t i = 1; i < waiting.size(); i++) {
+    if (priority(waiting[i].frame) < priority(waiting[first].frame)) {
+      first = i;
+    }
+  }
+  Queued queued = waiting[first];
+  waiting.erase(waiting.begin() + first);
+  uint32_t bits = frameBits(queued.frame);
+  if (queued.buffer >= 0 && !ack) {
+    bits += CAN_ERROR_FRAME_BITS - 10;      // Stops at the ACK slot
+  }
+  Time start = now;
+  uint32_t generation = ++wireGeneration;
+  busBusy = true;
+  onWire = queued;
+  at(now + bits * bitTime, [queued, start, generation] { busEnd(queued, start, generation); });
+}
+
+static void transmit(uint8_t buffer, const Frame &frame) {
+  txBusy[buffer] = true;
+  if (opMode == MCP_LOOPBACK) {
+    at(now + frameBits(frame) * bitTime, [buffer, frame] {
+      txBusy[buffer] = false;
+      opMode = MCP_NORMAL;                  // Loopback receives its own frames
+      receive(frame);
+      opMode = MCP_LOOPBACK;
+    });
+    return;
+  }
+  if (opMode != MCP_NORMAL) {
+    return;                                 // Stays pending
+  }
+  waiting.push_back(Queued { frame, buffer });
+  busNext();
+}
+
+}
+
+using namespace host;
+
+// The library's calls - each with the SPI commands it makes (register reads 3 bytes, writes 3 or 2 plus the data, bit modify 4)
+INT8U MCP_CAN::begin(INT8U idmodeset, INT8U speedset, INT8U /* clockset */) {
+  static const uint16_t KBPS[] = { 0, 5, 10, 20, 31, 33, 40, 50, 80, 100, 125, 200, 250, 500, 1000 };
+
+  command(m_cs, 1);                         // Reset
+  delayMicroseconds(10);
+  command(m_cs, 4);                         // Configuration mode
+  command(m_cs, 3);
+  for (uint8_t i = 0; i < 3; i++) {
+    command(m_cs, 3);                       // CNF1..3
+  }
+  for (uint8_t i = 0; i < 8; i++) {
+    command(m_cs, 6);                       // Masks and filters cleared
+  }
+  for (uint8_t i = 0; i < 3 * 14; i++) {
+    command(m_cs, 3);                       // Transmit buffers cleared
+  }
+  command(m_cs, 3);                         // CANINTE
+  command(m_cs, 4);                         // RXB0CTRL, RXB1CTRL
+  command(m_cs, 4);
+  command(m_cs, 4);                         // Loopback
+  command(m_cs, 3);
+
+  idMode = idmodeset;
+  opMode = MCP_LOOPBACK;
+  bitTime = 1000000000ULL / ((speedset < sizeof(KBPS) / sizeof(KBPS[0]) && KBPS[speedset]) ? KBPS[speedset] * 1000ULL : 125000ULL);
+  memset(masks, 0, sizeof(masks));
+  memset(filters, 0, sizeof(filters));
+  memset(rxFull, 0, sizeof(rxFull));
+  memset(txBusy, 0, sizeof(txBusy));
+  eflg = 0;
+  return CAN_OK;
+}
+
+INT8U MCP_CAN::init_Mask(INT8U num, INT8U ext, INT32U ulData) {
+  command(m_cs, 4);                         // Configuration mode and back
+  command(m_cs, 3);
+  command(m_cs, 6);
+  command(m_cs, 4);
+  command(m_cs, 3);
+  if (num > 1) {
+    return CAN_FAILINIT;
+  }
+  masks[num] = Filter { ext, ulData };
+  return CAN_OK;
+}
+
+INT8U MCP_CAN::init_Filt(INT8U num, INT8U ext, INT32U ulData) {
+  command(m_cs, 4);
+  command(m_cs, 3);
+  command(m_cs, 6);
+  command(m_cs, 4);
+  command(m_cs, 3);
+  if (num > 5) {
+    return CAN_FAILINIT;
+  }
+  filters[num] = Filter { ext, ulData };
+  return CAN_OK;
+}
+
+INT8U MCP_CAN::setMode(INT8U mode) {
+  command(m_cs, 4);
+  command(m_cs, 3);
+  opMode = mode;
+  return CAN_OK;
+}
+
+INT8U MCP_CAN::sendMsgBuf(INT32U id, INT8U ext, INT8U len, INT8U *buf) {
+  return sendMsgBuf(ext ? id | 0x80000000 : id, len, buf);
+}
+
+INT8U MCP_CAN::sendMsgBuf(INT32U id, INT8U len, INT8U *buf) {
+  Frame frame = { id, (uint8_t)(len > 8 ? 8 : len), { 0 } };
+  int buffer = -1;
+  uint16_t polls = 0;
+
+  memcpy(frame.data, buf, frame.dlc);
+  do {                                      // The first transmit buffer without TXREQ
+    for (uint8_t i = 0; i < MCP_TX_BUFFERS && buffer < 0; i++) {
+      command(m_cs, 3);
+      if (!txBusy[i]) {
+        buffer = i;
+      }
+    }
+    polls++;
+  } while (buffer < 0 && polls < MCP_TIMEOUT);
+  if (buffer < 0) {
+    return CAN_GETTXBFTIMEOUT;
+  }
+  command(m_cs, 2 + frame.dlc);             // Data, DLC, ID
+  command(m_cs, 3);
+  command(m_cs, 6);
+  command(m_cs, 4);                         // TXREQ
+  transmit(buffer, frame);
+  polls = 0;
+  do {
+    polls++;
+    command(m_cs, 3);
+  } while (txBusy[buffer] && polls < MCP_TIMEOUT);
+  return txBusy[buffer] ? CAN_SENDMSGTIMEOUT : CAN_OK;
+}
+
+INT8U MCP_CAN::readMsgBuf(INT32U *id, INT8U *ext, INT8U *len, INT8U *buf) {
+  INT8U result = readMsgBuf(id, len, buf);
+  *ext = (*id & 0x80000000) ? 1 : 0;
+  *id &= 0x1FFFFFFF;
+  return result;
+}
+
+INT8U MCP_CAN::readMsgBuf(INT32U *id, INT8U *len, INT8U *buf) {
+  INT8U result = CAN_NOMSG;
+
+  command(m_cs, 2);                         // Status
+  for (uint8_t i = 0; i < 2; i++) {
+    if (rxFull[i]) {
+      command(m_cs, 6);                     // ID, control, DLC, data
+      command(m_cs, 3);
+      command(m_cs, 3);
+      command(m_cs, 2 + (rx[i].dlc > 8 ? 8 : rx[i].dlc));
+      last = rx[i];
+      rxFull[i] = false;
+      command(m_cs, 4);                     // RXnIF cleared - INT goes high with the last one
+      result = CAN_OK;
+      break;
+    }
+  }
+  *id = last.id;                            // Without a frame - the one before, as the library
+  *len = last.dlc;
+  memcpy(buf, last.data, last.dlc > 8 ? 8 : last.dlc);
+  return result;
+}
+
+INT8U MCP_CAN::checkReceive() {
+  command(m_cs, 2);
+  return canIntLow() ? CAN_MSGAVAIL : CAN_NOMSG;
+}
+
+INT8U MCP_CAN::checkError() {
+  command(m_cs, 3);
+  return (eflg & MCP_EFLG_ERRORMASK) ? CAN_CTRLERROR : CAN_OK;
+}
+
+INT8U MCP_CAN::getError() {
+  command(m_cs, 3);
+  return eflg;
+}
+
+extern "C" {
+
+// A frame from another node, ready to go at tUs (with the CAN_FRAME_xxx flags in id)
+void host_can_inject(double tUs, uint32_t id, int dlc, const uint8_t *data) {
+  Frame frame = { id, (uint8_t)dlc, { 0 } };
+  memcpy(frame.data, data, dlc > 8 ? 8 : dlc);
+  at(HOST_US(tUs) > now ? HOST_US(tUs) : now, [frame] {
+    waiting.push_back(Queued { frame, -1 });
+    busNext();
+  });
+}
+
+// A bus error at tUs - the frame on the wire then is destroyed and goes again after the error frame
+void host_can_error(double tUs) {
+  at(HOST_US(tUs) > now ? HOST_US(tUs) : now, [] {
+    if (!busBusy) {
+      return;
+    }
+    uint32_t generation = ++wireGeneration;
+    waiting.push_back(onWire);
+    at(now + CAN_ERROR_FRAME_BITS * bitTime, [generation] {
+      if (generation == wireGeneration) {
+        busBusy = false;
+        busNext();
+      }
+    });
+  });
+}
+
+// Whether another node acknowledges the node's frames
+void host_can_ack(int on) {
+  ack = on;
+}
+
+int host_can_sent_count() {
+  return sent.size();
+}
+
+// Frame i the node sent: when it ended, its ID (with the flags) and data - returns the DLC
+int host_can_sent(int i, double *tUs, uint32_t *id, uint8_t *data) {
+  *tUs = sent[i].t / 1000.0;
+  *id = sent[i].frame.id;
+  memcpy(data, sent[i].frame.data, 8);
+  return sent[i].frame.dlc;
+}
+
+int host_can_eflg() {
+  return eflg;
+}
+
+}
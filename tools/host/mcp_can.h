@@ -0,0 +1,84 @@
+/*!
+ * @file mcp_can.h
+ * @brief Host build of the Elevator Controller - MCP2515 driver shim (see Arduino.h)
+ *
+ * The calls of coryjfowler's mcp_can on a simulated MCP2515: two receive buffers (buffer 0 rolls over into buffer 1) behind the masks and
+ * filters, INT low while a received frame waits, EFLG overflow bits when a frame finds both buffers full. Every call takes the SPI
+ * transfers the library makes for it (8 MHz, a chip select write around each register access). sendMsgBuf() waits, as the library does,
+ * until the frame has left the bus - its bit time at the bus rate, stuff bits included.
+ */
+
+#ifndef HOST_MCP_CAN_H
+#define HOST_MCP_CAN_H
+
+#include "Arduino.h"
+
+#define INT8U uint8_t
+#define INT32U uint32_t                     // The AVR's 32 bit unsigned long, whatever the host's long is
+
+// Result codes
+#define CAN_OK 0
+#define CAN_FAILINIT 1
+#define CAN_FAILTX 2
+#define CAN_MSGAVAIL 3
+#define CAN_NOMSG 4
+#define CAN_CTRLERROR 5
+#define CAN_GETTXBFTIMEOUT 6
+#define CAN_SENDMSGTIMEOUT 7
+#define CAN_FAIL 0xFF
+
+// begin() ID modes
+#define MCP_ANY 0                           // Masks and filters off
+#define MCP_STD 1
+#define MCP_EXT 2
+#define MCP_STDEXT 3
+
+// Operating modes
+#define MCP_NORMAL 0x00
+#define MCP_SLEEP 0x20
+#define MCP_LOOPBACK 0x40
+#define MCP_LISTENONLY 0x60
+
+// Oscillator
+#define MCP_20MHZ 0
+#define MCP_16MHZ 1
+#define MCP_8MHZ 2
+
+// Bit rates
+#define CAN_5KBPS 1
+#define CAN_10KBPS 2
+#define CAN_20KBPS 3
+#define CAN_31K25BPS 4
+#define CAN_33KBPS 5
+#define CAN_40KBPS 6
+#define CAN_50KBPS 7
+#define CAN_80KBPS 8
+#define CAN_100KBPS 9
+#define CAN_125KBPS 10
+#define CAN_200KBPS 11
+#define CAN_250KBPS 12
+#define CAN_500KBPS 13
+#define CAN_1000KBPS 14
+
+class MCP_CAN {
+public:
+  MCP_CAN(INT8U cs) : m_cs(cs) {}
+  INT8U begin(INT8U idmodeset, INT8U speedset, INT8U clockset);
+  INT8U init_Mask(INT8U num, INT8U ext, INT32U ulData);
+  INT8U init_Filt(INT8U num, INT8U ext, INT32U ulData);
+  INT8U setMode(INT8U opMode);
+  INT8U sendMsgBuf(INT32U id, INT8U ext, INT8U len, INT8U *buf);
+  INT8U sendMsgBuf(INT32U id, INT8U len, INT8U *buf);     // Extended and remote flags in the top bits of id
+  INT8U readMsgBuf(INT32U *id, INT8U *ext, INT8U *len, INT8U *buf);
+  INT8U readMsgBuf(INT32U *id, INT8U *len, INT8U *buf);   // Extended and remote flags in the top bits of id
+  INT8U checkReceive();
+  INT8U checkError();
+  INT8U getError();
+  INT8U errorCountRX() { return 0; }
+  INT8U errorCountTX() { return 0; }
+
+private:
+  INT8U m_cs;
+};
+
+#endif
@@ -0,0 +1,274 @@
+/*!
+ * @file vl53l0x.cpp
+ * @brief Host build of the Elevator Controller - the cars' VL53L0X sensors at register level (see Arduino.h)
+ *
+ * What the DFRobot driver talks to: paged registers (0xFF selects the page) with an auto-incrementing index, the I2C address register,
+ * the NVM strobe that gives the reference SPAD info, reference calibrations, and single or back-to-back ranging. A sensor is off the bus
+ * while its XSHUT pin is held low and comes back from power up on 0x29 with its registers reset, BOOT_US later.
+ *
+ * A measurement takes the timing budget the sequence step and timeout registers give (ST's formula), ends with the interrupt status set
+ * and the result block at 0x14 filled from the target distance tools/firmware.py returns for that moment: the return signal falls off
+ * with the square of the distance (signal100 MCPS at 100 mm), cover glass crosstalk adds to the signal and pulls the range toward zero,
+ * and the part's offset shifts it. A return below the signal rate limit (0x44), or no target, is status 4 with a range of 8190.
+ * The start bit clears as soon as the device takes the command. The faults make a sensor absent, leave its SPAD info or reference
+ * calibration unfinished, or stop its measurements from ever ending.
+ */
+
+#include "board.h"
+
+#define BOOT_US 1200.0                      // Power up to the first I2C access (tBOOT)
+#define NVM_US 500.0                        // SPAD info strobe
+#define REFCAL_US 2000.0                    // One VHV or phase calibration
+
+#define FAULT_NONE 0
+#define FAULT_ABSENT 1                      // Never answers
+#define FAULT_NO_SPAD 2                     // The SPAD info strobe never completes
+#define FAULT_NO_REFCAL 3                   // Reference calibrations never complete
+#define FAULT_STUCK 4                       // Measurements never complete
+
+namespace host {
+
+// Timing budget of the enabled sequence steps - VL53L0X_GetMeasurementTimingBudgetMicroSeconds()
+static uint32_t macroPeriodNs(uint8_t vcselPclks) {
+  return (((uint32_t)2304 * vcselPclks * 1655) + 500) / 1000;
+}
+
+static uint32_t mclksToUs(uint32_t mclks, uint8_t vcselPclks) {
+  return (mclks * macroPeriodNs(vcselPclks) + 500) / 1000;
+}
+
+static uint32_t decodeTimeout(uint16_t value) {
+  return ((uint32_t)(value & 0xFF) << (value >> 8)) + 1;
+}
+
+class Vl53l0x : public I2CDevice {
+public:
+  Vl53l0x(int index, uint8_t xshut) : m_index(index), m_xshut(xshut), m_powered(false), m_generation(0) {
+    signal100 = 100.0;
+    ambient = 0.5;
+    crosstalk = 0;
+    offset = 0;
+    spads = 8.0;
+    fault = FAULT_NONE;
+  }
+
+  double signal100;                         // in MCPS at 100 mm
+  double ambient;                           // in MCPS
+  double crosstalk;                         // in MCPS per SPAD
+  double offset;                            // in mm - read long by this
+  double spads;                             // Effective SPAD count
+  int fault;                                // FAULT_xxx
+
+  uint8_t xshut() { return m_xshut; }
+  boolean powered() { return m_powered; }
+  uint8_t address() { return m_address; }
+  uint8_t reg(uint8_t page, uint8_t reg) { return m_regs[page & 7][reg]; }
+
+  void power(boolean on) {
+    if (on == m_powered) {
+      return;
+    }
+    m_powered = on;
+    m_generation++;                         // Whatever was running is gone
+    if (on) {
+      reset();
+      m_ready = now + HOST_US(BOOT_US);
+    }
+  }
+
+  boolean answers(uint8_t address) {
+    return fault != FAULT_ABSENT && m_powered && now >= m_ready && address == m_address;
+  }
+
+  void write(const uint8_t *data, uint8_t n) {
+    if (n == 0) {
+      return;
+    }
+    m_pointer = data[0];
+    for (uint8_t i = 1; i < n; i++) {
+      writeReg(m_pointer++, data[i]);
+    }
+  }
+
+  uint8_t read() {
+    uint8_t value = (m_pointer == 0xFF) ? m_page : m_regs[m_page & 7][m_pointer];
+    m_pointer++;
+    return value;
+  }
+
+  uint32_t budgetUs() {
+    uint8_t sequence = m_regs[0][0x01];
+    uint8_t preVcsel = (m_regs[0][0x50] + 1) << 1;
+    uint8_t finalVcsel = (m_regs[0][0x70] + 1) << 1;
+    uint32_t msrcUs = mclksToUs(m_regs[0][0x46] + 1, preVcsel);
+    uint32_t preMclks = decodeTimeout((m_regs[0][0x51] << 8) | m_regs[0][0x52]);
+    uint32_t finalMclks = decodeTimeout((m_regs[0][0x71] << 8) | m_regs[0][0x72]);
+    uint32_t budget = 1910 + 960;
+
+    if (sequence & 0x40) {
+      finalMclks -= preMclks;               // The final range timeout includes the pre-range
+    }
+    if (sequence & 0x10) budget += msrcUs + 590;
+    if (sequence & 0x08) budget += 2 * (msrcUs + 690);
+    else if (sequence & 0x04) budget += msrcUs + 660;
+    if (sequence & 0x40) budget += mclksToUs(preMclks, preVcsel) + 660;
+    if (sequence & 0x80) budget += mclksToUs(finalMclks, finalVcsel) + 550;
+    return budget;
+  }
+
+private:
+  int m_index;
+  uint8_t m_xshut;
+  boolean m_powered;
+  uint32_t m_generation;                    // Measurements of an earlier generation are dropped when they end
+  Time m_ready;
+  uint8_t m_address;
+  uint8_t m_page;
+  uint8_t m_pointer;                         // Register index (auto-increments)
+  uint8_t m_regs[8][256];
+
+  void reset() {
+    static const uint8_t PAGE0[][2] = {
+      { 0x01, 0xFF }, { 0x44, 0x00 }, { 0x45, 0x20 }, { 0x46, 0x25 }, { 0x50, 0x06 }, { 0x51, 0x00 }, { 0x52, 0x96 }, { 0x70, 0x04 },
+      { 0x71, 0x01 }, { 0x72, 0xFE }, { 0x84, 0x11 }, { 0x8A, 0x29 }, { 0xB0, 0xFF }, { 0xB1, 0xFF }, { 0xB2, 0xFF }, { 0xB3, 0xFF },
+      { 0xB4, 0xFF }, { 0xB5, 0xFF }, { 0xC0, 0xEE }, { 0xC1, 0xAA }, { 0xC2, 0x10 },
+    };
+    memset(m_regs, 0, sizeof(m_regs));
+    for (size_t i = 0; i < sizeof(PAGE0) / sizeof(PAGE0[0]); i++) {
+      m_regs[0][PAGE0[i][0]] = PAGE0[i][1];
+    }
+    m_regs[1][0x91] = 0x3C;                 // Stop variable
+    m_regs[7][0x92] = 0x85;                 // SPAD info: 5 aperture SPADs
+    m_address = 0x29;
+    m_page = 0;
+    m_pointer = 0;
+  }
+
+  void writeReg(uint8_t reg, uint8_t value) {
+    if (reg == 0xFF) {
+      m_page = value;
+      return;
+    }
+    m_regs[m_page & 7][reg] = value;
+    if (m_page == 7 && reg == 0x83 && value == 0x00 && fault != FAULT_NO_SPAD) {
+      uint32_t generation = m_generation;
+      at(now + HOST_US(NVM_US), [this, generation] { if (generation == m_generation) m_regs[7][0x83] = 0x10; });
+    }
+    if (m_page != 0) {
+      return;
+    }
+    if (reg == 0x8A) {
+      m_address = value & 0x7F;             // Answers on the new address from the next transaction
+    }
+    else if (reg == 0x0B && (value & 0x01)) {
+      m_regs[0][0x13] = 0;                  // Interrupt clear
+    }
+    else if (reg == 0x00) {
+      start(value);
+    }
+  }
+
+  // SYSRANGE_START: 0x01 starts a single measurement (a reference calibration while the sequence is VHV or phase calibration only),
+  // 0x02 back-to-back ranging, 0x00 stops it
+  void start(uint8_t value) {
+    uint32_t generation = ++m_generation;
+    uint8_t sequence = m_regs[0][0x01];
+
+    m_regs[0][0x00] = value & ~0x01;        // Taken at once
+    if (value & 0x02) {
+      at(now + HOST_US(budgetUs()), [this, generation] { complete(generation, true); });
+    }
+    else if ((value & 0x01) && (sequence == 0x01 || sequence == 0x02)) {
+      if (fault != FAULT_NO_REFCAL) {
+        at(now + HOST_US(REFCAL_US), [this, generation] { if (generation == m_generation) m_regs[0][0x13] = 0x04; });
+      }
+    }
+    else if (value & 0x01) {
+      at(now + HOST_US(budgetUs()), [this, generation] { complete(generation, false); });
+    }
+  }
+
+  void complete(uint32_t generation, boolean continuous) {
+    if (generation != m_generation || fault == FAULT_STUCK) {
+      return;
+    }
+    double target = rangeCallback ? rangeCallback(m_index, now / 1000.0) : NAN;
+    double signal = isnan(target) || target <= 0 ? 0 : signal100 * (100.0 / target) * (100.0 / target);
+    double total = signal + crosstalk * spads;
+    double limit = ((m_regs[0][0x44] << 8) | m_regs[0][0x45]) / 128.0;
+    uint8_t status = 11;
+    uint16_t range = 8190;
+
+    if (isnan(target) || total < limit) {
+      status = 4;                           // No target - signal below the limit
+    }
+    else {
+      double mm = target * signal / total + offset;
+      mm = mm < 0 ? 0 : mm;
+      range = (m_regs[0][0x09] & 0x01) ? (uint16_t)(mm * 4 + 0.5) : (uint16_t)(mm + 0.5);
+    }
+    uint16_t spadReg = spads * 256;
+    uint16_t ambientReg = ambient * 128 > 0xFFFF ? 0xFFFF : ambient * 128;
+    uint16_t signalReg = total * 128 > 0xFFFF ? 0xFFFF : total * 128;
+    uint8_t *result = &m_regs[0][0x14];
+    memset(result, 0, 12);
+    result[0] = status << 3;
+    result[2] = spadReg >> 8;
+    result[3] = spadReg;
+    result[6] = ambientReg >> 8;
+    result[7] = ambientReg;
+    result[8] = signalReg >> 8;
+    result[9] = signalReg;
+    result[10] = range >> 8;
+    result[11] = range;
+    m_regs[0][0x13] = 0x04;                 // New sample ready
+    stats[STAT_RANGES]++;
+    if (continuous) {
+      at(now + HOST_US(budgetUs()), [this, generation] { complete(generation, true); });
+    }
+  }
+};
+
+static std::vector<Vl53l0x *> sensors;
+
+void addSensor(uint8_t xshutPin) {
+  Vl53l0x *sensor = new Vl53l0x(sensors.size(), xshutPin);
+  sensors.push_back(sensor);
+  attachI2C(sensor);
+}
+
+void sensorsPower() {
+  for (size_t i = 0; i < sensors.size(); i++) {
+    uint8_t xshut = sensors[i]->xshut();
+    sensors[i]->power(xshut == 0xFF || pinHigh(xshut));   // SENSOR_NO_XSHUT - always powered
+  }
+}
+
+}
+
+using namespace host;
+
+extern "C" {
+
+void host_sensor_config(int i, double signal100, double ambient, double crosstalk, double offset, int fault) {
+  sensors[i]->signal100 = signal100;
+  sensors[i]->ambient = ambient;
+  sensors[i]->crosstalk = crosstalk;
+  sensors[i]->offset = offset;
+  sensors[i]->fault = fault;
+}
+
+// I2C address sensor i answers on - 0 while it is off the bus
+int host_sensor_address(int i) {
+  return sensors[i]->answers(sensors[i]->address()) ? sensors[i]->address() : 0;
+}
+
+double host_sensor_budget_us(int i) {
+  return sensors[i]->budgetUs();
+}
+
+int host_sensor_reg(int i, int page, int reg) {
+  return sensors[i]->reg(page, reg);
+}
+
+}
@@ -0,0 +1,40 @@
+/*!
+ * @file vl53l0x_bench.cpp
+ * @brief Host build of the Elevator Controller - the DFRobot driver's calls one at a time, for tools/vl53l0x_trace.py --bench
+ *
+ * A driver instance of its own on car 1's sensor. The benchmark never runs setup(), so the firmware's instance stays off the bus.
+ */
+
+#include "DFRobot_VL53L0X.h"
+
+#define BENCH_BEGIN 0
+#define BENCH_SINGLE 1                      // setMode(Single, Low)
+#define BENCH_CONTINUOUS 2                  // setMode(Continuous, Low)
+#define BENCH_PROFILE 3                     // setProfile(arg)
+#define BENCH_START 4
+#define BENCH_STOP 5
+
+static DFRobotVL53L0X bench;
+
+// One call on the bench instance - what it returned (1 for the calls that return nothing)
+extern "C" int host_vl53l0x_call(int call, int arg) {
+  switch (call) {
+    case BENCH_BEGIN:
+      return bench.begin(arg);
+    case BENCH_SINGLE:
+      bench.setMode(Single, Low);
+      return 1;
+    case BENCH_CONTINUOUS:
+      bench.setMode(Continuous, Low);
+      return 1;
+    case BENCH_PROFILE:
+      return bench.setProfile((RangingProfile)arg);
+    case BENCH_START:
+      bench.start();
+      return 1;
+    case BENCH_STOP:
+      bench.stop();
+      return 1;
+  }
+  return 0;
+}
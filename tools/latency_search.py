@@ -0,0 +1,597 @@
+"""
+@file latency_search.py
+@brief Adversarial search for the worst command-to-DAC latency and loop overrun in the loop timing model
+
+Average runs (loadshed_sim.py, can_stress.py) seldom hit the interleavings
+that set the worst case: a CAN frame arriving just after a sensor trigger,
+the floor report timer, the [CANSTAT] record and the LCD all falling in one
+loop, a call waiting behind another frame. This tool plays
+ElevatorController::loop() in virtual time with the task costs of
+loadshed_sim.py:
+  - one CAN frame read per loop (two MCP2515 buffers, a third frame is lost)
+  - the floor reports
+  - Car::loop() for the next car in turn: Move(), then the [HEALTH] report,
+    then dispatch() with the LCD "Floor n"
+  - after a control tick the LCD distance and [TLM], otherwise [CANSTAT]
+  - load shedding and the Serial TX buffer
+
+A scenario is the timing of everything the loop does not control:
+  - when each CAN frame arrives, and whether it is a call or other traffic
+  - the phases of the floor report, [CANSTAT] and [HEALTH] timers
+  - the cars' control period phase
+  - each measurement's extra sensor time
+  - the Serial backlog and the load shedding level at the start
+
+The search perturbs scenarios to maximize one objective:
+  command  bus to DAC: from a call frame's end to the first DAC write of its
+           car after dispatch() took it (a lost call counts as the horizon)
+  loop     longest loop, the overrun beyond LOOP_BUDGET_US
+  control  sensor result ready to its DAC write
+
+Random search samples scenarios. Guided search keeps a corpus of scenarios
+that reached a new coverage feature (the set of tasks that ran in one loop,
+with its length bucket, and the call latency bucket) or a new worst. It
+mutates them, above all by snapping an event onto one seen in the
+scenario's own trace - a frame just after a trigger, a timer inside a
+control tick - which is how the rare coincidences are found.
+
+The worst scenario per objective is printed as a JSON script (or written to
+--out); --replay plays a script back with the loop timeline around its
+worst point.
+
+The branch costs are measured on the host build (tools/firmware.py) by
+default: a few seconds of calls and probe frames run loop by loop, each loop
+is sorted by what it did (sensor poll, start(), result read and DAC write,
+frame read, floor report, LCD characters, Serial bytes) and each branch costs
+the median difference to the loops that did the same without it. The host
+build spends no time on computation, so the law, the call queueing and
+dispatch() add the estimates of loadshed_sim.py and this file on top of
+their measured I/O. --costs table uses those estimates throughout.
+
+--capture checks the model against the [CANSTAT] records of a Serial
+capture: no loop_max_us the controller measured may be longer than the
+longest loop the search finds (exit 1 if one is). --check holds the model
+to the host build's own records from the measuring run, against the longest
+loop the model gives that run's traffic at any phase.
+
+    python3 tools/latency_search.py                          # random vs guided, every objective
+    python3 tools/latency_search.py --objective command --evals 5000 --out worst
+    python3 tools/latency_search.py --replay worst/command.json
+    python3 tools/latency_search.py --costs table            # loadshed_sim.py's estimates instead of the host build
+    python3 tools/latency_search.py --capture capture.txt    # [CANSTAT] loop_max_us of a bench run against the model
+    python3 tools/latency_search.py --check
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import statistics
+import sys
+
+from loadshed_sim import (Serial, Shedder, read_config, SHED_LCD, SHED_LOGGING, SHED_TELEMETRY,
+                          CAN_READ_US, CAN_SEND_US, POLL_US, TRIGGER_US, READ_US, LAW_US, DAC_US, LCD_CHAR_US,
+                          SENSOR_BUDGET_MS, RX_LOG, TX_LOG, TLM_LOG, LOOP_US)
+from can_stress import EFLG_US, CALL_US, STATS_LOG, read_can_config
+
+DISPATCH_US = 60            # CallScheduler::nextStop()
+FLOOR_CHARS = 13            # setTarget(): cursor, "Floor n" and the 5 blanks
+DIST_CHARS = 7              # LCD::loop(): cursor, 4 digits and "mm"
+HEALTH_LOG = 28             # "[HEALTH] 12345678,0,98,103,0,0"
+HEALTH_TX_LOG = 60          # "[CAN] ... TX: ID: 0x101 Data: 0xE 0x0 0x62 0x67 0x0"
+FRAME_US = 450              # shortest gap between frames at 125 kbps (1 data byte)
+SENSOR_JITTER_US = 2000     # most a measurement runs over its timing budget
+BUFFERS = 2
+HORIZON_US = 1200000.0      # virtual time per scenario
+FIRST_US = 150000.0         # frames arrive after every car's first control tick ...
+SETTLE_US = 250000.0        # ... and before HORIZON_US - SETTLE_US so every call reaches the DAC
+MAX_FRAMES = 24             # frames per scenario - the bus load the adversary may spend
+OBJECTIVES = ("command", "loop", "control")
+MEASURE_S = 20.0            # host build run the costs are measured on
+MEASURE_CALLS = (0x07, 0x05)
+CHECK_EVALS = 600           # phases of the measuring run's traffic tried by --check
+SUPERVISOR_ID = 0x100
+
+# Branch costs in us - the estimates of loadshed_sim.py and can_stress.py
+TABLE_COSTS = {"loop": LOOP_US, "rx": CAN_READ_US + EFLG_US, "call": CALL_US, "tx": CAN_SEND_US, "trigger": TRIGGER_US,
+               "poll": POLL_US, "tick": READ_US + LAW_US + DAC_US, "lcd_char": LCD_CHAR_US, "dispatch": DISPATCH_US,
+               "serial_byte": 0.0}
+COMPUTE_COSTS = {"tick": LAW_US, "call": CALL_US, "dispatch": DISPATCH_US}   # What the host build does not time
+
+# Tasks in one loop (the coverage features)
+RX, CALL, TX, TRIGGER, POLL, TICK, LCD_DIST, LCD_FLOOR, TLM, STATS, HEALTH, BLOCK, SHED = (1 << i for i in range(13))
+TASKS = ((RX, "rx"), (CALL, "call"), (TX, "tx"), (TRIGGER, "trigger"), (POLL, "poll"), (TICK, "read+law+dac"),
+         (LCD_DIST, "lcd"), (LCD_FLOOR, "lcd floor"), (TLM, "tlm"), (STATS, "canstat"), (HEALTH, "health"),
+         (BLOCK, "serial full"), (SHED, "shed"))
+
+
+def read_timers():
+    root = os.path.join(os.path.dirname(__file__), "..")
+    get = lambda path, name: int(re.search(r"#define %s\s+(\d+)" % name, open(os.path.join(root, path)).read()).group(1))
+    return {"stats_ms": get("ElevatorController.h", "CAN_STATS_MS"), "health_ms": get("SensorHealth.h", "HEALTH_REPORT_MS")}
+
+
+def loop_tasks(delta, out):
+    """What one host build loop did, from the board's counters and its Serial output (the frame reads as logged)."""
+    tasks = set()
+    if delta["dac_writes"]:
+        tasks |= {"poll", "tick"}                           # The ready check, then the result read and the law
+    elif delta["i2c_writes"] > 1:
+        tasks.add("trigger")                                # start(): the stop variable script
+    elif delta["i2c_writes"]:
+        tasks.add("poll")
+    if delta["can_tx"]:
+        tasks.add("tx")
+    m = re.search(r"RX:.*Data: 0x(\w+)", out)
+    if m:
+        tasks.add("call" if int(m.group(1), 16) in MEASURE_CALLS else "rx")
+    if delta["lcd_bytes"]:
+        tasks.add("lcd" if "tick" in tasks else "floor")    # LCD::loop()'s distance, or setTarget()'s "Floor n"
+    return frozenset(tasks)
+
+
+def measure_costs(duration=MEASURE_S):
+    """Branch costs (TABLE_COSTS keys) measured on the host build, and its Serial output."""
+    from firmware import Board
+    board = Board()
+    fw = board.fw
+    fw.setup()
+    probe = read_can_config()["CAN_PROBE"]
+    start = fw.now
+    for i in range(int(duration) - 2):
+        fw.inject(start + 2.0 + i, SUPERVISOR_ID, [MEASURE_CALLS[i % len(MEASURE_CALLS)]])
+        fw.inject(start + 2.5 + i, SUPERVISOR_ID, [probe, i & 0xFF])
+    keys = ("i2c_writes", "dac_writes", "lcd_bytes", "can_tx", "serial_bytes")
+    loops = []
+    before = fw.stats()
+    printed = len(fw.serial())
+    while fw.now < start + duration:
+        t = fw.now
+        fw.loop()
+        stats = fw.stats()
+        delta = {k: stats[k] - before[k] for k in keys}
+        before = stats
+        out = fw.serial()
+        loops.append((loop_tasks(delta, out[printed:]), (fw.now - t) * 1e6, delta["serial_bytes"], delta["lcd_bytes"]))
+        printed = len(out)
+
+    def median(values, branch):
+        if not values:
+            sys.exit("the host build run measured no loop for %s" % branch)
+        return statistics.median(values)
+
+    # Serial bytes: the slope between loops that did the same but printed different lengths
+    groups = {}
+    for tasks, us, nbytes, lcd in loops:
+        groups.setdefault((tasks, lcd), {}).setdefault(nbytes, []).append(us)
+    slopes = []
+    for by_bytes in groups.values():
+        if len(by_bytes) > 1:
+            lo, hi = min(by_bytes), max(by_bytes)
+            slopes.append((statistics.median(by_bytes[hi]) - statistics.median(by_bytes[lo])) / (hi - lo))
+    costs = {"serial_byte": max(0.0, median(slopes, "serial_byte"))}
+    work = [(tasks, us - nbytes * costs["serial_byte"], lcd) for tasks, us, nbytes, lcd in loops]
+
+    def base(tasks):
+        return median([us for t, us, lcd in work if t == tasks and not lcd], "%s" % ",".join(sorted(tasks)) or "idle")
+
+    def cost(task, without=None):
+        """Median of the loops with the task less the loops that did the same without it (or with 'without' instead)."""
+        common = {}
+        for tasks, us, lcd in work:
+            if task in tasks and not lcd:
+                common.setdefault(tasks, []).append(us)
+        if not common:
+            sys.exit("the host build run measured no loop for %s" % task)
+        tasks = max(common, key=lambda t: len(common[t]))
+        rest = (tasks - {task}) | ({without} if without else set())
+        return max(0.0, statistics.median(common[tasks]) - base(rest))
+
+    costs["loop"] = base(frozenset())
+    for task, without in (("poll", None), ("trigger", None), ("tick", None), ("tx", None), ("rx", None), ("call", "rx")):
+        costs[task] = cost(task, without)
+    costs["lcd_char"] = median([(us - base(tasks - {"lcd", "floor"})) / lcd for tasks, us, lcd in work if lcd and "floor" not in tasks],
+                               "lcd_char")
+    costs["dispatch"] = max(0.0, median([us - FLOOR_CHARS * costs["lcd_char"] - base(tasks - {"floor"})
+                                         for tasks, us, lcd in work if "floor" in tasks and lcd == FLOOR_CHARS], "dispatch"))
+    for task, us in COMPUTE_COSTS.items():
+        costs[task] += us
+    return costs, fw.serial()
+
+
+def capture_loops(lines):
+    """(t_ms, loop_max_us) of each [CANSTAT] record in a Serial capture."""
+    records = []
+    for line in lines:
+        m = re.search(r"\[CANSTAT\]\s+([\d,]+)", line)
+        if m:
+            fields = [int(v) for v in m.group(1).split(",")]
+            records.append((fields[0], fields[6]))
+    return records
+
+
+def check_capture(records, worst_us):
+    """Records whose loop_max_us the model's worst loop does not cover."""
+    return ["[CANSTAT] at %d ms: loop_max_us %d beyond the model's worst loop of %.0f us" % (t, us, worst_us)
+            for t, us in records if us > worst_us]
+
+
+def print_costs(costs, source):
+    print("branch costs (%s): %s" % (source, "  ".join("%s %.1f" % (k, costs[k]) for k in sorted(costs))))
+
+
+def simulate(s, cfg, timers, costs, trace=False):
+    """Play scenario s. Returns the metrics, the coverage features and (with trace) the loops and events."""
+    n = s["cars"]
+    period = cfg["period_ms"] * 1000.0
+    serial = Serial()
+    serial.queued = s["serial"]
+    shed = Shedder(cfg, True)
+    shed.level = s["shed"]
+    frames = sorted(s["frames"])
+    trigger = [s["start"] - period + i * period / n for i in range(n)]
+    sampling = [False] * n
+    ready = [0.0] * n
+    sensor_k = [0] * n
+    queued = [[] for _ in range(n)]          # calls handled by handleFrame(), waiting for dispatch()
+    dispatched = [[] for _ in range(n)]      # calls taken by dispatch(), waiting for the DAC write
+    health_next = [p * 1000.0 for p in s["health"]]
+    health_due = [False] * n
+    next_tx = s["tx"]
+    next_stats = s["stats"]
+    rx = []
+    lost = 0
+    k = 0
+    command, control, loops, events = [], [], [], []
+    features = set()
+    now = loop_start = loop_end = 0.0
+    mask = 0
+    next_car = tx_pending = 0
+
+    def deliver(until):
+        nonlocal k, lost
+        while k < len(frames) and frames[k][0] <= until:
+            if len(rx) >= BUFFERS:
+                lost += 1
+                if frames[k][1] == "call":
+                    command.append(HORIZON_US)
+                if trace:
+                    events.append((frames[k][0], "lost", frames[k][2]))
+            else:
+                rx.append(frames[k])
+            k += 1
+
+    def log(nbytes):
+        nonlocal now, mask
+        block = serial.print(now, nbytes)
+        if block:
+            mask |= BLOCK
+        now += block + nbytes * costs["serial_byte"]
+
+    while now < HORIZON_US:
+        if now > 0:
+            level = shed.level
+            loop_us = loop_end - loop_start
+            shed.update(loop_end, loop_us)
+            if shed.level != level:
+                mask |= SHED
+            features.add((mask, min(8, int(loop_us // 1000))))
+            loops.append((loop_start, loop_us, mask))
+        loop_start = now
+        mask = 0
+        verbose = shed.level < SHED_LOGGING
+
+        deliver(now)
+        if rx:                                                  # flagRecv - one frame per loop
+            t, kind, car = rx.pop(0)
+            mask |= RX
+            now += costs["rx"]
+            if verbose:
+                log(RX_LOG)
+            if kind == "call" and car < n:
+                mask |= CALL
+                now += costs["call"]
+                queued[car].append(t)
+        if now >= next_tx:                                      # TIMER_FLOOR_REPORT
+            next_tx += 1e6
+            tx_pending = n
+        if tx_pending:
+            tx_pending -= 1
+            mask |= TX
+            now += costs["tx"]
+            if verbose:
+                log(TX_LOG)
+
+        i = next_car
+        next_car = (next_car + 1) % n
+        ticked = False
+        if not sampling[i] and now - trigger[i] >= period:     # Move()
+            mask |= TRIGGER
+            now += costs["trigger"]
+            trigger[i] += (now - trigger[i]) // period * period
+            jitter = s["sensor"][i][sensor_k[i] % len(s["sensor"][i])]
+            sensor_k[i] += 1
+            ready[i] = now + SENSOR_BUDGET_MS * 1000.0 + jitter
+            sampling[i] = True
+            if trace:
+                events.append((now, "trigger", i))
+        elif sampling[i]:
+            mask |= POLL
+            now += costs["poll"]
+            if now >= ready[i]:
+                sampling[i] = False
+                ticked = True
+                mask |= TICK
+                now += costs["tick"]
+                control.append(now - ready[i])
+                for t in dispatched[i]:
+                    command.append(now - t)
+                dispatched[i] = []
+                if now >= health_next[i]:
+                    health_due[i] = True
+                    health_next[i] += timers["health_ms"] * 1000.0
+                if trace:
+                    events.append((now, "dac", i))
+        if health_due[i]:                                       # reportHealth()
+            health_due[i] = False
+            mask |= HEALTH
+            log(HEALTH_LOG)
+            now += costs["tx"]
+            if verbose:
+                log(HEALTH_TX_LOG)
+        if queued[i]:                                           # dispatch() -> setTarget()
+            mask |= LCD_FLOOR
+            now += costs["dispatch"] + (FLOOR_CHARS * costs["lcd_char"] if i == 0 else 0)
+            dispatched[i] += queued[i]
+            queued[i] = []
+        if ticked:
+            if shed.level < SHED_LCD and i == 0:
+                mask |= LCD_DIST
+                now += DIST_CHARS * costs["lcd_char"]
+            if shed.level < SHED_TELEMETRY:
+                mask |= TLM
+                log(TLM_LOG)
+        elif shed.level < SHED_TELEMETRY and now >= next_stats:
+            mask |= STATS
+            log(STATS_LOG)
+            next_stats = now + timers["stats_ms"] * 1000.0
+            if trace:
+                events.append((now, "canstat", i))
+        now += costs["loop"]
+        loop_end = now
+        if not mask and not any(sampling):                      # Idle until the next event - skip whole rounds of the cars
+            wake = min([trigger[c] + period for c in range(n)] + [next_tx, next_stats if shed.level < SHED_TELEMETRY else HORIZON_US,
+                        frames[k][0] if k < len(frames) else HORIZON_US,
+                        shed.slack_since * 1000.0 + cfg["restore_ms"] * 1000.0 if shed.level else HORIZON_US])
+            skip = int((wake - now) // (costs["loop"] * n)) - 1
+            if skip > 0:
+                now += skip * n * costs["loop"]
+
+    for c in command:
+        features.add(("command", int(c // 10000)))
+    result = {"command": max(command) if command else 0.0, "loop": max(l for _, l, _ in loops),
+              "control": max(control) if control else 0.0, "lost": lost, "budget_us": cfg["budget_us"]}
+    return result, features, (loops, events)
+
+
+def clamp_frames(frames):
+    """Sort and space the frames at least FRAME_US apart, as the bus would deliver them."""
+    out = []
+    for t, kind, car in sorted(frames):
+        t = max(t, out[-1][0] + FRAME_US) if out else max(t, FIRST_US)
+        if t < HORIZON_US - SETTLE_US:
+            out.append([t, kind, car])
+    return out[:MAX_FRAMES]
+
+
+def random_scenario(rng, cars, timers):
+    frames = [[rng.uniform(FIRST_US, HORIZON_US - SETTLE_US), rng.choice(("call", "other")), rng.randrange(cars)]
+              for _ in range(rng.randint(1, MAX_FRAMES))]
+    return {"cars": cars,
+            "frames": clamp_frames(frames),
+            "tx": rng.uniform(0, 1e6),
+            "stats": rng.uniform(0, timers["stats_ms"] * 1000.0),
+            "health": [rng.uniform(0, timers["health_ms"]) for _ in range(cars)],
+            "start": rng.uniform(0, 1e5),
+            "sensor": [[rng.uniform(0, SENSOR_JITTER_US) for _ in range(4)] for _ in range(cars)],
+            "serial": rng.randint(0, 64),
+            "shed": 0}
+
+
+def mutate(s, rng, trace, timers):
+    """One to three changes - half the time an event is snapped to just after one from the scenario's own trace."""
+    s = json.loads(json.dumps(s))
+    loops, events = trace
+    anchors = [t for t, _, _ in events] + [start for start, _, _ in loops[::7]]
+    for _ in range(rng.randint(1, 3)):
+        anchor = rng.choice(anchors) + rng.uniform(0, 300) if anchors else rng.uniform(0, HORIZON_US)
+        op = rng.randrange(10)
+        if op == 0 and s["frames"]:
+            f = rng.choice(s["frames"])
+            f[0] += rng.choice((-1, 1)) * rng.expovariate(1 / 500.0)
+        elif op in (1, 2) and s["frames"]:
+            rng.choice(s["frames"])[0] = anchor
+        elif op == 3:
+            s["frames"].append([anchor, rng.choice(("call", "call", "other")), rng.randrange(s["cars"])])
+        elif op == 9:
+            s["frames"] += [[anchor + j * FRAME_US, "call", rng.randrange(s["cars"])] for j in range(BUFFERS + 1)]   # A burst overruns the buffers
+        elif op == 4 and s["frames"]:
+            s["frames"].pop(rng.randrange(len(s["frames"])))
+        elif op == 5:
+            s["tx"] = anchor % 1e6 if rng.random() < 0.7 else rng.uniform(0, 1e6)
+        elif op == 6:
+            key = rng.choice(("stats", "health"))
+            if key == "stats":
+                s["stats"] = anchor % (timers["stats_ms"] * 1000.0)
+            else:
+                s["health"][rng.randrange(s["cars"])] = (anchor / 1000.0) % timers["health_ms"]
+        elif op == 7:
+            car = rng.randrange(s["cars"])
+            j = rng.randrange(len(s["sensor"][car]))
+            s["sensor"][car][j] = rng.choice((0.0, SENSOR_JITTER_US, rng.uniform(0, SENSOR_JITTER_US)))
+        else:
+            if rng.random() < 0.5:
+                s["serial"] = rng.choice((0, 64, rng.randint(0, 64)))
+            else:
+                s["start"] = rng.uniform(0, 1e5)
+    s["frames"] = clamp_frames(s["frames"])
+    return s
+
+
+def search(objective, evals, guided, cfg, timers, costs, cars, seed):
+    """Best scenario for the objective within evals runs. Returns (score, scenario, result, coverage)."""
+    rng = random.Random(seed)
+    best = (-1.0, None, None)
+    coverage = set()
+    corpus = []
+    for e in range(evals):
+        if guided and corpus and e >= evals // 10:
+            parent = max(rng.sample(corpus, min(3, len(corpus))), key=lambda c: c[0])       # Tournament - favours the worse scenarios
+            s = mutate(parent[1], rng, parent[2], timers)
+        else:
+            s = random_scenario(rng, cars, timers)
+        result, features, trace = simulate(s, cfg, timers, costs, trace=guided)
+        score = result[objective]
+        new = features - coverage
+        coverage |= features
+        if score > best[0]:
+            best = (score, s, result)
+        if guided and (new or score >= best[0]):
+            corpus.append((score, s, trace))
+    return best[0], best[1], best[2], len(coverage)
+
+
+def typical(cfg, timers, costs, cars):
+    """Evenly spread calls, nothing aligned - what an average test sees."""
+    s = {"cars": cars, "frames": [[50000.0 + i * 40000.0, "call" if i % 2 == 0 else "other", i % cars] for i in range(MAX_FRAMES)],
+         "tx": 500000.0, "stats": 700000.0, "health": [30000.0] * cars, "start": 0.0,
+         "sensor": [[SENSOR_JITTER_US / 2]] * cars, "serial": 0, "shed": 0}
+    s["frames"] = clamp_frames(s["frames"])
+    return simulate(s, cfg, timers, costs)[0]
+
+
+def ms(us):
+    return "lost" if us >= HORIZON_US else "%.2f ms" % (us / 1000)
+
+
+def replay(path, cfg, timers, costs, context):
+    with open(path) as f:
+        script = json.load(f)
+    s = script["scenario"]
+    result, _, (loops, events) = simulate(s, cfg, timers, costs, trace=True)
+    objective = script.get("objective", "loop")
+    print("%s: command %s  loop %s  control %s  lost frames %d" % (
+        path, ms(result["command"]), ms(result["loop"]), ms(result["control"]), result["lost"]))
+    lost = [e[0] for e in events if e[1] == "lost"]
+    if objective == "command" and lost:
+        centre = lost[0]
+    elif objective == "command":
+        focus = None
+        calls = [f[0] for f in s["frames"] if f[1] == "call"]
+        for t in calls:                                        # The call whose DAC write is the latest after its arrival
+            dac = min((e[0] for e in events if e[1] == "dac" and e[0] > t), default=HORIZON_US)
+            if focus is None or dac - t > focus[1]:
+                focus = (t, dac - t)
+        centre = focus[0] if focus else 0.0
+    else:
+        centre = max(loops, key=lambda l: l[1])[0]
+    print("  loop start    length   tasks")
+    near = [(l, loops[j - 1][0] if j else 0.0) for j, l in enumerate(loops) if l[0] >= centre - 2000]
+    for (start, length, mask), before in near[:context]:
+        frames = [f for f in s["frames"] if before <= f[0] < start]
+        print("  %10.3f ms %6.2f ms  %s%s" % (start / 1000, length / 1000, ", ".join(name for bit, name in TASKS if mask & bit) or "idle",
+                                             "  <- %s arrived" % ",".join(f[1] for f in frames) if frames else ""))
+
+
+def check(cfg, timers):
+    """Host build costs against its own [CANSTAT] records - the searched worst loop must cover every one."""
+    failures = []
+    costs, out = measure_costs()
+    print_costs(costs, "host build")
+    for name, us in sorted(costs.items()):
+        if not us > 0 and name != "serial_byte":
+            failures.append("branch %s measured %.1f us" % (name, us))
+    records = capture_loops(out.splitlines())
+    if len(records) < 2:
+        failures.append("the host build printed %d [CANSTAT] records" % len(records))
+    rng = random.Random(1)
+    worst = 0.0
+    for _ in range(CHECK_EVALS):                            # The measuring run's traffic - a call, a probe half a second later - at random phases
+        s = random_scenario(rng, 1, timers)
+        s["frames"] = [[FIRST_US, "call", 0], [FIRST_US + 500000.0, "other", 0]]
+        s["serial"] = 0
+        if "[HEALTH]" not in out:
+            s["health"] = [float(timers["health_ms"])]      # Not due within the run
+        worst = max(worst, simulate(s, cfg, timers, costs)[0]["loop"])
+    print("model longest loop %.2f ms for the run's traffic, host build [CANSTAT] longest %.2f ms in %d records" % (
+        worst / 1000, max([us for _, us in records] or [0]) / 1000, len(records)))
+    failures += check_capture(records, worst)
+    for f in failures:
+        print("FAIL " + f)
+    print("ok" if not failures else "%d failures" % len(failures))
+    return not failures
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--objective", action="append", choices=OBJECTIVES, help="objective(s) to maximize (default: all)")
+    ap.add_argument("--evals", type=int, default=1500, help="scenarios run per search")
+    ap.add_argument("--cars", type=int, default=1, help="cars served by the loop (CAR_COUNT)")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--costs", choices=("host", "table"), default="host", help="branch costs measured on the host build or loadshed_sim.py's estimates")
+    ap.add_argument("--out", help="directory for the worst scenarios (<objective>.json) - printed otherwise")
+    ap.add_argument("--replay", help="play back a script written by a search")
+    ap.add_argument("--context", type=int, default=16, help="loops shown by --replay")
+    ap.add_argument("--capture", help="check the model's worst loop against the [CANSTAT] records of a Serial capture, exit 1 if one is longer")
+    ap.add_argument("--check", action="store_true", help="measure the costs and check the model against the host build's [CANSTAT] records, exit 1 on a failure")
+    args = ap.parse_args()
+    cfg = read_config()
+    timers = read_timers()
+
+    if args.check:
+        sys.exit(0 if check(cfg, timers) else 1)
+    costs = measure_costs()[0] if args.costs == "host" else TABLE_COSTS
+    print_costs(costs, "host build" if args.costs == "host" else "table")
+
+    if args.replay:
+        replay(args.replay, cfg, timers, costs, args.context)
+        return
+    if args.capture:
+        with open(args.capture) as f:
+            records = capture_loops(f)
+        if not records:
+            sys.exit("no [CANSTAT] records in %s" % args.capture)
+        worst, _, _, _ = search("loop", args.evals, True, cfg, timers, costs, args.cars, args.seed)
+        print("%s: %d [CANSTAT] records, longest loop %.2f ms - model worst %.2f ms (LOOP_BUDGET_US %d)" % (
+            args.capture, len(records), max(us for _, us in records) / 1000, worst / 1000, cfg["budget_us"]))
+        failures = check_capture(records, worst)
+        for f in failures:
+            print("FAIL " + f)
+        sys.exit(1 if failures else 0)
+
+    t = typical(cfg, timers, costs, args.cars)
+    print("LOOP_BUDGET_US %d, %d car(s), %d evals per search" % (cfg["budget_us"], args.cars, args.evals))
+    print("  typical          command %s, loop %s, control %s" % (ms(t["command"]), ms(t["loop"]), ms(t["control"])))
+    scripts = {}
+    for objective in args.objective or OBJECTIVES:
+        for guided in (False, True):
+            score, s, result, coverage = search(objective, args.evals, guided, cfg, timers, costs, args.cars, args.seed)
+            print("  %-8s %-7s worst %9s  (command %s, loop %s, control %s, lost frames %d)  features %d" % (
+                objective, "guided" if guided else "random", ms(score), ms(result["command"]), ms(result["loop"]),
+                ms(result["control"]), result["lost"], coverage))
+            if guided or objective not in scripts or score > scripts[objective]["worst_us"]:
+                scripts[objective] = {"objective": objective, "worst_us": score, "search": "guided" if guided else "random", "scenario": s}
+    for objective, script in scripts.items():
+        if args.out:
+            os.makedirs(args.out, exist_ok=True)
+            path = os.path.join(args.out, objective + ".json")
+            with open(path, "w") as f:
+                json.dump(script, f, indent=1)
+            print("wrote %s" % path)
+        else:
+            print(json.dumps(script))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,694 @@
+"""
+@file laws.py
+@brief Host ports of the control laws in Car::Move()
+
+Each controller takes the integer sensor reading and the setpoint once per
+control tick and returns the (fractional) DAC command the firmware computes, so
+the laws can be compared on the plant model in plant.py. The output stage turns
+that into a code: Truncate is DAC::transferDAC(int), Dither is
+DAC::transferDACDithered(), and Slew puts DAC::limit() (DAC_SLEW_LIMIT) in
+front of either. Keep these in step with the firmware when the laws change.
+
+--check holds them to it: the host build (tools/firmware.py) of each
+CONTROL_LAW serves a round of floor calls on the plant, and the distance and
+setpoint of every [TLM] record are replayed through the port with the
+firmware's timing. Each code and velocity estimate must come out as the
+firmware's (exit 1 on a difference). Slew is also run through a stop, a
+restart in the same direction and a reversal: only the reversal waits at zero.
+
+    python3 tools/laws.py --check
+"""
+
+import math
+import os
+import re
+
+from plant import SETPOINT_TOLERANCE, DAC_MAX, FLOOR_SP, MINHEIGHT, MAXHEIGHT
+
+CONTROL_PERIOD = 0.1        # s, CONTROL_PERIOD_MS in ElevatorController.h
+VEL_FILTER = 0.5            # VELOCITY_FILTER in ElevatorController.h
+MPC_STOP_VELOCITY = 20      # mm/s, MPC_STOP_VELOCITY in ElevatorController.h
+
+# Exponential law constants (CANModule.h)
+DIFF_MAX = 1500
+DAMPENER = 2
+A = 1.5
+
+FLOOR_APPROACH = 200        # mm, FLOOR_APPROACH_MM in FloorTable.h
+UNIFORM_FLOOR = (SETPOINT_TOLERANCE, 0, 100)
+
+
+def load_floor_table(path=None):
+    """{setpoint: (tolerance mm, approach speed cap mm/s (0 = none), level gain %)} from FLOOR_TABLE in FloorTable.h."""
+    root = os.path.join(os.path.dirname(__file__), "..")
+    with open(os.path.join(root, "CANModule.h")) as f:
+        macros = dict(re.findall(r"#define (\w+)\s+(\d+)", f.read()))
+    with open(path or os.path.join(root, "FloorTable.h")) as f:
+        text = f.read()
+    macros.update(re.findall(r"#define (\w+)\s+(\d+)", text))
+    body = re.search(r"FLOOR_TABLE\[[^\]]*\]\s*=\s*\{(.*?)\};", text, re.S).group(1)
+    table = {}
+    for entry in re.findall(r"\{([^}]*)\}", re.sub(r"//.*", "", body)):
+        fields = [v.strip() for v in entry.split(",")]
+        setpoint, tolerance, speed, gain = (int(macros.get(v, v)) for v in fields[1:5])
+        table[setpoint] = (tolerance, speed, gain)
+    return table
+
+
+class Controller:
+    """Shared state: velocity estimate in mm/s, positive is moving up."""
+
+    name = "base"
+
+    governed = True             # Approach speed cap by scaling the law output (the cascaded law caps its velocity setpoint instead)
+    leveled = False             # The floor's level gain applies (exponential law only)
+
+    def __init__(self):
+        self.prev = None
+        self.velocity = 0.0
+        self.floors = load_floor_table()
+        self.tolerance, self.approach_speed, self.level_gain = UNIFORM_FLOOR
+
+    def floor(self, setpoint):
+        return self.floors.get(setpoint, UNIFORM_FLOOR)
+
+    def estimate(self, dist, dt):
+        if self.prev is not None and dt > 0:
+            raw = (dist - self.prev) / dt
+            self.velocity += VEL_FILTER * (raw - self.velocity)
+        self.prev = dist
+
+    def step(self, dist, setpoint, dt=CONTROL_PERIOD):
+        self.estimate(dist, dt)
+        self.tolerance, self.approach_speed, self.level_gain = self.floor(setpoint)
+        return self.approach(self.law(dist - setpoint), dist - setpoint)
+
+    def approach(self, u, difference):
+        """Car::Move() inside FLOOR_APPROACH_MM: the floor's leveling gain and, moving toward the floor, its speed cap."""
+        if abs(difference) >= FLOOR_APPROACH:
+            return u
+        if self.leveled:
+            u *= self.level_gain / 100.0
+        if self.governed and self.approach_speed and difference * self.velocity < 0 and abs(self.velocity) > self.approach_speed:
+            u *= self.approach_speed / abs(self.velocity)
+        return u
+
+    def law(self, difference):
+        raise NotImplementedError
+
+
+class Exponential(Controller):
+    """difference * A * e^(-a * |difference|) with the setpoint tolerance band."""
+
+    name = "exponential"
+    leveled = True
+
+    def law(self, difference):
+        if abs(difference) <= self.tolerance:
+            return 0
+        a = DAMPENER / DIFF_MAX
+        return difference * A * math.exp(-a * abs(difference))
+
+
+def load_mpc_table(path=None):
+    """Parse the breakpoints and table out of MPCTable.h."""
+    path = path or os.path.join(os.path.dirname(__file__), "..", "MPCTable.h")
+    with open(path) as f:
+        text = f.read()
+
+    def array(name):
+        m = re.search(name + r"\[[^\]]*\](?:\[[^\]]*\])?\s*PROGMEM\s*=\s*\{(.*?)\};", text, re.S)
+        return [int(v) for v in re.findall(r"-?\d+", re.sub(r"//.*", "", m.group(1)))]
+
+    e_bp = array("MPC_E_BREAKPOINTS")
+    v_bp = array("MPC_V_BREAKPOINTS")
+    flat = array("MPC_TABLE")
+    table = [flat[i * len(v_bp):(i + 1) * len(v_bp)] for i in range(len(e_bp))]
+    return e_bp, v_bp, table
+
+
+def _segment(bp, x):
+    """Index i and weight w so that x ~ bp[i]*(1-w) + bp[i+1]*w, clamped to the ends."""
+    if x <= bp[0]:
+        return 0, 0.0
+    if x >= bp[-1]:
+        return len(bp) - 2, 1.0
+    i = 0
+    while x > bp[i + 1]:
+        i += 1
+    return i, (x - bp[i]) / (bp[i + 1] - bp[i])
+
+
+def mpc_lookup(e_bp, v_bp, table, e, v):
+    """Bilinear table evaluation using the odd symmetry u(-e, -v) = -u(e, v)."""
+    sign = 1
+    if e < 0:
+        e, v, sign = -e, -v, -1
+    i, we = _segment(e_bp, e)
+    j, wv = _segment(v_bp, v)
+    u0 = table[i][j] + (table[i][j + 1] - table[i][j]) * wv
+    u1 = table[i + 1][j] + (table[i + 1][j + 1] - table[i + 1][j]) * wv
+    return sign * (u0 + (u1 - u0) * we)
+
+
+class MPC(Controller):
+    """Explicit MPC: interpolated lookup of the offline solution in MPCTable.h."""
+
+    name = "mpc"
+
+    def __init__(self, table=None):
+        super().__init__()
+        self.e_bp, self.v_bp, self.table = table or load_mpc_table()
+
+    def law(self, difference):
+        if abs(difference) <= self.tolerance and abs(self.velocity) < MPC_STOP_VELOCITY:
+            return 0
+        return mpc_lookup(self.e_bp, self.v_bp, self.table, difference, self.velocity)
+
+
+def firmware_enabled(name, path=None):
+    """True if the option name is #defined in ElevatorController.h."""
+    path = path or os.path.join(os.path.dirname(__file__), "..", "ElevatorController.h")
+    with open(path) as f:
+        return re.search(r"^#define %s\b" % name, f.read(), re.M) is not None
+
+
+def firmware_profile(path=None):
+    """True if MOTION_PROFILE is enabled in ElevatorController.h."""
+    return firmware_enabled("MOTION_PROFILE", path)
+
+
+class MotionProfile:
+    """Port of MotionProfile: trapezoid from v0 along the direction of travel to rest at the target (times in s, kept to the ms as in the firmware)."""
+
+    # PROFILE_* in MotionProfile.h
+    ACCEL = 150.0
+    SPEED = 180.0
+
+    def __init__(self, origin, target, v0=0.0, start=0.0):
+        self.origin = origin
+        self.direction = 1 if target > origin else -1
+        self.distance = abs(target - origin)
+        self.start = start
+        self.v0 = max(0.0, min(self.SPEED, v0))
+        a = self.ACCEL
+        if self.v0 > 0 and self.distance < self.v0 ** 2 / (2 * a):
+            self.v_peak, t_accel, t_cruise, t_decel = self.v0, 0.0, 0.0, 2 * self.distance / self.v0
+        else:
+            self.v_peak = min(math.sqrt(a * self.distance + self.v0 ** 2 / 2), self.SPEED)
+            t_accel = (self.v_peak - self.v0) / a
+            t_decel = self.v_peak / a
+            t_cruise = (self.distance - (self.v_peak ** 2 - self.v0 ** 2 / 2) / a) / self.v_peak
+        self.accel = (self.v_peak - self.v0) / t_accel if t_accel > 0 else 0.0
+        self.decel = self.v_peak / t_decel if t_decel > 0 else 0.0
+        self.t_accel, self.t_cruise, self.t_decel = (int(t * 1000) / 1000.0 for t in (t_accel, t_cruise, t_decel))
+
+    def sample(self, now):
+        """(position mm, velocity mm/s positive up) at 'now'."""
+        t = now - self.start
+        cruise_end = self.t_accel + self.t_cruise
+        end = cruise_end + self.t_decel
+        if t < self.t_accel:
+            s, v = (self.v0 + 0.5 * self.accel * t) * t, self.v0 + self.accel * t
+        elif t < cruise_end:
+            s, v = (self.v0 + self.v_peak) / 2 * self.t_accel + self.v_peak * (t - self.t_accel), self.v_peak
+        elif t < end:
+            togo = end - t
+            s, v = self.distance - 0.5 * self.decel * togo ** 2, self.decel * togo
+        else:
+            s, v = self.distance, 0.0
+        return self.origin + self.direction * min(s, self.distance), self.direction * v
+
+
+class Cascaded(Controller):
+    """Outer P position loop (speed limited, every OUTER_DIVIDER ticks) commanding an inner PI velocity loop.
+
+    With a profile (MOTION_PROFILE, the firmware setting by default) the outer loop tracks the trip's MotionProfile
+    with its velocity fed forward; a trip starts when the setpoint changes, from rest at a floor or planned on the way.
+    """
+
+    name = "cascaded"
+    governed = False
+
+    # CASCADE_* in ElevatorController.h
+    KP_POS = 2.0
+    MAX_SPEED = 200.0
+    OUTER_DIVIDER = 2
+    KFF = 2.5
+    KP_VEL = 2.0
+    KI_VEL = 2.0
+    STOP_VELOCITY = MPC_STOP_VELOCITY
+
+    def __init__(self, profile=None):
+        super().__init__()
+        self.tick = 0
+        self.v_ref = 0.0
+        self.integral = 0.0
+        self.dt = CONTROL_PERIOD
+        self.use_profile = firmware_profile() if profile is None else profile
+        self.profile = None
+        self.setpoint = None
+        self.dist = 0
+        self.t = 0.0
+
+    def step(self, dist, setpoint, dt=CONTROL_PERIOD, now=None):
+        self.dt = dt
+        self.t = self.t + dt if now is None else now
+        self.dist = dist
+        if setpoint != self.setpoint:
+            self.setpoint = setpoint
+            self.start_profile(dist, setpoint)
+        return super().step(dist, setpoint, dt)
+
+    def call(self, setpoint, now):
+        """Car::setTarget() between ticks: the profile starts at 'now' from the last reading and velocity estimate."""
+        self.setpoint = setpoint
+        self.start_profile(self.dist, setpoint, now)
+
+    def start_profile(self, dist, setpoint, start=None):
+        """Car::startProfile()"""
+        self.profile = None
+        if not self.use_profile or not MINHEIGHT < dist < MAXHEIGHT:
+            return
+        at_floor = [sp for sp in FLOOR_SP if abs(dist - sp) <= self.floor(sp)[0]]
+        if setpoint in at_floor:
+            return
+        start = self.t if start is None else start
+        if at_floor and abs(self.velocity) < self.STOP_VELOCITY:
+            self.profile = MotionProfile(at_floor[-1], setpoint, 0.0, start)
+        else:
+            self.profile = MotionProfile(dist, setpoint, self.velocity if setpoint > dist else -self.velocity, start)
+
+    def law(self, difference):
+        if abs(difference) <= self.tolerance and abs(self.velocity) < self.STOP_VELOCITY:
+            self.v_ref = 0.0
+            self.integral = 0.0
+            self.tick = 0
+            return 0
+        if self.tick == 0:
+            if self.profile:
+                reference, velocity = self.profile.sample(self.t)
+                self.v_ref = max(-self.MAX_SPEED, min(self.MAX_SPEED, velocity - self.KP_POS * (self.dist - reference)))
+            else:
+                self.v_ref = max(-self.MAX_SPEED, min(self.MAX_SPEED, -self.KP_POS * difference))
+            if self.approach_speed and abs(difference) < FLOOR_APPROACH:
+                self.v_ref = max(-self.approach_speed, min(self.approach_speed, self.v_ref))
+        self.tick = (self.tick + 1) % self.OUTER_DIVIDER
+        err = self.v_ref - self.velocity
+        u = -(self.KFF * self.v_ref + self.KP_VEL * err + self.KI_VEL * self.integral)
+        if abs(u) < DAC_MAX:
+            self.integral += err * self.dt          # anti-windup: only integrate while unsaturated
+        return max(-DAC_MAX, min(DAC_MAX, u))
+
+
+class Truncate:
+    """Plain transferDAC(int): saturated and the fraction dropped."""
+
+    def __init__(self):
+        self.last = 0
+
+    def __call__(self, command):
+        self.last = max(-DAC_MAX, min(DAC_MAX, int(command)))
+        return self.last
+
+
+class Dither:
+    """First order sigma-delta, as DAC::transferDACDithered()."""
+
+    def __init__(self):
+        self.residual = 0.0
+        self.last = 0
+
+    def __call__(self, command):
+        if command == 0 or (command > 0 and self.last < 0) or (command < 0 and self.last > 0):
+            self.residual = 0.0
+        target = command + self.residual
+        code = int(target + 0.5) if target >= 0 else -int(-target + 0.5)
+        code = max(-DAC_MAX, min(DAC_MAX, code))
+        self.residual = target - code
+        self.last = code
+        return code
+
+
+class Slew:
+    """DAC::limit() ahead of another stage: saturation, per direction slew limits and reversal through zero."""
+
+    # DAC_SLEW_* in DAC.h, codes per control tick
+    UP = 150
+    DOWN = 100
+    RELEASE = 300
+    REVERSAL_TICKS = 1
+
+    def __init__(self, inner):
+        self.inner = inner
+        self.hold = 0
+        self.last_sign = 0
+
+    @property
+    def last(self):
+        return self.inner.last
+
+    def __call__(self, command):
+        last = self.inner.last
+        command = max(-DAC_MAX, min(DAC_MAX, command))
+        if (command > 0 and last < 0) or (command < 0 and last > 0):
+            command = 0
+        if last == 0 and self.hold > 0:
+            if command * self.last_sign > 0:
+                self.hold = 0                   # Same direction as before the stop - not a reversal
+            else:
+                self.hold -= 1
+                return self.output(0)
+        if abs(command) > abs(last):
+            step = self.DOWN if command > 0 else self.UP
+        else:
+            step = self.RELEASE
+        command = max(last - step, min(last + step, command))
+        if command == 0 and last != 0:
+            self.hold = self.REVERSAL_TICKS
+        return self.output(command)
+
+    def output(self, command):
+        code = self.inner(command)
+        if self.inner.last:
+            self.last_sign = 1 if self.inner.last > 0 else -1
+        return code
+
+
+class OscillationDetector:
+    """Car::detectOscillation(): scales the law output down while the error keeps swinging across the setpoint."""
+
+    # OSC_* in ElevatorController.h (times in s)
+    BAND = 150
+    HYSTERESIS = 5
+    AMPLITUDE = 10
+    CROSSINGS = 4
+    WINDOW = 6.0
+    BACKOFF = 0.7
+    MIN_GAIN = 0.2
+    RESTORE = 30.0
+
+    def __init__(self):
+        self.scale = 1.0
+        self.side = 0
+        self.peak = 0
+        self.crossings = 0
+        self.start = 0.0
+        self.changed = 0.0
+        self.backoffs = []              # times of each backoff
+
+    def __call__(self, difference, now):
+        side = 1 if difference > self.HYSTERESIS else -1 if difference < -self.HYSTERESIS else 0
+        if abs(difference) > self.BAND:
+            self.side = 0
+            self.peak = 0
+        else:
+            if side != 0 and side != self.side:
+                if self.side != 0 and self.peak >= self.AMPLITUDE:
+                    if self.crossings == 0 or now - self.start > self.WINDOW:
+                        self.crossings = 0
+                        self.start = now
+                    self.crossings += 1
+                self.side = side
+                self.peak = 0
+            self.peak = max(self.peak, abs(difference))
+        if self.crossings >= self.CROSSINGS:
+            self.crossings = 0
+            self.scale = max(self.scale * self.BACKOFF, self.MIN_GAIN)
+            self.changed = now
+            self.backoffs.append(now)
+        elif self.scale < 1 and now - self.changed >= self.RESTORE:
+            self.scale = min(self.scale / self.BACKOFF, 1.0)
+            self.changed = now
+            if self.scale > 0.99:
+                self.scale = 1.0
+        return self.scale
+
+
+def read_dead_reckoning(path=None):
+    """DEADRECK_*, MOTOR_* and SENSOR_TIMEOUT_MS from ElevatorController.h."""
+    path = path or os.path.join(os.path.dirname(__file__), "..", "ElevatorController.h")
+    with open(path) as f:
+        text = f.read()
+    get = lambda name: float(re.search(r"#define %s\s+([\d.]+)" % name, text).group(1))
+    return {name: get(name) for name in ("DEADRECK_FAULTS", "DEADRECK_JUMP_MM", "DEADRECK_SPEED", "DEADRECK_RECOVER",
+                                         "MOTOR_K", "MOTOR_TAU", "MOTOR_FRICTION", "SENSOR_TIMEOUT_MS")}
+
+
+class DeadReckoning:
+    """Sensor fault handling of Car::Move() around a law.
+
+    step() takes the period's reading - (distance, valid) or None when the sensor
+    did not answer - and returns the command for the output stage, None to keep
+    the last code on the DAC, or 0 to stop. With enabled=False it is the firmware
+    without DEAD_RECKONING: hold the last code on an invalid range, stop on a
+    timeout or an out of range reading. Call applied() with each code written.
+    """
+
+    def __init__(self, controller, enabled=True, cfg=None):
+        self.c = controller
+        self.enabled = enabled
+        self.cfg = cfg or read_dead_reckoning()
+        self.model_valid = False
+        self.pos = self.vel = self.code = 0.0
+        self.time = 0.0
+        self.faults = 0
+        self.missed = 0
+        self.active = False
+        self.parked = False
+        self.floor = None
+        self.recover_count = 0
+        self.recover_dist = 0
+        self.events = []                # (t, text) as the [DIAG] lines
+
+    def advance(self, now):
+        k, tau, friction = self.cfg["MOTOR_K"], self.cfg["MOTOR_TAU"], self.cfg["MOTOR_FRICTION"]
+        dt = now - self.time
+        drive = abs(self.code) - friction
+        target = (-k * drive if self.code > 0 else k * drive) if drive > 0 else 0.0
+        decay = math.exp(-dt / tau)
+        self.pos += target * dt + (self.vel - target) * tau * (1 - decay)
+        self.vel = target + (self.vel - target) * decay
+        self.time = now
+
+    def applied(self, code, now):
+        self.advance(now)
+        self.code = code
+
+    def step(self, reading, setpoint, now, dt=CONTROL_PERIOD):
+        cfg = self.cfg
+        if reading is None:
+            self.missed += 1
+            if not self.enabled:
+                return 0 if self.missed * dt * 1000 > cfg["SENSOR_TIMEOUT_MS"] else None
+            if self.active or self.missed * dt * 1000 > cfg["SENSOR_TIMEOUT_MS"]:
+                self.missed = 0
+                return self.fault(now, timeout=True)
+            return None
+        self.missed = 0
+        dist, valid = reading
+        if not self.enabled:
+            if not valid:
+                return None
+        elif self.active:
+            if not self.recover(dist, valid, now):
+                return self.creep(now)
+        elif not self.usable(dist, valid, now):
+            return self.fault(now, timeout=False)
+        self.faults = 0
+        if not MINHEIGHT < dist < MAXHEIGHT:
+            self.c.prev = None
+            return 0
+        command = self.c.step(dist, setpoint, dt)
+        self.pos, self.vel, self.time, self.model_valid = float(dist), self.c.velocity, now, True
+        return command
+
+    def usable(self, dist, valid, now):
+        if not valid:
+            return False
+        if not self.model_valid:
+            return True
+        self.advance(now)
+        return abs(dist - self.pos) <= self.cfg["DEADRECK_JUMP_MM"]
+
+    def fault(self, now, timeout):
+        if not self.active and not timeout:
+            self.faults += 1
+            if self.faults < self.cfg["DEADRECK_FAULTS"]:
+                return None
+        if not self.active:
+            if not self.model_valid:
+                return 0
+            self.start(now)
+        return self.creep(now)
+
+    def start(self, now):
+        self.advance(now)
+        rest = self.pos + self.vel * self.cfg["MOTOR_TAU"]
+        moving = abs(self.vel) > self.cfg["DEADRECK_SPEED"]
+        ahead = [sp for sp in FLOOR_SP if not (moving and (sp - rest) * self.vel < 0)] or FLOOR_SP
+        self.floor = min(ahead, key=lambda sp: abs(sp - rest))      # FLOOR_SP is bottom up, so ties keep the lower floor
+        self.active = True
+        self.parked = False
+        self.recover_count = 0
+        self.events.append((now, "dead reckoning from %d mm to %d mm" % (self.pos, self.floor)))
+
+    def creep(self, now):
+        cfg = self.cfg
+        self.advance(now)
+        difference = self.pos - self.floor
+        rest = difference + self.vel * cfg["MOTOR_TAU"]
+        outside = not MINHEIGHT < self.pos < MAXHEIGHT
+        if not self.parked and (outside or abs(rest) <= cfg["DEADRECK_SPEED"] * CONTROL_PERIOD / 2 or rest * difference < 0):
+            self.parked = True
+            self.events.append((now, "parked at %d mm" % self.pos))
+        if self.parked:
+            return 0
+        return (1 if difference > 0 else -1) * (cfg["DEADRECK_SPEED"] / cfg["MOTOR_K"] + cfg["MOTOR_FRICTION"])
+
+    def recover(self, dist, valid, now):
+        if not valid:
+            self.recover_count = 0
+            return False
+        if self.recover_count and abs(dist - self.recover_dist) > self.cfg["DEADRECK_JUMP_MM"]:
+            self.recover_count = 0
+        self.recover_dist = dist
+        self.recover_count += 1
+        if self.recover_count < self.cfg["DEADRECK_RECOVER"]:
+            return False
+        self.active = False
+        self.c.prev = None
+        self.c.velocity = 0.0
+        self.events.append((now, "sensor recovered"))
+        return True
+
+
+LAWS = {cls.name: cls for cls in (Exponential, MPC, Cascaded)}
+
+
+# Pinned to the firmware: the host build (tools/firmware.py) runs PIN_CALLS under each CONTROL_LAW and its [TLM] records are replayed here
+PIN_CALLS = [0x07, 0x06, 0x05, 0x07, 0x05]   # Floor codes from the supervisory controller ...
+PIN_START = 2.0                             # s - ... the first at PIN_START, then PIN_SPACING apart
+PIN_SPACING = 12.0
+CONTROL_LAW_CODES = {"exponential": 0, "mpc": 1, "cascaded": 2}    # CONTROL_LAW_xxx in ElevatorController.h
+LAW_LEAD_MS = (0.005, 0.030)                # The law's millis() comes this long before its DAC latches the code (tools/host/board.cpp costs)
+CALL_LAG_MS = 5                              # A call is dispatched (Car::setTarget()) within this of its [CAN] RX line
+REPLAY_BEAM = 8                             # Candidate runs replay() follows on at most
+
+
+def firmware_run(law):
+    """[(tick ms candidates, dist, setpoint, code, velocity, call ms candidates)] - a [TLM] record of the host build per law run.
+
+    The firmware's millis() at the law is not visible outside it: it is the ms
+    the DAC latch less LAW_LEAD_MS falls in (two when that straddles a ms). A
+    new setpoint's profile starts when the loop dispatches the call, up to
+    CALL_LAG_MS after its [CAN] RX line. Calls are None if the setpoint did not
+    change.
+    """
+    from firmware import Board, SUPERVISOR_ID
+
+    board = Board({"CONTROL_LAW": CONTROL_LAW_CODES[law]})
+    board.fw.setup()
+    for i, code in enumerate(PIN_CALLS):
+        board.fw.inject(PIN_START + i * PIN_SPACING, SUPERVISOR_ID, [code])
+    board.run_until(PIN_START + len(PIN_CALLS) * PIN_SPACING)
+    latches = board.latches[0]
+    writes = [t * 1000 for i, t in enumerate(latches) if i == 0 or t - latches[i - 1] > 1e-4]   # A and B of one write latch together
+    records, rx, setpoint, w = [], None, None, 0
+    for line in board.fw.serial().splitlines():
+        m = re.match(r"\[CAN\] (\d+) RX", line)
+        if m:
+            rx = int(m.group(1))
+        if not line.startswith("[TLM] "):
+            continue
+        t, dist, sp, code, velocity = (int(v) for v in line[6:].split(",")[:5])
+        while w + 1 < len(writes) and writes[w + 1] < t + 1:
+            w += 1
+        ticks = sorted(set(int(writes[w] - lead) for lead in reversed(LAW_LEAD_MS)))
+        calls = list(range(rx, rx + CALL_LAG_MS + 1)) if setpoint is not None and sp != setpoint and rx is not None else None
+        records.append((ticks, dist, sp, code, velocity, calls))
+        setpoint = sp
+    return records
+
+
+def replay(law, records):
+    """The port on the firmware's inputs - [(t ms, firmware code and velocity, port code and velocity)] where they differ.
+
+    Each candidate time of a record is tried for the velocity estimate and for
+    the law's own millis() (the profile sample, the oscillation detector) - the
+    two calls can fall either side of a ms. Every run that gives the firmware's
+    code and its velocity to 1 mm/s (float against double) is followed on, up to
+    REPLAY_BEAM of them, since a wrong pick may only show ticks later.
+    """
+    import copy
+
+    output = Dither() if firmware_enabled("DAC_DITHER") else Truncate()
+    start = {
+        "law": LAWS[law](),
+        "detector": OscillationDetector() if firmware_enabled("OSC_DETECT") else None,
+        "output": Slew(output) if firmware_enabled("DAC_SLEW_LIMIT") else output,
+        "tick": None,
+    }
+
+    def run(s, estimated, now, dist, setpoint, call):
+        c = s["law"]
+        if call is not None and isinstance(c, Cascaded):
+            c.call(setpoint, call / 1000.0)
+        dt = (estimated - s["tick"]) / 1000.0 if s["tick"] is not None else 0.0   # No estimate on the first range (m_prevTime is 0)
+        s["tick"] = estimated
+        if not MINHEIGHT < dist < MAXHEIGHT:
+            return s["output"](0), c.velocity
+        u = c.step(dist, setpoint, dt, now=now / 1000.0) if isinstance(c, Cascaded) else c.step(dist, setpoint, dt)
+        if s["detector"]:
+            u *= s["detector"](dist - setpoint, now / 1000.0)
+        return s["output"](u), c.velocity
+
+    states = [start]
+    differences = []
+    for ticks, dist, setpoint, code, velocity, calls in records:
+        tried = []
+        for s in states:
+            for i, estimated in enumerate(ticks):
+                for now in ticks[i:]:
+                    for call in calls or [None]:
+                        trial = copy.deepcopy(s)
+                        tried.append((trial, estimated) + run(trial, estimated, now, dist, setpoint, call))
+        match = sorted((r for r in tried if r[2] == code and abs(int(r[3]) - velocity) <= 1), key=lambda r: abs(int(r[3]) - velocity))
+        if not match:
+            _, tick, port_code, port_velocity = tried[0]
+            differences.append((tick, code, velocity, port_code, port_velocity))
+            match = tried[:1]
+        states = [r[0] for r in match[:REPLAY_BEAM]]
+    return differences
+
+
+def check():
+    failures = []
+    for law in sorted(LAWS):
+        records = firmware_run(law)
+        differences = replay(law, records)
+        if len(records) < 500:
+            failures.append("%s: only %d [TLM] records from the host build" % (law, len(records)))
+        if differences:
+            t, code, velocity, port_code, port_velocity = differences[0]
+            failures.append("%s: %d of %d law runs differ from the firmware, first at %d ms: code %d velocity %d, laws.py %d and %.1f" % (
+                law, len(differences), len(records), t, code, velocity, port_code, port_velocity))
+    slew = Slew(Truncate())                     # A stop, a restart the same way (not held), then a reversal (held a tick at zero)
+    codes = [slew(c) for c in (200, 200, 0, 200, -200, -200, -200)]
+    if codes != [100, 200, 0, 100, 0, 0, -150]:
+        failures.append("DAC_SLEW_LIMIT output stage: codes %s for a stop, a restart and a reversal" % codes)
+    for f in failures:
+        print("FAIL " + f)
+    print("ok" if not failures else "%d failures" % len(failures))
+    return not failures
+
+
+if __name__ == "__main__":
+    import argparse
+    import sys
+
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--check", action="store_true", help="replay the host build's law runs through the ports, exit 1 on a difference")
+    if ap.parse_args().check:
+        sys.exit(0 if check() else 1)
+    ap.print_help()
@@ -0,0 +1,231 @@
+"""
+@file loadshed_sim.py
+@brief Loop timing model of ElevatorController::loop() for checking the load shedding policy
+
+Plays the firmware loop with estimated task costs (I2C sensor traffic at
+100 kHz, CAN SPI reads, Serial output at 115200 baud through the 64 byte TX
+buffer, LiquidCrystal writes) against a synthetic CAN burst. The shedding
+policy is a port of ElevatorController::updateLoadShedding() and reads
+LOOP_BUDGET_US, SHED_RESTORE_MS and CONTROL_PERIOD_MS from ElevatorController.h.
+With --cars the loop serves the cars round robin, one per loop, with their
+control periods staggered as in Car::startPeriods().
+
+Reported per run and car:
+  latency  time from a sensor result being ready to the DAC write
+  jitter   deviation of the interval between DAC writes from CONTROL_PERIOD_MS
+  busy     CPU time spent on work - polls that find no result and the bare
+           loop are idle time, so 100% - busy is the headroom left for more cars
+
+    python3 tools/loadshed_sim.py                       # 200 frames/s burst from 5 s to 10 s
+    python3 tools/loadshed_sim.py --rate 500 --check    # exit 1 if the shedding run breaks the latency bound
+    python3 tools/loadshed_sim.py --cars 2              # two shafts on one board (CAR_COUNT 2)
+"""
+
+import argparse
+import os
+import random
+import re
+import sys
+
+SHED_NONE, SHED_LCD, SHED_LOGGING, SHED_TELEMETRY = range(4)
+
+# Task costs in us (estimates for a 16 MHz UNO)
+SERIAL_BYTE_US = 87         # 115200 baud, 10 bits per byte
+SERIAL_BUFFER = 64          # HardwareSerial TX buffer
+CAN_READ_US = 150           # readMsgBuf over SPI
+CAN_SEND_US = 200           # sendMsgBuf over SPI
+POLL_US = 400               # isDataReady: 1 byte register read over I2C
+TRIGGER_US = 600            # start(): stop variable script + start bit poll
+READ_US = 1500              # 12 byte result read + interrupt clear
+LAW_US = 600                # velocity estimate + control law (float)
+DAC_US = 50
+LCD_CHAR_US = 200           # LiquidCrystal 4-bit write (two enable pulses + 100 us settle)
+SENSOR_BUDGET_MS = 33       # SENSOR_PROFILE ProfileDefault
+RX_LOG = 57                 # "[CAN] 12345678 RX: Standard ID: 0x100 DLC: 1 Data: 0x05\r\n"
+TX_LOG = 41                 # "[CAN] 12345678 TX: ID: 0x101 Data: 0x5\r\n"
+TLM_LOG = 44                # "[TLM] ..." record
+LOOP_US = 20                # loop overhead, checkFloor() and dispatch()
+
+
+def read_config(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "ElevatorController.h")
+    with open(path) as f:
+        text = f.read()
+    get = lambda name: int(re.search(r"#define %s\s+(\d+)" % name, text).group(1))
+    return {"budget_us": get("LOOP_BUDGET_US"), "restore_ms": get("SHED_RESTORE_MS"), "period_ms": get("CONTROL_PERIOD_MS")}
+
+
+class Serial:
+    """TX buffer draining at the baud rate; print() blocks while the buffer is full."""
+
+    def __init__(self):
+        self.queued = 0.0
+        self.t = 0.0
+
+    def drain(self, now):
+        self.queued = max(0.0, self.queued - (now - self.t) / SERIAL_BYTE_US)
+        self.t = now
+
+    def print(self, now, n):
+        self.drain(now)
+        block = max(0.0, self.queued + n - SERIAL_BUFFER) * SERIAL_BYTE_US
+        self.queued += n
+        return block
+
+
+class Shedder:
+    """Port of ElevatorController::updateLoadShedding()."""
+
+    def __init__(self, cfg, enabled=True):
+        self.cfg = cfg
+        self.enabled = enabled
+        self.level = SHED_NONE
+        self.slack_since = 0.0
+        self.levels = []
+
+    def update(self, now_us, loop_us):
+        now = now_us / 1000.0
+        if not self.enabled:
+            return
+        budget = self.cfg["budget_us"]
+        if loop_us > budget:
+            self.level = min(self.level + 1, SHED_TELEMETRY)
+            self.slack_since = now
+        elif self.level > SHED_NONE and now - self.slack_since >= self.cfg["restore_ms"]:
+            self.level -= 1
+            self.slack_since = now
+        self.levels.append((now_us, self.level))
+
+
+class Car:
+    """Control state of one car: Car::Move() with the staggered first period. node is its board's node.Node (the default identity if None)."""
+
+    def __init__(self, index, cars, period_us, node=None):
+        self.index = index
+        self.can_id = node.car_id(index) if node else 0x101 + index           # Car::getCanId()
+        self.number = node.record.first_car + index if node else index       # Bank car number - the high nibble of its codes
+        self.sampling = False
+        self.trigger_time = -period_us + index * period_us / cars
+        self.ready_at = 0.0
+        self.writes = []
+        self.latency = []
+
+
+def run(cfg, shedding, rate, burst, duration, cars=1, seed=1):
+    rng = random.Random(seed)
+    serial = Serial()
+    shed = Shedder(cfg, shedding)
+    period_us = cfg["period_ms"] * 1000.0
+    fleet = [Car(i, cars, period_us) for i in range(cars)]
+
+    # CAN arrivals: floor commands every 4 s plus a Poisson burst of other traffic
+    frames = [(t * 1e6, True) for t in range(2, int(duration), 4)]
+    t = burst[0]
+    while rate > 0:
+        t += rng.expovariate(rate)
+        if t >= burst[1]:
+            break
+        frames.append((t * 1e6, False))
+    frames.sort()
+
+    now = 0.0
+    loop_start = 0.0
+    next_tx = 1e6
+    next_car = 0
+    tx_pending = 0
+    idle = 0.0
+    while now < duration * 1e6:
+        shed.update(now, now - loop_start)
+        loop_start = now
+        verbose = shed.level < SHED_LOGGING
+
+        if frames and frames[0][0] <= now:                  # flagRecv: one frame per loop
+            _, floor = frames.pop(0)
+            now += CAN_READ_US
+            if verbose:
+                now += serial.print(now, RX_LOG)
+            if floor:
+                now += 8 * LCD_CHAR_US                      # "Floor n" is never shed
+        if now >= next_tx:                                  # TIMER_FLOOR_REPORT: every car reports its floor, one per loop
+            next_tx += 1e6
+            tx_pending = cars
+        if tx_pending:
+            tx_pending -= 1
+            now += CAN_SEND_US
+            if verbose:
+                now += serial.print(now, TX_LOG)
+
+        # Car::Move() for the next car in turn
+        car = fleet[next_car]
+        next_car = (next_car + 1) % cars
+        if not car.sampling and now - car.trigger_time >= period_us:
+            now += TRIGGER_US
+            car.trigger_time += (now - car.trigger_time) // period_us * period_us
+            car.ready_at = now + SENSOR_BUDGET_MS * 1000.0
+            car.sampling = True
+        elif car.sampling:
+            now += POLL_US
+            if now >= car.ready_at:
+                car.sampling = False
+                now += READ_US + LAW_US + DAC_US
+                car.writes.append(now)
+                car.latency.append(now - car.ready_at)
+                if shed.level < SHED_LCD and car.index == 0:
+                    now += 7 * LCD_CHAR_US
+                if shed.level < SHED_TELEMETRY:
+                    now += serial.print(now, TLM_LOG)
+            else:
+                idle += POLL_US
+        now += LOOP_US
+        idle += LOOP_US
+
+    for car in fleet:
+        car.jitter = [abs((b - a) - period_us) for a, b in zip(car.writes, car.writes[1:])]
+    return {"cars": fleet, "levels": shed.levels, "busy": 1.0 - idle / now,
+            "latency": [l for c in fleet for l in c.latency], "jitter": [j for c in fleet for j in c.jitter]}
+
+
+def pct(values, p):
+    s = sorted(values)
+    return s[min(len(s) - 1, int(p * len(s)))] if s else 0.0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--rate", type=float, default=200.0, help="burst CAN frames per second")
+    ap.add_argument("--burst", type=float, nargs=2, default=(5.0, 10.0), metavar=("START", "END"), help="burst window in s")
+    ap.add_argument("--duration", type=float, default=20.0, help="simulated time in s")
+    ap.add_argument("--check", action="store_true", help="exit 1 if the shedding run exceeds the latency bound")
+    ap.add_argument("--cars", type=int, default=1, help="cars served by the loop (CAR_COUNT)")
+    args = ap.parse_args()
+
+    cfg = read_config()
+    # Worst case with shedding: a result becomes ready just after its car's turn and waits one loop per car at the budget,
+    # then the result read, law and DAC write
+    bound = args.cars * cfg["budget_us"] + POLL_US + READ_US + LAW_US + DAC_US
+    ok = True
+    for shedding in (False, True):
+        r = run(cfg, shedding, args.rate, args.burst, args.duration, args.cars)
+        print("%-12s latency p99 %.1f ms max %.1f ms  jitter p99 %.1f ms max %.1f ms  busy %.0f%% (headroom %.0f%%)" % (
+            "shedding" if shedding else "no shedding",
+            pct(r["latency"], 0.99) / 1000, max(r["latency"]) / 1000,
+            pct(r["jitter"], 0.99) / 1000, max(r["jitter"]) / 1000,
+            100 * r["busy"], 100 * (1 - r["busy"])))
+        for car in r["cars"]:
+            print("    car %d  ticks %d (%.1f Hz)  latency max %.1f ms  jitter max %.1f ms" % (
+                car.index + 1, len(car.writes), len(car.writes) / args.duration, max(car.latency) / 1000, max(car.jitter) / 1000))
+        if shedding:
+            level = SHED_NONE
+            for t, l in r["levels"]:
+                if l != level:
+                    print("    %6.2f s  level %d" % (t / 1e6, l))
+                    level = l
+            if max(r["latency"]) > bound:
+                ok = False
+    print("bound %.1f ms: %s" % (bound / 1000, "ok" if ok else "EXCEEDED"))
+    if args.check and not ok:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
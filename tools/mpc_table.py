@@ -0,0 +1,176 @@
+"""
+@file mpc_table.py
+@brief Offline solver for the explicit MPC lookup table (MPCTable.h)
+
+Solves the constrained infinite-horizon optimal control problem for the plant
+model in plant.py by value iteration over a gridded (position error, velocity)
+state space, discretised at the firmware control period:
+
+    minimise  sum  Q * (e/100)^2 + R * (u/1023)^2
+    subject to     |u| <= 1023              (10-bit DAC)
+                   |v| <= V_LIMIT           (car speed limit)
+
+The resulting feedback law u(e, v) is sampled on the breakpoints below and
+written to MPCTable.h, storing only e >= 0 since the law is odd:
+u(-e, -v) = -u(e, v). ElevatorController evaluates it with a bilinear lookup.
+
+    python3 tools/mpc_table.py [--model fitted.json] [-o ../MPCTable.h]
+"""
+
+import argparse
+import math
+import os
+
+from plant import load_params, DAC_MAX
+from laws import CONTROL_PERIOD
+
+V_LIMIT = 250.0         # mm/s
+Q = 1.0
+R = 0.5
+
+# Solver grid (fine) and output table breakpoints (coarse, dense near the floor)
+E_GRID = [float(e) for e in range(-1400, 1401, 20)]
+V_GRID = [float(v) for v in range(-int(V_LIMIT), int(V_LIMIT) + 1, 10)]
+ACTIONS = sorted(set([int(round(DAC_MAX * k / 24.0)) for k in range(-24, 25)]))
+FINE_ACTIONS = sorted(set([s * u for u in list(range(0, DAC_MAX, 8)) + [DAC_MAX] for s in (-1, 1)]))
+E_BREAKPOINTS = [0, 25, 50, 75, 100, 150, 200, 300, 400, 600, 800, 1200]
+V_BREAKPOINTS = [-300, -250, -200, -150, -100, -50, -25, 0, 25, 50, 100, 150, 200, 250, 300]
+
+
+def model(params, dt):
+    """Exact zero-order-hold discretisation of the plant velocity dynamics."""
+    k, tau, fric = params["K"], params["tau"], params["friction"]
+    decay = math.exp(-dt / tau)
+
+    def step(e, v, u):
+        mag = max(abs(u) - fric, 0.0)
+        vt = -math.copysign(k * mag, u) if u else 0.0
+        v2 = vt + (v - vt) * decay
+        e2 = e + vt * dt + (v - vt) * tau * (1.0 - decay)
+        return e2, v2
+    return step
+
+
+def locate(grid, x):
+    if x <= grid[0]:
+        return 0, 0.0
+    if x >= grid[-1]:
+        return len(grid) - 2, 1.0
+    h = grid[1] - grid[0]
+    i = min(int((x - grid[0]) / h), len(grid) - 2)
+    return i, (x - grid[i]) / h
+
+
+def stage_cost(e, u):
+    return Q * (e / 100.0) ** 2 + R * (u / float(DAC_MAX)) ** 2
+
+
+def solve(params, dt=CONTROL_PERIOD, iterations=400, tol=1e-4):
+    step = model(params, dt)
+    ne, nv = len(E_GRID), len(V_GRID)
+    # Precompute successor interpolation weights for every (state, action)
+    trans = []
+    for e in E_GRID:
+        for v in V_GRID:
+            options = []
+            for u in ACTIONS:
+                e2, v2 = step(e, v, u)
+                if abs(v2) > V_LIMIT:
+                    continue                        # speed constraint
+                i, we = locate(E_GRID, e2)
+                j, wv = locate(V_GRID, v2)
+                options.append((stage_cost(e, u), i * nv + j, we, wv))
+            trans.append(options)
+
+    value = [0.0] * (ne * nv)
+    for it in range(iterations):
+        new = [0.0] * (ne * nv)
+        delta = 0.0
+        for s, options in enumerate(trans):
+            best = float("inf")
+            for (c, k, we, wv) in options:
+                v00, v01 = value[k], value[k + 1]
+                v10, v11 = value[k + nv], value[k + nv + 1]
+                q = c + (1 - we) * (v00 + (v01 - v00) * wv) + we * (v10 + (v11 - v10) * wv)
+                if q < best:
+                    best = q
+            new[s] = best if best != float("inf") else value[s]
+            delta = max(delta, abs(new[s] - value[s]))
+        value = new
+        if delta < tol:
+            break
+    return value, step
+
+
+def interpolate(value, e, v):
+    nv = len(V_GRID)
+    i, we = locate(E_GRID, e)
+    j, wv = locate(V_GRID, max(-V_LIMIT, min(V_LIMIT, v)))
+    k = i * nv + j
+    v00, v01, v10, v11 = value[k], value[k + 1], value[k + nv], value[k + nv + 1]
+    return (1 - we) * (v00 + (v01 - v00) * wv) + we * (v10 + (v11 - v10) * wv)
+
+
+def policy(value, step, e, v):
+    """Greedy action against the converged value function on a fine action set."""
+    successors = [(u,) + step(e, v, u) for u in FINE_ACTIONS]
+    feasible = [s for s in successors if abs(s[2]) <= V_LIMIT]
+    if not feasible:                                # over the limit: brake as hard as possible
+        return min(successors, key=lambda s: abs(s[2]))[0]
+    best, best_u = float("inf"), 0
+    for (u, e2, v2) in feasible:
+        q = stage_cost(e, u) + interpolate(value, e2, v2)
+        if q < best:
+            best, best_u = q, u
+    return best_u
+
+
+def emit(table, path, params):
+    lines = []
+    w = lines.append
+    w("/*!")
+    w(" * @file MPCTable.h")
+    w(" * @brief Explicit MPC lookup table for ElevatorController (CONTROL_LAW_MPC)")
+    w(" *")
+    w(" * GENERATED by tools/mpc_table.py - do not edit by hand.")
+    w(" * Plant: K=%.3f mm/s/code, tau=%.3f s, friction=%.0f codes; period %d ms, speed limit %d mm/s" % (
+        params["K"], params["tau"], params["friction"], int(CONTROL_PERIOD * 1000), int(V_LIMIT)))
+    w(" * Rows are position error (mm, e >= 0 only - the law is odd), columns are velocity (mm/s).")
+    w(" */")
+    w("")
+    w("#ifndef MPCTABLE_H")
+    w("#define MPCTABLE_H")
+    w("")
+    w("#include <avr/pgmspace.h>")
+    w("")
+    w("#define MPC_E_POINTS %d" % len(E_BREAKPOINTS))
+    w("#define MPC_V_POINTS %d" % len(V_BREAKPOINTS))
+    w("")
+    w("const int16_t MPC_E_BREAKPOINTS[MPC_E_POINTS] PROGMEM = { %s };" % ", ".join(str(e) for e in E_BREAKPOINTS))
+    w("const int16_t MPC_V_BREAKPOINTS[MPC_V_POINTS] PROGMEM = { %s };" % ", ".join(str(v) for v in V_BREAKPOINTS))
+    w("")
+    w("const int16_t MPC_TABLE[MPC_E_POINTS][MPC_V_POINTS] PROGMEM = {")
+    for e, row in zip(E_BREAKPOINTS, table):
+        w("  { %s },  // e = %d" % (", ".join("%5d" % u for u in row), e))
+    w("};")
+    w("")
+    w("#endif")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--model", help="fitted plant model JSON from sysid_fit.py")
+    ap.add_argument("-o", "--output", default=os.path.join(os.path.dirname(__file__), "..", "MPCTable.h"))
+    args = ap.parse_args()
+
+    params = load_params(args.model)
+    value, step = solve(params)
+    table = [[policy(value, step, float(e), float(v)) for v in V_BREAKPOINTS] for e in E_BREAKPOINTS]
+    emit(table, args.output, params)
+    print("wrote %s (%d bytes of flash)" % (args.output, 2 * (len(E_BREAKPOINTS) * (len(V_BREAKPOINTS) + 1) + len(V_BREAKPOINTS))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,332 @@
+"""
+@file node.py
+@brief CAN node identity records and the assignment procedure for a bank of elevator controllers
+
+Ports the node identity of CANModule (NodeRecord in EEPROM, the defaults a
+blank board comes up with, the NODE_QUERY / NODE_SELECT / NODE_SET /
+NODE_STORE handling, its NODE_NACK and the stores it refuses (no source, a
+floor code given to two floors), the MCP2515 filters and the routing of a
+floor or command code to one of the board's cars in
+ElevatorController::handleFrame()) and the supervisory controller's side of
+the assignment. The record layout and the codes are read from CANModule.h.
+
+bank() brings up --boards blank boards with --cars cars each on one bus and
+assigns them from the supervisory controller:
+
+  1. NODE_QUERY - every node answers with its UID, (uid % 256) ms after the
+     query, so the blank boards (all on the default ID) rarely start a frame
+     in the same bit time
+  2. for each UID in turn: NODE_SELECT, then NODE_SET of the board's ID
+     (--base + board * --stride), first car (board * --cars), sources and
+     floor codes, then NODE_STORE - the node answers from its new ID
+
+The multi-car simulations (can_stress.py --boards) instantiate their boards
+and cars this way. With --check the port is verified instead (exit 1 on a
+failure).
+
+    python3 tools/node.py --boards 4 --cars 2
+    python3 tools/node.py --check
+"""
+
+import argparse
+import os
+import random
+import re
+import struct
+import sys
+
+MASTER_ID = 0x100
+
+
+def read_node_config(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "CANModule.h")
+    with open(path) as f:
+        text = f.read()
+    get = lambda name: int(re.search(r"#define %s\s+(0x[0-9A-Fa-f]+|\d+)" % name, text).group(1), 0)
+    cfg = {k: get(k) for k in ("TxID", "FILTER_SC", "CAR_SHIFT", "CAR_CODE_MASK", "FLOOR1", "FLOOR2", "FLOOR3", "SYSID", "HEALTH",
+                               "NODE_QUERY", "NODE_SELECT", "NODE_SET", "NODE_STORE", "NODE_NACK", "NODE_QUERY_DLC", "NODE_SELECT_DLC",
+                               "NODE_SET_DLC", "NODE_FIELD_TXID", "NODE_FIELD_FIRST_CAR", "NODE_FIELD_SOURCE",
+                               "NODE_FIELD_FLOOR", "NODE_SOURCES", "NODE_NO_SOURCE", "NODE_FLOORS", "NODE_CARS", "NODE_MAGIC")}
+    cfg["floors"] = [cfg["FLOOR1"], cfg["FLOOR2"], cfg["FLOOR3"]]                  # FLOOR_TABLE codes
+    # AVR layout of NodeRecord (no padding): magic, uid, txId, firstCar, sources[], floorCodes[], check
+    cfg["layout"] = "<BIHB%dH%dsB" % (cfg["NODE_SOURCES"], cfg["NODE_FLOORS"])
+    return cfg
+
+
+class NodeRecord:
+    def __init__(self, cfg, uid=0, tx_id=0, first_car=0, sources=None, floors=None):
+        self.cfg = cfg
+        self.uid = uid
+        self.tx_id = tx_id
+        self.first_car = first_car
+        self.sources = list(sources or [cfg["NODE_NO_SOURCE"]] * cfg["NODE_SOURCES"])
+        self.floors = list(floors or [0xFF] * cfg["NODE_FLOORS"])
+
+    def copy(self):
+        return NodeRecord(self.cfg, self.uid, self.tx_id, self.first_car, self.sources, self.floors)
+
+    def pack(self):
+        """The record as EEPROM.put() writes it, with its checksum."""
+        body = struct.pack(self.cfg["layout"], self.cfg["NODE_MAGIC"], self.uid, self.tx_id, self.first_car,
+                           *(self.sources + [bytes(self.floors)] + [0]))[:-1]
+        return body + bytes([sum(body) & 0xFF])
+
+    @classmethod
+    def unpack(cls, cfg, data):
+        """Record from EEPROM bytes, None if blank or corrupt (CANModule::loadNode())."""
+        n = cfg["NODE_SOURCES"]
+        fields = struct.unpack(cfg["layout"], bytes(data))
+        if fields[0] != cfg["NODE_MAGIC"] or fields[-1] != sum(bytes(data)[:-1]) & 0xFF:
+            return None
+        return cls(cfg, fields[1], fields[2], fields[3], list(fields[4:4 + n]), list(fields[4 + n]))
+
+
+class Node:
+    """One board: its EEPROM record, MCP2515 filters and CANModule::handleNodeConfig()."""
+
+    def __init__(self, cfg, eeprom=None, cars=1, rng=None):
+        self.cfg = cfg
+        self.cars = cars
+        self.size = struct.calcsize(cfg["layout"])
+        self.eeprom = bytearray(eeprom if eeprom is not None else b"\xFF" * self.size)
+        self.rng = rng or random.Random()
+        self.selected = False
+        self.query_due = None
+        self.load()
+        self.pending = self.record.copy()
+
+    def load(self):
+        self.record = NodeRecord.unpack(self.cfg, self.eeprom)
+        if self.record is None:                                 # Blank or corrupt - defaults and a new UID, written back
+            c = self.cfg
+            floors = c["floors"] + [0xFF] * (c["NODE_FLOORS"] - len(c["floors"]))
+            self.record = NodeRecord(c, self.rng.getrandbits(32), c["TxID"], 0,
+                                     [c["FILTER_SC"] >> 16] + [c["NODE_NO_SOURCE"]] * (c["NODE_SOURCES"] - 1), floors)
+            self.save()
+
+    def save(self):
+        self.eeprom[:] = self.record.pack()
+
+    def accepts(self, can_id):
+        """MCP2515 acceptance: full ID masks, one source per filter (unused filters repeat the first)."""
+        r = self.record
+        return any(can_id == (s if s != self.cfg["NODE_NO_SOURCE"] else r.sources[0]) for s in r.sources)
+
+    def car(self, code):
+        """Board car a floor or command code is for (ElevatorController::handleFrame()), None if another board's."""
+        bank = code >> self.cfg["CAR_SHIFT"]
+        index = (bank - self.record.first_car) & 0xFF
+        return index if bank < self.cfg["NODE_CARS"] and index < self.cars else None
+
+    def floor(self, code):
+        """FLOOR_TABLE index of a floor code (CANModule::floorIndex()), None if not a floor."""
+        floors = self.record.floors[:len(self.cfg["floors"])]
+        return floors.index(code) if code in floors else None
+
+    def car_id(self, index):
+        return self.record.tx_id + index
+
+    def receive(self, now_ms, data):
+        """A frame from an accepted source. Returns the answers as (ready ms, ID, data)."""
+        c = self.cfg
+        code = data[0] if data else None
+        if code == c["NODE_QUERY"] and len(data) == 1:
+            self.query_due = now_ms + (self.record.uid & 0xFF)
+        elif code == c["NODE_SELECT"] and len(data) == c["NODE_SELECT_DLC"]:
+            self.selected = struct.unpack("<I", bytes(data[1:5]))[0] == self.record.uid
+            self.pending = self.record.copy()
+        elif code == c["NODE_SET"] and len(data) == c["NODE_SET_DLC"] and self.selected:
+            if not self.apply(data[1], data[2] | (data[3] << 8)):
+                return [(now_ms, self.record.tx_id, bytes([c["NODE_NACK"]]) + bytes(data[1:]))]
+        elif code == c["NODE_STORE"] and len(data) == 1 and self.selected:
+            floors = self.pending.floors[:len(c["floors"])]
+            if self.pending.sources[0] == c["NODE_NO_SOURCE"] or len(set(floors)) != len(floors):
+                return []                               # No source, or two floors on one code
+            self.record = self.pending.copy()
+            self.selected = False
+            self.save()
+            return [(now_ms, self.record.tx_id, self.answer(c["NODE_STORE"])[:c["NODE_SELECT_DLC"]])]
+        return []
+
+    def apply(self, field, value):
+        """CANModule::applyNodeSet() - False if the field is unknown or the value out of range."""
+        c = self.cfg
+        p = self.pending
+        if field == c["NODE_FIELD_TXID"] and value <= 0x7FF:
+            p.tx_id = value
+        elif field == c["NODE_FIELD_FIRST_CAR"] and value < c["NODE_CARS"]:
+            p.first_car = value
+        elif c["NODE_FIELD_SOURCE"] <= field < c["NODE_FIELD_SOURCE"] + c["NODE_SOURCES"] and (value <= 0x7FF or value == c["NODE_NO_SOURCE"]):
+            p.sources[field - c["NODE_FIELD_SOURCE"]] = value
+        elif (c["NODE_FIELD_FLOOR"] <= field < c["NODE_FIELD_FLOOR"] + len(c["floors"]) and 0 < value <= c["CAR_CODE_MASK"]
+              and not c["SYSID"] <= value <= c["HEALTH"]):
+            p.floors[field - c["NODE_FIELD_FLOOR"]] = value
+        else:
+            return False
+        return True
+
+    def loop(self, now_ms):
+        """CANModule::loop() - the NODE_QUERY answer once its slot has come."""
+        if self.query_due is not None and now_ms >= self.query_due:
+            self.query_due = None
+            return [(now_ms, self.record.tx_id, self.answer(self.cfg["NODE_QUERY"]))]
+        return []
+
+    def answer(self, code):
+        return bytes([code]) + struct.pack("<I", self.record.uid) + bytes([self.record.first_car])
+
+
+class Bus:
+    """Frames from the supervisory controller to every node that accepts them, answers collected in arbitration order."""
+
+    def __init__(self, nodes):
+        self.nodes = nodes
+        self.now = 0
+        self.log = []
+
+    def send(self, data, can_id=MASTER_ID, wait_ms=1):
+        answers = []
+        for node in self.nodes:
+            if node.accepts(can_id):
+                answers += node.receive(self.now, list(data))
+        for _ in range(wait_ms):
+            self.now += 1
+            for node in self.nodes:
+                answers += node.loop(self.now)
+        answers.sort(key=lambda a: (a[0], a[1]))            # Lowest ID wins a frame started in the same ms
+        self.log.append((can_id, bytes(data), answers))
+        return answers
+
+
+def set_frame(cfg, field, value):
+    return bytes([cfg["NODE_SET"], field, value & 0xFF, value >> 8])
+
+
+def assign(bus, cfg, cars, base, stride, sources=(MASTER_ID,), floors=None):
+    """Supervisory controller's assignment: query the UIDs, then give each board its ID, first car, sources and floor codes."""
+    answers = bus.send([cfg["NODE_QUERY"]], wait_ms=256)
+    uids = sorted({struct.unpack("<I", data[1:5])[0] for _, _, data in answers})
+    plan = {}
+    for board, uid in enumerate(uids):
+        tx_id, first_car = base + board * stride, board * cars
+        bus.send(bytes([cfg["NODE_SELECT"]]) + struct.pack("<I", uid))
+        bus.send(set_frame(cfg, cfg["NODE_FIELD_TXID"], tx_id))
+        bus.send(set_frame(cfg, cfg["NODE_FIELD_FIRST_CAR"], first_car))
+        for i in range(cfg["NODE_SOURCES"]):
+            bus.send(set_frame(cfg, cfg["NODE_FIELD_SOURCE"] + i, sources[i] if i < len(sources) else cfg["NODE_NO_SOURCE"]))
+        for i, code in enumerate(floors or cfg["floors"]):
+            bus.send(set_frame(cfg, cfg["NODE_FIELD_FLOOR"] + i, code))
+        stored = bus.send([cfg["NODE_STORE"]])
+        plan[uid] = (tx_id, first_car, [a[1] for a in stored])
+    return uids, plan
+
+
+def bank(boards, cars, base=0x101, stride=0x10, seed=1, cfg=None):
+    """Blank boards brought up on one bus and assigned - returns the nodes in bank order (first car ascending) and the bus."""
+    cfg = cfg or read_node_config()
+    rng = random.Random(seed)
+    nodes = [Node(cfg, cars=cars, rng=rng) for _ in range(boards)]
+    bus = Bus(nodes)
+    assign(bus, cfg, cars, base, stride)
+    return sorted(nodes, key=lambda n: n.record.first_car), bus
+
+
+def check(cfg):
+    failures = []
+    rng = random.Random(3)
+
+    node = Node(cfg, rng=rng)
+    r = node.record
+    if r.tx_id != cfg["TxID"] or r.first_car != 0 or not node.accepts(MASTER_ID) or node.accepts(0x200) or node.floor(cfg["FLOOR2"]) != 1:
+        failures.append("blank board does not come up with the defaults")
+    if NodeRecord.unpack(cfg, node.eeprom) is None or Node(cfg, node.eeprom, rng=rng).record.uid != r.uid:
+        failures.append("blank board's record (and UID) not written back")
+    corrupt = bytearray(node.eeprom)
+    corrupt[5] ^= 1
+    if NodeRecord.unpack(cfg, corrupt) is not None:
+        failures.append("corrupt record accepted")
+
+    for boards, cars in ((1, 1), (4, 2), (6, 2), (13, 1)):
+        nodes, bus = bank(boards, cars, seed=boards, cfg=cfg)
+        ids = [n.car_id(i) for n in nodes for i in range(cars)]
+        if len(set(ids)) != len(ids) or len(set(n.record.uid for n in nodes)) != boards:
+            failures.append("%d boards x %d cars: car IDs or UIDs not unique" % (boards, cars))
+        for k, n in enumerate(nodes):
+            if n.record.first_car != k * cars or NodeRecord.unpack(cfg, n.eeprom) is None:
+                failures.append("%d boards x %d cars: board %d not stored" % (boards, cars, k))
+        for car in range(boards * cars):
+            for floor, code in enumerate(cfg["floors"]):
+                frame = code | (car << cfg["CAR_SHIFT"])
+                hits = [(k, n.car(frame), n.floor(code)) for k, n in enumerate(nodes) if n.car(frame) is not None]
+                if hits != [(car // cars, car % cars, floor)]:
+                    failures.append("%d boards x %d cars: code 0x%02X routed to %s" % (boards, cars, frame, hits))
+        for code in (cfg["NODE_QUERY"], 0xE0, 0xF0):
+            if any(n.car(code) is not None for n in nodes):
+                failures.append("reserved code 0x%02X routed to a car" % code)
+
+    # Only the selected node takes changes, a store without a source or with a duplicate floor code is refused, and the floor codes remap
+    nodes = [Node(cfg, rng=rng) for _ in range(2)]
+    bus = Bus(nodes)
+    a, b = nodes
+    bus.send(bytes([cfg["NODE_SELECT"]]) + struct.pack("<I", a.record.uid))
+    bus.send(set_frame(cfg, cfg["NODE_FIELD_SOURCE"], cfg["NODE_NO_SOURCE"]))
+    if bus.send([cfg["NODE_STORE"]]) or not a.accepts(MASTER_ID):
+        failures.append("store without a source accepted")
+    bus.send(bytes([cfg["NODE_SELECT"]]) + struct.pack("<I", a.record.uid))
+    bus.send(set_frame(cfg, cfg["NODE_FIELD_FLOOR"] + 0, 0x09))
+    bus.send(set_frame(cfg, cfg["NODE_FIELD_TXID"], 0x180))
+    if a.record.tx_id != cfg["TxID"]:
+        failures.append("NODE_SET applied before NODE_STORE")
+    stored = bus.send([cfg["NODE_STORE"]])
+    if [s[1] for s in stored] != [0x180] or a.floor(0x09) != 0 or a.floor(cfg["FLOOR1"]) is not None:
+        failures.append("store did not apply the new ID and floor code")
+    if b.record.tx_id != cfg["TxID"] or b.floor(cfg["FLOOR1"]) != 0:
+        failures.append("deselected node changed")
+    bus.send(bytes([cfg["NODE_SELECT"]]) + struct.pack("<I", a.record.uid))
+    for value in (0, cfg["SYSID"], cfg["HEALTH"], 0x10):     # Not a floor code, a car command's code, a code with a car in it
+        nack = bus.send(set_frame(cfg, cfg["NODE_FIELD_FLOOR"] + 1, value))
+        if [(s[1], s[2]) for s in nack] != [(0x180, bytes([cfg["NODE_NACK"]]) + set_frame(cfg, cfg["NODE_FIELD_FLOOR"] + 1, value)[1:])]:
+            failures.append("floor code 0x%02X not refused with a NODE_NACK" % value)
+    bus.send([cfg["NODE_STORE"]])
+    if a.floor(cfg["FLOOR2"]) != 1:
+        failures.append("refused floor code stored")
+    bus.send(set_frame(cfg, cfg["NODE_FIELD_TXID"], 0x190))
+    if bus.send([cfg["NODE_STORE"]]):
+        failures.append("NODE_SET / NODE_STORE taken without a NODE_SELECT")
+    bus.send(bytes([cfg["NODE_SELECT"]]) + struct.pack("<I", a.record.uid))
+    bus.send(set_frame(cfg, cfg["NODE_FIELD_FLOOR"] + 1, 0x09))     # Floor 1's code
+    if bus.send([cfg["NODE_STORE"]]) or a.floor(cfg["FLOOR2"]) != 1 or a.floor(0x09) != 0:
+        failures.append("store with a floor code given to two floors accepted")
+
+    for f in failures:
+        print("FAIL " + f)
+    print("ok" if not failures else "%d failures" % len(failures))
+    return not failures
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--boards", type=int, default=4)
+    ap.add_argument("--cars", type=int, default=1, help="cars per board (CAR_COUNT)")
+    ap.add_argument("--base", type=lambda v: int(v, 0), default=0x101, help="ID of the first board's first car")
+    ap.add_argument("--stride", type=lambda v: int(v, 0), default=0x10, help="ID step between boards")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--check", action="store_true", help="verify the port, exit 1 on a failure")
+    args = ap.parse_args()
+    cfg = read_node_config()
+    if args.check:
+        sys.exit(0 if check(cfg) else 1)
+    if args.boards * args.cars > cfg["NODE_CARS"]:
+        sys.exit("a bank has %d cars at most" % cfg["NODE_CARS"])
+
+    nodes, bus = bank(args.boards, args.cars, args.base, args.stride, args.seed, cfg)
+    query = bus.log[0][2]
+    print("NODE_QUERY: %d answers from ID 0x%X in %d ms" % (len(query), cfg["TxID"], max(t for t, _, _ in query) if query else 0))
+    print("%d frames to assign %d boards" % (len(bus.log), args.boards))
+    for k, n in enumerate(nodes):
+        print("  board %d  uid 0x%08X  cars %s  IDs %s" % (k, n.record.uid, ",".join(str(n.record.first_car + i) for i in range(args.cars)),
+                                                        ",".join("0x%X" % n.car_id(i) for i in range(args.cars))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,142 @@
+"""
+@file plant.py
+@brief Host-side plant model of the elevator car, motor drive and distance sensor
+
+The car is modelled as a first order velocity response to the DAC command:
+
+    v_target = -K * sign(u) * max(|u| - friction, 0)
+    dv/dt    = (v_target - v) / tau
+
+A positive DAC code drives the car down (distance to the floor sensor shrinks),
+matching Car::Move(). The sensor reports the position as it was
+'delay' seconds ago, rounded to 1 mm like DFRobotVL53L0X::getDistance().
+
+Sensor models the rangefinders selectable with RANGEFINDER in DistanceSensor.h:
+a measurement triggered at t is ready one timing budget later and reports the
+car position averaged over that window, plus Gaussian noise.
+
+Energy is integrated from the DAC command and direction: the motor sees
+V = V_FULL * |u| / DAC_MAX and draws I_LIFT * load amps while driving the car
+up (u < 0) and I_LOWER amps while driving it down, where gravity does most of
+the work. Plant.energy is in joules of the lab rig; ENERGY_SCALE turns it into a
+kWh-equivalent for a full size car.
+
+Default parameters are rough estimates for the lab shaft; run sysid_fit.py on a
+logged identification run and pass the resulting JSON with --model to use
+fitted values instead.
+"""
+
+import json
+import math
+import random
+
+# Mirrors of the firmware constants (CANModule.h)
+MINHEIGHT = 100
+MAXHEIGHT = 1500
+FLOOR_SP = [300, 635, 1220]
+SETPOINT_TOLERANCE = 50
+DAC_MAX = 1023
+
+DEFAULT_PARAMS = {
+    "K": 0.30,          # mm/s per DAC code above the friction band
+    "tau": 0.15,        # s, motor/car velocity time constant
+    "friction": 60.0,   # DAC codes needed to break static friction
+    "delay": 0.03,      # s, sensor measurement delay
+}
+
+
+# Rangefinder models (DistanceSensor.h). budget in s, noise is 1-sigma in mm (rough datasheet figures for a white target indoors).
+SENSORS = {
+    "vl53l0x": {"budget": 0.033, "noise": 3.0},    # SENSOR_PROFILE ProfileDefault
+    "vl53l1x": {"budget": 0.020, "noise": 2.0},    # VL53L1X_DISTANCE_MODE DistanceShort, VL53L1X_TIMING_BUDGET 20
+}
+
+
+# Motor energy model (rough figures for the lab drive). ENERGY_SCALE maps lab joules to kWh of a full size car
+# (about 1000x the moving mass and 20x the travel, 3.6e6 J per kWh).
+ENERGY = {
+    "V_FULL": 12.0,     # V at DAC_MAX
+    "I_LIFT": 1.5,      # A driving up at load 1.0
+    "I_LOWER": 0.4,     # A driving down
+}
+ENERGY_SCALE = 1000 * 20 / 3.6e6
+
+
+def load_params(path=None):
+    """Return plant parameters, overriding the defaults from a fitted JSON model."""
+    params = dict(DEFAULT_PARAMS)
+    if path:
+        with open(path) as f:
+            params.update({k: float(v) for k, v in json.load(f).items() if k in DEFAULT_PARAMS})
+    return params
+
+
+class Plant:
+    """Continuous plant integrated with a fixed substep."""
+
+    SUBSTEP = 0.001     # s
+
+    def __init__(self, params=None, position=FLOOR_SP[0], load=1.0):
+        self.p = dict(params or DEFAULT_PARAMS)
+        self.load = load                    # >1.0 is a heavier car (slower response)
+        self.t = 0.0
+        self.x = float(position)            # mm from sensor
+        self.v = 0.0                        # mm/s, positive is moving up
+        self.u = 0                          # DAC code currently applied
+        self.energy = 0.0                   # J drawn by the motor
+        self.history = [(0.0, self.x)]      # (t, x) for the sensor delay line
+
+    def target_velocity(self, u):
+        mag = max(abs(u) - self.p["friction"], 0.0)
+        return -math.copysign(self.p["K"] * mag / self.load, u) if u else 0.0
+
+    def apply(self, u):
+        """Latch a new DAC code (clamped to the 10-bit field like the hardware)."""
+        self.u = max(-DAC_MAX, min(DAC_MAX, int(u)))
+
+    def advance(self, dt):
+        steps = max(1, int(round(dt / self.SUBSTEP)))
+        h = dt / steps
+        tau = self.p["tau"] * self.load
+        self.energy += self.power() * dt
+        for _ in range(steps):
+            self.v += (self.target_velocity(self.u) - self.v) * h / tau
+            self.x += self.v * h
+            self.t += h
+            self.history.append((self.t, self.x))
+        # keep only what the delay line needs
+        horizon = self.t - self.p["delay"] - 0.1
+        while len(self.history) > 2 and self.history[1][0] < horizon:
+            self.history.pop(0)
+
+    def power(self):
+        """Electrical power in W for the latched DAC code."""
+        volts = ENERGY["V_FULL"] * abs(self.u) / DAC_MAX
+        amps = ENERGY["I_LIFT"] * self.load if self.u < 0 else ENERGY["I_LOWER"]
+        return volts * amps if self.u else 0.0
+
+    def measure(self):
+        """Sensor reading in mm (integer), delayed by the sensor latency."""
+        t = self.t - self.p["delay"]
+        x = self.history[0][1]
+        for (ts, xs) in self.history:
+            if ts > t:
+                break
+            x = xs
+        return int(round(x))
+
+
+class Sensor:
+    """Triggered rangefinder: sample() advances the plant by one timing budget and returns the reading."""
+
+    def __init__(self, name, seed=1):
+        self.name = name
+        self.budget = SENSORS[name]["budget"]
+        self.noise = SENSORS[name]["noise"]
+        self.rng = random.Random(seed)
+
+    def sample(self, plant):
+        plant.advance(self.budget / 2)
+        mid = plant.measure()
+        plant.advance(self.budget / 2)
+        return int(round(mid + self.rng.gauss(0.0, self.noise)))
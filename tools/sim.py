@@ -0,0 +1,179 @@
+"""
+@file sim.py
+@brief Closed-loop trip simulator for comparing control laws on the plant model
+
+Runs every floor-to-floor trip with each selected law and reports trip time
+(last time the car was outside SETPOINT_TOLERANCE), overshoot past the
+setpoint, final leveling error, peak DAC step, peak jerk, the number of law
+commands the output stage had to saturate and the number of codes sent outside
+the 10-bit DAC field (always 0 unless the output stage is broken).
+
+    python3 tools/sim.py                       # all laws, default plant
+    python3 tools/sim.py --law mpc --model fitted.json --load 1.3
+    python3 tools/sim.py --sensor vl53l0x --sensor vl53l1x   # same trips with each rangefinder model
+    python3 tools/sim.py --slew --gain 4       # DAC_SLEW_LIMIT output stage against an over-tuned law
+    python3 tools/sim.py --gain 6 --detect --duration 60     # OSC_DETECT gain backoff on a car that hunts
+    python3 tools/sim.py --law cascaded --no-profile         # cascaded law without MOTION_PROFILE
+    python3 tools/sim.py --floors --sensor vl53l0x           # per destination floor, FLOOR_TABLE against --uniform-floors
+
+Hunting counts the times the car swings from one side of the setpoint to the
+other by more than OSC_HYSTERESIS (an overshoot is one); settled is how long
+the car stays inside SETPOINT_TOLERANCE at the end of the run.
+
+Without --sensor the reading is the ideal (delayed, noiseless) plant position.
+"""
+
+import argparse
+import math
+
+from plant import Plant, Sensor, SENSORS, load_params, FLOOR_SP, SETPOINT_TOLERANCE, MINHEIGHT, MAXHEIGHT, DAC_MAX
+from laws import LAWS, CONTROL_PERIOD, Truncate, Dither, Slew, OscillationDetector
+
+APPROACH = 100      # mm - final approach window for the smoothness metric
+
+
+def run_trip(controller, params, origin, dest, load=1.0, duration=20.0, period=CONTROL_PERIOD, output=None, sensor=None, gain=1.0, detector=None):
+    plant = Plant(params, position=origin, load=load)
+    output = output or Truncate()
+    accel = []
+    direction = 1 if dest > origin else -1
+    tolerance = controller.floor(dest)[0]
+    last_outside = 0.0
+    overshoot = 0.0
+    peak_step = 0
+    peak_speed = 0.0
+    approach_speed = 0.0
+    prev_u = 0
+    prev_accel = 0.0
+    peak_jerk = 0.0
+    saturated = 0
+    out_of_range = 0
+    side = 0
+    hunting = 0
+    codes = []
+    while plant.t < duration:
+        start = plant.t
+        dist = sensor.sample(plant) if sensor else plant.measure()
+        if MINHEIGHT < dist < MAXHEIGHT:
+            command = gain * controller.step(dist, dest, period)
+            if detector:
+                command *= detector(dist - dest, plant.t)
+            saturated += abs(command) > DAC_MAX
+            u = output(command)
+        else:
+            u = output(0)
+        out_of_range += abs(u) > DAC_MAX
+        plant.apply(u)
+        codes.append(plant.u)
+        peak_step = max(peak_step, abs(plant.u - prev_u))
+        prev_u = plant.u
+        v_before = plant.v
+        plant.advance(period - (plant.t - start))
+        peak_speed = max(peak_speed, abs(plant.v))
+        a = (plant.v - v_before) / period
+        peak_jerk = max(peak_jerk, abs(a - prev_accel) / period)
+        prev_accel = a
+        if abs(plant.x - dest) < APPROACH:
+            accel.append(a)
+            approach_speed = max(approach_speed, abs(plant.v))
+        if abs(plant.x - dest) > tolerance:
+            last_outside = plant.t
+        overshoot = max(overshoot, (plant.x - dest) * direction)
+        s = 1 if plant.x - dest > OscillationDetector.HYSTERESIS else -1 if plant.x - dest < -OscillationDetector.HYSTERESIS else 0
+        if s and s != side:
+            hunting += side != 0
+            side = s
+    return {
+        "trip_time": last_outside,
+        "overshoot": overshoot,
+        "level_error": abs(plant.x - dest),
+        "peak_step": peak_step,
+        "peak_speed": peak_speed,
+        "energy": plant.energy,
+        "approach_speed": approach_speed,
+        "approach_accel": math.sqrt(sum(a * a for a in accel) / len(accel)) if accel else 0.0,
+        "peak_jerk": peak_jerk,
+        "saturated": saturated,
+        "out_of_range": out_of_range,
+        "hunting": hunting,
+        "settled": duration - last_outside,
+        "backoffs": len(detector.backoffs) if detector else 0,
+        "gain": detector.scale if detector else 1.0,
+        "codes": codes,
+    }
+
+
+def make_law(name, args):
+    law = LAWS[name](profile=False) if args.no_profile and name == "cascaded" else LAWS[name]()
+    if args.uniform_floors:
+        law.floors = {}
+    return law
+
+
+def trips():
+    for a in FLOOR_SP:
+        for b in FLOOR_SP:
+            if a != b:
+                yield a, b
+
+
+def summarize(name, results):
+    n = len(results)
+    print("%-12s trip %.2f s (max %.2f)  overshoot %.1f mm (max %.1f)  level err %.1f mm (max %.1f)  peak dU %d  peak v %.0f mm/s  approach accel rms %.1f mm/s2  peak jerk %.0f mm/s3  energy %.1f J  saturated %d  out of range %d" % (
+        name,
+        sum(r["trip_time"] for r in results) / n, max(r["trip_time"] for r in results),
+        sum(r["overshoot"] for r in results) / n, max(r["overshoot"] for r in results),
+        sum(r["level_error"] for r in results) / n, max(r["level_error"] for r in results),
+        max(r["peak_step"] for r in results), max(r["peak_speed"] for r in results),
+        sum(r["approach_accel"] for r in results) / n,
+        max(r["peak_jerk"] for r in results),
+        sum(r["energy"] for r in results) / n,
+        sum(r["saturated"] for r in results), sum(r["out_of_range"] for r in results)))
+    print("%-12s hunting %.1f crossings/trip (max %d)  settled %.1f s/trip  backoffs %d  final gain %.2f-%.2f" % (
+        "", sum(r["hunting"] for r in results) / n, max(r["hunting"] for r in results),
+        sum(r["settled"] for r in results) / n, sum(r["backoffs"] for r in results),
+        min(r["gain"] for r in results), max(r["gain"] for r in results)))
+
+
+def summarize_floors(name, results):
+    """Per destination floor: the effect of its FLOOR_TABLE entry."""
+    for dest in FLOOR_SP:
+        rs = [r for (a, b), r in results if b == dest]
+        print("%-12s to %4d mm  trip %.2f s (max %.2f)  approach speed max %.0f mm/s  overshoot max %.1f mm  level err max %.1f mm  peak jerk %.0f mm/s3" % (
+            name, dest, sum(r["trip_time"] for r in rs) / len(rs), max(r["trip_time"] for r in rs), max(r["approach_speed"] for r in rs),
+            max(r["overshoot"] for r in rs), max(r["level_error"] for r in rs), max(r["peak_jerk"] for r in rs)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--law", action="append", choices=sorted(LAWS), help="law(s) to run (default: all)")
+    ap.add_argument("--model", help="fitted plant model JSON from sysid_fit.py")
+    ap.add_argument("--load", type=float, action="append", help="car load factor(s), 1.0 is nominal")
+    ap.add_argument("--dither", action="store_true", help="sigma-delta DAC output stage (DAC_DITHER) instead of truncation")
+    ap.add_argument("--sensor", action="append", choices=sorted(SENSORS), help="rangefinder model(s) (default: ideal reading)")
+    ap.add_argument("--slew", action="store_true", help="DAC_SLEW_LIMIT output stage (DAC::limit()) ahead of the DAC transfer")
+    ap.add_argument("--gain", type=float, default=1.0, help="scale the law output (a mis-tuned law for exercising saturation and hunting)")
+    ap.add_argument("--detect", action="store_true", help="OSC_DETECT oscillation detector and gain backoff")
+    ap.add_argument("--duration", type=float, default=20.0, help="seconds per trip")
+    ap.add_argument("--no-profile", action="store_true", help="cascaded law on the floor error alone (MOTION_PROFILE off)")
+    ap.add_argument("--uniform-floors", action="store_true", help="SETPOINT_TOLERANCE, no speed cap and full gain at every floor instead of FLOOR_TABLE")
+    ap.add_argument("--floors", action="store_true", help="break the results down by destination floor")
+    args = ap.parse_args()
+    stage = Dither if args.dither else Truncate
+    output = (lambda: Slew(stage())) if args.slew else stage
+
+    params = load_params(args.model)
+    for sensor in args.sensor or [None]:
+        for load in args.load or [1.0]:
+            print("load %.2f%s" % (load, "  sensor " + sensor if sensor else ""))
+            for name in args.law or sorted(LAWS):
+                results = [run_trip(make_law(name, args), params, a, b, load, output=output(), sensor=Sensor(sensor) if sensor else None, gain=args.gain,
+                                    duration=args.duration, detector=OscillationDetector() if args.detect else None)
+                           for a, b in trips()]
+                summarize(name, results)
+                if args.floors:
+                    summarize_floors(name, list(zip(trips(), results)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,183 @@
+"""
+@file sysid_fit.py
+@brief Fit the plant model parameters to a system identification log
+
+Send the SYSID command (0x0A, 0x1A for the second car on the board) to the
+controller with the car parked at the middle floor and capture the Serial
+monitor output. The controller plays the SYSID_SCRIPT in Car.cpp and prints
+"[SYSID] t_ms,dac,dist_mm" for every sensor sample. This tool fits the plant.py model (motor gain K, time
+constant tau, friction band and sensor delay) to that log by least squares on
+the measured position and writes a JSON model that sim.py and mpc_table.py
+accept with --model.
+
+    python3 tools/sysid_fit.py capture.log -o fitted.json
+    python3 tools/sysid_fit.py --simulate synthetic.log     # make a log from plant.py to check the fit
+"""
+
+import argparse
+import json
+import math
+import os
+import random
+import re
+
+from plant import Plant, load_params, FLOOR_SP
+
+TAU_RANGE = (0.02, 1.0)
+FRICTION_RANGE = (0.0, 250.0)
+DELAY_RANGE = (0.0, 0.25)
+
+
+def parse_log(path):
+    """Return [(t_s, code, dist_mm)] from the [SYSID] lines of a capture."""
+    samples = []
+    with open(path) as f:
+        for line in f:
+            m = re.search(r"\[SYSID\]\s+(\d+),(-?\d+),(\d+)", line)
+            if m:
+                samples.append((int(m.group(1)) / 1000.0, int(m.group(2)), int(m.group(3))))
+    return samples
+
+
+def response(samples, tau, friction, delay):
+    """Unit-gain position response g(t_i - delay) to the logged DAC codes.
+
+    The code logged with each sample is held until the next sample. The model
+    is integrated exactly over each constant-code interval."""
+    queries = [t - delay for (t, _, _) in samples]
+    changes = [(t, code) for (t, code, _) in samples]
+    out = []
+    x = v = 0.0
+    now = changes[0][0]
+    u = 0
+    k = 0
+    for q in queries:
+        while True:
+            nxt = changes[k][0] if k < len(changes) else float("inf")
+            end = min(nxt, q)
+            h = end - now
+            if h > 0:
+                mag = max(abs(u) - friction, 0.0)
+                vt = -math.copysign(mag, u) if u else 0.0
+                decay = math.exp(-h / tau)
+                x += vt * h + (v - vt) * tau * (1.0 - decay)
+                v = vt + (v - vt) * decay
+                now = end
+            if nxt <= q:
+                u = changes[k][1]
+                k += 1
+            else:
+                break
+        out.append(x)
+    return out
+
+
+def fit_linear(g, y):
+    """Least squares y ~ x0 + K * g; returns (K, x0, sse)."""
+    n = float(len(g))
+    sg, sy = sum(g), sum(y)
+    sgg = sum(a * a for a in g)
+    sgy = sum(a * b for a, b in zip(g, y))
+    den = n * sgg - sg * sg
+    if den == 0:
+        return 0.0, sy / n, float("inf")
+    k = (n * sgy - sg * sy) / den
+    x0 = (sy - k * sg) / n
+    sse = sum((x0 + k * a - b) ** 2 for a, b in zip(g, y))
+    return k, x0, sse
+
+
+def linspace(lo, hi, n):
+    return [lo + (hi - lo) * i / (n - 1) for i in range(n)]
+
+
+def fit(samples, rounds=3, points=8):
+    """Grid search over (tau, friction, delay), shrinking around the best point each round."""
+    y = [d for (_, _, d) in samples]
+    ranges = [TAU_RANGE, FRICTION_RANGE, DELAY_RANGE]
+    best = None
+    for _ in range(rounds):
+        for tau in linspace(*ranges[0], points):
+            for fric in linspace(*ranges[1], points):
+                for delay in linspace(*ranges[2], points):
+                    k, x0, sse = fit_linear(response(samples, tau, fric, delay), y)
+                    if best is None or sse < best[0]:
+                        best = (sse, k, tau, fric, delay)
+        _, _, tau, fric, delay = best
+        ranges = [
+            (max(TAU_RANGE[0], tau - (ranges[0][1] - ranges[0][0]) / points), tau + (ranges[0][1] - ranges[0][0]) / points),
+            (max(0.0, fric - (ranges[1][1] - ranges[1][0]) / points), fric + (ranges[1][1] - ranges[1][0]) / points),
+            (max(0.0, delay - (ranges[2][1] - ranges[2][0]) / points), delay + (ranges[2][1] - ranges[2][0]) / points),
+        ]
+    sse, k, tau, fric, delay = best
+    return {"K": k, "tau": tau, "friction": fric, "delay": delay, "rmse": math.sqrt(sse / len(samples))}
+
+
+def load_script(path=None):
+    """Read SYSID_SCRIPT and the chirp band from Car.cpp and ElevatorController.h so the simulation matches the firmware."""
+    base = os.path.join(os.path.dirname(__file__), "..")
+    with open(path or os.path.join(base, "Car.cpp")) as f:
+        body = re.search(r"SYSID_SCRIPT\[\]\s*PROGMEM\s*=\s*\{(.*?)\};", f.read(), re.S).group(1)
+    with open(os.path.join(base, "ElevatorController.h")) as f:
+        header = f.read()
+    f0 = float(re.search(r"#define SYSID_CHIRP_F0\s+([\d.]+)", header).group(1))
+    f1 = float(re.search(r"#define SYSID_CHIRP_F1\s+([\d.]+)", header).group(1))
+    script = [(kind, int(amp), int(ms)) for kind, amp, ms in
+              re.findall(r"\{\s*SYSID_(STEP|CHIRP),\s*(-?\d+),\s*(\d+)\s*\}", body)]
+    return script, f0, f1
+
+
+def simulate(path, params, rate=33.0, noise=2.0, seed=1):
+    """Write a synthetic capture by playing the firmware script on the plant model."""
+    script, f0, f1 = load_script()
+    rng = random.Random(seed)
+    plant = Plant(params, position=FLOOR_SP[1])
+    period = 1.0 / rate
+    lines = ["[SYSID] start car 1"]
+    start = 0.0
+    for kind, amp, ms in script:
+        dur = ms / 1000.0
+        seg_start = plant.t
+        while plant.t - seg_start < dur:
+            t = plant.t - seg_start
+            if kind == "CHIRP":
+                code = int(amp * math.sin(2 * math.pi * (f0 * t + (f1 - f0) * t * t / (2 * dur))))
+            else:
+                code = amp
+            plant.apply(code)
+            dist = int(round(plant.measure() + rng.gauss(0.0, noise)))
+            lines.append("[SYSID] %d,%d,%d" % (int((plant.t - start) * 1000), code, dist))
+            plant.advance(period)
+    lines.append("[SYSID] done")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("log", nargs="?", help="Serial capture containing [SYSID] lines")
+    ap.add_argument("-o", "--output", help="write the fitted model JSON here")
+    ap.add_argument("--simulate", metavar="LOG", help="write a synthetic capture from the plant model instead of fitting")
+    ap.add_argument("--model", help="plant parameters for --simulate (default: plant.py defaults)")
+    args = ap.parse_args()
+
+    if args.simulate:
+        simulate(args.simulate, load_params(args.model))
+        return
+    if not args.log:
+        ap.error("a capture log is required")
+
+    samples = parse_log(args.log)
+    if len(samples) < 20:
+        ap.error("only %d [SYSID] samples in %s" % (len(samples), args.log))
+    model = fit(samples)
+    print("K %.4f mm/s/code  tau %.3f s  friction %.1f codes  delay %.3f s  (rmse %.2f mm over %d samples)" % (
+        model["K"], model["tau"], model["friction"], model["delay"], model["rmse"], len(samples)))
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(model, f, indent=2)
+            f.write("\n")
+
+
+if __name__ == "__main__":
+    main()
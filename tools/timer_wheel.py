@@ -0,0 +1,186 @@
+"""
+@file timer_wheel.py
+@brief Tick cost of the TimerWheel against a scan of every timer
+
+Ports TimerWheel (TimerWheel.h - levels, slots and the cascade read from
+the header) and runs it with dozens of periodic and one-shot timers,
+restarted and cancelled at random as the firmware's jobs would. Every
+expiry is checked against the tick it was due at. The cost of a tick is
+counted in timer visits, each a handful of byte loads and stores on the
+AVR:
+
+  wheel   the timers of this tick's slot, plus the timers cascaded down
+          when a level wraps
+  scan    every running timer, compared against the tick (one timer array
+          polled from the interrupt - what a flag per job grows into)
+
+The average is what the interrupt adds to the loop, and the worst is the
+longest the tick interrupt holds off the CAN interrupt's timestamp. On the
+board, TIMER_BENCHMARK in TimerWheel.h prints the measured tick time.
+
+    python3 tools/timer_wheel.py                    # 8 .. 64 timers
+    python3 tools/timer_wheel.py --timers 48 --ticks 200000
+    python3 tools/timer_wheel.py --check            # every expiry on its tick
+"""
+
+import argparse
+import os
+import random
+import re
+import sys
+
+VISIT_US = 1.5              # rough AVR time per timer visited (unlink or flag, relink: ~24 cycles at 16 MHz)
+TICK_US = 6                 # interrupt entry, register save/restore and the slot index
+
+
+def read_config(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "TimerWheel.h")
+    with open(path) as f:
+        text = f.read()
+    get = lambda name: int(re.search(r"#define %s\s+(\d+)" % name, text).group(1))
+    return {"bits": get("TIMER_SLOT_BITS"), "levels": get("TIMER_LEVELS"), "tick_ms": get("TIMER_TICK_MS")}
+
+
+class Wheel:
+    """TimerWheel with the slot lists as Python lists (order does not matter) and a visit counter."""
+
+    def __init__(self, cfg, count):
+        self.bits = cfg["bits"]
+        self.slots_per = 1 << self.bits
+        self.levels = cfg["levels"]
+        self.span = 1 << (self.bits * self.levels)
+        self.slots = [[] for _ in range(self.levels * self.slots_per)]
+        self.expires = [0] * count
+        self.period = [0] * count
+        self.slot = [None] * count
+        self.expired = set()
+        self.now = 0
+        self.visits = 0
+
+    def insert(self, i):
+        expires = self.expires[i]
+        delta = expires - self.now
+        if delta >= self.span:
+            expires = self.now + self.span - 1
+            delta = self.span - 1
+        level = 0
+        while delta >= 1 << (self.bits * (level + 1)):
+            level += 1
+        slot = level * self.slots_per + ((expires >> (self.bits * level)) & (self.slots_per - 1))
+        self.slots[slot].append(i)
+        self.slot[i] = slot
+
+    def start(self, i, ticks, period=0):
+        self.cancel(i)
+        self.expires[i] = self.now + max(ticks, 1) - 1
+        self.period[i] = period
+        self.insert(i)
+
+    def cancel(self, i):
+        if self.slot[i] is not None:
+            self.slots[self.slot[i]].remove(i)
+            self.slot[i] = None
+        self.expired.discard(i)
+
+    def cascade(self, slot):
+        timers, self.slots[slot] = self.slots[slot], []
+        for i in timers:
+            self.visits += 1
+            self.insert(i)
+
+    def tick(self):
+        index = self.now & (self.slots_per - 1)
+        if index == 0:
+            for level in range(1, self.levels):
+                slot = (self.now >> (self.bits * level)) & (self.slots_per - 1)
+                self.cascade(level * self.slots_per + slot)
+                if slot:
+                    break
+        due, self.slots[index] = self.slots[index], []
+        for i in due:
+            self.visits += 1
+            self.expired.add(i)
+            if self.period[i]:
+                self.expires[i] += self.period[i]
+                self.insert(i)
+            else:
+                self.slot[i] = None
+        self.now += 1
+        return due
+
+
+def run(cfg, count, ticks, seed=1):
+    """(wheel visits per tick avg, max; scan visits avg, max; errors) for count timers."""
+    rng = random.Random(seed)
+    wheel = Wheel(cfg, count)
+    due = [None] * count            # Reference: the tick each timer is due at
+    period = [0] * count
+    tick_ms = cfg["tick_ms"]
+
+    def restart(i):
+        if rng.random() < 0.7:      # Periodic job: report, heartbeat, statistics, watchdog (10 ms .. 60 s)
+            p = max(1, int(rng.choice((10, 100, 250, 1000, 5000, 60000)) * rng.uniform(0.8, 1.2) / tick_ms))
+            first = rng.randint(1, p)
+        else:                       # One-shot: a door, re-leveling or answer timeout (20 ms .. 10 min)
+            p = 0
+            first = max(1, int(rng.choice((20, 200, 2000, 30000, 600000)) / tick_ms))
+        first = min(first, 0xFFFF)
+        wheel.start(i, first, p)
+        due[i] = wheel.now + first - 1
+        period[i] = p
+
+    for i in range(count):
+        restart(i)
+    errors = 0
+    wheel_sum = wheel_max = scan_sum = scan_max = 0
+    for t in range(ticks):
+        if rng.random() < 0.01:     # Jobs restart or cancel their timers now and then
+            i = rng.randrange(count)
+            if rng.random() < 0.2:
+                wheel.cancel(i)
+                due[i] = None
+            else:
+                restart(i)
+        scan = sum(1 for d in due if d is not None)
+        wheel.visits = 0
+        fired = set(wheel.tick())
+        want = {i for i in range(count) if due[i] == t}
+        errors += len(fired ^ want)
+        for i in want:
+            due[i] = due[i] + period[i] if period[i] else None
+            if due[i] is None and rng.random() < 0.5:
+                restart(i)          # The job takes its one-shot timer again
+        wheel.expired.clear()
+        wheel_sum += wheel.visits
+        wheel_max = max(wheel_max, wheel.visits)
+        scan_sum += scan
+        scan_max = max(scan_max, scan)
+    return wheel_sum / ticks, wheel_max, scan_sum / ticks, scan_max, errors
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--timers", type=int, action="append", help="running timers (default 8, 16, 32, 48, 64)")
+    ap.add_argument("--ticks", type=int, default=100000)
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--check", action="store_true", help="exit 1 if a timer expires off its tick")
+    args = ap.parse_args()
+    cfg = read_config()
+
+    print("%d levels of %d slots, %d ms tick, %d ticks - visits per tick and ~us on the UNO (%.1f us per visit + %d us entry)" % (
+        cfg["levels"], 1 << cfg["bits"], cfg["tick_ms"], args.ticks, VISIT_US, TICK_US))
+    print("  timers   wheel avg   max     us avg   max    scan avg   max     us avg   max   errors")
+    errors = 0
+    for count in args.timers or (8, 16, 32, 48, 64):
+        w_avg, w_max, s_avg, s_max, err = run(cfg, count, args.ticks, args.seed)
+        us = lambda visits: TICK_US + VISIT_US * visits
+        print("  %6d  %10.3f  %4d  %8.1f  %5.1f  %10.1f  %4d  %8.1f  %5.1f  %6d" % (
+            count, w_avg, w_max, us(w_avg), us(w_max), s_avg, s_max, us(s_avg), us(s_max), err))
+        errors += err
+    if args.check:
+        print("ok" if not errors else "%d timers expired off their tick" % errors)
+        sys.exit(1 if errors else 0)
+
+
+if __name__ == "__main__":
+    main()
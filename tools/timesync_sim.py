@@ -0,0 +1,264 @@
+"""
+@file timesync_sim.py
+@brief Bus model of the CAN time sync (SYNC + FOLLOW_UP) for measuring the sync error a car controller achieves
+
+The supervisory controller (master) sends SYNC every --period s and, once it
+knows when the SYNC finished on the bus, a FOLLOW_UP with that time. The
+controller stamps the SYNC in the CAN interrupt and keeps the master clock as a
+reference plus a rate correction - a port of CANModule::handleTimeSync() and
+syncMillis() that reads TSYNC_RATE_FILTER from CANModule.h.
+
+Modelled at 125 kbps:
+  master   write-to-bus latency of the host CAN driver (exponential), waits for
+           a frame already on the bus (--load) and for higher priority frames,
+           stamp jitter on the transmit-complete time that goes into FOLLOW_UP
+  bus      frame time with random bit stuffing, lost frames (--loss)
+  node     ceramic resonator rate error (--ppm) wandering with temperature,
+           interrupt latency (another ISR running), micros() 4 us resolution
+
+Methods compared:
+  sync only          SYNC carries the master's time at write (no FOLLOW_UP)
+  follow-up          FOLLOW_UP time, offset only
+  follow-up + rate   FOLLOW_UP time and rate tracking (the firmware)
+  ... loop stamp     as the firmware, but stamped when loop() reads the frame
+
+Errors are of the extrapolated master clock in us, sampled every 10 ms after
+the first 10 s; the [TLM]/[SHED]/[DIAG]/[CAN] stamps add their 1 ms truncation.
+
+Without a FOLLOW_UP for TSYNC_TIMEOUT_MS the node holds over: syncMillis()
+moves the reference up to now on the last rate, so micros() - m_refStamp
+never nears the 32 bit wrap (71.6 min). --check runs an outage past the wrap.
+
+    python3 tools/timesync_sim.py
+    python3 tools/timesync_sim.py --load 0.6 --ppm 5000 --period 2
+    python3 tools/timesync_sim.py --outage 80        # master gone past the micros() wrap
+    python3 tools/timesync_sim.py --check
+"""
+
+import argparse
+import math
+import os
+import random
+import re
+import sys
+
+BIT_US = 8.0                # 125 kbps
+SYNC_DLC = 2
+FOLLOW_UP_DLC = 8
+MICROS_RES = 4              # micros() resolution on a 16 MHz UNO
+WANDER_PPM = 300            # resonator drift with board temperature ...
+WANDER_PERIOD = 900.0       # ... over this many s
+DRIVER_US = 300.0           # mean host driver latency from write to the controller's TX buffer
+ECHO_US = (60.0, 20.0)      # master's transmit-complete stamp: mean, sd
+ISR_US = 3.0                # CAN interrupt entry to micros()
+ISR_BLOCK_US = 6.0          # longest other ISR (Timer0, Serial TX) that can delay it ...
+ISR_BLOCK_P = 0.3           # ... and the chance one is running
+LOOP_MAX_US = 3500.0        # longest loop() pass (sensor read + law + telemetry)
+OUTAGE_START_S = 60.0       # --outage: the master stops sending SYNC this far into the run
+CHECK_OUTAGE_MIN = 80       # --check: an outage past the micros() wrap (71.6 min) ...
+HOLDOVER_MS = 10            # ... the clock holds on the last rate within the resonator wander over the outage plus this, never stepping back ...
+RESYNC_MAX_US = 1000        # ... and is this close again 30 s after the master is back
+
+
+def read_filter(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "CANModule.h")
+    with open(path) as f:
+        return float(re.search(r"#define TSYNC_RATE_FILTER\s+([\d.]+)", f.read()).group(1))
+
+
+def read_timeout(path=None):
+    path = path or os.path.join(os.path.dirname(__file__), "..", "CANModule.h")
+    with open(path) as f:
+        return int(re.search(r"#define TSYNC_TIMEOUT_MS\s+(\d+)", f.read()).group(1))
+
+
+def frame_us(dlc, rng):
+    """Standard frame: 47 bits of overhead + data, plus stuff bits (one per 5 equal bits at worst)."""
+    bits = 47 + 8 * dlc
+    return (bits + rng.randint(0, (34 + 8 * dlc - 1) // 4)) * BIT_US
+
+
+class NodeClock:
+    """The controller's micros(): rate error ppm plus a slow temperature wander, from a random boot offset."""
+
+    def __init__(self, ppm, rng):
+        self.rate = rng.uniform(-ppm, ppm) * 1e-6
+        self.offset = rng.uniform(0, 2 ** 32)
+        self.phase = rng.uniform(0, 2 * math.pi)
+
+    def micros(self, t_us):
+        w = 2 * math.pi / (WANDER_PERIOD * 1e6)
+        wander = WANDER_PPM * 1e-6 / w * (math.sin(w * t_us + self.phase) - math.sin(self.phase))
+        return int((self.offset + t_us * (1 + self.rate) + wander) // MICROS_RES * MICROS_RES) % 2 ** 32
+
+
+class Sync:
+    """Port of CANModule's time sync: reference (master time, local stamp) and rate."""
+
+    def __init__(self, rate_filter, track_rate=True, timeout_ms=None):
+        self.filter = rate_filter
+        self.track_rate = track_rate
+        self.timeout_us = (timeout_ms if timeout_ms is not None else read_timeout()) * 1000
+        self.ref = None             # (master us, local us)
+        self.drift = 0.0
+        self.rate_known = False
+        self.holdover = False
+
+    def follow_up(self, master, stamp):
+        if self.ref and self.track_rate and not self.holdover:
+            m = master - self.ref[0]
+            l = (stamp - self.ref[1]) % 2 ** 32
+            if l > 0:
+                drift = (m - l) / float(l)
+                self.drift = self.drift + self.filter * (drift - self.drift) if self.rate_known else drift
+                self.rate_known = True
+        self.ref = (master, stamp)
+        self.holdover = False
+
+    def master_us(self, local):
+        elapsed = (local - self.ref[1]) % 2 ** 32       # unsigned long micros() - m_refStamp
+        master = self.ref[0] + elapsed + int(elapsed * self.drift)
+        if elapsed > self.timeout_us:                   # Holdover - the reference moves up to now
+            self.ref = (master, local)
+            self.holdover = True
+        return master
+
+
+def bus_events(args, rng):
+    """(time the SYNC finished on the bus, master time written into SYNC, master stamp for FOLLOW_UP, FOLLOW_UP arrival) per sync."""
+    out = []
+    t = 1e6
+    while t < args.duration * 1e6:
+        written = t
+        start = written + rng.expovariate(1.0 / DRIVER_US)
+        if rng.random() < args.load:                                # bus busy: wait out the frame on it ...
+            start += rng.uniform(0, frame_us(8, rng))
+            while rng.random() < args.load * args.priority:         # ... and lose arbitration to higher priority frames
+                start += frame_us(8, rng)
+        done = start + frame_us(SYNC_DLC, rng)
+        stamp = done + max(0.0, rng.gauss(*ECHO_US))
+        follow = stamp + rng.expovariate(1.0 / DRIVER_US) + frame_us(FOLLOW_UP_DLC, rng)
+        if rng.random() < args.load:
+            follow += rng.uniform(0, frame_us(8, rng))
+        if rng.random() >= args.loss and rng.random() >= args.loss:
+            out.append((done, written, stamp, follow))
+        t += args.period * 1e6
+        if args.outage and OUTAGE_START_S * 1e6 <= t < (OUTAGE_START_S + args.outage * 60) * 1e6:
+            t = (OUTAGE_START_S + args.outage * 60) * 1e6     # The master is gone - no SYNC until it is back
+    return out
+
+
+def rx_stamp(done, rng, loop_stamp=False):
+    """True time the SYNC is stamped at."""
+    t = done + ISR_US
+    if rng.random() < ISR_BLOCK_P:
+        t += rng.uniform(0, ISR_BLOCK_US)
+    if loop_stamp:
+        t += rng.uniform(0, LOOP_MAX_US)
+    return t
+
+
+def run(args, method, seed, step_us=10e3):
+    rng = random.Random(seed)
+    node = NodeClock(args.ppm, rng)
+    # (time the reference is updated, master time, stamp): a SYNC only reference is taken on the SYNC, the others on the FOLLOW_UP
+    # (or on reading the SYNC if the loop gets to it later)
+    updates = []
+    for done, written, stamp, follow in bus_events(args, random.Random(seed + 1)):
+        rx = rx_stamp(done, rng, method == "loop")
+        if method == "sync":
+            updates.append((rx, written, rx))
+        else:
+            updates.append((max(rx, follow), stamp, rx))
+    sync = Sync(read_filter(), track_rate=method in ("rate", "loop"))
+    errors = []
+    k = 0
+    t = updates[0][0]
+    while t < args.duration * 1e6:
+        while k < len(updates) and updates[k][0] <= t:
+            _, master, rx = updates[k]
+            sync.follow_up(master, node.micros(rx))
+            k += 1
+        if t >= 10e6:
+            errors.append(sync.master_us(node.micros(t)) - t)
+        t += step_us
+    return errors
+
+
+def holdover(args, seed, timeout_ms=None):
+    """Master time the node reads every 100 ms through an --outage (errors in us, and the most it steps back between reads before the
+    master is back - the first FOLLOW_UP after it may step back by the error built up)."""
+    rng = random.Random(seed)
+    node = NodeClock(args.ppm, rng)
+    sync = Sync(read_filter(), timeout_ms=timeout_ms)
+    updates = [(max(rx, follow), stamp, rx) for done, written, stamp, follow in bus_events(args, random.Random(seed + 1))
+               for rx in [rx_stamp(done, rng)]]
+    errors, back, last = [], 0, None
+    k = 0
+    t = updates[0][0]
+    while t < args.duration * 1e6:
+        while k < len(updates) and updates[k][0] <= t:
+            _, master, rx = updates[k]
+            sync.follow_up(master, node.micros(rx))
+            k += 1
+        master = sync.master_us(node.micros(t))
+        if last is not None and t < (OUTAGE_START_S + args.outage * 60) * 1e6:
+            back = max(back, last - master)
+        last = master
+        errors.append((t, master - t))
+        t += 100e3
+    return errors, back
+
+
+def check(args):
+    """A master outage past the micros() wrap: the holdover keeps the clock on the last rate and it resyncs after."""
+    failures = []
+    args.outage = CHECK_OUTAGE_MIN
+    args.duration = OUTAGE_START_S + args.outage * 60 + 120
+    end = (OUTAGE_START_S + args.outage * 60) * 1e6
+    bound = WANDER_PPM * args.outage * 60 + HOLDOVER_MS * 1e3
+    for seed in range(args.seeds):
+        errors, back = holdover(args, seed)
+        during = max(abs(e) for t, e in errors if OUTAGE_START_S * 1e6 < t < end)
+        after = max(abs(e) for t, e in errors if t > end + 30e6)
+        print("  node %d  outage %d min: max error %7.1f ms (bound %.0f), steps back %5.1f ms, after resync %5.0f us" % (
+            seed, args.outage, during / 1e3, bound / 1e3, back / 1e3, after))
+        if during > bound or back > 0:
+            failures.append("node %d: holdover error %.0f ms, steps back %.0f ms" % (seed, during / 1e3, back / 1e3))
+        if after > RESYNC_MAX_US:
+            failures.append("node %d: %.0f us off after the master is back" % (seed, after))
+    _, back = holdover(args, 0, timeout_ms=2 ** 32)
+    print("  without the holdover the clock steps back %.0f s at the micros() wrap" % (back / 1e6))
+    if back < 1e6:
+        failures.append("the run does not reach the micros() wrap")
+    for f in failures:
+        print("FAIL " + f)
+    print("ok" if not failures else "%d failures" % len(failures))
+    return not failures
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--period", type=float, default=1.0, help="s between SYNCs")
+    ap.add_argument("--load", type=float, default=0.3, help="bus load from other traffic (0 - 1)")
+    ap.add_argument("--priority", type=float, default=0.2, help="share of that traffic with a lower ID than the master")
+    ap.add_argument("--ppm", type=float, default=5000, help="largest node clock rate error (ceramic resonator: 0.5%%)")
+    ap.add_argument("--loss", type=float, default=0.01, help="chance a frame is lost")
+    ap.add_argument("--duration", type=float, default=600.0, help="simulated time in s")
+    ap.add_argument("--seeds", type=int, default=5, help="nodes simulated (different clocks)")
+    ap.add_argument("--outage", type=float, default=0, help="min without SYNC from %d s into the run (holdover)" % OUTAGE_START_S)
+    ap.add_argument("--check", action="store_true", help="hold over an outage past the micros() wrap, exit 1 on a failure")
+    args = ap.parse_args()
+    if args.check:
+        sys.exit(0 if check(args) else 1)
+
+    print("period %.1f s, load %.0f%%, clock +-%d ppm, TSYNC_RATE_FILTER %.2f" % (args.period, 100 * args.load, args.ppm, read_filter()))
+    for method, name in (("sync", "sync only"), ("offset", "follow-up"), ("rate", "follow-up + rate"), ("loop", "... loop stamp")):
+        errors = [e for seed in range(args.seeds) for e in run(args, method, seed)]
+        mags = sorted(abs(e) for e in errors)
+        print("  %-18s mean %+8.0f us  p50 %7.0f us  p99 %7.0f us  max %7.0f us" % (
+            name, sum(errors) / len(errors), mags[len(mags) // 2], mags[int(0.99 * len(mags))], mags[-1]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,304 @@
+"""
+@file twin.py
+@brief Digital twin divergence monitor - runs the plant model in lockstep with [TLM] telemetry
+
+A worn motor or a slipping cable changes how the car answers its DAC codes
+long before it stops reaching the floors: the law simply works harder. The
+twin replays the recorded codes of every [TLM] record
+("[TLM] t_ms,dist,setpoint,dac,velocity,loop_us,shed,car,diag") into the
+plant.py model of each car and compares the position it predicts with the
+one measured:
+
+  - every window starts from the measured distance and velocity, and the
+    model is driven by the recorded codes (each applied when its record was
+    printed, the measurement lagging by the model's sensor delay)
+  - a window ends after WINDOW s, or IDLE_WINDOW s while neither the car nor
+    the model moves (a car creeping off a floor shows up over the long wait)
+  - the window diverged when measured and predicted travel differ by more
+    than ERROR_MM + REL_ERROR of the travel
+
+Windows with codes sent and parked windows are kept apart, so trips that
+match the model do not hide a parked car creeping (windows in which codes
+were sent but neither moved carry no information and are skipped).
+Divergence is sustained when ALARM of the last HISTORY windows of either
+kind diverged; the alarm clears once both are down to CLEAR. Each change
+prints "[TWIN] t_ms,car,state,diverged,gain_pct,creep_mm_s" (state
+DIVERGED or OK). gain_pct is the car's travel in % of the model's over the recent
+moving windows, and creep_mm_s is the drift while parked. A worn motor
+shows as a falling gain, a slipping cable as creep. Windows across a gap
+in the records, a reading out of MINHEIGHT .. MAXHEIGHT or dead reckoning
+(DIAG_DEAD_RECKONING) restart the window instead.
+
+The model is plant.py's (K, tau, friction, delay), integrated exactly over
+each held code, so a day of telemetry at CONTROL_PERIOD_MS takes seconds.
+Use --model with the sysid_fit.py model of the car when it was last
+serviced. --simulate writes a synthetic day with a fault for trying it out.
+
+    python3 tools/twin.py capture.log --model fitted.json
+    tail -f capture.log | python3 tools/twin.py -           # streamed
+    python3 tools/twin.py --simulate day.log --fault wear --hours 24
+    python3 tools/twin.py --check                           # healthy, wear and slip days: alarm only on the faults
+
+--check first replays the host build's exponential law runs through
+laws.py (laws.py --check), so the synthetic days come from the law the
+firmware runs.
+"""
+
+import argparse
+import math
+import random
+import re
+import sys
+import time
+
+from plant import load_params, FLOOR_SP, MINHEIGHT, MAXHEIGHT, SENSORS
+from laws import Exponential, Truncate, CONTROL_PERIOD, firmware_run, replay
+
+WINDOW = 2.0                # s - prediction window while the car moves
+IDLE_WINDOW = 20.0          # s - while neither the car nor the model moves
+MOVE_MM = 20                # travel that makes a window a moving one
+ERROR_MM = 12               # allowed prediction error - sensor noise at both ends and the velocity estimate at the start ...
+REL_ERROR = 0.15            # ... plus this share of the travel
+HISTORY = 12                # windows in the sustained rule
+ALARM = 7                   # diverged windows of HISTORY that raise the alarm ...
+CLEAR = 2                   # ... and that clear it
+GAIN_FILTER = 0.05          # weight of the newest moving window in gain_pct
+GAP = 0.5                   # s - records further apart restart the window
+DIAG_DEAD_RECKONING = 0x02
+FAULTS = ("none", "wear", "slip")
+
+TLM = re.compile(r"\[TLM\] (\d+),(\d+),\d+,(-?\d+),(-?\d+),\d+,\d+,(\d+),(\d+)")
+
+
+def integrate(x, v, u, h, p):
+    """Hold code u for h s from (x, v) - the plant.py model solved exactly."""
+    mag = abs(u) - p["friction"]
+    target = -math.copysign(p["K"] * mag, u) if u and mag > 0 else 0.0
+    decay = math.exp(-h / p["tau"])
+    return x + target * h + (v - target) * p["tau"] * (1.0 - decay), target + (v - target) * decay
+
+
+class Twin:
+    """One car's model in lockstep with its records."""
+
+    def __init__(self, car, params):
+        self.car = car
+        self.p = params
+        self.anchor = None          # (t, dist) the window started at
+        self.x = self.v = 0.0       # Model state at self.s (the measured position's time)
+        self.s = 0.0
+        self.u = 0                  # Code applied at self.s
+        self.codes = []             # (t, code) applied later than self.s
+        self.last_t = None
+        self.moved = False          # A code other than 0 in the window
+        self.history = []           # Diverged or not, of the last windows with codes sent ...
+        self.parked = []            # ... and of those without
+        self.alarm = False
+        self.gain = None
+        self.creep = 0.0
+        self.windows = self.diverged = 0
+
+    def record(self, t, dist, dac, velocity, diag):
+        """Returns a [TWIN] line when the alarm changes, else None."""
+        line = None
+        usable = MINHEIGHT < dist < MAXHEIGHT and not diag & DIAG_DEAD_RECKONING
+        if self.anchor is None or self.last_t is None or not 0 < t - self.last_t <= GAP or not usable:
+            self.restart(t, dist, velocity)
+        else:
+            self.advance(t - self.p["delay"])
+            span = t - self.anchor[0]
+            if span >= WINDOW and (self.moved or abs(self.x - self.anchor[1]) >= MOVE_MM or abs(dist - self.anchor[1]) >= MOVE_MM or span >= IDLE_WINDOW):
+                line = self.evaluate(t, dist, span)
+                self.restart(t, dist, velocity)
+        self.last_t = t
+        self.codes.append((t, dac))
+        self.moved = self.moved or dac != 0
+        if not usable:
+            self.anchor = None
+        return line
+
+    def restart(self, t, dist, velocity):
+        self.advance(t - self.p["delay"])
+        self.anchor = (t, dist)
+        self.x = float(dist)
+        self.v = float(velocity)
+        self.moved = self.u != 0
+
+    def advance(self, s):
+        """Drive the model to time s with the codes applied before it."""
+        while self.codes and self.codes[0][0] <= s:
+            t, code = self.codes.pop(0)
+            if t > self.s:
+                self.x, self.v = integrate(self.x, self.v, self.u, t - self.s, self.p)
+                self.s = t
+            self.u = code
+            self.moved = self.moved or code != 0
+        if s > self.s:
+            self.x, self.v = integrate(self.x, self.v, self.u, s - self.s, self.p)
+        self.s = max(self.s, s)
+
+    def evaluate(self, t, dist, span):
+        predicted = self.x - self.anchor[1]
+        measured = dist - self.anchor[1]
+        travel = max(abs(predicted), abs(measured))
+        diverged = abs(measured - predicted) > ERROR_MM + REL_ERROR * travel
+        moving = travel >= MOVE_MM and abs(predicted) >= MOVE_MM
+        if moving:
+            ratio = measured / predicted
+            self.gain = ratio if self.gain is None else self.gain + GAIN_FILTER * (ratio - self.gain)
+        elif not self.moved:
+            self.creep += GAIN_FILTER * ((measured - predicted) / span - self.creep)
+        if not (moving or diverged or not self.moved):
+            return None                                         # Codes sent but neither moved - no information
+        history = self.parked if not self.moved else self.history
+        history.append(diverged)
+        del history[:-HISTORY]
+        self.windows += 1
+        self.diverged += diverged
+        count = max(sum(self.history), sum(self.parked))
+        if not self.alarm and count >= ALARM or self.alarm and count <= CLEAR:
+            self.alarm = not self.alarm
+            return "[TWIN] %d,%d,%s,%d,%d,%.1f" % (t * 1000, self.car, "DIVERGED" if self.alarm else "OK", count,
+                                                   round(100 * self.gain) if self.gain is not None else 0, self.creep)
+        return None
+
+
+def monitor(lines, params, out=None):
+    """Feed [TLM] lines through a twin per car. Returns the twins and the [TWIN] lines."""
+    twins = {}
+    alarms = []
+    match = TLM.search
+    for text in lines:
+        m = match(text)
+        if not m:
+            continue
+        t_ms, dist, dac, velocity, car, diag = m.groups()
+        car = int(car)
+        twin = twins.get(car)
+        if twin is None:
+            twin = twins[car] = Twin(car, params)
+        line = twin.record(int(t_ms) / 1000.0, int(dist), int(dac), int(velocity), int(diag))
+        if line:
+            alarms.append(line)
+            if out:
+                out.write(line + "\n")
+                out.flush()
+    return twins, alarms
+
+
+def fault_level(fault, t, start, ramp):
+    """0 .. 1 - how far the fault has developed at t (s)."""
+    return min(max((t - start) / ramp, 0.0), 1.0) if fault != "none" else 0.0
+
+
+def simulate(hours, fault, start, ramp, params, seed=1):
+    """A day of [TLM] records: a car serving random floors with the exponential law on a plant that develops the fault.
+
+    wear   motor gain down to 60 % and friction up by 40 codes (worn brushes and bearings)
+    slip   the car creeps down at up to 2 mm/s whatever the motor does (a slipping cable)
+    Passenger load varies the motor response by up to 10 % from trip to trip."""
+    rng = random.Random(seed)
+    law = Exponential()
+    output = Truncate()
+    noise = SENSORS["vl53l0x"]["noise"]
+    delay = params["delay"]
+    x = float(FLOOR_SP[0])
+    v = 0.0
+    u = 0
+    target = FLOOR_SP[0]
+    wait = rng.uniform(20.0, 90.0)
+    load = 1.0
+    lines = []
+    for k in range(int(hours * 3600 / CONTROL_PERIOD)):
+        t = k * CONTROL_PERIOD
+        level = fault_level(fault, t / 3600.0, start, ramp)
+        p = dict(params)
+        if fault == "wear":
+            p["K"] *= 1.0 - 0.4 * level
+            p["friction"] += 40 * level
+        p["K"] /= load
+        p["tau"] *= load
+        creep = -2.0 * level if fault == "slip" else 0.0
+        x, v = integrate(x, v, u, CONTROL_PERIOD - delay, p)
+        x += creep * (CONTROL_PERIOD - delay)
+        dist = int(round(x + rng.gauss(0.0, noise)))
+        x, v = integrate(x, v, u, delay, p)
+        x += creep * delay
+
+        wait -= CONTROL_PERIOD
+        if wait <= 0 and abs(dist - target) <= law.tolerance:
+            target = rng.choice([f for f in FLOOR_SP if f != target])
+            wait = rng.uniform(20.0, 90.0)
+            load = rng.uniform(0.95, 1.1)
+        u = output(law.step(dist, target))
+        lines.append("[TLM] %d,%d,%d,%d,%d,3200,0,0,0" % (round(t * 1000), dist, target, u, int(law.velocity)))
+    return lines
+
+
+def check(params):
+    """Healthy, wear and slip days - the healthy one must stay quiet, the faults must alarm before they are half developed.
+
+    The days come from laws.py's exponential law, so it is first replayed against the host build's (laws.py --check)."""
+    failures = []
+    records = firmware_run("exponential")
+    differences = replay("exponential", records)
+    if differences:
+        failures.append("laws.py's exponential law differs from the host build's in %d of %d law runs" % (len(differences), len(records)))
+    start, ramp = 6.0, 12.0
+    print("  fault  records  run time  first alarm   fault level   gain   creep")
+    for fault in FAULTS:
+        lines = simulate(24.0, fault, start, ramp, params)
+        began = time.time()
+        twins, alarms = monitor(lines, params)
+        elapsed = time.time() - began
+        first = next((int(a.split()[1].split(",")[0]) / 3600000.0 for a in alarms if "DIVERGED" in a), None)
+        level = fault_level(fault, first, start, ramp) if first is not None else None
+        twin = twins[0]
+        print("  %-5s  %7d  %6.2f s  %s  %s  %4.0f %%  %4.1f mm/s" % (
+            fault, len(lines), elapsed, "%8.2f h" % first if first is not None else "     never",
+            "%10.0f %%" % (100 * level) if level is not None else "           -", 100 * (twin.gain or 0), twin.creep))
+        if fault == "none" and alarms:
+            failures.append("healthy car: %s" % alarms[0])
+        elif fault != "none" and (level is None or level <= 0 or level >= 0.5):
+            failures.append("%s: first alarm at fault level %s" % (fault, level))
+    return failures
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("log", nargs="?", help="Serial capture with [TLM] records ('-' reads stdin as it streams)")
+    ap.add_argument("--model", help="fitted plant model JSON (sysid_fit.py) - plant.py defaults otherwise")
+    ap.add_argument("--simulate", metavar="LOG", help="write a synthetic capture instead of monitoring one")
+    ap.add_argument("--fault", choices=FAULTS, default="wear", help="fault developing in the synthetic capture")
+    ap.add_argument("--hours", type=float, default=24.0, help="length of the synthetic capture")
+    ap.add_argument("--start", type=float, default=6.0, help="hour the fault starts to develop")
+    ap.add_argument("--ramp", type=float, default=12.0, help="hours until it is fully developed")
+    ap.add_argument("--check", action="store_true", help="exit 1 on a false alarm or a fault not caught early")
+    args = ap.parse_args()
+    params = load_params(args.model)
+
+    if args.check:
+        failures = check(params)
+        for f in failures:
+            print("FAIL " + f)
+        print("ok" if not failures else "%d failures" % len(failures))
+        sys.exit(1 if failures else 0)
+    if args.simulate:
+        with open(args.simulate, "w") as f:
+            f.write("\n".join(simulate(args.hours, args.fault, args.start, args.ramp, params)) + "\n")
+        return
+    if not args.log:
+        ap.error("a capture to monitor, --simulate or --check")
+
+    began = time.time()
+    source = sys.stdin if args.log == "-" else open(args.log)
+    twins, _ = monitor(source, params, sys.stdout)
+    for car, twin in sorted(twins.items()):
+        print("car %d: %d windows, %d diverged, gain %s, creep %.1f mm/s%s" % (
+            car, twin.windows, twin.diverged, "%d %%" % round(100 * twin.gain) if twin.gain is not None else "-",
+            twin.creep, " - DIVERGED" if twin.alarm else ""))
+    print("%.1f s" % (time.time() - began), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,198 @@
+"""
+@file vl53l0x_trace.py
+@brief VL53L0X driver I2C traffic from the host build, against the recorded sequence in tools/host
+
+Runs EC.setup() of the host build (tools/firmware.py) and records every Wire
+transaction on the bus - DFRobotVL53L0X::begin() (DataInit, StaticInit with
+the SPAD info and the tuning script, the reference calibrations), setMode()
+and setProfile() for the car's sensor on the register model in
+tools/host/vl53l0x.cpp. tools/host/vl53l0x_setup.trace is that sequence as
+recorded: one transaction per line, the 7 bit address, W or R and the bytes
+(the register index first on a write), NACK when no device answered.
+
+With --check the recording is compared against the file and the driver is
+run against the model's faults and profiles (exit 1 on a failure):
+  absent      begin() fails - nothing answers the model ID read, nothing is written
+  no_spad     the SPAD info strobe never completes - begin() fails after VL53L0X_IO_TIMEOUT
+  no_refcal   the reference calibrations never complete - begin() fails
+  profiles    each SENSOR_PROFILE leaves its timing budget, VCSEL periods and signal rate limit in the registers
+
+  bench       no call puts more transactions on the bus than one register per transaction would
+
+After a deliberate change to the driver, --record writes the new sequence
+(review the diff of the .trace file like any other).
+
+--bench runs the driver's calls one at a time on a driver instance of its own
+(tools/host/vl53l0x_bench.cpp) and counts the transactions and bytes each puts
+on the bus, the address byte included. Next to them are the counts of the same
+register writes sent one register per transaction, as writeByteData() did
+before the register scripts merged consecutive registers.
+
+    python3 tools/vl53l0x_trace.py              # the recording, summarized
+    python3 tools/vl53l0x_trace.py --check
+    python3 tools/vl53l0x_trace.py --record
+    python3 tools/vl53l0x_trace.py --bench
+"""
+
+import argparse
+import os
+import sys
+
+from firmware import Firmware, build
+
+TRACE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "host", "vl53l0x_setup.trace")
+
+# SENSOR_PROFILE: budget set in us, pre-range and final range VCSEL periods, signal rate limit (MCPS)
+PROFILES = {
+    "ProfileDefault": (33000, 14, 10, 0.25),
+    "ProfileHighSpeed": (20000, 14, 10, 0.25),
+    "ProfileLongRange": (33000, 18, 14, 0.1),
+    "ProfileHighAccuracy": (200000, 14, 10, 0.25),
+}
+# tools/host/vl53l0x_bench.cpp BENCH_xxx - the calls --bench makes, in order (begin() takes car 1's address)
+BENCH_CALLS = [
+    ("begin()", 0, None),
+    ("setMode(Single, Low)", 1, 0),
+    ("setProfile(ProfileDefault)", 3, 0),
+    ("start() single", 4, 0),
+    ("setMode(Continuous, Low)", 2, 0),
+    ("start() continuous", 4, 0),
+    ("stop()", 5, 0),
+]
+STATIC_INIT_FAIL = "VL53L0X reference init failed"
+NOT_FOUND = "Sensor not found"
+
+
+def line(record):
+    _, address, read, ack, data = record
+    if not ack:
+        return "%02X %s NACK" % (address, "R" if read else "W")
+    return ("%02X %s %s" % (address, "R" if read else "W", " ".join("%02X" % b for b in data))).rstrip()
+
+
+def record_setup(defines=None, fault="none"):
+    """EC.setup() with the car's sensor given the fault - (trace lines, Serial output, the board)."""
+    fw = Firmware(defines)
+    fw.sensor(0, fault=fault)
+    fw.i2c_trace(True)
+    fw.setup()
+    return [line(r) for r in fw.i2c()], fw.serial(), fw
+
+
+def read_trace(path=TRACE):
+    with open(path) as f:
+        return [l.rstrip("\n") for l in f if l.strip() and not l.startswith("#")]
+
+
+def write_trace(lines, path=TRACE):
+    with open(path, "w") as f:
+        f.write("# EC.setup() on the host build (tools/vl53l0x_trace.py --record) - address, W/R, bytes\n")
+        f.write("# DFRobotVL53L0X::begin(), setMode(), setProfile(SENSOR_PROFILE) for car 1's sensor\n")
+        for l in lines:
+            f.write(l + "\n")
+
+
+def summarize(lines):
+    writes = [l for l in lines if " W " in l and "NACK" not in l]
+    reads = [l for l in lines if " R " in l and "NACK" not in l]
+    data = sum(len(l.split()) - 2 for l in writes + reads)
+    print("%d transactions (%d writes, %d reads), %d bytes after the address, %d NACKs" % (
+        len(lines), len(writes), len(reads), data, sum("NACK" in l for l in lines)))
+
+
+def bus_counts(records):
+    """(transactions, bytes, transactions one register each, bytes one register each) - bytes count the address byte."""
+    transactions = size = single = single_size = 0
+    for _, _, read, _, data in records:
+        transactions += 1
+        size += 1 + len(data)
+        if read or len(data) <= 2:
+            single += 1
+            single_size += 1 + len(data)
+        else:
+            single += len(data) - 1                   # The index and one value each
+            single_size += 3 * (len(data) - 1)
+    return transactions, size, single, single_size
+
+
+def bench(defines=None):
+    """[(call, what it returned, bus_counts())] for BENCH_CALLS on the bench instance."""
+    fw = Firmware(defines)
+    rows = []
+    for name, call, arg in BENCH_CALLS:
+        fw.i2c_trace(True)
+        ret = fw.lib.host_vl53l0x_call(call, fw.car_table[0][0] if arg is None else arg)
+        rows.append((name, ret, bus_counts(fw.i2c())))
+    return rows
+
+
+def check():
+    failures = []
+
+    lines, out, fw = record_setup()
+    recorded = read_trace()
+    if lines != recorded:
+        i = next((i for i, (a, b) in enumerate(zip(lines, recorded)) if a != b), min(len(lines), len(recorded)))
+        failures.append("setup trace differs from %s at transaction %d: %r, recorded %r (%d against %d transactions)" % (
+            os.path.relpath(TRACE), i + 1, lines[i] if i < len(lines) else None, recorded[i] if i < len(recorded) else None,
+            len(lines), len(recorded)))
+    if NOT_FOUND in out or STATIC_INIT_FAIL in out or fw.sensor_address(0) != fw.car_table[0][0]:
+        failures.append("healthy sensor: begin() failed or the sensor is not on 0x%02X" % fw.car_table[0][0])
+
+    lines, out, fw = record_setup(fault="absent")
+    if NOT_FOUND not in out or any(" W " in l and "NACK" not in l for l in lines) or not lines or "NACK" not in lines[0]:
+        failures.append("absent sensor: begin() did not fail at the model ID read")
+    for fault in ("no_spad", "no_refcal"):
+        lines, out, fw = record_setup(fault=fault)
+        if NOT_FOUND not in out or STATIC_INIT_FAIL not in out:
+            failures.append("%s: begin() did not report the failed reference init" % fault)
+
+    for profile, (budget, pre, final, limit) in sorted(PROFILES.items()):
+        fw = Firmware({"SENSOR_PROFILE": profile})
+        fw.setup()
+        got = (fw.sensor_budget(0) * 1e6, (fw.sensor_reg(0, 0, 0x50) + 1) * 2, (fw.sensor_reg(0, 0, 0x70) + 1) * 2,
+               ((fw.sensor_reg(0, 0, 0x44) << 8) | fw.sensor_reg(0, 0, 0x45)) / 128.0)
+        # ST's budget readback counts 590 us more start overhead than the budget it was set to
+        if abs(got[0] - budget) > 1000 or got[1:3] != (pre, final) or abs(got[3] - limit) > 1 / 128.0:
+            failures.append("%s: budget %.0f us, VCSEL %d/%d, limit %.3f MCPS - expected %d us, %d/%d, %.2f" % ((profile,) + got + (budget, pre, final, limit)))
+
+    for name, ret, (transactions, size, single, single_size) in bench():
+        if not ret or transactions > single or size > single_size:
+            failures.append("bench %s: returned %d, %d transactions %d bytes against %d and %d one register each" % (
+                name, ret, transactions, size, single, single_size))
+
+    for f in failures:
+        print("FAIL " + f)
+    print("ok" if not failures else "%d failures" % len(failures))
+    return not failures
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--check", action="store_true", help="compare against the recording and run the faults and profiles, exit 1 on a failure")
+    ap.add_argument("--record", action="store_true", help="write the current sequence to %s" % os.path.relpath(TRACE))
+    ap.add_argument("--bench", action="store_true", help="count the transactions and bytes of the driver's calls one at a time")
+    ap.add_argument("--fault", choices=["none", "absent", "no_spad", "no_refcal", "stuck"], default="none", help="sensor fault for the printed run")
+    ap.add_argument("--print", action="store_true", help="print every transaction")
+    args = ap.parse_args()
+    if args.check:
+        sys.exit(0 if check() else 1)
+    if args.bench:
+        print("%-28s %12s %6s   %s" % ("call", "transactions", "bytes", "one register per transaction"))
+        for name, _, (transactions, size, single, single_size) in bench():
+            print("%-28s %12d %6d   %d, %d bytes" % (name, transactions, size, single, single_size))
+        return
+
+    lines, out, _ = record_setup(fault=args.fault)
+    if args.record:
+        if args.fault != "none":
+            sys.exit("--record takes the healthy sensor")
+        write_trace(lines)
+        print("wrote %s" % os.path.relpath(TRACE))
+    if args.print:
+        print("\n".join(lines))
+    summarize(lines)
+
+
+if __name__ == "__main__":
+    main()